@@ -0,0 +1,428 @@
+/*
+ * diff-daemon-bench: load a running diff-daemon over its socket.
+ *
+ *   diff-daemon-bench [--conns=<n>] [--jobs=<n>] [--depth=<n>]
+ *                     [--size=<KiB>] [--edits=<n>] [--distinct=<n>]
+ *                     [--flags=<n>] [--merge] [--text | --funcnames]
+ *                     [--no-cache] <socket>
+ *
+ * Makes --distinct pairs of files of --size KiB that differ in --edits
+ * lines (triples for --merge), then has each of --conns connections
+ * send --jobs jobs round-robin over them, keeping up to --depth jobs in
+ * flight. Reports throughput, job latency and the daemon's counters,
+ * and checks that every run of the same job gave the same answer.
+ */
+
+#include "git-compat-util.h"
+#include "xdiff.h"
+#include "particle_core/src/wire/PD_AI_wire.h"
+
+static const char bench_usage[] =
+	"usage: diff-daemon-bench [--conns=<n>] [--jobs=<n>] [--depth=<n>]\n"
+	"                         [--size=<KiB>] [--edits=<n>] [--distinct=<n>]\n"
+	"                         [--flags=<n>] [--merge] [--text | --funcnames]\n"
+	"                         [--no-cache] <socket>";
+
+static const char *socket_path;
+static int nconns = 4, njobs = 1000, depth = 8, ndistinct = 16;
+static long size_kb = 64, nedits = 16;
+static uint32_t xdf_flags;
+static uint8_t opt;
+static int merge;
+
+/* One prepared request per distinct input, and the answer it got. */
+struct request {
+	char *msg;
+	size_t len;
+	uint32_t count;		/* UINT32_MAX until the first M_DONE */
+};
+static struct request *requests;
+static long mismatches;
+
+struct bench_conn {
+	pthread_t sender, reader;
+	int fd, id;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int inflight;
+	uint64_t *sent_at;	/* by rid */
+	uint64_t *latency;	/* by rid, ns */
+	long errors, cached;
+	uint64_t bytes_out;
+};
+
+static NORETURN void die_bench(const char *msg, const char *arg)
+{
+	fprintf(stderr, "diff-daemon-bench: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+	exit(128);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t next_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/* Lines of 8 to 72 characters, roughly like source code. */
+static void make_file(mmfile_t *mf, uint64_t seed)
+{
+	long size = size_kb << 10, len;
+
+	mf->ptr = xmalloc(size);
+	mf->size = 0;
+	while (mf->size < size) {
+		len = 8 + next_rand(&seed) % 64;
+		if (len > size - mf->size)
+			len = size - mf->size;
+		while (len-- > 1)
+			mf->ptr[mf->size++] = 'a' + next_rand(&seed) % 26;
+		mf->ptr[mf->size++] = '\n';
+	}
+}
+
+/* Overwrites nedits lines of a copy of mf with other text. */
+static void make_edit(mmfile_t const *mf, mmfile_t *out, uint64_t seed)
+{
+	long i;
+
+	out->ptr = xmalloc(mf->size);
+	out->size = mf->size;
+	memcpy(out->ptr, mf->ptr, mf->size);
+	for (i = 0; i < nedits && out->size > 1; i++) {
+		char *p = out->ptr + next_rand(&seed) % (out->size - 1);
+
+		while (p > out->ptr && p[-1] != '\n')
+			p--;
+		for (; *p != '\n'; p++)
+			*p = 'A' + next_rand(&seed) % 26;
+	}
+}
+
+static void make_requests(void)
+{
+	int i, k, nf = merge ? 3 : 2;
+
+	requests = xcalloc(ndistinct, sizeof(*requests));
+	for (i = 0; i < ndistinct; i++) {
+		struct request *r = &requests[i];
+		mmfile_t mf[3];
+		dj24_t dj;
+		wh16_t hdr;
+		char *p;
+
+		memset(mf, 0, sizeof(mf));
+		make_file(&mf[0], 0x9e3779b97f4a7c15ULL * (i + 1));
+		for (k = 1; k < nf; k++)
+			make_edit(&mf[0], &mf[k], 0x2545f4914f6cdd1dULL * (i + 1) + k);
+
+		memset(&dj, 0, sizeof(dj));
+		dj.flags = xdf_flags;
+		dj.ctx = merge ? 0 : 3;
+		dj.opt = opt;
+		dj.level = merge ? XDL_MERGE_ZEALOUS : 0;
+		for (k = 0; k < nf; k++)
+			dj.len[k] = mf[k].size;
+
+		hdr = WH(merge ? M_MERGE : M_DIFF, K_DIFF, ANN_RW, 0, 0,
+			 BYTES_JOB(dj.len[0], dj.len[1], dj.len[2]));
+		r->len = MSG_SIZE(hdr.n);
+		p = r->msg = xmalloc(r->len);
+		memcpy(p, &hdr, sizeof(hdr));
+		memcpy(p += sizeof(hdr), &dj, sizeof(dj));
+		p += sizeof(dj);
+		for (k = 0; k < nf; k++) {
+			memcpy(p, mf[k].ptr, mf[k].size);
+			p += mf[k].size;
+			free(mf[k].ptr);
+		}
+		r->count = UINT32_MAX;
+	}
+}
+
+static int write_all(int fd, const char *p, size_t n)
+{
+	while (n) {
+		ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return -1;
+		p += w;
+		n -= w;
+	}
+	return 0;
+}
+
+static int read_all(int fd, char *p, size_t n)
+{
+	while (n) {
+		ssize_t r = read(fd, p, n);
+
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		p += r;
+		n -= r;
+	}
+	return 0;
+}
+
+static int connect_daemon(void)
+{
+	struct sockaddr_un sa;
+	int fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(sa.sun_path))
+		die_bench("socket path too long", socket_path);
+	strcpy(sa.sun_path, socket_path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		die_bench("cannot connect", socket_path);
+	return fd;
+}
+
+/* Job rid of connection c is the job's index among c's jobs, plus one. */
+static struct request *request_for(struct bench_conn *c, uint32_t rid)
+{
+	return &requests[(c->id + rid - 1) % ndistinct];
+}
+
+static void *send_jobs(void *arg)
+{
+	struct bench_conn *c = arg;
+	uint32_t rid;
+
+	for (rid = 1; rid <= (uint32_t)njobs; rid++) {
+		struct request *r = request_for(c, rid);
+		wh16_t hdr;
+
+		pthread_mutex_lock(&c->lock);
+		while (c->inflight >= depth)
+			pthread_cond_wait(&c->cond, &c->lock);
+		c->inflight++;
+		pthread_mutex_unlock(&c->lock);
+
+		memcpy(&hdr, r->msg, sizeof(hdr));
+		hdr.rid = rid;
+		c->sent_at[rid] = now_ns();
+		if (write_all(c->fd, (const char *)&hdr, sizeof(hdr)) < 0 ||
+		    write_all(c->fd, r->msg + sizeof(hdr), r->len - sizeof(hdr)) < 0)
+			die_bench("cannot send job", strerror(errno));
+	}
+	shutdown(c->fd, SHUT_WR);
+	return NULL;
+}
+
+static void finish_job(struct bench_conn *c, wh16_t const *hdr, dr8_t const *dr)
+{
+	struct request *r;
+	uint32_t expect = UINT32_MAX;
+
+	if (!hdr->rid || hdr->rid > (uint32_t)njobs)
+		die_bench("reply for an unknown job", NULL);
+	c->latency[hdr->rid] = now_ns() - c->sent_at[hdr->rid];
+	if (hdr->mt == M_ERROR) {
+		c->errors++;
+	} else {
+		r = request_for(c, hdr->rid);
+		if (dr->flags & DR_CACHED)
+			c->cached++;
+		if (!__atomic_compare_exchange_n(&r->count, &expect, dr->count, 0,
+						 __ATOMIC_RELAXED, __ATOMIC_RELAXED) &&
+		    expect != dr->count)
+			__atomic_add_fetch(&mismatches, 1, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_lock(&c->lock);
+	c->inflight--;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+}
+
+static void *read_replies(void *arg)
+{
+	struct bench_conn *c = arg;
+	char *buf = NULL;
+	size_t alloc = 0;
+	long done = 0;
+	wh16_t hdr;
+
+	while (done < njobs) {
+		if (read_all(c->fd, (char *)&hdr, sizeof(hdr)) < 0)
+			die_bench("connection lost", NULL);
+		if (hdr.n > alloc)
+			buf = xrealloc(buf, alloc = hdr.n);
+		if (read_all(c->fd, buf, hdr.n) < 0)
+			die_bench("connection lost", NULL);
+		c->bytes_out += MSG_SIZE(hdr.n);
+
+		if (hdr.mt == M_DONE || hdr.mt == M_ERROR) {
+			dr8_t dr;
+
+			if (hdr.n != sizeof(dr))
+				die_bench("malformed reply", NULL);
+			memcpy(&dr, buf, sizeof(dr));
+			finish_job(c, &hdr, &dr);
+			done++;
+		} else if (hdr.mt != M_HUNK && hdr.mt != M_DATA) {
+			die_bench("unexpected reply", NULL);
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+static void print_stats(void)
+{
+	static const char *names[] = {
+		NULL, "connections", "jobs", "diffs", "merges", "errors",
+		"cache hits", "cache misses", "cache KiB", "cached results",
+		"input KiB", "workers", "queued us", "running us",
+	};
+	wh16_t hdr = WH(M_STATS, K_DIFF, ANN_RO, 0, 1, 0);
+	kv32_t kv[64];
+	int fd = connect_daemon();
+	uint32_t i;
+
+	if (write_all(fd, (const char *)&hdr, sizeof(hdr)) < 0 ||
+	    read_all(fd, (char *)&hdr, sizeof(hdr)) < 0 ||
+	    hdr.mt != M_STATS || hdr.n > sizeof(kv) ||
+	    read_all(fd, (char *)kv, hdr.n) < 0)
+		die_bench("cannot read daemon counters", NULL);
+	close(fd);
+
+	printf("daemon:\n");
+	for (i = 0; i < hdr.n / sizeof(kv32_t); i++)
+		if (kv[i].k < ARRAY_SIZE(names) && names[kv[i].k])
+			printf("  %-16s %u\n", names[kv[i].k], kv[i].v);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static long parse_num(const char *arg)
+{
+	char *end;
+	long n = strtol(arg, &end, 0);
+
+	if (end == arg || *end || n < 0)
+		die_bench(bench_usage, NULL);
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_conn *conns;
+	uint64_t *lat, start, elapsed, bytes_in = 0, bytes_out = 0;
+	long errors = 0, cached = 0, total, n = 0;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		const char *arg = argv[i];
+
+		if (starts_with(arg, "--conns="))
+			nconns = parse_num(arg + 8);
+		else if (starts_with(arg, "--jobs="))
+			njobs = parse_num(arg + 7);
+		else if (starts_with(arg, "--depth="))
+			depth = parse_num(arg + 8);
+		else if (starts_with(arg, "--size="))
+			size_kb = parse_num(arg + 7);
+		else if (starts_with(arg, "--edits="))
+			nedits = parse_num(arg + 8);
+		else if (starts_with(arg, "--distinct="))
+			ndistinct = parse_num(arg + 11);
+		else if (starts_with(arg, "--flags="))
+			xdf_flags = parse_num(arg + 8);
+		else if (!strcmp(arg, "--merge"))
+			merge = 1;
+		else if (!strcmp(arg, "--text"))
+			opt |= DJ_TEXT;
+		else if (!strcmp(arg, "--funcnames"))
+			opt |= DJ_FUNCNAMES | DJ_TEXT;
+		else if (!strcmp(arg, "--no-cache"))
+			opt |= DJ_NOCACHE;
+		else
+			die_bench(bench_usage, NULL);
+	}
+	if (i + 1 != argc || nconns < 1 || njobs < 1 || depth < 1 ||
+	    ndistinct < 1 || (merge && (opt & DJ_TEXT)))
+		die_bench(bench_usage, NULL);
+	socket_path = argv[i];
+
+	make_requests();
+	conns = xcalloc(nconns, sizeof(*conns));
+	start = now_ns();
+	for (i = 0; i < nconns; i++) {
+		struct bench_conn *c = &conns[i];
+
+		c->id = i;
+		c->fd = connect_daemon();
+		c->sent_at = xcalloc(njobs + 1, sizeof(uint64_t));
+		c->latency = xcalloc(njobs + 1, sizeof(uint64_t));
+		pthread_mutex_init(&c->lock, NULL);
+		pthread_cond_init(&c->cond, NULL);
+		if (pthread_create(&c->reader, NULL, read_replies, c) ||
+		    pthread_create(&c->sender, NULL, send_jobs, c))
+			die_bench("cannot start threads", NULL);
+	}
+
+	total = (long)nconns * njobs;
+	lat = xmalloc(total * sizeof(*lat));
+	for (i = 0; i < nconns; i++) {
+		struct bench_conn *c = &conns[i];
+		uint32_t rid;
+
+		pthread_join(c->sender, NULL);
+		pthread_join(c->reader, NULL);
+		close(c->fd);
+		for (rid = 1; rid <= (uint32_t)njobs; rid++) {
+			lat[n++] = c->latency[rid];
+			bytes_in += request_for(c, rid)->len;
+		}
+		bytes_out += c->bytes_out;
+		errors += c->errors;
+		cached += c->cached;
+		free(c->sent_at);
+		free(c->latency);
+		pthread_mutex_destroy(&c->lock);
+		pthread_cond_destroy(&c->cond);
+	}
+	free(conns);
+	elapsed = now_ns() - start;
+	QSORT(lat, total, cmp_u64);
+
+	printf("%ld jobs on %d connections in %.3f s: %.0f jobs/s, %.1f MiB/s in, %.1f MiB/s out\n",
+	       total, nconns, elapsed / 1e9, total / (elapsed / 1e9),
+	       bytes_in / (elapsed / 1e9) / (1 << 20),
+	       bytes_out / (elapsed / 1e9) / (1 << 20));
+	printf("latency: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+	       lat[total / 2] / 1e6, lat[total * 9 / 10] / 1e6,
+	       lat[total * 99 / 100] / 1e6, lat[total - 1] / 1e6);
+	printf("cached replies: %ld, errors: %ld, mismatched answers: %ld\n",
+	       cached, errors, mismatches);
+	print_stats();
+
+	free(lat);
+	return errors || mismatches ? 1 : 0;
+}
@@ -0,0 +1,794 @@
+/*
+ * diff-daemon: run diffs and merges for local clients.
+ *
+ *   diff-daemon [--threads=<n>] [--cache=<MiB>] [--max-job=<MiB>]
+ *               [--index-dir=<dir>] <socket>
+ *
+ * Listens on a Unix socket for jobs framed as in PD_AI_wire.h: a wh16_t
+ * header of key class K_DIFF, then for M_DIFF and M_MERGE a dj24_t and
+ * the inputs. Jobs from all connections run on one xdiff worker pool.
+ * A diff answers with M_HUNK frames (or M_DATA unified diff text with
+ * DJ_TEXT), a merge with M_DATA frames of the merged file, and both end
+ * with M_DONE or M_ERROR; every reply carries the rid of its job, so a
+ * client may keep many jobs in flight on one connection and receive
+ * their frames interleaved, but must keep reading while it does: a
+ * worker blocks on a connection whose replies are not being read.
+ * M_PING and M_STATS are answered at once.
+ *
+ * Replies are kept in a result cache shared by all connections, keyed
+ * by the whole request.
+ *
+ * With --index-dir, every input of 64KB or more gets a prepared-file
+ * index there (see xpparam_t.index_dir), which saves hashing it again
+ * when it comes back with whitespace options. An index takes 18 bytes
+ * per line of its input, more than the input itself when lines are
+ * short, and none is ever removed: the directory grows with every
+ * distinct large input the daemon sees, so give it a filesystem of its
+ * own or prune it, by access time for instance, from outside.
+ */
+
+#include "git-compat-util.h"
+#include "xdiff.h"
+#include "particle_core/src/wire/PD_AI_wire.h"
+
+#define DIFFD_FRAME ((size_t)64 << 10)	/* M_HUNK / M_DATA payload bytes */
+#define DIFFD_MAX_OUTPUT ((size_t)1 << 30)	/* merged file */
+#define DIFFD_INFLIGHT 64		/* queued jobs per connection */
+#define DIFFD_CACHE_BUCKETS 4096
+
+#define DIFFD_XDF_MASK (XDF_WHITESPACE_FLAGS | XDF_IGNORE_BLANK_LINES | \
+			XDF_DIFF_ALGORITHM_MASK | XDF_UNIQUE_ANCHORS | \
+			XDF_CHUNK_PREPASS | XDF_SEGMENT_LINES | \
+			XDF_FILTER_IGNORED | XDF_INDENT_HEURISTIC)
+
+static const char diff_daemon_usage[] =
+	"usage: diff-daemon [--threads=<n>] [--cache=<MiB>] [--max-job=<MiB>]\n"
+	"                   [--index-dir=<dir>] <socket>";
+
+static xdpool_t *pool;
+static const char *index_dir;
+static size_t max_job = (size_t)256 << 20;
+static volatile sig_atomic_t stopping;
+
+static uint64_t stats[DS_RUN_US + 1];
+
+static void stat_add(int key, uint64_t n)
+{
+	__atomic_add_fetch(&stats[key], n, __ATOMIC_RELAXED);
+}
+
+static NORETURN void die_daemon(const char *msg, const char *arg)
+{
+	fprintf(stderr, "diff-daemon: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+	exit(128);
+}
+
+/*
+ * Result cache. An entry holds the request payload it answers and the
+ * reply frames with their rid zeroed; entries are reference counted so
+ * that a reply can be replayed without holding the cache lock.
+ */
+struct cache_entry {
+	struct cache_entry *next;		/* hash chain */
+	struct cache_entry *lru_prev, *lru_next;
+	uint64_t hash;
+	uint8_t mt;
+	char *key;
+	size_t keylen;
+	char *reply;
+	size_t replylen;
+	int refs;
+	int evicted;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct cache_entry *bucket[DIFFD_CACHE_BUCKETS];
+	struct cache_entry lru;	/* head: most recently used follows */
+	size_t bytes, limit;
+	long nr;
+} cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.limit = (size_t)256 << 20,
+};
+
+static uint64_t cache_hash(uint8_t mt, const char *p, size_t n)
+{
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ mt ^ ((uint64_t)n << 8), w;
+
+	for (; n >= 8; p += 8, n -= 8) {
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	while (n--)
+		h = (h ^ (uint8_t)*p++) * 0x100000001b3ULL;
+	return h ^ (h >> 29);
+}
+
+static void cache_unlink_lru(struct cache_entry *e)
+{
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+}
+
+static void cache_link_lru(struct cache_entry *e)
+{
+	e->lru_next = cache.lru.lru_next;
+	e->lru_prev = &cache.lru;
+	e->lru_next->lru_prev = e;
+	cache.lru.lru_next = e;
+}
+
+/* Called with cache.lock held. */
+static void cache_put_locked(struct cache_entry *e)
+{
+	if (--e->refs || !e->evicted)
+		return;
+	free(e->key);
+	free(e->reply);
+	free(e);
+}
+
+static void cache_put(struct cache_entry *e)
+{
+	pthread_mutex_lock(&cache.lock);
+	cache_put_locked(e);
+	pthread_mutex_unlock(&cache.lock);
+}
+
+static void cache_evict_locked(struct cache_entry *e)
+{
+	struct cache_entry **pp = &cache.bucket[e->hash % DIFFD_CACHE_BUCKETS];
+
+	while (*pp != e)
+		pp = &(*pp)->next;
+	*pp = e->next;
+	cache_unlink_lru(e);
+	cache.bytes -= e->keylen + e->replylen;
+	cache.nr--;
+	e->evicted = 1;
+	cache_put_locked(e);
+}
+
+static struct cache_entry *cache_find_locked(uint64_t hash, uint8_t mt,
+					     const char *key, size_t keylen)
+{
+	struct cache_entry *e;
+
+	for (e = cache.bucket[hash % DIFFD_CACHE_BUCKETS]; e; e = e->next)
+		if (e->hash == hash && e->mt == mt && e->keylen == keylen &&
+		    !memcmp(e->key, key, keylen))
+			return e;
+	return NULL;
+}
+
+/* Returns a referenced entry answering the request, or NULL. */
+static struct cache_entry *cache_get(uint64_t hash, uint8_t mt,
+				     const char *key, size_t keylen)
+{
+	struct cache_entry *e;
+
+	pthread_mutex_lock(&cache.lock);
+	if ((e = cache_find_locked(hash, mt, key, keylen))) {
+		e->refs++;
+		cache_unlink_lru(e);
+		cache_link_lru(e);
+	}
+	pthread_mutex_unlock(&cache.lock);
+	return e;
+}
+
+/*
+ * Takes over key and reply. Either is freed right away when the cache
+ * cannot hold them or already holds an answer to the same request.
+ */
+static void cache_add(uint64_t hash, uint8_t mt, char *key, size_t keylen,
+		      char *reply, size_t replylen)
+{
+	struct cache_entry *e;
+	size_t size = keylen + replylen;
+
+	pthread_mutex_lock(&cache.lock);
+	if (size > cache.limit / 8 || cache_find_locked(hash, mt, key, keylen)) {
+		pthread_mutex_unlock(&cache.lock);
+		free(key);
+		free(reply);
+		return;
+	}
+	while (cache.bytes + size > cache.limit)
+		cache_evict_locked(cache.lru.lru_prev);
+
+	e = xcalloc(1, sizeof(*e));
+	e->hash = hash;
+	e->mt = mt;
+	e->key = key;
+	e->keylen = keylen;
+	e->reply = reply;
+	e->replylen = replylen;
+	e->refs = 1;
+	e->next = cache.bucket[hash % DIFFD_CACHE_BUCKETS];
+	cache.bucket[hash % DIFFD_CACHE_BUCKETS] = e;
+	cache_link_lru(e);
+	cache.bytes += size;
+	cache.nr++;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/*
+ * A client connection. Its reader thread parses requests and queues
+ * jobs; workers write their frames under wlock, one whole frame at a
+ * time, so replies to different jobs may interleave. A failed write
+ * cancels the connection's remaining jobs.
+ */
+struct conn {
+	int fd;
+	pthread_mutex_t wlock;
+	int broken;
+	xdcancel_t cancel;
+	xdtask_group_t grp;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int inflight;
+};
+
+static int write_all(int fd, const char *p, size_t n)
+{
+	while (n) {
+		ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return -1;
+		p += w;
+		n -= w;
+	}
+	return 0;
+}
+
+static int read_all(int fd, char *p, size_t n)
+{
+	while (n) {
+		ssize_t r = read(fd, p, n);
+
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		p += r;
+		n -= r;
+	}
+	return 0;
+}
+
+static int conn_send(struct conn *c, uint8_t mt, uint32_t rid,
+		     const void *data, size_t n)
+{
+	wh16_t hdr = WH(mt, K_DIFF, ANN_RO, 0, rid, (uint32_t)n);
+	int ret = -1;
+
+	pthread_mutex_lock(&c->wlock);
+	if (!c->broken) {
+		if (!write_all(c->fd, (const char *)&hdr, sizeof(hdr)) &&
+		    !write_all(c->fd, data, n))
+			ret = 0;
+		else {
+			c->broken = 1;
+			xdl_cancel_request(&c->cancel);
+		}
+	}
+	pthread_mutex_unlock(&c->wlock);
+	return ret;
+}
+
+static void conn_send_result(struct conn *c, uint8_t mt, uint32_t rid,
+			     uint32_t count, uint32_t flags)
+{
+	dr8_t dr = { count, flags };
+
+	if (mt == M_ERROR)
+		stat_add(DS_ERRORS, 1);
+	conn_send(c, mt, rid, &dr, sizeof(dr));
+}
+
+/* Replays a cached reply under the given rid. */
+static void conn_replay(struct conn *c, uint32_t rid, struct cache_entry *e)
+{
+	const char *p = e->reply, *top = e->reply + e->replylen;
+	wh16_t hdr;
+
+	while (p < top) {
+		memcpy(&hdr, p, sizeof(hdr));
+		p += sizeof(hdr);
+		if (hdr.mt == M_DONE) {
+			dr8_t dr;
+
+			memcpy(&dr, p, sizeof(dr));
+			conn_send_result(c, M_DONE, rid, dr.count, dr.flags | DR_CACHED);
+		} else if (conn_send(c, hdr.mt, rid, p, hdr.n) < 0)
+			break;
+		p += hdr.n;
+	}
+}
+
+/*
+ * A queued M_DIFF or M_MERGE. The payload doubles as the cache key;
+ * frames sent are also collected in reply until they exceed what the
+ * cache would take.
+ */
+struct job {
+	struct conn *c;
+	uint32_t rid;
+	uint8_t mt;
+	dj24_t dj;
+	char *payload;
+	size_t size;
+	uint64_t hash;
+	int cache;
+
+	char *reply;
+	size_t replylen, replyalloc;
+
+	char *buf;		/* hunks or text not sent yet */
+	size_t buflen, bufalloc;
+	uint32_t nhunks;
+};
+
+static void job_buf_add(char **buf, size_t *len, size_t *alloc,
+			const void *data, size_t n)
+{
+	if (*len + n > *alloc) {
+		*alloc = (*len + n) * 2;
+		*buf = xrealloc(*buf, *alloc);
+	}
+	memcpy(*buf + *len, data, n);
+	*len += n;
+}
+
+static int job_frame(struct job *j, uint8_t mt, const void *data, size_t n)
+{
+	if (j->cache) {
+		wh16_t hdr = WH(mt, K_DIFF, ANN_RO, 0, 0, (uint32_t)n);
+
+		if (j->replylen + sizeof(hdr) + n + j->size > cache.limit / 8) {
+			FREE_AND_NULL(j->reply);
+			j->cache = 0;
+		} else {
+			job_buf_add(&j->reply, &j->replylen, &j->replyalloc,
+				    &hdr, sizeof(hdr));
+			job_buf_add(&j->reply, &j->replylen, &j->replyalloc,
+				    data, n);
+		}
+	}
+	return conn_send(j->c, mt, j->rid, data, n);
+}
+
+static int job_flush(struct job *j, uint8_t mt)
+{
+	int ret = 0;
+
+	if (j->buflen)
+		ret = job_frame(j, mt, j->buf, j->buflen);
+	j->buflen = 0;
+	return ret;
+}
+
+static int job_hunk(long s1, long c1, long s2, long c2, void *priv)
+{
+	struct job *j = priv;
+	hk16_t hk = { (uint32_t)s1, (uint32_t)c1, (uint32_t)s2, (uint32_t)c2 };
+
+	j->nhunks++;
+	job_buf_add(&j->buf, &j->buflen, &j->bufalloc, &hk, sizeof(hk));
+	if (j->buflen + sizeof(hk) > DIFFD_FRAME)
+		return job_flush(j, M_HUNK);
+	return 0;
+}
+
+static int job_text(void *priv, mmbuffer_t *mb, int nbuf)
+{
+	struct job *j = priv;
+	int i;
+
+	if (nbuf && mb[0].size > 3 && !memcmp(mb[0].ptr, "@@ -", 4))
+		j->nhunks++;
+	for (i = 0; i < nbuf; i++)
+		job_buf_add(&j->buf, &j->buflen, &j->bufalloc, mb[i].ptr, mb[i].size);
+	if (j->buflen >= DIFFD_FRAME)
+		return job_flush(j, M_DATA);
+	return 0;
+}
+
+static void job_inputs(struct job *j, mmfile_t *mf)
+{
+	char *p = j->payload + sizeof(dj24_t);
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		mf[i].ptr = p;
+		mf[i].size = j->dj.len[i];
+		p += j->dj.len[i];
+	}
+}
+
+static int job_diff(struct job *j, xpparam_t const *xpp, uint32_t *count)
+{
+	xdemitconf_t xecfg;
+	xdemitcb_t ecb;
+	mmfile_t mf[3];
+	int text = j->dj.opt & DJ_TEXT;
+
+	job_inputs(j, mf);
+	memset(&xecfg, 0, sizeof(xecfg));
+	memset(&ecb, 0, sizeof(ecb));
+	xecfg.ctxlen = j->dj.ctx;
+	if (j->dj.opt & DJ_FUNCNAMES) {
+		xecfg.flags = XDL_EMIT_FUNCNAMES;
+		xecfg.func_lang = j->dj.lang;
+	}
+	ecb.priv = j;
+	if (text)
+		ecb.out_line = job_text;
+	else
+		xecfg.hunk_func = job_hunk;
+
+	if (xdl_diff(&mf[0], &mf[1], xpp, &xecfg, &ecb) < 0 ||
+	    job_flush(j, text ? M_DATA : M_HUNK) < 0)
+		return -1;
+	*count = j->nhunks;
+	return 0;
+}
+
+static int job_merge(struct job *j, xpparam_t const *xpp, uint32_t *count)
+{
+	xmparam_t xmp;
+	xdoutbuf_t ob;
+	mmfile_t mf[3];
+	size_t off;
+	int ret;
+
+	job_inputs(j, mf);
+	memset(&xmp, 0, sizeof(xmp));
+	xmp.xpp = *xpp;
+	xmp.marker_size = j->dj.ctx ? j->dj.ctx : DEFAULT_CONFLICT_MARKER_SIZE;
+	xmp.level = j->dj.level;
+	xmp.favor = j->dj.favor;
+	xmp.style = j->dj.style;
+
+	if (xdl_outbuf_init(&ob, 0, DIFFD_MAX_OUTPUT) < 0)
+		return -1;
+	ret = xdl_merge_outbuf(&mf[0], &mf[1], &mf[2], &xmp, &ob);
+	for (off = 0; ret >= 0 && off < ob.size; off += DIFFD_FRAME)
+		if (job_frame(j, M_DATA, ob.ptr + off,
+			      ob.size - off < DIFFD_FRAME ? ob.size - off : DIFFD_FRAME) < 0)
+			ret = -1;
+	xdl_outbuf_release(&ob);
+	if (ret < 0)
+		return -1;
+	*count = ret;
+	return 0;
+}
+
+static void job_free(struct job *j)
+{
+	free(j->payload);
+	free(j->reply);
+	free(j->buf);
+	free(j);
+}
+
+static void run_job(void *priv)
+{
+	struct job *j = priv;
+	xpparam_t xpp;
+	uint32_t count = 0;
+	int ret;
+
+	memset(&xpp, 0, sizeof(xpp));
+	xpp.flags = j->dj.flags;
+	xpp.pool = pool;
+	xpp.index_dir = index_dir;
+	xpp.abort_check = xdl_cancel_check;
+	xpp.abort_priv = &j->c->cancel;
+
+	if (j->mt == M_DIFF)
+		ret = job_diff(j, &xpp, &count);
+	else
+		ret = job_merge(j, &xpp, &count);
+
+	if (ret < 0) {
+		conn_send_result(j->c, M_ERROR, j->rid, DE_FAILED, 0);
+		return;
+	}
+	if (j->cache) {
+		dr8_t dr = { count, 0 };
+
+		job_frame(j, M_DONE, &dr, sizeof(dr));
+		if (j->cache) {
+			cache_add(j->hash, j->mt, j->payload, j->size,
+				  j->reply, j->replylen);
+			j->payload = j->reply = NULL;
+		}
+	} else {
+		conn_send_result(j->c, M_DONE, j->rid, count, 0);
+	}
+}
+
+static void job_done(void *priv, int status, xdtask_times_t const *times)
+{
+	struct job *j = priv;
+	struct conn *c = j->c;
+
+	if (status < 0)
+		conn_send_result(c, M_ERROR, j->rid, DE_FAILED, 0);
+	else
+		stat_add(DS_RUN_US, (times->finished - times->started) / 1000);
+	if (times->started)
+		stat_add(DS_QUEUE_US, (times->started - times->queued) / 1000);
+	job_free(j);
+
+	pthread_mutex_lock(&c->lock);
+	c->inflight--;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+}
+
+static void send_stats(struct conn *c, uint32_t rid)
+{
+	kv32_t kv[DS_RUN_US];
+	int i;
+
+	pthread_mutex_lock(&cache.lock);
+	__atomic_store_n(&stats[DS_CACHE_KB], cache.bytes >> 10, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats[DS_CACHE_NR], cache.nr, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&cache.lock);
+	__atomic_store_n(&stats[DS_WORKERS], xdl_pool_threads(pool), __ATOMIC_RELAXED);
+
+	for (i = 0; i < DS_RUN_US; i++)
+		kv[i] = KV(i + 1, (uint32_t)__atomic_load_n(&stats[i + 1],
+							    __ATOMIC_RELAXED));
+	conn_send(c, M_STATS, rid, kv, sizeof(kv));
+}
+
+/* Discards the payload of a request that is not going to be run. */
+static int skip_payload(int fd, uint32_t n)
+{
+	char buf[8192];
+
+	while (n) {
+		uint32_t len = n < sizeof(buf) ? n : sizeof(buf);
+
+		if (read_all(fd, buf, len) < 0)
+			return -1;
+		n -= len;
+	}
+	return 0;
+}
+
+static int check_job(wh16_t const *hdr, dj24_t const *dj)
+{
+	uint64_t total = (uint64_t)dj->len[0] + dj->len[1] + dj->len[2];
+
+	if (dj->flags & ~(uint32_t)DIFFD_XDF_MASK)
+		return -1;
+	if (hdr->mt == M_DIFF && (dj->len[2] || dj->lang > XDL_FUNC_LANG_JAVA ||
+				  (dj->opt & ~(DJ_TEXT | DJ_NOCACHE | DJ_FUNCNAMES))))
+		return -1;
+	if (hdr->mt == M_MERGE && (dj->opt & ~DJ_NOCACHE || dj->lang ||
+				   dj->style > XDL_MERGE_ZEALOUS_DIFF3 ||
+				   dj->level > XDL_MERGE_ZEALOUS_ALNUM ||
+				   dj->favor > XDL_MERGE_FAVOR_UNION))
+		return -1;
+	return total + sizeof(*dj) == hdr->n ? 0 : -1;
+}
+
+/*
+ * Reads one M_DIFF or M_MERGE and queues it, or answers it from the
+ * cache. Returns -1 when the connection cannot go on.
+ */
+static int read_job(struct conn *c, wh16_t const *hdr)
+{
+	struct cache_entry *e;
+	struct job *j;
+	xdtask_t task;
+
+	if (hdr->n < sizeof(dj24_t)) {
+		conn_send_result(c, M_ERROR, hdr->rid, DE_PROTO, 0);
+		return skip_payload(c->fd, hdr->n);
+	}
+	if (hdr->n > max_job) {
+		conn_send_result(c, M_ERROR, hdr->rid, DE_TOOBIG, 0);
+		return skip_payload(c->fd, hdr->n);
+	}
+
+	j = xcalloc(1, sizeof(*j));
+	j->c = c;
+	j->rid = hdr->rid;
+	j->mt = hdr->mt;
+	j->size = hdr->n;
+	if (!(j->payload = malloc(j->size))) {
+		free(j);
+		conn_send_result(c, M_ERROR, hdr->rid, DE_NOMEM, 0);
+		return skip_payload(c->fd, hdr->n);
+	}
+	if (read_all(c->fd, j->payload, j->size) < 0) {
+		job_free(j);
+		return -1;
+	}
+	memcpy(&j->dj, j->payload, sizeof(j->dj));
+	if (check_job(hdr, &j->dj) < 0) {
+		job_free(j);
+		conn_send_result(c, M_ERROR, hdr->rid, DE_PROTO, 0);
+		return 0;
+	}
+
+	stat_add(DS_JOBS, 1);
+	stat_add(j->mt == M_DIFF ? DS_DIFFS : DS_MERGES, 1);
+	stat_add(DS_IN_KB, j->size >> 10);
+	if (!(j->dj.opt & DJ_NOCACHE)) {
+		j->hash = cache_hash(j->mt, j->payload, j->size);
+		if ((e = cache_get(j->hash, j->mt, j->payload, j->size))) {
+			stat_add(DS_HITS, 1);
+			conn_replay(c, j->rid, e);
+			cache_put(e);
+			job_free(j);
+			return 0;
+		}
+		stat_add(DS_MISSES, 1);
+		j->cache = 1;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	while (c->inflight >= DIFFD_INFLIGHT)
+		pthread_cond_wait(&c->cond, &c->lock);
+	c->inflight++;
+	pthread_mutex_unlock(&c->lock);
+
+	memset(&task, 0, sizeof(task));
+	task.run = run_job;
+	task.done = job_done;
+	task.priv = j;
+	task.prio = XDL_PRIO_INTERACTIVE;
+	task.affinity = XDL_AFFINITY_ANY;
+	if (xdl_pool_submit(&c->grp, &task) < 0) {
+		conn_send_result(c, M_ERROR, j->rid, DE_NOMEM, 0);
+		job_free(j);
+		pthread_mutex_lock(&c->lock);
+		c->inflight--;
+		pthread_mutex_unlock(&c->lock);
+	}
+	return 0;
+}
+
+static void *serve_conn(void *arg)
+{
+	struct conn *c = arg;
+	wh16_t hdr;
+
+	while (!read_all(c->fd, (char *)&hdr, sizeof(hdr))) {
+		if (hdr.kc != K_DIFF) {
+			conn_send_result(c, M_ERROR, hdr.rid, DE_PROTO, 0);
+			break;
+		}
+		if (hdr.mt == M_DIFF || hdr.mt == M_MERGE) {
+			if (read_job(c, &hdr) < 0)
+				break;
+			continue;
+		}
+		if (skip_payload(c->fd, hdr.n) < 0)
+			break;
+		if (hdr.mt == M_PING)
+			conn_send(c, M_PONG, hdr.rid, NULL, 0);
+		else if (hdr.mt == M_STATS)
+			send_stats(c, hdr.rid);
+		else
+			conn_send_result(c, M_ERROR, hdr.rid, DE_PROTO, 0);
+	}
+
+	/* Let queued jobs finish (or fail, if the client went away). */
+	xdl_group_wait(&c->grp);
+	close(c->fd);
+	pthread_mutex_destroy(&c->wlock);
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->cond);
+	free(c);
+	return NULL;
+}
+
+static void on_signal(int sig UNUSED)
+{
+	stopping = 1;
+}
+
+static unsigned long parse_num(const char *arg)
+{
+	char *end;
+	unsigned long n = strtoul(arg, &end, 10);
+
+	if (end == arg || *end)
+		die_daemon(diff_daemon_usage, NULL);
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_un sa;
+	struct sigaction act;
+	pthread_attr_t attr;
+	int i, fd, threads = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		const char *arg = argv[i];
+
+		if (starts_with(arg, "--threads="))
+			threads = (int)parse_num(arg + 10);
+		else if (starts_with(arg, "--cache="))
+			cache.limit = (size_t)parse_num(arg + 8) << 20;
+		else if (starts_with(arg, "--max-job="))
+			max_job = (size_t)parse_num(arg + 10) << 20;
+		else if (starts_with(arg, "--index-dir="))
+			index_dir = arg + 12;
+		else if (!strcmp(arg, "--")) {
+			i++;
+			break;
+		} else
+			die_daemon(diff_daemon_usage, NULL);
+	}
+	if (i + 1 != argc || max_job > UINT32_MAX)
+		die_daemon(diff_daemon_usage, NULL);
+	if (strlen(argv[i]) >= sizeof(sa.sun_path))
+		die_daemon("socket path too long", argv[i]);
+
+	if (index_dir && mkdir(index_dir, 0700) < 0 && errno != EEXIST)
+		die_daemon("cannot create index directory", index_dir);
+	cache.lru.lru_next = cache.lru.lru_prev = &cache.lru;
+	if (!(pool = xdl_pool_new(threads)))
+		die_daemon("cannot start worker threads", NULL);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, argv[i]);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		die_daemon("cannot create socket", strerror(errno));
+	unlink(sa.sun_path);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, 64) < 0)
+		die_daemon("cannot listen", sa.sun_path);
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = on_signal;
+	sigaction(SIGINT, &act, NULL);	/* no SA_RESTART: accept() returns */
+	sigaction(SIGTERM, &act, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while (!stopping) {
+		struct conn *c;
+		pthread_t th;
+		int cfd = accept(fd, NULL, NULL);
+
+		if (cfd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			die_daemon("accept failed", strerror(errno));
+		}
+		stat_add(DS_CONNS, 1);
+		c = xcalloc(1, sizeof(*c));
+		c->fd = cfd;
+		pthread_mutex_init(&c->wlock, NULL);
+		pthread_mutex_init(&c->lock, NULL);
+		pthread_cond_init(&c->cond, NULL);
+		xdl_cancel_init(&c->cancel, 0);
+		xdl_group_init(&c->grp, pool);
+		if (pthread_create(&th, &attr, serve_conn, c)) {
+			close(cfd);
+			free(c);
+		}
+	}
+
+	/* Connections still being served die with the process. */
+	close(fd);
+	unlink(sa.sun_path);
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * diff-html: render diffs as HTML with gitweb's markup.
+ *
+ *   diff-html [<options>] <old> <new>
+ *   diff-html [<options>] --stdin
+ *
+ * The first form diffs two files. With --stdin, unified diff text is
+ * read instead and each section starting with a "diff" line is
+ * rendered on its own, the sections' HTML separated by NUL bytes, so
+ * a caller such as gitweb can render every hunk of a page with one
+ * process.
+ */
+
+#include "git-compat-util.h"
+#include "xdiff.h"
+
+#define DIFF_HTML_MAX_OUTPUT ((size_t)1 << 30)
+
+static const char diff_html_usage[] =
+	"usage: diff-html [--side-by-side] [--highlight] [--no-hunk-header]\n"
+	"                 [-U<n>] (--stdin | <old> <new>)";
+
+static void die_html(const char *msg, const char *arg)
+{
+	fprintf(stderr, "diff-html: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+	exit(128);
+}
+
+static void read_all(FILE *fp, const char *name, mmfile_t *mf)
+{
+	size_t alloc = 8192, n;
+
+	mf->ptr = xmalloc(alloc);
+	mf->size = 0;
+	while ((n = fread(mf->ptr + mf->size, 1, alloc - mf->size, fp)) > 0) {
+		mf->size += n;
+		if ((size_t)mf->size == alloc)
+			mf->ptr = xrealloc(mf->ptr, alloc *= 2);
+	}
+	if (ferror(fp))
+		die_html("cannot read", name);
+}
+
+static void read_path(const char *path, mmfile_t *mf)
+{
+	FILE *fp = fopen(path, "rb");
+
+	if (!fp)
+		die_html("cannot open", path);
+	read_all(fp, path, mf);
+	fclose(fp);
+}
+
+static void write_out(xdoutbuf_t *ob)
+{
+	if (ob->size && fwrite(ob->ptr, 1, ob->size, stdout) != ob->size)
+		die_html("write error", NULL);
+	ob->size = 0;
+}
+
+static int is_section_start(const char *p, const char *top)
+{
+	return top - p >= 4 && !memcmp(p, "diff", 4) &&
+		(top - p == 4 || isspace((unsigned char)p[4]));
+}
+
+static void render_stdin(unsigned long flags, xdoutbuf_t *ob)
+{
+	mmfile_t in;
+	char *p, *top, *end, *eol;
+	int first = 1;
+
+	read_all(stdin, "standard input", &in);
+	top = in.ptr + in.size;
+	for (p = in.ptr; p < top; p = end) {
+		/* A section runs up to the next "diff" line. */
+		for (end = p; end < top; end = eol) {
+			eol = memchr(end, '\n', top - end);
+			eol = eol ? eol + 1 : top;
+			if (end > p && is_section_start(end, top))
+				break;
+		}
+		if (!first && fputc('\0', stdout) == EOF)
+			die_html("write error", NULL);
+		first = 0;
+		if (xdl_html_patch(p, (long)(end - p), flags, ob) < 0)
+			die_html("cannot render diff", NULL);
+		write_out(ob);
+	}
+	free(in.ptr);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long flags = 0;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	xdoutbuf_t ob;
+	mmfile_t mf1, mf2;
+	int i, use_stdin = 0;
+
+	memset(&xpp, 0, sizeof(xpp));
+	memset(&xecfg, 0, sizeof(xecfg));
+	xecfg.ctxlen = 3;
+	xecfg.flags = XDL_EMIT_FUNCNAMES;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		const char *arg = argv[i];
+
+		if (!strcmp(arg, "--side-by-side"))
+			flags |= XDL_HTML_SIDEBYSIDE;
+		else if (!strcmp(arg, "--highlight"))
+			flags |= XDL_HTML_HIGHLIGHT;
+		else if (!strcmp(arg, "--no-hunk-header"))
+			flags |= XDL_HTML_NO_HUNK_HDR;
+		else if (!strncmp(arg, "-U", 2) && arg[2])
+			xecfg.ctxlen = strtol(arg + 2, NULL, 10);
+		else if (!strcmp(arg, "--stdin"))
+			use_stdin = 1;
+		else if (!strcmp(arg, "--")) {
+			i++;
+			break;
+		} else
+			die_html(diff_html_usage, NULL);
+	}
+	if (use_stdin ? i != argc : i + 2 != argc)
+		die_html(diff_html_usage, NULL);
+
+	if (xdl_outbuf_init(&ob, 0, DIFF_HTML_MAX_OUTPUT) < 0)
+		die_html("out of memory", NULL);
+	if (use_stdin) {
+		render_stdin(flags, &ob);
+	} else {
+		read_path(argv[i], &mf1);
+		read_path(argv[i + 1], &mf2);
+		xecfg.func_lang = xdl_func_lang_for_path(argv[i + 1]);
+		if (xdl_diff_html(&mf1, &mf2, &xpp, &xecfg, flags, &ob) < 0)
+			die_html("cannot render diff", NULL);
+		write_out(&ob);
+		free(mf1.ptr);
+		free(mf2.ptr);
+	}
+	xdl_outbuf_release(&ob);
+
+	if (fflush(stdout))
+		die_html("write error", NULL);
+	return 0;
+}
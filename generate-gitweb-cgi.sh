@@ -42,6 +42,7 @@ sed -e "1s|#!/usr/bin/perl|#!$PERL_PATH|" \
     -e "s|@GITWEB_SITE_HEADER@|$GITWEB_SITE_HEADER|" \
     -e "s|@GITWEB_SITE_FOOTER@|$GITWEB_SITE_FOOTER|" \
     -e "s|@HIGHLIGHT_BIN@|$HIGHLIGHT_BIN|" \
+    -e "s|@DIFF_HTML_BIN@|$DIFF_HTML_BIN|" \
     "$INPUT" >"$OUTPUT"
 
 chmod a+x "$OUTPUT"
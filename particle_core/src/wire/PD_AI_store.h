@@ -0,0 +1,129 @@
+#ifndef PD_AI_STORE_H
+#define PD_AI_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "PD_AI_wire.h"
+
+/**
+ * PD_AI Shared Record Store
+ * Fixed-size record table for wh16_t records living in one flat,
+ * position-independent memory region
+ *
+ * The region holds only offsets, never pointers, so the same bytes can
+ * be mapped by several threads or processes (MAP_SHARED, shm_open, or
+ * the backing store of a SharedArrayBuffer) and all of them see one
+ * copy of the state. Reads are lock-free (per-slot sequence counters);
+ * writes publish atomically by bumping the sequence counter.
+ *
+ * Capacity: at most nslots records are live at a time. Deleting a
+ * record frees its slot for any later rid, but slots are never returned
+ * to the empty state, so once nslots distinct rids have been stored,
+ * looking up a rid that is not there probes the whole table. Inserting
+ * a rid that has no slot yet briefly takes a region-wide claim lock.
+ */
+
+// ============================================================================
+// Core Structure Definitions
+// ============================================================================
+
+/**
+ * Store handle - the formatted memory region itself
+ */
+typedef struct pd_store pd_store_t;
+
+/**
+ * Zero-copy view of one record
+ * data/offset point into the shared region; the view is only known to
+ * be consistent if pd_store_view_valid() still holds after the caller
+ * has finished reading it.
+ */
+typedef struct {
+    wh16_t         hdr;      // header as published (hdr.n = payload bytes)
+    const uint8_t *data;     // payload inside the region
+    size_t         offset;   // payload offset from the start of the region
+    uint32_t       slot;     // slot index
+    uint32_t       seq;      // slot sequence number when the view was taken
+} pd_view_t;
+
+// ============================================================================
+// Status Codes
+// ============================================================================
+
+#define PD_STORE_OK        0   // Success
+#define PD_STORE_ENOENT   -1   // No such record
+#define PD_STORE_EFULL    -2   // No free slot left
+#define PD_STORE_ETOOBIG  -3   // Payload larger than the slot capacity
+#define PD_STORE_EINVAL   -4   // Bad argument, message or region
+#define PD_STORE_EPERM    -5   // Annotation bits forbid the operation
+
+// ============================================================================
+// Layout
+// ============================================================================
+
+#define PD_STORE_MAGIC     0x54534450u  // "PDST"
+#define PD_STORE_VERSION   1
+
+/**
+ * Bytes needed for a region with nslots slots of payload_max bytes
+ * nslots is rounded up to a power of two; returns 0 on overflow.
+ */
+size_t pd_store_bytes(uint32_t nslots, uint32_t payload_max);
+
+/**
+ * Format mem as an empty store (done once, by one owner)
+ * mem must be 64-byte aligned, e.g. from mmap() or aligned_alloc().
+ */
+int pd_store_init(void *mem, size_t len, uint32_t nslots, uint32_t payload_max);
+
+/**
+ * Validate an already formatted region and return it as a store
+ * Returns NULL if the region is not a compatible store.
+ */
+pd_store_t *pd_store_attach(void *mem, size_t len);
+
+// ============================================================================
+// Record Operations
+// ============================================================================
+
+/**
+ * Insert or replace the record hdr->rid (payload of hdr->n bytes)
+ * Returns PD_STORE_EFULL only when nslots records are live.
+ */
+int pd_store_upsert(pd_store_t *st, const wh16_t *hdr, const void *payload);
+
+/**
+ * Remove record rid; its slot can be reused by any later insert
+ */
+int pd_store_delete(pd_store_t *st, uint32_t rid);
+
+/**
+ * Look up rid without copying (M_QUERY)
+ * Lock-free; never blocks a writer.
+ */
+int pd_store_query(const pd_store_t *st, uint32_t rid, pd_view_t *view);
+
+/**
+ * Check that the record behind a view has not been republished
+ */
+int pd_store_view_valid(const pd_store_t *st, const pd_view_t *view);
+
+/**
+ * Consistent copy of rid into buf (retries while a writer is active)
+ * On success *hdr is filled and hdr->n bytes are copied; returns
+ * PD_STORE_ETOOBIG if cap is smaller than the payload.
+ */
+int pd_store_read(const pd_store_t *st, uint32_t rid,
+                  wh16_t *hdr, void *buf, size_t cap);
+
+/**
+ * Apply one framed wire message (M_UPSERT or M_DELETE)
+ */
+int pd_store_apply(pd_store_t *st, const uint8_t *msg, size_t len);
+
+/**
+ * Number of live records
+ */
+uint32_t pd_store_count(const pd_store_t *st);
+
+#endif // PD_AI_STORE_H
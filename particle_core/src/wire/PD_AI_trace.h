@@ -0,0 +1,125 @@
+#ifndef PD_AI_TRACE_H
+#define PD_AI_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "PD_AI_wire.h"
+
+/**
+ * PD_AI Trace Spans
+ * Per-operation timing records for native diff and wire work
+ *
+ * Every span remembers the async context of the caller that queued the
+ * work (async_id / trigger_id, as handed over by the embedder), so CPU
+ * time spent on a worker thread can be attributed to the request that
+ * caused it. Finished spans go into a fixed ring living in one flat
+ * region (offsets only, like PD_AI_store.h); consumers drain it into
+ * their own array without any allocation.
+ */
+
+// ============================================================================
+// Core Structure Definitions
+// ============================================================================
+
+/**
+ * Ring handle - the formatted memory region itself
+ */
+typedef struct pd_trace pd_trace_t;
+
+/**
+ * Span - 64 bytes, one cache line
+ * Timestamps are CLOCK_MONOTONIC nanoseconds (see pd_trace_now()).
+ */
+typedef struct {
+    uint64_t async_id;    // caller's async context (0 = none)
+    uint64_t trigger_id;  // context that triggered the caller
+    uint64_t t_queue;     // work was queued
+    uint64_t t_start;     // a worker started executing it
+    uint64_t t_end;       // result was delivered back to the caller
+    uint32_t op;          // wire message type (M_*) or PD_SPAN_* operation
+    int32_t  status;      // operation result, 0 = success
+    uint64_t bytes;       // input bytes processed
+    uint32_t thread;      // worker that executed the span
+    uint32_t reserved;
+} pd_span_t;
+
+// ============================================================================
+// Operation Codes
+// ============================================================================
+
+// Values below 0x100 are wire message types (M_UPSERT, M_QUERY, ...)
+#define PD_SPAN_DIFF    0x100  // xdiff diff
+#define PD_SPAN_MERGE   0x101  // xdiff three-way merge
+#define PD_SPAN_USER    0x1000 // first embedder-defined operation
+
+// ============================================================================
+// Layout
+// ============================================================================
+
+#define PD_TRACE_MAGIC     0x52544450u  // "PDTR"
+#define PD_TRACE_VERSION   1
+
+/**
+ * Bytes needed for a ring of nspans spans
+ * nspans is rounded up to a power of two; returns 0 on overflow.
+ */
+size_t pd_trace_bytes(uint32_t nspans);
+
+/**
+ * Format mem as an empty ring (mem must be 64-byte aligned)
+ */
+int pd_trace_init(void *mem, size_t len, uint32_t nspans);
+
+/**
+ * Validate an already formatted region and return it as a ring
+ */
+pd_trace_t *pd_trace_attach(void *mem, size_t len);
+
+// ============================================================================
+// Span Lifecycle
+// ============================================================================
+
+/**
+ * Monotonic clock in nanoseconds
+ */
+uint64_t pd_trace_now(void);
+
+/**
+ * Open a span when work is queued, on the caller's thread
+ */
+void pd_span_queue(pd_span_t *span, uint32_t op,
+                   uint64_t async_id, uint64_t trigger_id);
+
+/**
+ * Mark the start of execution, on the worker thread
+ */
+void pd_span_start(pd_span_t *span, uint32_t thread);
+
+/**
+ * Close the span and publish it to the ring
+ * Takes no locks; a span that loses a race with a newer writer for the
+ * same ring entry is counted as dropped.
+ */
+void pd_span_end(pd_trace_t *tr, pd_span_t *span, int32_t status,
+                 uint64_t bytes);
+
+// ============================================================================
+// Reading
+// ============================================================================
+
+/**
+ * Copy up to max finished spans after *cursor into out
+ * *cursor is the consumer's position (start at 0) and is advanced past
+ * everything returned or lost. Spans overwritten before they could be
+ * read are added to *dropped when it is not NULL. Returns the number
+ * of spans copied.
+ */
+size_t pd_trace_read(const pd_trace_t *tr, uint64_t *cursor,
+                     pd_span_t *out, size_t max, uint64_t *dropped);
+
+/**
+ * Total number of spans ever published to the ring
+ */
+uint64_t pd_trace_head(const pd_trace_t *tr);
+
+#endif // PD_AI_TRACE_H
@@ -48,6 +48,45 @@ typedef struct {
     uint32_t used_credits; // used credits
 } __attribute__((packed)) bud_t;
 
+/**
+ * Diff Job - 24 bytes packed structure
+ * Leads the payload of M_DIFF and M_MERGE; the inputs follow it back
+ * to back (old, new for M_DIFF; base, ours, theirs for M_MERGE).
+ */
+typedef struct {
+    uint32_t flags;    // XDF_* diff flags
+    uint16_t ctx;      // context lines (M_DIFF) or conflict marker size (M_MERGE)
+    uint8_t  opt;      // DJ_* options
+    uint8_t  style;    // M_MERGE: 0, XDL_MERGE_DIFF3 or XDL_MERGE_ZEALOUS_DIFF3
+    uint8_t  level;    // M_MERGE: XDL_MERGE_MINIMAL .. XDL_MERGE_ZEALOUS_ALNUM
+    uint8_t  favor;    // M_MERGE: 0 or XDL_MERGE_FAVOR_*
+    uint8_t  lang;     // M_DIFF: XDL_FUNC_LANG_* for DJ_FUNCNAMES
+    uint8_t  reserved;
+    uint32_t len[3];   // input sizes in bytes (len[2] = 0 for M_DIFF)
+} __attribute__((packed)) dj24_t;
+
+/**
+ * Hunk - 16 bytes packed structure
+ * One changed range of a diff, 0-based lines as passed to
+ * xdemitconf_t.hunk_func; M_HUNK payloads are arrays of these.
+ */
+typedef struct {
+    uint32_t s1;       // first line in the old file
+    uint32_t c1;       // lines removed
+    uint32_t s2;       // first line in the new file
+    uint32_t c2;       // lines added
+} __attribute__((packed)) hk16_t;
+
+/**
+ * Job Result - 8 bytes packed structure
+ * Payload of M_DONE (count = hunks or conflicts) and M_ERROR
+ * (count = DE_* code)
+ */
+typedef struct {
+    uint32_t count;    // hunks, conflicts or error code
+    uint32_t flags;    // DR_* bits
+} __attribute__((packed)) dr8_t;
+
 // ============================================================================
 // Message Type Constants
 // ============================================================================
@@ -61,6 +100,15 @@ typedef struct {
 #define M_RESTORE    0x06  // Restore from snapshot
 #define M_SYNC       0x07  // Synchronization request
 
+// Diff daemon jobs; replies carry the rid of the job they answer
+#define M_DIFF       0x08  // Diff job (dj24_t + old + new)
+#define M_MERGE      0x09  // Three-way merge job (dj24_t + base + ours + theirs)
+#define M_STATS      0x0A  // Daemon counters (empty request, kv32_t reply)
+#define M_HUNK       0x0B  // Diff result: hk16_t array
+#define M_DATA       0x0C  // Result bytes: unified diff text or merged file
+#define M_DONE       0x0D  // Job finished (dr8_t)
+#define M_ERROR      0x0E  // Job failed (dr8_t)
+
 // ============================================================================
 // Key Class Constants
 // ============================================================================
@@ -71,6 +119,7 @@ typedef struct {
 #define K_STATE      0x40  // State data keys
 #define K_SNAPSHOT   0x50  // Snapshot keys
 #define K_METADATA   0x60  // Metadata keys
+#define K_DIFF       0x70  // Diff daemon jobs and results
 
 // ============================================================================
 // Annotation Bits (Permissions/Flags)
@@ -109,6 +158,39 @@ typedef struct {
 #define CAP_EXTENDED (P_TOOLS | P_APPS | P_FILES)
 #define CAP_FULL     0xFFFFFFFF                   // All capabilities
 
+// ============================================================================
+// Diff Daemon Constants
+// ============================================================================
+
+// dj24_t.opt
+#define DJ_TEXT      0x01  // M_DIFF: reply with unified diff text (M_DATA)
+#define DJ_NOCACHE   0x02  // Neither use nor fill the result cache
+#define DJ_FUNCNAMES 0x04  // M_DIFF with DJ_TEXT: function names in hunk headers
+
+// dr8_t.flags
+#define DR_CACHED    0x01  // Replayed from the result cache
+
+// dr8_t.count of M_ERROR
+#define DE_PROTO     1     // Malformed or unknown request
+#define DE_TOOBIG    2     // Request larger than the daemon accepts
+#define DE_NOMEM     3     // Out of memory
+#define DE_FAILED    4     // Diff or merge failed
+
+// M_STATS keys (32-bit counters, wrapping)
+#define DS_CONNS     0x01  // Connections accepted
+#define DS_JOBS      0x02  // Jobs run or replayed
+#define DS_DIFFS     0x03  // M_DIFF jobs
+#define DS_MERGES    0x04  // M_MERGE jobs
+#define DS_ERRORS    0x05  // Jobs answered with M_ERROR
+#define DS_HITS      0x06  // Result cache hits
+#define DS_MISSES    0x07  // Result cache misses
+#define DS_CACHE_KB  0x08  // Result cache size in KiB
+#define DS_CACHE_NR  0x09  // Results in the cache
+#define DS_IN_KB     0x0A  // Job input received, KiB
+#define DS_WORKERS   0x0B  // Worker threads
+#define DS_QUEUE_US  0x0C  // Time jobs spent queued, microseconds
+#define DS_RUN_US    0x0D  // Time jobs spent running, microseconds
+
 // ============================================================================
 // Record ID Ranges
 // ============================================================================
@@ -156,6 +238,12 @@ typedef struct {
 #define MSG_SIZE(payload_bytes) \
     (sizeof(wh16_t) + (payload_bytes))
 
+/**
+ * Calculate payload size of a diff job with inputs of a, b and c bytes
+ */
+#define BYTES_JOB(a, b, c) \
+    (sizeof(dj24_t) + (a) + (b) + (c))
+
 // ============================================================================
 // Validation Macros
 // ============================================================================
@@ -0,0 +1,388 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "PD_AI_store.h"
+
+/**
+ * PD_AI Shared Record Store
+ * Open-addressed table of fixed-size slots guarded by seqlocks
+ *
+ * Each slot carries a sequence counter that is odd while a writer owns
+ * the slot. Readers sample the counter before and after looking at the
+ * slot and retry (or report the view stale) when it moved. Deleting a
+ * record only clears its live flag: a slot never becomes free again,
+ * so probe chains stay intact. Binding a slot to a new rid is done
+ * under the region's claim lock and reuses the first dead slot on the
+ * rid's probe chain, so deleted records give their room back.
+ */
+
+// ============================================================================
+// Region Layout
+// ============================================================================
+
+#define PD_STORE_HDR_BYTES  64u   // region header, one cache line
+#define PD_STORE_ALIGN      64u   // slot alignment
+
+struct pd_store {
+    uint32_t         magic;        // PD_STORE_MAGIC
+    uint32_t         version;      // PD_STORE_VERSION
+    uint32_t         nslots;       // power of two
+    uint32_t         payload_max;  // payload capacity per slot
+    uint32_t         stride;       // bytes per slot, header included
+    _Atomic uint32_t claim;        // held while a slot is bound to a rid
+    _Atomic uint32_t count;        // live records
+};
+
+typedef struct {
+    _Atomic uint32_t seq;     // odd while a writer owns the slot
+    _Atomic uint32_t rid;     // 0 = never claimed
+    _Atomic uint32_t live;    // 1 if the record exists
+    uint32_t         pad;
+    wh16_t           hdr;     // published header
+} pd_slot_t;
+
+#define PD_SLOT_BYTES  ((uint32_t)sizeof(pd_slot_t))
+
+static uint32_t round_pow2(uint32_t v) {
+    uint32_t p = 1;
+
+    while (p < v && p < 0x80000000u)
+        p <<= 1;
+    return p;
+}
+
+static uint32_t slot_stride(uint32_t payload_max) {
+    uint64_t s = (uint64_t)PD_SLOT_BYTES + payload_max;
+
+    s = (s + PD_STORE_ALIGN - 1) & ~(uint64_t)(PD_STORE_ALIGN - 1);
+    return s > UINT32_MAX ? 0 : (uint32_t)s;
+}
+
+static pd_slot_t *slot_at(const pd_store_t *st, uint32_t i) {
+    return (pd_slot_t *)((uint8_t *)st + PD_STORE_HDR_BYTES +
+                         (size_t)i * st->stride);
+}
+
+static uint32_t slot_home(const pd_store_t *st, uint32_t rid) {
+    // Fibonacci hashing; nslots is a power of two
+    return (uint32_t)(rid * 2654435761u) & (st->nslots - 1);
+}
+
+size_t pd_store_bytes(uint32_t nslots, uint32_t payload_max) {
+    uint32_t stride = slot_stride(payload_max);
+
+    if (!nslots || !stride)
+        return 0;
+    nslots = round_pow2(nslots);
+    if ((SIZE_MAX - PD_STORE_HDR_BYTES) / stride < nslots)
+        return 0;
+    return PD_STORE_HDR_BYTES + (size_t)nslots * stride;
+}
+
+int pd_store_init(void *mem, size_t len, uint32_t nslots, uint32_t payload_max) {
+    size_t need = pd_store_bytes(nslots, payload_max);
+    pd_store_t *st = mem;
+
+    if (!mem || !need || len < need || ((uintptr_t)mem % PD_STORE_ALIGN))
+        return PD_STORE_EINVAL;
+
+    memset(mem, 0, need);
+    st->nslots = round_pow2(nslots);
+    st->payload_max = payload_max;
+    st->stride = slot_stride(payload_max);
+    st->version = PD_STORE_VERSION;
+    atomic_store_explicit(&st->count, 0, memory_order_relaxed);
+
+    // Publish the magic last so attachers never see a half-built header
+    atomic_thread_fence(memory_order_release);
+    st->magic = PD_STORE_MAGIC;
+    return PD_STORE_OK;
+}
+
+pd_store_t *pd_store_attach(void *mem, size_t len) {
+    pd_store_t *st = mem;
+
+    if (!mem || len < PD_STORE_HDR_BYTES || ((uintptr_t)mem % PD_STORE_ALIGN))
+        return NULL;
+    if (st->magic != PD_STORE_MAGIC || st->version != PD_STORE_VERSION)
+        return NULL;
+    atomic_thread_fence(memory_order_acquire);
+    if (!st->nslots || (st->nslots & (st->nslots - 1)) ||
+        st->stride != slot_stride(st->payload_max) ||
+        len < pd_store_bytes(st->nslots, st->payload_max))
+        return NULL;
+    return st;
+}
+
+// ============================================================================
+// Slot Lookup
+// ============================================================================
+
+/**
+ * Find the slot bound to rid
+ * Returns the slot index or PD_STORE_ENOENT. The slot may be rebound
+ * to another rid once its record is deleted, so callers check the rid
+ * again under the slot's sequence counter.
+ */
+static int64_t find_slot(const pd_store_t *st, uint32_t rid) {
+    uint32_t i, idx = slot_home(st, rid);
+
+    for (i = 0; i < st->nslots; i++, idx = (idx + 1) & (st->nslots - 1)) {
+        pd_slot_t *s = slot_at(st, idx);
+        uint32_t cur = atomic_load_explicit(&s->rid, memory_order_acquire);
+
+        if (cur == rid)
+            return idx;
+        if (cur == 0)
+            return PD_STORE_ENOENT;
+    }
+    return PD_STORE_ENOENT;
+}
+
+static uint32_t slot_lock(pd_slot_t *s) {
+    uint32_t seq;
+
+    for (;;) {
+        seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+        if (!(seq & 1) &&
+            atomic_compare_exchange_weak_explicit(&s->seq, &seq, seq + 1,
+                                                  memory_order_acquire,
+                                                  memory_order_relaxed))
+            return seq + 1;
+        sched_yield();
+    }
+}
+
+static void slot_unlock(pd_slot_t *s, uint32_t seq) {
+    // Everything written under the lock becomes visible with seq + 1
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+}
+
+static void claim_lock(pd_store_t *st) {
+    uint32_t expected = 0;
+
+    while (!atomic_compare_exchange_weak_explicit(&st->claim, &expected, 1,
+                                                  memory_order_acquire,
+                                                  memory_order_relaxed)) {
+        expected = 0;
+        sched_yield();
+    }
+}
+
+static void claim_unlock(pd_store_t *st) {
+    atomic_store_explicit(&st->claim, 0, memory_order_release);
+}
+
+/**
+ * Bind a slot to rid: the slot already bound to it, else the first
+ * dead slot on its probe chain, else the free slot ending the chain
+ * Only claims change a slot's rid, and they are serialized, so a rid
+ * is never bound to two slots. Returns the slot index or
+ * PD_STORE_EFULL when all nslots records are live.
+ */
+static int64_t claim_slot(pd_store_t *st, uint32_t rid) {
+    int64_t ret = PD_STORE_EFULL;
+
+    claim_lock(st);
+    for (;;) {
+        uint32_t i, idx = slot_home(st, rid);
+        int64_t dead = -1, free_idx = -1;
+        pd_slot_t *s;
+        uint32_t seq;
+
+        for (i = 0; i < st->nslots; i++, idx = (idx + 1) & (st->nslots - 1)) {
+            uint32_t cur;
+
+            s = slot_at(st, idx);
+            cur = atomic_load_explicit(&s->rid, memory_order_acquire);
+            if (cur == rid) {
+                ret = idx;
+                goto out;
+            }
+            if (cur == 0) {
+                free_idx = idx;
+                break;
+            }
+            if (dead < 0 && !atomic_load_explicit(&s->live, memory_order_relaxed))
+                dead = idx;
+        }
+        if (dead < 0 && free_idx < 0)
+            goto out;
+
+        s = slot_at(st, (uint32_t)(dead >= 0 ? dead : free_idx));
+        seq = slot_lock(s);
+        if (atomic_load_explicit(&s->live, memory_order_relaxed)) {
+            // Revived by its old rid since the scan; look again
+            slot_unlock(s, seq);
+            continue;
+        }
+        atomic_store_explicit(&s->rid, rid, memory_order_release);
+        s->hdr.rid = rid;
+        slot_unlock(s, seq);
+        ret = dead >= 0 ? dead : free_idx;
+        goto out;
+    }
+out:
+    claim_unlock(st);
+    return ret;
+}
+
+// ============================================================================
+// Record Operations
+// ============================================================================
+
+int pd_store_upsert(pd_store_t *st, const wh16_t *hdr, const void *payload) {
+    pd_slot_t *s;
+    int64_t idx;
+    uint32_t seq;
+
+    if (!st || !hdr || !RID_IS_VALID(hdr->rid) || (hdr->n && !payload))
+        return PD_STORE_EINVAL;
+    if (hdr->n > st->payload_max)
+        return PD_STORE_ETOOBIG;
+
+    for (;;) {
+        if ((idx = find_slot(st, hdr->rid)) < 0 &&
+            (idx = claim_slot(st, hdr->rid)) < 0)
+            return (int)idx;
+
+        s = slot_at(st, (uint32_t)idx);
+        seq = slot_lock(s);
+        if (atomic_load_explicit(&s->rid, memory_order_relaxed) == hdr->rid)
+            break;
+        // Dead and rebound to another rid after we found it
+        slot_unlock(s, seq);
+    }
+    s->hdr = *hdr;
+    if (hdr->n)
+        memcpy((uint8_t *)s + PD_SLOT_BYTES, payload, hdr->n);
+    if (!atomic_load_explicit(&s->live, memory_order_relaxed)) {
+        atomic_store_explicit(&s->live, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&st->count, 1, memory_order_relaxed);
+    }
+    slot_unlock(s, seq);
+    return PD_STORE_OK;
+}
+
+int pd_store_delete(pd_store_t *st, uint32_t rid) {
+    pd_slot_t *s;
+    int64_t idx;
+    uint32_t seq;
+    int ret = PD_STORE_OK;
+
+    if (!st || !RID_IS_VALID(rid))
+        return PD_STORE_EINVAL;
+    if ((idx = find_slot(st, rid)) < 0)
+        return (int)idx;
+
+    s = slot_at(st, (uint32_t)idx);
+    seq = slot_lock(s);
+    if (atomic_load_explicit(&s->rid, memory_order_relaxed) == rid &&
+        atomic_load_explicit(&s->live, memory_order_relaxed)) {
+        atomic_store_explicit(&s->live, 0, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&st->count, 1, memory_order_relaxed);
+    } else {
+        // Not live, or already rebound to another rid
+        ret = PD_STORE_ENOENT;
+    }
+    slot_unlock(s, seq);
+    return ret;
+}
+
+int pd_store_query(const pd_store_t *st, uint32_t rid, pd_view_t *view) {
+    pd_slot_t *s;
+    int64_t idx;
+    uint32_t s1, s2, live, bound;
+
+    if (!st || !view || !RID_IS_VALID(rid))
+        return PD_STORE_EINVAL;
+retry:
+    if ((idx = find_slot(st, rid)) < 0)
+        return (int)idx;
+
+    s = slot_at(st, (uint32_t)idx);
+    for (;;) {
+        s1 = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (s1 & 1) {
+            sched_yield();
+            continue;
+        }
+        view->hdr = s->hdr;
+        live = atomic_load_explicit(&s->live, memory_order_relaxed);
+        bound = atomic_load_explicit(&s->rid, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&s->seq, memory_order_relaxed);
+        if (s1 == s2)
+            break;
+    }
+    if (bound != rid)
+        goto retry;  // rebound since find_slot(); rid may live elsewhere now
+    if (!live)
+        return PD_STORE_ENOENT;
+
+    view->slot = (uint32_t)idx;
+    view->seq = s1;
+    view->offset = PD_STORE_HDR_BYTES + (size_t)idx * st->stride + PD_SLOT_BYTES;
+    view->data = (const uint8_t *)st + view->offset;
+    return PD_STORE_OK;
+}
+
+int pd_store_view_valid(const pd_store_t *st, const pd_view_t *view) {
+    pd_slot_t *s;
+
+    if (!st || !view || view->slot >= st->nslots)
+        return 0;
+    s = slot_at(st, view->slot);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&s->seq, memory_order_relaxed) == view->seq;
+}
+
+int pd_store_read(const pd_store_t *st, uint32_t rid,
+                  wh16_t *hdr, void *buf, size_t cap) {
+    pd_view_t view;
+    int ret;
+
+    if (!hdr || (cap && !buf))
+        return PD_STORE_EINVAL;
+    for (;;) {
+        if ((ret = pd_store_query(st, rid, &view)) != PD_STORE_OK)
+            return ret;
+        if (view.hdr.n > cap)
+            return PD_STORE_ETOOBIG;
+        if (view.hdr.n)
+            memcpy(buf, view.data, view.hdr.n);
+        if (pd_store_view_valid(st, &view))
+            break;
+    }
+    *hdr = view.hdr;
+    return PD_STORE_OK;
+}
+
+int pd_store_apply(pd_store_t *st, const uint8_t *msg, size_t len) {
+    wh16_t hdr;
+
+    if (!st || !msg || len < sizeof(wh16_t))
+        return PD_STORE_EINVAL;
+    memcpy(&hdr, msg, sizeof(hdr));
+    if (hdr.ver != 1 || hdr.n > len - sizeof(wh16_t))
+        return PD_STORE_EINVAL;
+
+    switch (hdr.mt) {
+    case M_UPSERT:
+        if (!HAS_WRITE(hdr.ann))
+            return PD_STORE_EPERM;
+        return pd_store_upsert(st, &hdr, msg + sizeof(wh16_t));
+    case M_DELETE:
+        if (!HAS_DELETE(hdr.ann))
+            return PD_STORE_EPERM;
+        return pd_store_delete(st, hdr.rid);
+    default:
+        return PD_STORE_EINVAL;
+    }
+}
+
+uint32_t pd_store_count(const pd_store_t *st) {
+    return st ? atomic_load_explicit(&st->count, memory_order_relaxed) : 0;
+}
@@ -0,0 +1,456 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "PD_AI_store.h"
+
+/**
+ * PD_AI Shared Record Store Test Suite
+ * Tests for region layout, record operations and lock-free reads
+ */
+
+// Test counters
+static int tests_run = 0;
+static int tests_passed = 0;
+
+// Test helper macros
+#define TEST_START(name) \
+    do { \
+        printf("\n[TEST] %s\n", name); \
+        tests_run++; \
+    } while(0)
+
+#define TEST_PASS() \
+    do { \
+        tests_passed++; \
+        printf("  ✓ PASSED\n"); \
+    } while(0)
+
+#define ASSERT_EQ(a, b, msg) \
+    do { \
+        if ((a) != (b)) { \
+            printf("  ✗ FAILED: %s (expected %d, got %d)\n", msg, (int)(b), (int)(a)); \
+            return 0; \
+        } \
+    } while(0)
+
+#define ASSERT_TRUE(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            printf("  ✗ FAILED: %s\n", msg); \
+            return 0; \
+        } \
+    } while(0)
+
+/**
+ * Map a shared anonymous region, as a SharedArrayBuffer backing store
+ * or a shm segment would be
+ */
+static void *map_region(size_t len) {
+    void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+// ============================================================================
+// Test Functions
+// ============================================================================
+
+/**
+ * Test 1: Region Layout
+ * Verify sizing, formatting and attaching
+ */
+int test_layout() {
+    TEST_START("test_layout - Region Layout");
+
+    size_t len = pd_store_bytes(100, 200);
+    ASSERT_TRUE(len > 0, "Region size must be computable");
+    ASSERT_EQ(len, pd_store_bytes(128, 200), "Slot count must round to a power of two");
+    ASSERT_EQ(pd_store_bytes(0, 200), 0, "Zero slots must be rejected");
+
+    void *mem = map_region(len);
+    ASSERT_TRUE(mem != NULL, "Region mapping failed");
+    ASSERT_TRUE(pd_store_attach(mem, len) == NULL, "Unformatted region must not attach");
+    ASSERT_EQ(pd_store_init(mem, len - 1, 100, 200), PD_STORE_EINVAL, "Short region must be rejected");
+    ASSERT_EQ(pd_store_init(mem, len, 100, 200), PD_STORE_OK, "Init failed");
+
+    pd_store_t *st = pd_store_attach(mem, len);
+    ASSERT_TRUE(st != NULL, "Attach failed");
+    ASSERT_TRUE(pd_store_attach(mem, len - 1) == NULL, "Truncated region must not attach");
+    ASSERT_EQ(pd_store_count(st), 0, "New store must be empty");
+
+    printf("  - Region size for 100 x 200 bytes: %zu bytes\n", len);
+
+    munmap(mem, len);
+    TEST_PASS();
+    return 1;
+}
+
+/**
+ * Test 2: Upsert and Query
+ * Records are readable in place and replaced on upsert
+ */
+int test_upsert_query() {
+    TEST_START("test_upsert_query - Upsert and Zero-Copy Query");
+
+    size_t len = pd_store_bytes(16, 64);
+    void *mem = map_region(len);
+    ASSERT_TRUE(mem != NULL, "Region mapping failed");
+    pd_store_init(mem, len, 16, 64);
+    pd_store_t *st = pd_store_attach(mem, len);
+
+    kv32_t kvs[2] = { KV(0x1001, 0x2002), KV(0x3003, 0x4004) };
+    wh16_t hdr = WH(M_UPSERT, K_STATE, ANN_RW, CAP_STANDARD, RID_USER_MIN, BYTES_KV(2));
+    ASSERT_EQ(pd_store_upsert(st, &hdr, kvs), PD_STORE_OK, "Upsert failed");
+    ASSERT_EQ(pd_store_count(st), 1, "Count after insert");
+
+    pd_view_t view;
+    ASSERT_EQ(pd_store_query(st, RID_USER_MIN, &view), PD_STORE_OK, "Query failed");
+    ASSERT_EQ(view.hdr.n, BYTES_KV(2), "Payload size mismatch");
+    ASSERT_EQ(view.hdr.kc, K_STATE, "Key class mismatch");
+    ASSERT_TRUE(view.data == (const uint8_t *)mem + view.offset, "View must point into the region");
+    ASSERT_TRUE(memcmp(view.data, kvs, BYTES_KV(2)) == 0, "Payload mismatch");
+    ASSERT_TRUE(pd_store_view_valid(st, &view), "Fresh view must be valid");
+
+    kvs[0].v = 0x5005;
+    hdr.n = BYTES_KV(1);
+    ASSERT_EQ(pd_store_upsert(st, &hdr, kvs), PD_STORE_OK, "Replace failed");
+    ASSERT_EQ(pd_store_count(st), 1, "Replace must not change count");
+    ASSERT_TRUE(!pd_store_view_valid(st, &view), "Old view must be stale after replace");
+
+    wh16_t out;
+    kv32_t buf[2];
+    ASSERT_EQ(pd_store_read(st, RID_USER_MIN, &out, buf, sizeof(buf)), PD_STORE_OK, "Read failed");
+    ASSERT_EQ(out.n, BYTES_KV(1), "Replaced size mismatch");
+    ASSERT_EQ(buf[0].v, 0x5005, "Replaced value mismatch");
+    ASSERT_EQ(pd_store_read(st, RID_USER_MIN, &out, buf, 4), PD_STORE_ETOOBIG, "Short buffer must be rejected");
+
+    ASSERT_EQ(pd_store_query(st, RID_USER_MIN + 1, &view), PD_STORE_ENOENT, "Missing record must not be found");
+
+    printf("  - Payload offset in region: %zu\n", view.offset);
+
+    munmap(mem, len);
+    TEST_PASS();
+    return 1;
+}
+
+/**
+ * Test 3: Delete and Capacity
+ * Deleted rids can come back; full tables and big payloads are refused
+ */
+int test_delete_capacity() {
+    TEST_START("test_delete_capacity - Delete and Capacity Limits");
+
+    size_t len = pd_store_bytes(4, 16);
+    void *mem = map_region(len);
+    ASSERT_TRUE(mem != NULL, "Region mapping failed");
+    pd_store_init(mem, len, 4, 16);
+    pd_store_t *st = pd_store_attach(mem, len);
+
+    uint8_t payload[32] = {0};
+    wh16_t hdr = WH(M_UPSERT, K_MCP, ANN_MCP, CAP_STANDARD, 0, 8);
+    for (uint32_t i = 0; i < 4; i++) {
+        hdr.rid = RID_USER_MIN + i;
+        ASSERT_EQ(pd_store_upsert(st, &hdr, payload), PD_STORE_OK, "Fill failed");
+    }
+    hdr.rid = RID_USER_MIN + 4;
+    ASSERT_EQ(pd_store_upsert(st, &hdr, payload), PD_STORE_EFULL, "Full table must be reported");
+
+    hdr.rid = RID_USER_MIN;
+    hdr.n = 17;
+    ASSERT_EQ(pd_store_upsert(st, &hdr, payload), PD_STORE_ETOOBIG, "Oversized payload must be rejected");
+
+    ASSERT_EQ(pd_store_delete(st, RID_USER_MIN + 2), PD_STORE_OK, "Delete failed");
+    ASSERT_EQ(pd_store_delete(st, RID_USER_MIN + 2), PD_STORE_ENOENT, "Double delete must fail");
+    ASSERT_EQ(pd_store_count(st), 3, "Count after delete");
+
+    pd_view_t view;
+    ASSERT_EQ(pd_store_query(st, RID_USER_MIN + 2, &view), PD_STORE_ENOENT, "Deleted record must be gone");
+
+    hdr.rid = RID_USER_MIN + 2;
+    hdr.n = 8;
+    ASSERT_EQ(pd_store_upsert(st, &hdr, payload), PD_STORE_OK, "Re-insert failed");
+    ASSERT_EQ(pd_store_count(st), 4, "Count after re-insert");
+    ASSERT_EQ(pd_store_upsert(st, &hdr, NULL), PD_STORE_EINVAL, "Missing payload must be rejected");
+
+    munmap(mem, len);
+    TEST_PASS();
+    return 1;
+}
+
+/**
+ * Test 4: Wire Messages
+ * Framed M_UPSERT / M_DELETE messages honour annotation bits
+ */
+int test_apply_messages() {
+    TEST_START("test_apply_messages - Applying Wire Messages");
+
+    size_t len = pd_store_bytes(8, 64);
+    void *mem = map_region(len);
+    ASSERT_TRUE(mem != NULL, "Region mapping failed");
+    pd_store_init(mem, len, 8, 64);
+    pd_store_t *st = pd_store_attach(mem, len);
+
+    uint8_t msg[MSG_SIZE(BYTES_KV(1))];
+    kv32_t kv = KV(0xAAAA, 0xBBBB);
+    wh16_t hdr = WH(M_UPSERT, K_CONFIG, ANN_RW, CAP_STANDARD, RID_SYSTEM_MIN, BYTES_KV(1));
+    memcpy(msg, &hdr, sizeof(hdr));
+    memcpy(msg + sizeof(hdr), &kv, sizeof(kv));
+
+    ASSERT_EQ(pd_store_apply(st, msg, sizeof(msg)), PD_STORE_OK, "Apply upsert failed");
+    ASSERT_EQ(pd_store_apply(st, msg, sizeof(msg) - 1), PD_STORE_EINVAL, "Truncated message must be rejected");
+
+    hdr.mt = M_DELETE;
+    hdr.n = 0;
+    memcpy(msg, &hdr, sizeof(hdr));
+    ASSERT_EQ(pd_store_apply(st, msg, sizeof(wh16_t)), PD_STORE_EPERM, "Delete without T_D must be refused");
+
+    hdr.ann = ANN_MCP;
+    memcpy(msg, &hdr, sizeof(hdr));
+    ASSERT_EQ(pd_store_apply(st, msg, sizeof(wh16_t)), PD_STORE_OK, "Apply delete failed");
+    ASSERT_EQ(pd_store_count(st), 0, "Store must be empty after delete");
+
+    hdr.mt = M_PING;
+    memcpy(msg, &hdr, sizeof(hdr));
+    ASSERT_EQ(pd_store_apply(st, msg, sizeof(wh16_t)), PD_STORE_EINVAL, "Non-record message must be rejected");
+
+    munmap(mem, len);
+    TEST_PASS();
+    return 1;
+}
+
+/**
+ * Test 5: Concurrent Readers
+ * Readers running against a writer never see a torn record
+ */
+#define RACE_ROUNDS  20000
+#define RACE_READERS 3
+#define RACE_BYTES   48
+
+typedef struct {
+    pd_store_t *st;
+    volatile int done;
+    long torn;
+    long reads;
+} race_t;
+
+static void *race_reader(void *arg) {
+    race_t *r = arg;
+    pd_view_t view;
+    uint8_t copy[RACE_BYTES];
+    long torn = 0, reads = 0;
+
+    while (!r->done) {
+        if (pd_store_query(r->st, RID_USER_MIN, &view) != PD_STORE_OK)
+            continue;
+        memcpy(copy, view.data, view.hdr.n);
+        if (!pd_store_view_valid(r->st, &view))
+            continue;
+        reads++;
+        for (uint32_t i = 1; i < view.hdr.n; i++)
+            if (copy[i] != copy[0] || view.hdr.cap != copy[0]) {
+                torn++;
+                break;
+            }
+    }
+    __atomic_add_fetch(&r->torn, torn, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&r->reads, reads, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+int test_concurrent_readers() {
+    TEST_START("test_concurrent_readers - Lock-Free Reads Under Writes");
+
+    size_t len = pd_store_bytes(8, RACE_BYTES);
+    void *mem = map_region(len);
+    ASSERT_TRUE(mem != NULL, "Region mapping failed");
+    pd_store_init(mem, len, 8, RACE_BYTES);
+
+    race_t race = { pd_store_attach(mem, len), 0, 0, 0 };
+    pthread_t readers[RACE_READERS];
+    uint8_t payload[RACE_BYTES];
+    wh16_t hdr = WH(M_UPSERT, K_STATE, ANN_RW, 0, RID_USER_MIN, RACE_BYTES);
+
+    for (int i = 0; i < RACE_READERS; i++)
+        pthread_create(&readers[i], NULL, race_reader, &race);
+
+    for (uint32_t round = 0; round < RACE_ROUNDS; round++) {
+        memset(payload, (int)(round & 0xFF), sizeof(payload));
+        hdr.cap = round & 0xFF;
+        pd_store_upsert(race.st, &hdr, payload);
+        if (!(round & 63))
+            sched_yield();  // let readers get between writes
+    }
+    race.done = 1;
+    for (int i = 0; i < RACE_READERS; i++)
+        pthread_join(readers[i], NULL);
+
+    ASSERT_EQ(race.torn, 0, "Validated views must never be torn");
+
+    printf("  - %d writes, %ld validated reads, %ld torn\n",
+           RACE_ROUNDS, race.reads, race.torn);
+
+    munmap(mem, len);
+    TEST_PASS();
+    return 1;
+}
+
+/**
+ * Test 6: Rid Churn
+ * Deleted records give their slot back to new rids; chains stay intact
+ */
+int test_rid_churn() {
+    TEST_START("test_rid_churn - Slot Reuse Under Rid Churn");
+
+    size_t len = pd_store_bytes(8, 16);
+    void *mem = map_region(len);
+    ASSERT_TRUE(mem != NULL, "Region mapping failed");
+    pd_store_init(mem, len, 8, 16);
+    pd_store_t *st = pd_store_attach(mem, len);
+
+    uint8_t payload[16] = {0};
+    wh16_t hdr = WH(M_UPSERT, K_STATE, ANN_RW, CAP_STANDARD, 0, 4);
+    for (uint32_t i = 0; i < 1000; i++) {
+        hdr.rid = RID_USER_MIN + i;
+        ASSERT_EQ(pd_store_upsert(st, &hdr, payload), PD_STORE_OK, "Upsert of a fresh rid failed");
+        ASSERT_EQ(pd_store_delete(st, hdr.rid), PD_STORE_OK, "Delete failed");
+    }
+    ASSERT_EQ(pd_store_count(st), 0, "Store must be empty after churn");
+
+    // Fill to capacity, then swap records out one at a time
+    for (uint32_t i = 0; i < 8; i++) {
+        hdr.rid = RID_USER_MIN + 2000 + i;
+        payload[0] = (uint8_t)i;
+        ASSERT_EQ(pd_store_upsert(st, &hdr, payload), PD_STORE_OK, "Fill after churn failed");
+    }
+    hdr.rid = RID_USER_MIN + 3000;
+    ASSERT_EQ(pd_store_upsert(st, &hdr, payload), PD_STORE_EFULL, "Ninth live record must not fit");
+
+    for (uint32_t i = 0; i < 8; i += 2) {
+        ASSERT_EQ(pd_store_delete(st, RID_USER_MIN + 2000 + i), PD_STORE_OK, "Delete of filled rid failed");
+        hdr.rid = RID_USER_MIN + 3000 + i;
+        payload[0] = (uint8_t)(0x80 + i);
+        ASSERT_EQ(pd_store_upsert(st, &hdr, payload), PD_STORE_OK, "Insert into freed slot failed");
+    }
+    ASSERT_EQ(pd_store_count(st), 8, "Count after swapping records");
+
+    wh16_t out;
+    uint8_t buf[16];
+    for (uint32_t i = 0; i < 8; i++) {
+        int odd = i & 1;
+        uint32_t rid = RID_USER_MIN + (odd ? 2000 : 3000) + i;
+
+        ASSERT_EQ(pd_store_read(st, rid, &out, buf, sizeof(buf)), PD_STORE_OK, "Surviving record lost");
+        ASSERT_EQ(buf[0], odd ? i : 0x80 + i, "Surviving record has the wrong payload");
+        ASSERT_EQ(pd_store_read(st, RID_USER_MIN + (odd ? 3000 : 2000) + i, &out, buf, sizeof(buf)),
+                  PD_STORE_ENOENT, "Deleted or never stored record found");
+    }
+
+    munmap(mem, len);
+    TEST_PASS();
+    return 1;
+}
+
+/**
+ * Test 7: Concurrent Churn
+ * Writers inserting and deleting their own rids never lose or duplicate one
+ */
+#define CHURN_WRITERS 4
+#define CHURN_ROUNDS  20000
+
+typedef struct {
+    pd_store_t *st;
+    uint32_t    base;
+    long        errors;
+} churn_t;
+
+static void *churn_writer(void *arg) {
+    churn_t *c = arg;
+    wh16_t hdr = WH(M_UPSERT, K_STATE, ANN_RW, CAP_STANDARD, 0, 4);
+    uint32_t v, out_v;
+    wh16_t out;
+
+    for (uint32_t i = 0; i < CHURN_ROUNDS; i++) {
+        hdr.rid = c->base + (i % 64);
+        v = i;
+        if (pd_store_upsert(c->st, &hdr, &v) != PD_STORE_OK ||
+            pd_store_read(c->st, hdr.rid, &out, &out_v, sizeof(out_v)) != PD_STORE_OK ||
+            out_v != i || pd_store_delete(c->st, hdr.rid) != PD_STORE_OK ||
+            pd_store_delete(c->st, hdr.rid) != PD_STORE_ENOENT)
+            c->errors++;
+    }
+    return NULL;
+}
+
+int test_concurrent_churn() {
+    TEST_START("test_concurrent_churn - Slot Reuse With Concurrent Writers");
+
+    // Room for one live record per writer, plus some slack
+    size_t len = pd_store_bytes(8, 16);
+    void *mem = map_region(len);
+    ASSERT_TRUE(mem != NULL, "Region mapping failed");
+    pd_store_init(mem, len, 8, 16);
+    pd_store_t *st = pd_store_attach(mem, len);
+
+    churn_t churn[CHURN_WRITERS];
+    pthread_t writers[CHURN_WRITERS];
+    long errors = 0;
+
+    for (int i = 0; i < CHURN_WRITERS; i++) {
+        churn[i] = (churn_t){ st, RID_USER_MIN + 1000u * i, 0 };
+        pthread_create(&writers[i], NULL, churn_writer, &churn[i]);
+    }
+    for (int i = 0; i < CHURN_WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+        errors += churn[i].errors;
+    }
+
+    ASSERT_EQ(errors, 0, "Every insert, read and delete must succeed");
+    ASSERT_EQ(pd_store_count(st), 0, "Store must be empty after churn");
+
+    printf("  - %d writers x %d insert/delete rounds over 8 slots\n",
+           CHURN_WRITERS, CHURN_ROUNDS);
+
+    munmap(mem, len);
+    TEST_PASS();
+    return 1;
+}
+
+// ============================================================================
+// Test Runner
+// ============================================================================
+
+int main(void) {
+    printf("==========================================================\n");
+    printf("PD_AI Shared Record Store Test Suite\n");
+    printf("==========================================================\n");
+
+    // Run all tests
+    test_layout();
+    test_upsert_query();
+    test_delete_capacity();
+    test_apply_messages();
+    test_concurrent_readers();
+    test_rid_churn();
+    test_concurrent_churn();
+
+    // Print summary
+    printf("\n==========================================================\n");
+    printf("Test Summary\n");
+    printf("==========================================================\n");
+    printf("Tests run:    %d\n", tests_run);
+    printf("Tests passed: %d\n", tests_passed);
+    printf("Tests failed: %d\n", tests_run - tests_passed);
+
+    if (tests_passed == tests_run) {
+        printf("\n✓✓✓ ALL TESTS PASSED ✓✓✓\n");
+        return 0;
+    } else {
+        printf("\n✗✗✗ SOME TESTS FAILED ✗✗✗\n");
+        return 1;
+    }
+}
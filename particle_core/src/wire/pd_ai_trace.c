@@ -0,0 +1,211 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include "PD_AI_trace.h"
+
+/**
+ * PD_AI Trace Spans
+ * Multi-producer ring of finished spans with per-entry sequence words
+ *
+ * Writers claim a position by bumping head and then own ring entry
+ * pos & (nspans - 1). An entry's sequence word is 2*pos+1 while position
+ * pos is being written and 2*pos+2 once it is complete, so a reader can
+ * tell a finished span from one in progress or one already overwritten
+ * by a later lap of the ring. Old spans are overwritten, never waited
+ * for: tracing must not slow down the work it measures.
+ */
+
+// ============================================================================
+// Region Layout
+// ============================================================================
+
+#define PD_TRACE_HDR_BYTES  64u
+#define PD_TRACE_ALIGN      64u
+
+struct pd_trace {
+    uint32_t         magic;      // PD_TRACE_MAGIC
+    uint32_t         version;    // PD_TRACE_VERSION
+    uint32_t         nspans;     // power of two
+    uint32_t         reserved;
+    _Atomic uint64_t head;       // positions handed out so far
+};
+
+typedef struct {
+    _Atomic uint64_t seq;        // 0 = empty, 2*pos+1 writing, 2*pos+2 done
+    uint64_t         pad[7];     // keep the span on its own cache line
+    pd_span_t        span;
+} pd_trace_entry_t;
+
+static uint32_t round_pow2(uint32_t v) {
+    uint32_t p = 1;
+
+    while (p < v && p < 0x80000000u)
+        p <<= 1;
+    return p;
+}
+
+static pd_trace_entry_t *entry_at(const pd_trace_t *tr, uint64_t pos) {
+    return (pd_trace_entry_t *)((uint8_t *)tr + PD_TRACE_HDR_BYTES) +
+           (pos & (tr->nspans - 1));
+}
+
+size_t pd_trace_bytes(uint32_t nspans) {
+    if (!nspans)
+        return 0;
+    nspans = round_pow2(nspans);
+#if SIZE_MAX <= UINT32_MAX
+    if ((SIZE_MAX - PD_TRACE_HDR_BYTES) / sizeof(pd_trace_entry_t) < nspans)
+        return 0;
+#endif
+    return PD_TRACE_HDR_BYTES + (size_t)nspans * sizeof(pd_trace_entry_t);
+}
+
+int pd_trace_init(void *mem, size_t len, uint32_t nspans) {
+    size_t need = pd_trace_bytes(nspans);
+    pd_trace_t *tr = mem;
+
+    if (!mem || !need || len < need || ((uintptr_t)mem % PD_TRACE_ALIGN))
+        return -1;
+
+    memset(mem, 0, need);
+    tr->nspans = round_pow2(nspans);
+    tr->version = PD_TRACE_VERSION;
+
+    // Publish the magic last so attachers never see a half-built header
+    atomic_thread_fence(memory_order_release);
+    tr->magic = PD_TRACE_MAGIC;
+    return 0;
+}
+
+pd_trace_t *pd_trace_attach(void *mem, size_t len) {
+    pd_trace_t *tr = mem;
+
+    if (!mem || len < PD_TRACE_HDR_BYTES || ((uintptr_t)mem % PD_TRACE_ALIGN))
+        return NULL;
+    if (tr->magic != PD_TRACE_MAGIC || tr->version != PD_TRACE_VERSION)
+        return NULL;
+    atomic_thread_fence(memory_order_acquire);
+    if (!tr->nspans || (tr->nspans & (tr->nspans - 1)) ||
+        len < pd_trace_bytes(tr->nspans))
+        return NULL;
+    return tr;
+}
+
+// ============================================================================
+// Span Lifecycle
+// ============================================================================
+
+uint64_t pd_trace_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void pd_span_queue(pd_span_t *span, uint32_t op,
+                   uint64_t async_id, uint64_t trigger_id) {
+    memset(span, 0, sizeof(*span));
+    span->op = op;
+    span->async_id = async_id;
+    span->trigger_id = trigger_id;
+    span->t_queue = pd_trace_now();
+}
+
+void pd_span_start(pd_span_t *span, uint32_t thread) {
+    span->thread = thread;
+    span->t_start = pd_trace_now();
+}
+
+void pd_span_end(pd_trace_t *tr, pd_span_t *span, int32_t status,
+                 uint64_t bytes) {
+    pd_trace_entry_t *e;
+    uint64_t pos, cur, mine;
+
+    span->status = status;
+    span->bytes = bytes;
+    span->t_end = pd_trace_now();
+    if (!span->t_start)
+        span->t_start = span->t_end;  // executed inline, never queued
+    if (!tr)
+        return;
+
+    pos = atomic_fetch_add_explicit(&tr->head, 1, memory_order_relaxed);
+    e = entry_at(tr, pos);
+    mine = 2 * pos + 1;
+
+    cur = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    for (;;) {
+        if (cur >= mine) {
+            // A writer one lap ahead already owns the entry; readers
+            // see the newer sequence and count this span as dropped
+            return;
+        }
+        if (cur & 1) {
+            // Only if the ring wrapped during a single write
+            sched_yield();
+            cur = atomic_load_explicit(&e->seq, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&e->seq, &cur, mine,
+                                                  memory_order_acquire,
+                                                  memory_order_relaxed))
+            break;
+    }
+    e->span = *span;
+    atomic_store_explicit(&e->seq, mine + 1, memory_order_release);
+}
+
+// ============================================================================
+// Reading
+// ============================================================================
+
+size_t pd_trace_read(const pd_trace_t *tr, uint64_t *cursor,
+                     pd_span_t *out, size_t max, uint64_t *dropped) {
+    uint64_t head, pos, lost = 0;
+    size_t count = 0;
+
+    if (!tr || !cursor || (max && !out))
+        return 0;
+
+    head = atomic_load_explicit(&tr->head, memory_order_acquire);
+    pos = *cursor;
+    if (pos > head)
+        pos = head;
+    if (head - pos > tr->nspans) {
+        lost += head - pos - tr->nspans;
+        pos = head - tr->nspans;
+    }
+
+    while (pos < head && count < max) {
+        pd_trace_entry_t *e = entry_at(tr, pos);
+        uint64_t done = 2 * pos + 2;
+        uint64_t s1 = atomic_load_explicit(&e->seq, memory_order_acquire);
+
+        if (s1 < done)
+            break;  // still being written; pick it up next time
+        if (s1 == done) {
+            out[count] = e->span;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&e->seq, memory_order_relaxed) == done) {
+                count++;
+                pos++;
+                continue;
+            }
+        }
+        // Overwritten by a later lap before we got to it
+        lost++;
+        pos++;
+    }
+
+    *cursor = pos;
+    if (dropped)
+        *dropped += lost;
+    return count;
+}
+
+uint64_t pd_trace_head(const pd_trace_t *tr) {
+    return tr ? atomic_load_explicit(&tr->head, memory_order_relaxed) : 0;
+}
@@ -0,0 +1,274 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "PD_AI_trace.h"
+
+/**
+ * PD_AI Trace Span Test Suite
+ * Tests for span timing, context propagation and the span ring
+ */
+
+// Test counters
+static int tests_run = 0;
+static int tests_passed = 0;
+
+// Test helper macros
+#define TEST_START(name) \
+    do { \
+        printf("\n[TEST] %s\n", name); \
+        tests_run++; \
+    } while(0)
+
+#define TEST_PASS() \
+    do { \
+        tests_passed++; \
+        printf("  ✓ PASSED\n"); \
+    } while(0)
+
+#define ASSERT_EQ(a, b, msg) \
+    do { \
+        if ((a) != (b)) { \
+            printf("  ✗ FAILED: %s (expected %d, got %d)\n", msg, (int)(b), (int)(a)); \
+            return 0; \
+        } \
+    } while(0)
+
+#define ASSERT_TRUE(cond, msg) \
+    do { \
+        if (!(cond)) { \
+            printf("  ✗ FAILED: %s\n", msg); \
+            return 0; \
+        } \
+    } while(0)
+
+/**
+ * Allocate a formatted ring of nspans spans
+ */
+static pd_trace_t *make_ring(uint32_t nspans, void **mem) {
+    size_t len = pd_trace_bytes(nspans);
+
+    *mem = aligned_alloc(64, len);
+    if (!*mem || pd_trace_init(*mem, len, nspans) != 0)
+        return NULL;
+    return pd_trace_attach(*mem, len);
+}
+
+// ============================================================================
+// Test Functions
+// ============================================================================
+
+/**
+ * Test 1: Span Layout
+ * Verify span size and ring formatting
+ */
+int test_layout() {
+    TEST_START("test_layout - Span and Ring Layout");
+
+    ASSERT_EQ(sizeof(pd_span_t), 64, "Span must fill one cache line");
+    ASSERT_EQ(pd_trace_bytes(0), 0, "Zero spans must be rejected");
+    ASSERT_EQ(pd_trace_bytes(100), pd_trace_bytes(128), "Span count must round to a power of two");
+
+    size_t len = pd_trace_bytes(16);
+    void *mem = aligned_alloc(64, len);
+    ASSERT_TRUE(mem != NULL, "Allocation failed");
+    memset(mem, 0, len);
+    ASSERT_TRUE(pd_trace_attach(mem, len) == NULL, "Unformatted region must not attach");
+    ASSERT_EQ(pd_trace_init(mem, len - 1, 16), -1, "Short region must be rejected");
+    ASSERT_EQ(pd_trace_init(mem, len, 16), 0, "Init failed");
+    ASSERT_TRUE(pd_trace_attach(mem, len) != NULL, "Attach failed");
+    ASSERT_EQ(pd_trace_head(pd_trace_attach(mem, len)), 0, "New ring must be empty");
+
+    printf("  - Ring size for 16 spans: %zu bytes\n", len);
+
+    free(mem);
+    TEST_PASS();
+    return 1;
+}
+
+/**
+ * Test 2: Span Lifecycle
+ * Queue, start and end times are ordered and context is kept
+ */
+int test_lifecycle() {
+    TEST_START("test_lifecycle - Queue/Start/End Timing");
+
+    void *mem;
+    pd_trace_t *tr = make_ring(8, &mem);
+    ASSERT_TRUE(tr != NULL, "Ring setup failed");
+
+    pd_span_t span, out[4];
+    pd_span_queue(&span, PD_SPAN_DIFF, 42, 7);
+    pd_span_start(&span, 3);
+    pd_span_end(tr, &span, 0, 4096);
+
+    pd_span_queue(&span, M_UPSERT, 43, 42);
+    pd_span_end(tr, &span, -1, 16);
+
+    uint64_t cursor = 0, dropped = 0;
+    ASSERT_EQ(pd_trace_read(tr, &cursor, out, 4, &dropped), 2, "Two spans expected");
+    ASSERT_EQ(cursor, 2, "Cursor must advance past both spans");
+    ASSERT_EQ(dropped, 0, "Nothing may be dropped");
+
+    ASSERT_EQ(out[0].op, PD_SPAN_DIFF, "Operation mismatch");
+    ASSERT_EQ(out[0].async_id, 42, "Async id mismatch");
+    ASSERT_EQ(out[0].trigger_id, 7, "Trigger id mismatch");
+    ASSERT_EQ(out[0].thread, 3, "Worker id mismatch");
+    ASSERT_EQ(out[0].bytes, 4096, "Byte count mismatch");
+    ASSERT_TRUE(out[0].t_queue <= out[0].t_start && out[0].t_start <= out[0].t_end,
+                "Timestamps must be ordered");
+
+    ASSERT_EQ(out[1].op, M_UPSERT, "Wire operation mismatch");
+    ASSERT_EQ(out[1].status, -1, "Status mismatch");
+    ASSERT_TRUE(out[1].t_start == out[1].t_end, "Inline span starts when it ends");
+
+    ASSERT_EQ(pd_trace_read(tr, &cursor, out, 4, &dropped), 0, "Ring must be drained");
+
+    printf("  - Queue wait %llu ns, execute %llu ns\n",
+           (unsigned long long)(out[0].t_start - out[0].t_queue),
+           (unsigned long long)(out[0].t_end - out[0].t_start));
+
+    free(mem);
+    TEST_PASS();
+    return 1;
+}
+
+/**
+ * Test 3: Overwrite Accounting
+ * A slow reader loses the oldest spans and is told how many
+ */
+int test_overwrite() {
+    TEST_START("test_overwrite - Lapped Reader Accounting");
+
+    void *mem;
+    pd_trace_t *tr = make_ring(4, &mem);
+    ASSERT_TRUE(tr != NULL, "Ring setup failed");
+
+    pd_span_t span, out[8];
+    for (uint64_t i = 1; i <= 10; i++) {
+        pd_span_queue(&span, PD_SPAN_MERGE, i, 0);
+        pd_span_end(tr, &span, 0, 0);
+    }
+
+    uint64_t cursor = 0, dropped = 0;
+    ASSERT_EQ(pd_trace_read(tr, &cursor, out, 2, &dropped), 2, "Partial read size");
+    ASSERT_EQ(dropped, 6, "Six spans were overwritten");
+    ASSERT_EQ(out[0].async_id, 7, "Oldest surviving span");
+    ASSERT_EQ(out[1].async_id, 8, "Next surviving span");
+
+    ASSERT_EQ(pd_trace_read(tr, &cursor, out, 8, &dropped), 2, "Remaining spans");
+    ASSERT_EQ(out[1].async_id, 10, "Newest span");
+    ASSERT_EQ(cursor, pd_trace_head(tr), "Reader caught up");
+
+    free(mem);
+    TEST_PASS();
+    return 1;
+}
+
+/**
+ * Test 4: Concurrent Writers
+ * Every span is either read intact or reported as dropped
+ */
+#define RACE_WRITERS 4
+#define RACE_SPANS   50000
+
+typedef struct {
+    pd_trace_t *tr;
+    uint32_t    id;
+} race_writer_t;
+
+static void *race_writer(void *arg) {
+    race_writer_t *w = arg;
+    pd_span_t span;
+
+    for (uint64_t i = 0; i < RACE_SPANS; i++) {
+        uint64_t ctx = ((uint64_t)w->id << 32) | i;
+
+        pd_span_queue(&span, PD_SPAN_USER + w->id, ctx, ~ctx);
+        pd_span_start(&span, w->id);
+        pd_span_end(w->tr, &span, 0, ctx ^ 0x5A5A);
+        if (!(i & 15))
+            sched_yield();  // give the reader a chance to keep up
+    }
+    return NULL;
+}
+
+int test_concurrent_writers() {
+    TEST_START("test_concurrent_writers - Multi-Producer Ring");
+
+    void *mem;
+    pd_trace_t *tr = make_ring(256, &mem);
+    ASSERT_TRUE(tr != NULL, "Ring setup failed");
+
+    pthread_t threads[RACE_WRITERS];
+    race_writer_t writers[RACE_WRITERS];
+    for (uint32_t i = 0; i < RACE_WRITERS; i++) {
+        writers[i].tr = tr;
+        writers[i].id = i;
+        pthread_create(&threads[i], NULL, race_writer, &writers[i]);
+    }
+
+    pd_span_t out[64];
+    uint64_t cursor = 0, dropped = 0, seen = 0, torn = 0;
+    uint64_t total = (uint64_t)RACE_WRITERS * RACE_SPANS;
+
+    while (cursor < total) {
+        size_t n = pd_trace_read(tr, &cursor, out, 64, &dropped);
+
+        for (size_t i = 0; i < n; i++) {
+            uint64_t ctx = out[i].async_id;
+            if (out[i].trigger_id != ~ctx || out[i].bytes != (ctx ^ 0x5A5A) ||
+                out[i].thread != (ctx >> 32) || out[i].op != PD_SPAN_USER + out[i].thread)
+                torn++;
+        }
+        seen += n;
+    }
+    for (int i = 0; i < RACE_WRITERS; i++)
+        pthread_join(threads[i], NULL);
+
+    ASSERT_EQ(torn, 0, "Spans must never be torn");
+    ASSERT_TRUE(seen + dropped == total, "Every span is read or dropped");
+
+    printf("  - %llu spans, %llu read, %llu dropped\n",
+           (unsigned long long)total, (unsigned long long)seen,
+           (unsigned long long)dropped);
+
+    free(mem);
+    TEST_PASS();
+    return 1;
+}
+
+// ============================================================================
+// Test Runner
+// ============================================================================
+
+int main(void) {
+    printf("==========================================================\n");
+    printf("PD_AI Trace Span Test Suite\n");
+    printf("==========================================================\n");
+
+    // Run all tests
+    test_layout();
+    test_lifecycle();
+    test_overwrite();
+    test_concurrent_writers();
+
+    // Print summary
+    printf("\n==========================================================\n");
+    printf("Test Summary\n");
+    printf("==========================================================\n");
+    printf("Tests run:    %d\n", tests_run);
+    printf("Tests passed: %d\n", tests_passed);
+    printf("Tests failed: %d\n", tests_run - tests_passed);
+
+    if (tests_passed == tests_run) {
+        printf("\n✓✓✓ ALL TESTS PASSED ✓✓✓\n");
+        return 0;
+    } else {
+        printf("\n✗✗✗ SOME TESTS FAILED ✗✗✗\n");
+        return 1;
+    }
+}
@@ -333,6 +333,65 @@ int test_capabilities() {
     return 1;
 }
 
+/**
+ * Test 9: Diff Job Frames
+ * Verify diff daemon structures and a framed M_DIFF job
+ */
+int test_diff_job() {
+    TEST_START("test_diff_job - Diff Daemon Frames");
+    
+    ASSERT_EQ(sizeof(dj24_t), 24, "dj24_t size incorrect");
+    ASSERT_EQ(sizeof(hk16_t), 16, "hk16_t size incorrect");
+    ASSERT_EQ(sizeof(dr8_t), 8, "dr8_t size incorrect");
+    ASSERT_EQ(M_DIFF, 0x08, "M_DIFF value incorrect");
+    ASSERT_EQ(M_ERROR, 0x0E, "M_ERROR value incorrect");
+    ASSERT_EQ(K_DIFF, 0x70, "K_DIFF value incorrect");
+    
+    // Job header followed by both inputs
+    const char *a = "one\ntwo\n", *b = "one\n2\n";
+    dj24_t job;
+    memset(&job, 0, sizeof(job));
+    job.ctx = 3;
+    job.opt = DJ_TEXT;
+    job.len[0] = strlen(a);
+    job.len[1] = strlen(b);
+    
+    uint32_t payload_size = BYTES_JOB(job.len[0], job.len[1], job.len[2]);
+    ASSERT_EQ(payload_size, 24 + 8 + 6, "Job payload size incorrect");
+    wh16_t header = WH(M_DIFF, K_DIFF, ANN_RW, 0, RID_TEMP_MIN, payload_size);
+    
+    uint8_t *msg = (uint8_t *)malloc(MSG_SIZE(payload_size));
+    ASSERT_TRUE(msg != NULL, "Memory allocation failed");
+    memcpy(msg, &header, sizeof(wh16_t));
+    memcpy(msg + sizeof(wh16_t), &job, sizeof(job));
+    memcpy(msg + sizeof(wh16_t) + sizeof(job), a, job.len[0]);
+    memcpy(msg + sizeof(wh16_t) + sizeof(job) + job.len[0], b, job.len[1]);
+    
+    // Inputs are found from the lengths alone
+    dj24_t *read_job = (dj24_t *)(msg + sizeof(wh16_t));
+    const uint8_t *input2 = msg + sizeof(wh16_t) + sizeof(dj24_t) + read_job->len[0];
+    ASSERT_EQ(read_job->opt, DJ_TEXT, "Job options mismatch");
+    ASSERT_EQ(read_job->len[1], 6, "Second input length mismatch");
+    ASSERT_TRUE(memcmp(input2, "one\n2\n", 6) == 0, "Second input mismatch");
+    ASSERT_EQ(((wh16_t *)msg)->n, sizeof(dj24_t) + read_job->len[0] + read_job->len[1],
+              "Header size must cover job and inputs");
+    
+    // Replies
+    hk16_t hunk = {1, 1, 1, 1};
+    dr8_t done = {1, DR_CACHED};
+    ASSERT_EQ(hunk.s2 + hunk.c2, 2, "Hunk range incorrect");
+    ASSERT_TRUE((done.flags & DR_CACHED) != 0, "DR_CACHED lost");
+    ASSERT_TRUE(DE_PROTO != 0 && DE_FAILED != DE_NOMEM, "Error codes must be distinct");
+    
+    printf("  - M_DIFF message: %zu bytes (job %zu + inputs %u)\n",
+           MSG_SIZE(payload_size), sizeof(dj24_t), job.len[0] + job.len[1]);
+    printf("  - Replies: hk16_t=%zu dr8_t=%zu bytes\n", sizeof(hk16_t), sizeof(dr8_t));
+    
+    free(msg);
+    TEST_PASS();
+    return 1;
+}
+
 // ============================================================================
 // Test Runner
 // ============================================================================
@@ -351,6 +410,7 @@ int main(void) {
     test_id_ranges();
     test_message_types();
     test_capabilities();
+    test_diff_job();
     
     // Print summary
     printf("\n==========================================================\n");
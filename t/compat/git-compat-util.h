@@ -0,0 +1,108 @@
+/*
+ * The few helpers of git's git-compat-util.h that the xdiff sources and
+ * the diff-daemon programs use, so that the tests can build them on
+ * their own. Nothing here is used when building inside git.
+ */
+#ifndef GIT_COMPAT_UTIL_H
+#define GIT_COMPAT_UTIL_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+#define UNUSED __attribute__((unused))
+#define NORETURN __attribute__((noreturn))
+#define BUG(...) (fprintf(stderr, "BUG: " __VA_ARGS__), abort())
+#define FREE_AND_NULL(p) do { free(p); (p) = NULL; } while (0)
+#define QSORT(base, n, compar) qsort((base), (n), sizeof(*(base)), compar)
+#define signed_add_overflows(a, b) ((b) > LONG_MAX - (a))
+
+static inline void *xmalloc(size_t size)
+{
+	void *p = malloc(size ? size : 1);
+
+	if (!p)
+		abort();
+	return p;
+}
+
+static inline void *xcalloc(size_t nmemb, size_t size)
+{
+	void *p = calloc(nmemb ? nmemb : 1, size ? size : 1);
+
+	if (!p)
+		abort();
+	return p;
+}
+
+static inline void *xrealloc(void *ptr, size_t size)
+{
+	void *p = realloc(ptr, size ? size : 1);
+
+	if (!p)
+		abort();
+	return p;
+}
+
+static inline int starts_with(const char *str, const char *prefix)
+{
+	return !strncmp(str, prefix, strlen(prefix));
+}
+
+__attribute__((format (printf, 1, 2)))
+static inline char *xstrfmt(const char *fmt, ...)
+{
+	va_list ap;
+	char *buf;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	buf = (char *)xmalloc(len + 1);
+	va_start(ap, fmt);
+	vsnprintf(buf, len + 1, fmt, ap);
+	va_end(ap);
+	return buf;
+}
+
+static inline int regexec_buf(const regex_t *preg, const char *buf, size_t size,
+			      size_t nmatch, regmatch_t pmatch[], int eflags)
+{
+	char *str = strndup(buf, size);
+	int ret;
+
+	if (!str)
+		abort();
+	ret = regexec(preg, str, nmatch, pmatch, eflags);
+	free(str);
+	return ret;
+}
+
+#endif /* GIT_COMPAT_UTIL_H */
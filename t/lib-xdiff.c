@@ -0,0 +1,472 @@
+#include "lib-xdiff.h"
+
+struct t_line {
+	char const *ptr;
+	long size;	/* without the newline */
+};
+
+uint64_t t_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+mmfile_t t_file_str(char const *s)
+{
+	mmfile_t mf;
+
+	mf.ptr = (char *)s;
+	mf.size = strlen(s);
+	return mf;
+}
+
+struct t_text {
+	char *ptr;
+	long size, alloc;
+};
+
+static void text_add(struct t_text *t, char const *p, long n)
+{
+	if (t->size + n + 1 > t->alloc) {
+		t->alloc = (t->size + n + 1) * 2;
+		t->ptr = xrealloc(t->ptr, t->alloc);
+	}
+	memcpy(t->ptr + t->size, p, n);
+	t->size += n;
+	t->ptr[t->size] = '\0';
+}
+
+static void text_line(struct t_text *t, char const *fmt, uint64_t n)
+{
+	char buf[64];
+	int len = snprintf(buf, sizeof(buf), fmt, n);
+
+	text_add(t, buf, len);
+}
+
+void t_file_gen(mmfile_t *mf, uint64_t *seed, long nlines, long vocab)
+{
+	struct t_text t = { 0 };
+	long i;
+
+	text_add(&t, "", 0);
+	for (i = 0; i < nlines; i++)
+		text_line(&t, "line %"PRIu64"\n",
+			  vocab ? t_rand(seed) % vocab : (uint64_t)i);
+	mf->ptr = t.ptr;
+	mf->size = t.size;
+}
+
+static long split_lines(mmfile_t const *mf, struct t_line **lines)
+{
+	long n = 0, alloc = 16;
+	char const *p = mf->ptr, *end = mf->ptr + mf->size, *eol;
+
+	*lines = xmalloc(alloc * sizeof(**lines));
+	while (p < end) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		if (n == alloc) {
+			alloc *= 2;
+			*lines = xrealloc(*lines, alloc * sizeof(**lines));
+		}
+		(*lines)[n].ptr = p;
+		(*lines)[n].size = eol - p;
+		n++;
+		p = eol + 1;
+	}
+	return n;
+}
+
+void t_file_edit(mmfile_t *out, mmfile_t const *in, uint64_t *seed,
+		 long nedits)
+{
+	struct t_line *l;
+	long n = split_lines(in, &l), i, j, k;
+	unsigned char *op = xcalloc(n + 1, 1);	/* 1 delete, 2 replace */
+	long *ins = xcalloc(n + 1, sizeof(*ins));
+	struct t_text t = { 0 };
+	static uint64_t fresh;
+
+	for (k = 0; k < nedits; k++) {
+		long at = t_rand(seed) % (n + 1), len = 1 + t_rand(seed) % 3;
+		int kind = t_rand(seed) % 3;
+
+		if (kind == 0 || at == n)
+			ins[at] += len;
+		else
+			for (j = at; j < n && j < at + len; j++)
+				op[j] = kind;
+	}
+	text_add(&t, "", 0);
+	for (i = 0; i <= n; i++) {
+		for (j = 0; j < ins[i]; j++)
+			text_line(&t, "new %"PRIu64"\n", fresh++);
+		if (i == n)
+			break;
+		if (op[i] == 2)
+			text_line(&t, "changed %"PRIu64"\n", fresh++);
+		else if (!op[i]) {
+			text_add(&t, l[i].ptr, l[i].size);
+			text_add(&t, "\n", 1);
+		}
+	}
+	free(l);
+	free(op);
+	free(ins);
+	out->ptr = t.ptr;
+	out->size = t.size;
+}
+
+void t_file_free(mmfile_t *mf)
+{
+	FREE_AND_NULL(mf->ptr);
+	mf->size = 0;
+}
+
+/*
+ * One step of xdl_hash_bytes() and its inverse in the word hashed:
+ * each step is a bijection of the state, so any word of a block can
+ * be changed and the next one chosen to bring the state back.
+ */
+#define H_MUL1 0xff51afd7ed558ccdULL
+#define H_MUL2 0xc4ceb9fe1a85ec53ULL
+
+static uint64_t h_step(uint64_t ha, uint64_t w)
+{
+	ha = (ha ^ (w * H_MUL1)) * H_MUL2;
+	return ha ^ (ha >> 29);
+}
+
+static uint64_t h_inverse(uint64_t odd)
+{
+	uint64_t inv = odd;
+	int i;
+
+	for (i = 0; i < 5; i++)
+		inv *= 2 - odd * inv;
+	return inv;
+}
+
+static uint64_t h_solve(uint64_t ha, uint64_t target)
+{
+	uint64_t x = target ^ (target >> 29) ^ (target >> 58);
+
+	return ((x * h_inverse(H_MUL2)) ^ ha) * h_inverse(H_MUL1);
+}
+
+void t_file_collide(mmfile_t *out, mmfile_t const *in)
+{
+	uint64_t ha = 0x9e3779b97f4a7c15ULL ^ (uint64_t)in->size, w, next;
+	size_t k = (in->size / 16) * 8, i;
+
+	if (in->size < 24)
+		BUG("t_file_collide() needs 24 bytes");
+	out->size = in->size;
+	out->ptr = xmalloc(out->size);
+	memcpy(out->ptr, in->ptr, out->size);
+	for (i = 0; i < k; i += 8) {
+		memcpy(&w, out->ptr + i, 8);
+		ha = h_step(ha, w);
+	}
+	memcpy(&w, out->ptr + k, 8);
+	memcpy(&next, out->ptr + k + 8, 8);
+	next = h_step(h_step(ha, w), next);
+	memcpy(out->ptr + k, "changed\n", 8);
+	memcpy(&w, out->ptr + k, 8);
+	w = h_solve(h_step(ha, w), next);
+	memcpy(out->ptr + k + 8, &w, 8);
+}
+
+void t_file_read(mmfile_t *mf, char const *path)
+{
+	struct t_text t = { 0 };
+	char buf[8192];
+	size_t n;
+	FILE *fp = fopen(path, "rb");
+
+	if (!fp)
+		BUG("cannot open %s: %s", path, strerror(errno));
+	text_add(&t, "", 0);
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		text_add(&t, buf, n);
+	fclose(fp);
+	mf->ptr = t.ptr;
+	mf->size = t.size;
+}
+
+void t_file_write(char const *path, char const *data, long size)
+{
+	FILE *fp = fopen(path, "wb");
+
+	if (!fp || fwrite(data, 1, size, fp) != (size_t)size || fclose(fp))
+		BUG("cannot write %s: %s", path, strerror(errno));
+}
+
+char const *t_trash_dir(char const *name)
+{
+	static char path[PATH_MAX];
+	char cmd[PATH_MAX + 16];
+
+	snprintf(path, sizeof(path), "trash/%s", name);
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", path);
+	if (system(cmd) || (mkdir("trash", 0777) && errno != EEXIST) ||
+	    mkdir(path, 0777))
+		BUG("cannot make %s: %s", path, strerror(errno));
+	return path;
+}
+
+int t_diff(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp, long ctxlen,
+	   xdoutbuf_t *ob)
+{
+	xdemitconf_t xecfg = { 0 };
+	xdemitcb_t ecb = { 0 };
+
+	if (xdl_outbuf_init(ob, 0, (size_t)1 << 32) < 0)
+		return -1;
+	xecfg.ctxlen = ctxlen;
+	ecb.priv = ob;
+	ecb.out_line = xdl_outbuf_out_line;
+	return xdl_diff(a, b, xpp, &xecfg, &ecb);
+}
+
+static int count_hunk(long start_a UNUSED, long count_a,
+		      long start_b UNUSED, long count_b, void *priv)
+{
+	*(long *)priv += count_a + count_b;
+	return 0;
+}
+
+long t_changed(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp)
+{
+	xdemitconf_t xecfg = { 0 };
+	xdemitcb_t ecb = { 0 };
+	long n = 0;
+
+	xecfg.hunk_func = count_hunk;
+	ecb.priv = &n;
+	return xdl_diff(a, b, xpp, &xecfg, &ecb) < 0 ? -1 : n;
+}
+
+static int same_line(struct t_line const *l, char const *p, long n)
+{
+	return l->size == n && !memcmp(l->ptr, p, n);
+}
+
+static int left_out(struct t_line const *l, unsigned flags, regex_t const *re)
+{
+	return (!l->size && (flags & T_APPLY_IGNORE_BLANK)) ||
+		(re && !regexec_buf(re, l->ptr, l->size, 0, NULL, 0));
+}
+
+static int compare_result(struct t_text const *out, mmfile_t const *b,
+			  unsigned flags, regex_t const *re)
+{
+	mmfile_t r = { out->ptr, out->size };
+	struct t_line *lr, *lb;
+	long nr, nb, i = 0, j = 0;
+	int ret = 0;
+
+	if (!(flags & T_APPLY_IGNORE_BLANK) && !re) {
+		if (r.size == b->size && !memcmp(r.ptr, b->ptr, r.size))
+			return 0;
+		test_msg("patch applied, but does not give the new file");
+		return -1;
+	}
+	nr = split_lines(&r, &lr);
+	nb = split_lines(b, &lb);
+	for (;;) {
+		while (i < nr && left_out(&lr[i], flags, re))
+			i++;
+		while (j < nb && left_out(&lb[j], flags, re))
+			j++;
+		if (i == nr || j == nb)
+			break;
+		if (!same_line(&lr[i], lb[j].ptr, lb[j].size))
+			break;
+		i++, j++;
+	}
+	if (i < nr || j < nb) {
+		test_msg("patched line %ld differs from new line %ld", i + 1, j + 1);
+		ret = -1;
+	}
+	free(lr);
+	free(lb);
+	return ret;
+}
+
+static void copy_old(struct t_text *out, mmfile_t const *a,
+		     struct t_line const *la, long i, long na)
+{
+	text_add(out, la[i].ptr, la[i].size);
+	if (i < na - 1 || a->ptr[a->size - 1] == '\n')
+		text_add(out, "\n", 1);
+}
+
+int t_apply_ignoring(mmfile_t const *a, mmfile_t const *b, char const *patch,
+		     size_t size, unsigned flags, regex_t const *re)
+{
+	mmfile_t p = { (char *)patch, (long)size };
+	struct t_line *la, *lp;
+	long na = split_lines(a, &la), np = split_lines(&p, &lp);
+	long ai = 0, i = 0, s1, c1, s2, c2;
+	struct t_text out = { 0 };
+	int ret = -1, last = 0;
+
+	text_add(&out, "", 0);
+	while (i < np) {
+		char const *l = lp[i].ptr;
+
+		if (sscanf(l, "@@ -%ld,%ld +%ld,%ld @@", &s1, &c1, &s2, &c2) != 4) {
+			c1 = 1;
+			if (sscanf(l, "@@ -%ld +", &s1) != 1 &&
+			    sscanf(l, "@@ -%ld,%ld +", &s1, &c1) != 2) {
+				test_msg("bad patch line %ld: %.*s", i + 1,
+					 (int)lp[i].size, l);
+				goto out;
+			}
+		}
+		if (!c1)
+			s1++;
+		if (s1 - 1 < ai || s1 - 1 > na) {
+			test_msg("hunk at patch line %ld out of order", i + 1);
+			goto out;
+		}
+		for (; ai < s1 - 1; ai++)
+			copy_old(&out, a, la, ai, na);
+		for (i++; i < np && lp[i].ptr[0] != '@'; i++) {
+			char const *body = lp[i].ptr + 1;
+			long n = lp[i].size - 1;
+
+			switch (lp[i].ptr[0]) {
+			case '\\':
+				/* "\ No newline at end of file" */
+				if (last && out.size && out.ptr[out.size - 1] == '\n')
+					out.ptr[--out.size] = '\0';
+				continue;
+			case ' ':
+			case '-':
+				if (ai == na || !same_line(&la[ai], body, n)) {
+					test_msg("patch line %ld does not match old line %ld",
+						 i + 1, ai + 1);
+					goto out;
+				}
+				ai++;
+				last = lp[i].ptr[0] == ' ';
+				if (last)
+					break;
+				continue;
+			case '+':
+				last = 1;
+				break;
+			default:
+				test_msg("bad patch line %ld: %.*s", i + 1,
+					 (int)lp[i].size, lp[i].ptr);
+				goto out;
+			}
+			text_add(&out, body, n);
+			text_add(&out, "\n", 1);
+		}
+	}
+	for (; ai < na; ai++)
+		copy_old(&out, a, la, ai, na);
+	ret = compare_result(&out, b, flags, re);
+out:
+	free(la);
+	free(lp);
+	free(out.ptr);
+	return ret;
+}
+
+int t_apply(mmfile_t const *a, mmfile_t const *b, char const *patch,
+	    size_t size, unsigned flags)
+{
+	return t_apply_ignoring(a, b, patch, size, flags, NULL);
+}
+
+int t_diff_applies(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp)
+{
+	xdoutbuf_t ob;
+	int ret;
+
+	if (t_diff(a, b, xpp, 3, &ob) < 0) {
+		test_msg("xdl_diff() failed");
+		return 0;
+	}
+	ret = !t_apply(a, b, ob.ptr, ob.size, 0);
+	xdl_outbuf_release(&ob);
+	return ret;
+}
+
+int t_same_diff(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp1,
+		xpparam_t const *xpp2)
+{
+	xdoutbuf_t ob1, ob2;
+	size_t i;
+	int ret = 0;
+
+	if (t_diff(a, b, xpp1, 3, &ob1) < 0) {
+		test_msg("xdl_diff() failed");
+		return 0;
+	}
+	if (t_diff(a, b, xpp2, 3, &ob2) < 0) {
+		test_msg("xdl_diff() failed");
+		xdl_outbuf_release(&ob1);
+		return 0;
+	}
+	for (i = 0; i < ob1.size && i < ob2.size && ob1.ptr[i] == ob2.ptr[i]; i++)
+		;
+	if (i == ob1.size && i == ob2.size)
+		ret = 1;
+	else
+		test_msg("diffs differ at byte %"PRIuMAX" (sizes %"PRIuMAX
+			 " and %"PRIuMAX")", (uintmax_t)i,
+			 (uintmax_t)ob1.size, (uintmax_t)ob2.size);
+	xdl_outbuf_release(&ob1);
+	xdl_outbuf_release(&ob2);
+	return ret;
+}
+
+uint64_t t_hash(char const *p, size_t n)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (n--)
+		h = (h ^ (unsigned char)*p++) * 0x100000001b3ULL;
+	return h;
+}
+
+long t_edit_distance(mmfile_t const *a, mmfile_t const *b)
+{
+	struct t_line *la, *lb;
+	long n = split_lines(a, &la), m = split_lines(b, &lb);
+	long max = n + m, d, k, x, y, *v;
+
+	v = xcalloc(2 * max + 3, sizeof(*v));
+	v += max + 1;
+	for (d = 0; d <= max; d++) {
+		for (k = -d; k <= d; k += 2) {
+			if (k == -d || (k != d && v[k - 1] < v[k + 1]))
+				x = v[k + 1];
+			else
+				x = v[k - 1] + 1;
+			for (y = x - k; x < n && y < m &&
+			     same_line(&la[x], lb[y].ptr, lb[y].size); x++, y++)
+				;
+			v[k] = x;
+			if (x >= n && y >= m)
+				goto done;
+		}
+	}
+done:
+	free(v - (max + 1));
+	free(la);
+	free(lb);
+	return d;
+}
@@ -0,0 +1,83 @@
+#ifndef LIB_XDIFF_H
+#define LIB_XDIFF_H
+
+#include "test-lib.h"
+#include "xdiff.h"
+
+/*
+ * Inputs and oracles shared by the xdiff tests. Generated files are
+ * deterministic in the seed, so a failure reproduces from the test
+ * description alone.
+ */
+
+/* xorshift64*; *state must not be 0 */
+uint64_t t_rand(uint64_t *state);
+
+/* Wrap a NUL-terminated string, without copying it. */
+mmfile_t t_file_str(char const *s);
+
+/*
+ * nlines lines drawn from vocab distinct ones ("line 17\n"), or all
+ * different when vocab is 0.
+ */
+void t_file_gen(mmfile_t *mf, uint64_t *seed, long nlines, long vocab);
+
+/*
+ * A copy of in with nedits random edits: runs of one to three lines
+ * deleted, inserted or replaced. Inserted lines appear nowhere else.
+ */
+void t_file_edit(mmfile_t *out, mmfile_t const *in, uint64_t *seed,
+		 long nedits);
+
+void t_file_free(mmfile_t *mf);
+
+/*
+ * A copy of in that differs from it in two words near the middle but
+ * has the same xdl_hash_bytes(); in must be at least 24 bytes.
+ */
+void t_file_collide(mmfile_t *out, mmfile_t const *in);
+
+/* Read or write a whole file, dying on errors. */
+void t_file_read(mmfile_t *mf, char const *path);
+void t_file_write(char const *path, char const *data, long size);
+
+/* An empty directory trash/<name> for the test to write into. */
+char const *t_trash_dir(char const *name);
+
+/* Unified diff of a and b into ob, which this initialises. */
+int t_diff(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp, long ctxlen,
+	   xdoutbuf_t *ob);
+
+/* Lines xdl_diff() reports as changed on both sides, or -1. */
+long t_changed(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp);
+
+/*
+ * Apply a unified diff to a and compare the result with b. Returns 0
+ * if it applies cleanly and gives b, otherwise describes the first
+ * problem with test_msg() and returns -1.
+ */
+#define T_APPLY_IGNORE_BLANK 1	/* compare leaving blank lines out */
+int t_apply(mmfile_t const *a, mmfile_t const *b, char const *patch,
+	    size_t size, unsigned flags);
+
+/* t_apply(), also leaving out the lines re matches when comparing. */
+int t_apply_ignoring(mmfile_t const *a, mmfile_t const *b, char const *patch,
+		     size_t size, unsigned flags, regex_t const *re);
+
+/* Diff a and b with xpp and check the result turns a into b. */
+int t_diff_applies(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp);
+
+/*
+ * Diff a and b with both parameter sets; true if both succeed and give
+ * the same bytes.
+ */
+int t_same_diff(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp1,
+		xpparam_t const *xpp2);
+
+/* FNV-1a of a buffer, for comparing output against recorded digests */
+uint64_t t_hash(char const *p, size_t n);
+
+/* Fewest lines to delete and insert to turn a into b. */
+long t_edit_distance(mmfile_t const *a, mmfile_t const *b);
+
+#endif /* LIB_XDIFF_H */
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Loopback smoke test: start diff-daemon on a socket in trash/, load it
+# with diff-daemon-bench, which fails on errors and on runs of the same
+# job that answer differently, and check where indexes go.
+
+trash=trash/t-diff-daemon
+sock=$trash/sock
+pid=
+n=0
+failed=0
+
+ok () {
+	n=$((n + 1))
+	if test "$1" = 0
+	then
+		echo "ok $n - $2"
+	else
+		echo "not ok $n - $2"
+		failed=1
+	fi
+}
+
+start_daemon () {
+	./diff-daemon --threads=4 "$@" "$sock" &
+	pid=$!
+	i=0
+	while ! test -S "$sock" && test $i -lt 100
+	do
+		sleep 0.1
+		i=$((i + 1))
+	done
+}
+
+stop_daemon () {
+	kill $pid 2>/dev/null
+	wait $pid 2>/dev/null
+	pid=
+}
+
+bench () {
+	./diff-daemon-bench --conns=4 --jobs=200 --depth=4 --size=128 \
+		--distinct=4 "$@" "$sock" >$trash/out 2>&1 ||
+	{
+		sed 's/^/# /' $trash/out
+		return 1
+	}
+}
+
+trap 'test -z "$pid" || kill $pid 2>/dev/null' EXIT
+rm -rf $trash && mkdir -p $trash || exit 1
+
+start_daemon
+test -S "$sock"
+ok $? "the daemon listens"
+bench
+ok $? "hunk replies are consistent"
+bench --text
+ok $? "unified diff text replies are consistent"
+bench --funcnames
+ok $? "replies with function headers are consistent"
+bench --merge
+ok $? "merge replies are consistent"
+bench --flags=2 --no-cache
+ok $? "uncached whitespace-ignoring diffs are consistent"
+test -z "$(ls -A $trash | grep -v '^sock$' | grep -v '^out$')"
+ok $? "nothing is written without --index-dir"
+stop_daemon
+
+start_daemon --index-dir=$trash/index
+bench --flags=2 --no-cache
+ok $? "diffs with indexes are consistent"
+test -n "$(ls $trash/index | grep '\.xdi$')"
+ok $? "large inputs are indexed in --index-dir"
+bench --flags=2 --no-cache
+ok $? "diffs read from indexes are consistent"
+stop_daemon
+
+echo "1..$n"
+exit $failed
@@ -0,0 +1,183 @@
+#include "lib-xdiff.h"
+
+/*
+ * Everything a diff or merge allocates internally goes through the
+ * allocator of the call: output is unaffected, every block comes back,
+ * and the limit makes the call fail cleanly.
+ */
+
+struct blocks {
+	long live;	/* blocks handed out and not yet freed */
+	long calls;
+};
+
+static void *count_malloc(void *priv, size_t size)
+{
+	struct blocks *b = priv;
+
+	__atomic_add_fetch(&b->live, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&b->calls, 1, __ATOMIC_RELAXED);
+	return malloc(size);
+}
+
+static void *count_realloc(void *priv, void *ptr, size_t size)
+{
+	struct blocks *b = priv;
+
+	if (!ptr)
+		__atomic_add_fetch(&b->live, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&b->calls, 1, __ATOMIC_RELAXED);
+	return realloc(ptr, size);
+}
+
+static void count_free(void *priv, void *ptr)
+{
+	struct blocks *b = priv;
+
+	if (ptr)
+		__atomic_sub_fetch(&b->live, 1, __ATOMIC_RELAXED);
+	free(ptr);
+}
+
+static void init_alloc(xdalloc_t *al, struct blocks *b)
+{
+	memset(al, 0, sizeof(*al));
+	memset(b, 0, sizeof(*b));
+	al->malloc = count_malloc;
+	al->realloc = count_realloc;
+	al->free = count_free;
+	al->priv = b;
+}
+
+static void check_diff(unsigned long flags, int nthreads, int hooks)
+{
+	uint64_t seed = 60 + flags + nthreads;
+	xpparam_t plain = { 0 }, xpp = { 0 };
+	xdalloc_t al;
+	struct blocks b;
+	mmfile_t m1, m2;
+
+	t_file_gen(&m1, &seed, 40000, 300);
+	t_file_edit(&m2, &m1, &seed, 300);
+	init_alloc(&al, &b);
+	if (!hooks)
+		al.malloc = NULL, al.realloc = NULL, al.free = NULL;
+	plain.flags = xpp.flags = flags;
+	xpp.alloc = &al;
+	if (nthreads)
+		xpp.pool = xdl_pool_new(nthreads);
+	check(t_same_diff(&m1, &m2, &plain, &xpp));
+	if (nthreads)
+		xdl_pool_put(xpp.pool);
+
+	check_uint(al.current, ==, 0);
+	check_uint(al.peak, >, 0);
+	check_uint(al.total, >=, al.peak);
+	check_uint(al.denied, ==, 0);
+	check_int(b.live, ==, 0);
+	if (hooks)
+		check_int(b.calls, >, 0);
+	t_file_free(&m1);
+	t_file_free(&m2);
+}
+
+static void t_hooks(void)
+{
+	check_diff(0, 0, 1);
+	check_diff(XDF_PATIENCE_DIFF, 0, 1);
+	check_diff(XDF_HISTOGRAM_DIFF, 0, 1);
+}
+
+static void t_accounting_only(void)
+{
+	check_diff(0, 0, 0);
+}
+
+static void t_pool(void)
+{
+	check_diff(XDF_HISTOGRAM_DIFF, 4, 1);
+	check_diff(XDF_PATIENCE_DIFF, 4, 1);
+	check_diff(XDF_UNIQUE_ANCHORS, 4, 1);
+}
+
+static void t_limit(void)
+{
+	uint64_t seed = 70;
+	xpparam_t xpp = { 0 };
+	xdalloc_t al;
+	struct blocks b;
+	size_t peak;
+	mmfile_t m1, m2;
+
+	t_file_gen(&m1, &seed, 20000, 100);
+	t_file_edit(&m2, &m1, &seed, 200);
+	init_alloc(&al, &b);
+	xpp.alloc = &al;
+	check_int(t_changed(&m1, &m2, &xpp), >, 0);
+	peak = al.peak;
+
+	/* a limit at the peak is enough... */
+	init_alloc(&al, &b);
+	al.limit = peak;
+	check_int(t_changed(&m1, &m2, &xpp), >, 0);
+	check_uint(al.denied, ==, 0);
+
+	/* ... below it the diff fails, and gives everything back */
+	init_alloc(&al, &b);
+	al.limit = peak / 2;
+	check_int(t_changed(&m1, &m2, &xpp), ==, -1);
+	check_uint(al.denied, >, 0);
+	check_uint(al.current, ==, 0);
+	check_uint(al.peak, <=, peak / 2);
+	check_int(b.live, ==, 0);
+	t_file_free(&m1);
+	t_file_free(&m2);
+}
+
+static void t_merge(void)
+{
+	uint64_t seed = 71;
+	xmparam_t xmp = { 0 };
+	xdalloc_t al;
+	struct blocks b;
+	mmbuffer_t res, exp;
+	mmfile_t o, m1, m2;
+	int r;
+
+	t_file_gen(&o, &seed, 10000, 100);
+	t_file_edit(&m1, &o, &seed, 50);
+	t_file_edit(&m2, &o, &seed, 50);
+	xmp.level = XDL_MERGE_ZEALOUS;
+	r = xdl_merge(&o, &m1, &m2, &xmp, &exp);
+	check_int(r, >=, 0);
+
+	init_alloc(&al, &b);
+	xmp.xpp.alloc = &al;
+	if (check_int(xdl_merge(&o, &m1, &m2, &xmp, &res), ==, r)) {
+		/* the result is the caller's, and not charged */
+		check_mem(res.ptr, res.size, exp.ptr, exp.size);
+		free(res.ptr);
+	}
+	check_uint(al.current, ==, 0);
+	check_int(b.live, ==, 0);
+
+	init_alloc(&al, &b);
+	al.limit = 1024;
+	check_int(xdl_merge(&o, &m1, &m2, &xmp, &res), ==, -1);
+	check_uint(al.current, ==, 0);
+	check_int(b.live, ==, 0);
+	free(exp.ptr);
+	t_file_free(&o);
+	t_file_free(&m1);
+	t_file_free(&m2);
+}
+
+int main(void)
+{
+	TEST(t_hooks(), "allocator hooks leave the output alone and get every block back");
+	TEST(t_accounting_only(), "an allocator without hooks only accounts");
+	TEST(t_pool(), "pool workers allocate through the call's allocator");
+	TEST(t_limit(), "diffs over the limit fail and release everything");
+	TEST(t_merge(), "merges allocate through the allocator");
+	return test_done();
+}
@@ -0,0 +1,174 @@
+#include "lib-xdiff.h"
+
+/*
+ * XDF_UNIQUE_ANCHORS cuts Myers at lines unique to both files. The
+ * result must still turn one file into the other, must not depend on
+ * whether the boxes were diffed on a pool, must keep every anchor, and
+ * must change no more lines than the plain Myers diff.
+ */
+
+/* every every-th line unique, the others drawn from five repeated ones */
+static void gen_mixed(mmfile_t *mf, uint64_t *seed, long n, long every)
+{
+	long i;
+	char *p;
+
+	mf->ptr = p = xmalloc(n * 32);
+	for (i = 0; i < n; i++)
+		p += i % every ? sprintf(p, "rep %d\n", (int)(t_rand(seed) % 5)) :
+			     sprintf(p, "anchor %ld\n", i);
+	mf->size = p - mf->ptr;
+}
+
+static void t_applies(void)
+{
+	uint64_t seed = 10;
+	xpparam_t xpp = { 0 };
+	int i;
+
+	xpp.flags = XDF_UNIQUE_ANCHORS;
+	for (i = 0; i < 20; i++) {
+		mmfile_t a, b;
+
+		if (i % 2)
+			t_file_gen(&a, &seed, 500 + i * 100, 0);
+		else
+			gen_mixed(&a, &seed, 500 + i * 100, 7);
+		t_file_edit(&b, &a, &seed, 1 + i * 3);
+		if (!check(t_diff_applies(&a, &b, &xpp)))
+			test_msg("input %d", i);
+		t_file_free(&a);
+		t_file_free(&b);
+	}
+}
+
+static void t_pool(void)
+{
+	uint64_t seed = 11;
+	xpparam_t serial = { 0 }, pooled = { 0 };
+	mmfile_t a, b;
+
+	serial.flags = pooled.flags = XDF_UNIQUE_ANCHORS;
+	pooled.pool = xdl_pool_new(4);
+	gen_mixed(&a, &seed, 40000, 7);
+	t_file_edit(&b, &a, &seed, 400);
+	check(t_same_diff(&a, &b, &serial, &pooled));
+	xdl_pool_put(pooled.pool);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+struct ranges {
+	long n;
+	long r[256][2];	/* changed lines of the old file */
+};
+
+static int collect(long start_a, long count_a, long start_b UNUSED,
+		   long count_b UNUSED, void *priv)
+{
+	struct ranges *rg = priv;
+
+	if (count_a && rg->n < 256) {
+		rg->r[rg->n][0] = start_a;
+		rg->r[rg->n][1] = start_a + count_a;
+		rg->n++;
+	}
+	return 0;
+}
+
+static void t_anchors_kept(void)
+{
+	uint64_t seed = 12;
+	xpparam_t xpp = { 0 };
+	xdemitconf_t xecfg = { 0 };
+	xdemitcb_t ecb = { 0 };
+	struct ranges rg = { 0 };
+	mmfile_t a, b;
+	long i, j;
+
+	/* Only the repeated lines change; every anchor survives. */
+	gen_mixed(&a, &seed, 3000, 7);
+	b.ptr = xmalloc(a.size);
+	memcpy(b.ptr, a.ptr, a.size);
+	b.size = a.size;
+	for (i = 0; i < b.size; i += 400) {
+		char *p = memmem(b.ptr + i, b.size - i, "rep ", 4);
+
+		if (p)
+			p[4] = '9';
+	}
+
+	xpp.flags = XDF_UNIQUE_ANCHORS;
+	xecfg.hunk_func = collect;
+	ecb.priv = &rg;
+	if (!check_int(xdl_diff(&a, &b, &xpp, &xecfg, &ecb), ==, 0))
+		goto out;
+	check_int(rg.n, >, 0);
+	for (i = 0; i < rg.n; i++)
+		for (j = rg.r[i][0]; j < rg.r[i][1]; j++)
+			if (!check(j % 7))
+				test_msg("anchor line %ld reported changed", j + 1);
+out:
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+/*
+ * Boxes far apart and heavily edited run into the cost limit, which
+ * must be that of the whole files: the limit of the box alone gives
+ * up much earlier and changes more lines than a plain diff.
+ */
+static void t_costly(void)
+{
+	uint64_t seed = 13;
+	xpparam_t plain = { 0 }, anchored = { 0 };
+	long nedits;
+
+	anchored.flags = XDF_UNIQUE_ANCHORS;
+	for (nedits = 2000; nedits <= 8000; nedits *= 2) {
+		mmfile_t a, b;
+
+		gen_mixed(&a, &seed, 100000, 20000);
+		t_file_edit(&b, &a, &seed, nedits);
+		check_int(t_changed(&a, &b, &anchored), <=, t_changed(&a, &b, &plain));
+		check(t_diff_applies(&a, &b, &anchored));
+		t_file_free(&a);
+		t_file_free(&b);
+	}
+}
+
+static void t_expected(void)
+{
+	mmfile_t a = t_file_str("x\n{\nfoo\n}\ny\n{\nbar\n}\nz\n");
+	mmfile_t b = t_file_str("x\n{\nfoo\n}\n{\nbaz\n}\ny\nz\n");
+	xpparam_t xpp = { 0 };
+	xdoutbuf_t ob;
+	char const *exp =
+		"@@ -2,8 +2,8 @@\n"
+		" {\n"
+		" foo\n"
+		" }\n"
+		"-y\n"
+		" {\n"
+		"-bar\n"
+		"+baz\n"
+		" }\n"
+		"+y\n"
+		" z\n";
+
+	xpp.flags = XDF_UNIQUE_ANCHORS;
+	if (check_int(t_diff(&a, &b, &xpp, 3, &ob), ==, 0)) {
+		check_mem(ob.ptr, ob.size, exp, strlen(exp));
+		xdl_outbuf_release(&ob);
+	}
+}
+
+int main(void)
+{
+	TEST(t_applies(), "anchored diffs turn the old file into the new");
+	TEST(t_pool(), "diffing the boxes on a pool gives the same output");
+	TEST(t_anchors_kept(), "unique lines in order are never changed");
+	TEST(t_costly(), "costly boxes change no more lines than a plain diff");
+	TEST(t_expected(), "a small anchored diff");
+	return test_done();
+}
@@ -0,0 +1,137 @@
+#include "lib-xdiff.h"
+
+/*
+ * XDF_AUTO_DIFF picks an engine from the shape of the input; whatever
+ * it picks, the output must be exactly what asking for that engine
+ * directly gives.
+ */
+
+static void auto_matches(mmfile_t *a, mmfile_t *b, unsigned long want)
+{
+	xpparam_t xpp = { 0 };
+	xdautoinfo_t ai;
+	xdoutbuf_t got, exp;
+
+	xpp.flags = XDF_AUTO_DIFF;
+	xpp.auto_info = &ai;
+	if (!check_int(t_diff(a, b, &xpp, 3, &got), ==, 0))
+		return;
+	check_uint(ai.alg, ==, want);
+
+	memset(&xpp, 0, sizeof(xpp));
+	xpp.flags = want;
+	if (check_int(t_diff(a, b, &xpp, 3, &exp), ==, 0)) {
+		check_mem(got.ptr, got.size, exp.ptr, exp.size);
+		check_int(t_apply(a, b, got.ptr, got.size, 0), ==, 0);
+		xdl_outbuf_release(&exp);
+	}
+	xdl_outbuf_release(&got);
+}
+
+static void t_small(void)
+{
+	mmfile_t a = t_file_str("a\nb\nc\nd\n"), b = t_file_str("a\nc\nd\ne\n");
+
+	auto_matches(&a, &b, 0);
+}
+
+static void t_unique_lines(void)
+{
+	uint64_t seed = 1;
+	mmfile_t a, b;
+
+	t_file_gen(&a, &seed, 5000, 0);
+	t_file_edit(&b, &a, &seed, 40);
+	auto_matches(&a, &b, 0);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+/* The same unique lines, with 100-line blocks moved around. */
+static void t_moved_blocks(void)
+{
+	uint64_t seed = 2;
+	long order[40], i, j, tmp;
+	char *p;
+	mmfile_t a, b;
+
+	t_file_gen(&a, &seed, 4000, 0);
+	for (i = 0; i < 40; i++)
+		order[i] = i;
+	for (i = 39; i > 0; i--) {
+		j = t_rand(&seed) % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	b.ptr = p = xmalloc(a.size);
+	b.size = a.size;
+	for (i = 0; i < 40; i++) {
+		char const *s = a.ptr, *e;
+
+		for (j = 0; j < order[i] * 100; j++)
+			s = strchr(s, '\n') + 1;
+		for (e = s, j = 0; j < 100; j++)
+			e = strchr(e, '\n') + 1;
+		memcpy(p, s, e - s);
+		p += e - s;
+	}
+	auto_matches(&a, &b, XDF_HISTOGRAM_DIFF);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+/* Mostly lines from a small vocabulary, every tenth one unique. */
+static void gen_repetitive(mmfile_t *mf, uint64_t *seed, long n)
+{
+	long i;
+	char *p;
+
+	mf->ptr = p = xmalloc(n * 32);
+	for (i = 0; i < n; i++)
+		p += i % 10 ? sprintf(p, "rep %d\n", (int)(t_rand(seed) % 8)) :
+			      sprintf(p, "anchor %ld\n", i);
+	mf->size = p - mf->ptr;
+}
+
+static void t_repetitive(void)
+{
+	uint64_t seed = 3;
+	mmfile_t a, b;
+
+	gen_repetitive(&a, &seed, 6000);
+	t_file_edit(&b, &a, &seed, 60);
+	auto_matches(&a, &b, XDF_PATIENCE_DIFF);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_auto_info(void)
+{
+	mmfile_t a = t_file_str("x\ny\ny\nz\nw\n"), b = t_file_str("w\nz\ny\nv\n");
+	xpparam_t xpp = { 0 };
+	xdautoinfo_t ai;
+
+	xpp.flags = XDF_AUTO_DIFF;
+	xpp.auto_info = &ai;
+	if (!check_int(t_changed(&a, &b, &xpp), >=, 0))
+		return;
+	check_int(ai.nrec1, ==, 5);
+	check_int(ai.nrec2, ==, 4);
+	check_int(ai.nclass, ==, 5);
+	check_int(ai.nunique, ==, 2);	/* z, w */
+	check_int(ai.nunmatched, ==, 2);	/* x, v */
+	check_int(ai.maxdup, ==, 2);	/* y */
+	check_int(ai.breaks, ==, 1);	/* w comes before z in b */
+	check_uint(ai.alg, ==, 0);
+}
+
+int main(void)
+{
+	TEST(t_small(), "small inputs are diffed with Myers");
+	TEST(t_unique_lines(), "unique lines in order are diffed with Myers");
+	TEST(t_moved_blocks(), "moved blocks are diffed with histogram");
+	TEST(t_repetitive(), "repetitive inputs are diffed with patience");
+	TEST(t_auto_info(), "auto_info describes the input");
+	return test_done();
+}
@@ -0,0 +1,302 @@
+#include "lib-xdiff.h"
+
+/*
+ * A diff or merge told to stop through xpparam_t.abort_check fails
+ * with -1, wherever it was when it noticed, and has freed everything
+ * it allocated by the time it returns, on the calling thread and on
+ * pool workers alike. The checks here cancel an xdcancel_t after a
+ * given number of polls. Trace hooks tell which phase each poll comes
+ * from, so that every phase that polls gets cancelled in turn.
+ */
+
+/* phases as xdtrace_t numbers them, plus one: 0 is outside of any */
+#define NPHASES (XDL_TRACE_MERGE + 2)
+#define NO_PHASE 0
+#define PHASE(p) ((p) + 1)
+
+static __thread int stack[32];
+static __thread int depth;
+
+static void on_enter(void *priv UNUSED, int phase, long size1 UNUSED,
+		     long size2 UNUSED)
+{
+	if (depth < (int)ARRAY_SIZE(stack))
+		stack[depth] = phase;
+	depth++;
+}
+
+static void on_leave(void *priv UNUSED, int phase UNUSED, long size1 UNUSED,
+		     long size2 UNUSED, long cost UNUSED, int status UNUSED)
+{
+	depth--;
+}
+
+static int current_phase(void)
+{
+	if (!depth)
+		return NO_PHASE;
+	return depth <= (int)ARRAY_SIZE(stack) ? PHASE(stack[depth - 1]) : -1;
+}
+
+struct blocks {
+	long live;	/* blocks handed out and not yet freed */
+};
+
+static void *count_malloc(void *priv, size_t size)
+{
+	struct blocks *b = priv;
+
+	__atomic_add_fetch(&b->live, 1, __ATOMIC_RELAXED);
+	return malloc(size);
+}
+
+static void *count_realloc(void *priv, void *ptr, size_t size)
+{
+	struct blocks *b = priv;
+
+	if (!ptr)
+		__atomic_add_fetch(&b->live, 1, __ATOMIC_RELAXED);
+	return realloc(ptr, size);
+}
+
+static void count_free(void *priv, void *ptr)
+{
+	struct blocks *b = priv;
+
+	if (ptr)
+		__atomic_sub_fetch(&b->live, 1, __ATOMIC_RELAXED);
+	free(ptr);
+}
+
+struct aborter {
+	xdcancel_t cancel;
+	long polls;
+	long after;		/* cancel once polled more often; -1: never */
+	long first[NPHASES];	/* number of the first poll from each phase */
+	int hit;		/* phase of poll number after + 1 */
+};
+
+static int abort_after(void *priv)
+{
+	struct aborter *ab = priv;
+	long n = __atomic_add_fetch(&ab->polls, 1, __ATOMIC_RELAXED), none = 0;
+	int phase = current_phase();
+
+	if (phase >= 0)
+		__atomic_compare_exchange_n(&ab->first[phase], &none, n, 0,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	if (ab->after >= 0 && n == ab->after + 1)
+		ab->hit = phase;
+	if (ab->after >= 0 && n > ab->after)
+		xdl_cancel_request(&ab->cancel);
+	return xdl_cancel_check(&ab->cancel);
+}
+
+struct inputs {
+	mmfile_t o, a, b;
+};
+
+struct outcome {
+	int ret;
+	size_t bytes;	/* still live afterwards */
+	long blocks;
+};
+
+/*
+ * Diffs a and b, or merges them against o, with ab cancelling after
+ * ab->after polls.
+ */
+static void run(struct inputs *in, unsigned long flags, int merge,
+		xdpool_t *pool, struct aborter *ab, struct outcome *out)
+{
+	struct blocks b = { 0 };
+	xdalloc_t al = { 0 };
+	xpparam_t xpp = { 0 };
+	int ret;
+
+	xdl_cancel_init(&ab->cancel, 0);
+	ab->polls = 0;
+	memset(ab->first, 0, sizeof(ab->first));
+	ab->hit = -1;
+	al.malloc = count_malloc;
+	al.realloc = count_realloc;
+	al.free = count_free;
+	al.priv = &b;
+	xpp.flags = flags;
+	xpp.abort_check = abort_after;
+	xpp.abort_priv = ab;
+	xpp.alloc = &al;
+	xpp.pool = pool;
+
+	if (merge) {
+		xmparam_t xmp = { 0 };
+		mmbuffer_t result;
+
+		xmp.xpp = xpp;
+		xmp.level = XDL_MERGE_ZEALOUS;
+		ret = xdl_merge(&in->o, &in->a, &in->b, &xmp, &result);
+		if (ret >= 0)
+			free(result.ptr);
+	} else {
+		xdoutbuf_t ob;
+
+		ret = t_diff(&in->a, &in->b, &xpp, 3, &ob);
+		xdl_outbuf_release(&ob);
+	}
+	out->ret = ret;
+	out->bytes = al.current;
+	out->blocks = b.live;
+}
+
+static char const *phase_name(int phase)
+{
+	static char const *names[NPHASES] = {
+		"no phase", "prepare", "cleanup", "myers", "histogram",
+		"patience", "compact", "build_script", "emit", "merge",
+	};
+
+	return phase >= 0 ? names[phase] : "?";
+}
+
+/*
+ * Cancels a run of in at the first poll of every phase that polls,
+ * at the very first poll, and halfway; must_poll is the phase the
+ * flags are meant to reach.
+ */
+static void check_cancel(struct inputs *in, unsigned long flags, int merge,
+			 xdpool_t *pool, int must_poll)
+{
+	struct aborter ab, probe;
+	struct outcome out;
+	int phase;
+
+	probe.after = -1;
+	run(in, flags, merge, pool, &probe, &out);
+	check_int(out.ret, >=, 0);
+	check_uint(out.bytes, ==, 0);
+	check_int(out.blocks, ==, 0);
+	if (!check_int(probe.first[must_poll], >, 0)) {
+		test_msg("flags %#lx%s: %s never polls", flags,
+			 merge ? " merge" : "", phase_name(must_poll));
+		return;
+	}
+
+	for (phase = -2; phase < NPHASES; phase++) {
+		if (phase == -2)
+			ab.after = 0;
+		else if (phase == -1)
+			ab.after = probe.polls / 2;
+		else if (probe.first[phase])
+			ab.after = probe.first[phase] - 1;
+		else
+			continue;
+		run(in, flags, merge, pool, &ab, &out);
+		if (!check_int(out.ret, ==, -1) || !check_uint(out.bytes, ==, 0) ||
+		    !check_int(out.blocks, ==, 0) ||
+		    /* on the calling thread, polls come in the same order */
+		    (!pool && phase >= 0 && !check_int(ab.hit, ==, phase)))
+			test_msg("flags %#lx%s%s, cancelled after %ld of %ld polls, in %s",
+				 flags, merge ? " merge" : "", pool ? " pooled" : "",
+				 ab.after, probe.polls, phase_name(ab.hit));
+	}
+}
+
+static struct {
+	unsigned long flags;
+	int merge;
+	int must_poll;
+} const runs[] = {
+	{ 0, 0, PHASE(XDL_TRACE_MYERS) },
+	{ XDF_NEED_MINIMAL, 0, PHASE(XDL_TRACE_MYERS) },
+	{ XDF_HISTOGRAM_DIFF, 0, PHASE(XDL_TRACE_HISTOGRAM) },
+	{ XDF_PATIENCE_DIFF, 0, PHASE(XDL_TRACE_PATIENCE) },
+	{ XDF_UNIQUE_ANCHORS, 0, PHASE(XDL_TRACE_MYERS) },
+	/* the chunking itself runs before any phase */
+	{ XDF_CHUNK_PREPASS, 0, NO_PHASE },
+	{ XDF_CHUNK_PREPASS | XDF_HISTOGRAM_DIFF, 0, NO_PHASE },
+	{ 0, 1, PHASE(XDL_TRACE_MYERS) },
+	{ XDF_HISTOGRAM_DIFF, 1, PHASE(XDL_TRACE_HISTOGRAM) },
+};
+
+/* over the size that takes the chunking pre-pass, and busy enough for Myers */
+static void gen_inputs(struct inputs *in, uint64_t seed)
+{
+	t_file_gen(&in->o, &seed, 150000, 3000);
+	t_file_edit(&in->a, &in->o, &seed, 3000);
+	t_file_edit(&in->b, &in->o, &seed, 3000);
+}
+
+static void free_inputs(struct inputs *in)
+{
+	t_file_free(&in->o);
+	t_file_free(&in->a);
+	t_file_free(&in->b);
+}
+
+static void check_all(xdpool_t *pool, uint64_t seed)
+{
+	struct inputs in;
+	size_t i;
+
+	gen_inputs(&in, seed);
+	for (i = 0; i < ARRAY_SIZE(runs); i++)
+		check_cancel(&in, runs[i].flags, runs[i].merge, pool,
+			     runs[i].must_poll);
+	free_inputs(&in);
+}
+
+static void t_inline(void)
+{
+	check_all(NULL, 100);
+}
+
+static void t_pool(void)
+{
+	xdpool_t *pool = xdl_pool_new(4);
+
+	check_all(pool, 101);
+	xdl_pool_put(pool);
+}
+
+static void t_deadline(void)
+{
+	uint64_t seed = 102;
+	xpparam_t xpp = { 0 };
+	xdcancel_t cancel;
+	xdoutbuf_t ob;
+	mmfile_t a, b;
+
+	t_file_gen(&a, &seed, 60000, 2000);
+	t_file_edit(&b, &a, &seed, 400);
+	xpp.abort_check = xdl_cancel_check;
+	xpp.abort_priv = &cancel;
+
+	/* already cancelled, and out of time */
+	xdl_cancel_init(&cancel, 0);
+	xdl_cancel_request(&cancel);
+	check_int(t_diff(&a, &b, &xpp, 3, &ob), ==, -1);
+	xdl_outbuf_release(&ob);
+	xdl_cancel_init(&cancel, 1);
+	check_int(t_diff(&a, &b, &xpp, 3, &ob), ==, -1);
+	xdl_outbuf_release(&ob);
+
+	/* a distant deadline changes nothing */
+	xdl_cancel_init(&cancel, (uint64_t)3600 * 1000000000);
+	check_int(t_diff(&a, &b, &xpp, 3, &ob), ==, 0);
+	check(t_diff_applies(&a, &b, &xpp));
+	xdl_outbuf_release(&ob);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	xdtrace_t hooks = { on_enter, on_leave, NULL };
+
+	xdl_trace_set(&hooks);
+	TEST(t_inline(), "cancelled diffs and merges fail and free everything");
+	TEST(t_pool(), "the same with a pool attached");
+	TEST(t_deadline(), "xdcancel_t requests and deadlines");
+	xdl_trace_set(NULL);
+	return test_done();
+}
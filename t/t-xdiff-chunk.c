@@ -0,0 +1,148 @@
+#include "lib-xdiff.h"
+
+/*
+ * XDF_CHUNK_PREPASS only diffs the regions around edits. It must not
+ * come back with more changed lines than a plain diff of the same
+ * files, which it used to on repetitive input when every region was
+ * diffed with cost limits sized for the region alone.
+ */
+
+static char const *stmts[] = {
+	"{", "}", "", "return 0;", "int i;", "break;", "\t}", "\tcontinue;",
+	"if (err)", "\tgoto out;", "/* comment */", "else",
+};
+
+struct lines {
+	char const **l;
+	long n;
+};
+
+/* n lines of code-like text, with few distinct lines */
+static void gen_code(struct lines *a, uint64_t *seed, long n)
+{
+	long i;
+
+	a->l = xmalloc(n * sizeof(*a->l));
+	for (i = 0; i < n; i++)
+		a->l[i] = stmts[t_rand(seed) % ARRAY_SIZE(stmts)];
+	a->n = n;
+}
+
+/*
+ * nedits edits of up to maxlen lines: deletions, copies of lines from
+ * elsewhere and runs of new statements; with moves, blocks of up to
+ * that many lines also move elsewhere.
+ */
+static void edit_code(struct lines *b, struct lines const *a, uint64_t *seed,
+		      long nedits, long maxlen, long moves)
+{
+	char const **l = xmalloc((a->n + nedits * (maxlen + moves)) * sizeof(*l));
+	char const **tmp = xmalloc((maxlen + moves) * sizeof(*tmp));
+	long n = a->n, e, j;
+
+	memcpy(l, a->l, n * sizeof(*l));
+	for (e = 0; e < nedits; e++) {
+		long at = t_rand(seed) % n, len = 1 + t_rand(seed) % maxlen;
+		int kind = t_rand(seed) % (moves ? 4 : 3);
+
+		if (kind == 3)
+			len = 1 + t_rand(seed) % moves;
+		if (kind == 0 || kind == 3) {
+			if (len > n - at)
+				len = n - at;
+			memcpy(tmp, l + at, len * sizeof(*l));
+			memmove(l + at, l + at + len, (n - at - len) * sizeof(*l));
+			n -= len;
+			if (kind == 0)
+				continue;
+			at = t_rand(seed) % n;
+		}
+		memmove(l + at + len, l + at, (n - at) * sizeof(*l));
+		for (j = 0; j < len; j++)
+			l[at + j] = kind == 3 ? tmp[j] :
+				kind == 1 ? a->l[(at + j) * 7 % a->n] :
+				stmts[t_rand(seed) % ARRAY_SIZE(stmts)];
+		n += len;
+	}
+	free(tmp);
+	b->l = l;
+	b->n = n;
+}
+
+static void to_file(mmfile_t *mf, struct lines const *ls)
+{
+	long i;
+	char *p;
+
+	mf->ptr = p = xmalloc(ls->n * 24 + 1);
+	for (i = 0; i < ls->n; i++)
+		p += sprintf(p, "    %s\n", ls->l[i]);
+	mf->size = p - mf->ptr;
+}
+
+static void check_prepass(uint64_t seed, long nlines, long nedits,
+			  long maxlen, long moves)
+{
+	struct lines la, lb;
+	xpparam_t plain = { 0 }, pre = { 0 };
+	long nplain, npre;
+	mmfile_t a, b;
+
+	gen_code(&la, &seed, nlines);
+	edit_code(&lb, &la, &seed, nedits, maxlen, moves);
+	to_file(&a, &la);
+	to_file(&b, &lb);
+	check_int(a.size, >=, 1024 * 1024);
+
+	pre.flags = XDF_CHUNK_PREPASS;
+	nplain = t_changed(&a, &b, &plain);
+	npre = t_changed(&a, &b, &pre);
+	check_int(nplain, >, 0);
+	check_int(npre, <=, nplain);
+	check(t_diff_applies(&a, &b, &pre));
+
+	free(la.l);
+	free(lb.l);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_small_edits(void)
+{
+	check_prepass(4, 120000, 500, 3, 0);
+}
+
+static void t_dense_edits(void)
+{
+	check_prepass(1, 120000, 500, 40, 0);
+	check_prepass(2, 120000, 500, 40, 0);
+	check_prepass(2, 120000, 500, 100, 0);
+}
+
+static void t_moved_blocks(void)
+{
+	check_prepass(3, 120000, 500, 10, 2000);
+}
+
+static void t_small_input(void)
+{
+	uint64_t seed = 5;
+	xpparam_t plain = { 0 }, pre = { 0 };
+	mmfile_t a, b;
+
+	t_file_gen(&a, &seed, 20000, 50);
+	t_file_edit(&b, &a, &seed, 100);
+	pre.flags = XDF_CHUNK_PREPASS;
+	check(t_same_diff(&a, &b, &plain, &pre));
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	TEST(t_small_edits(), "pre-pass with scattered small edits");
+	TEST(t_dense_edits(), "pre-pass changes no more lines than a plain diff");
+	TEST(t_moved_blocks(), "pre-pass with moved blocks falls back to a plain diff");
+	TEST(t_small_input(), "small inputs skip the pre-pass");
+	return test_done();
+}
@@ -0,0 +1,115 @@
+#include "lib-xdiff.h"
+
+/*
+ * Myers diff first discards lines with no match on the other side and
+ * multimatch lines sitting in runs of those. The pass was rewritten
+ * around prefix sums; the digests below were recorded with the scan
+ * it replaced, on inputs made mostly of such runs.
+ */
+
+struct discard_case {
+	uint64_t seed;
+	long nlines;
+	int pct_repeated, pct_only;	/* the rest are unique lines in common */
+	long vocab, nedits;
+	unsigned long flags;
+	long changed;
+	uint64_t digest;
+};
+
+static struct discard_case const cases[] = {
+	{ 40, 6000, 30, 20, 20, 50, 0, 2519, 0x9d30925fd3f7e16cULL },
+	{ 41, 6000, 60, 30, 10, 50, 0, 3749, 0xfb9794bb1be5a66fULL },
+	{ 42, 6000, 45, 45, 30, 200, 0, 5695, 0x754fedf3f17accd2ULL },
+	{ 43, 20000, 70, 25, 8, 100, 0, 10170, 0x3a9333044a4b5e0fULL },
+	{ 44, 20000, 50, 10, 60, 400, 0, 4935, 0x6d4c404fbc76fcceULL },
+	{ 45, 6000, 60, 30, 10, 50, XDF_IGNORE_WHITESPACE, 3751, 0xcf61a6095864febbULL },
+	{ 46, 80000, 60, 30, 30, 300, 0, 48480, 0x6be85f15fd75286bULL },
+	{ 47, 10000, 40, 55, 10, 100, 0, 11332, 0x8388155875caf130ULL },
+	{ 48, 10000, 25, 70, 5, 50, 0, 14921, 0x59de9906e34c7e75ULL },
+	{ 49, 10000, 35, 60, 8, 100, XDF_NEED_MINIMAL, 11994, 0x53a3ac0241796384ULL },
+};
+
+/*
+ * Both files take the same repeated lines and the same unique common
+ * lines at the same places; "only" lines differ between them. The new
+ * file then gets nedits more edits.
+ */
+static void gen_case(struct discard_case const *c, mmfile_t *a, mmfile_t *b)
+{
+	uint64_t seed = c->seed;
+	mmfile_t b0;
+	char *p, *q;
+	long i;
+
+	a->ptr = p = xmalloc(c->nlines * 32);
+	b0.ptr = q = xmalloc(c->nlines * 32);
+	for (i = 0; i < c->nlines; i++) {
+		int r = t_rand(&seed) % 100;
+
+		if (r < c->pct_repeated) {
+			int v = t_rand(&seed) % c->vocab;
+
+			p += sprintf(p, "rep %d\n", v);
+			q += sprintf(q, "rep %d\n", v);
+		} else if (r < c->pct_repeated + c->pct_only) {
+			p += sprintf(p, "only a %ld\n", i);
+			q += sprintf(q, "only b %ld\n", i);
+		} else {
+			p += sprintf(p, "line %ld\n", i);
+			q += sprintf(q, "line %ld\n", i);
+		}
+	}
+	a->size = p - a->ptr;
+	b0.size = q - b0.ptr;
+	t_file_edit(b, &b0, &seed, c->nedits);
+	t_file_free(&b0);
+}
+
+static void check_case(struct discard_case const *c, long *changed,
+		       uint64_t *digest)
+{
+	xpparam_t xpp = { 0 }, pooled = { 0 };
+	xdoutbuf_t ob;
+	mmfile_t a, b;
+
+	gen_case(c, &a, &b);
+	xpp.flags = pooled.flags = c->flags;
+	*changed = t_changed(&a, &b, &xpp);
+	if (c->flags & XDF_NEED_MINIMAL)
+		check_int(*changed, ==, t_edit_distance(&a, &b));
+	if (t_diff(&a, &b, &xpp, 3, &ob) < 0) {
+		*digest = 0;
+	} else {
+		*digest = t_hash(ob.ptr, ob.size);
+		if (!(c->flags & XDF_WHITESPACE_FLAGS))
+			check_int(t_apply(&a, &b, ob.ptr, ob.size, 0), ==, 0);
+		xdl_outbuf_release(&ob);
+	}
+	/* large inputs clean up both files on the pool */
+	pooled.pool = xdl_pool_new(2);
+	check(t_same_diff(&a, &b, &xpp, &pooled));
+	xdl_pool_put(pooled.pool);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_case(struct discard_case const *c)
+{
+	long changed;
+	uint64_t digest;
+
+	check_case(c, &changed, &digest);
+	check_int(changed, ==, c->changed);
+	check_uint(digest, ==, c->digest);
+}
+
+int main(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++)
+		TEST(t_case(&cases[i]), "discard pass on input %d (seed %"PRIu64")",
+		     (int)i, cases[i].seed);
+	return test_done();
+}
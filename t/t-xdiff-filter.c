@@ -0,0 +1,245 @@
+#include "lib-xdiff.h"
+
+/*
+ * XDF_FILTER_IGNORED takes the lines XDF_IGNORE_BLANK_LINES and the -I
+ * regexes make ignorable out before the engine runs and puts them back
+ * after. The diff must still turn one file into the other, up to those
+ * lines; a hunk must not be made of them alone; and inputs without any
+ * must diff exactly as they do unfiltered.
+ */
+
+static regex_t ts_re;
+static regex_t *ts_res[] = { &ts_re };
+
+static unsigned long const engines[] = {
+	0,
+	XDF_NEED_MINIMAL,
+	XDF_PATIENCE_DIFF,
+	XDF_HISTOGRAM_DIFF,
+	XDF_INDENT_HEURISTIC,
+};
+
+static void set_regex(xpparam_t *xpp)
+{
+	xpp->ignore_regex = ts_res;
+	xpp->ignore_regex_nr = 1;
+}
+
+/*
+ * The lines of in, with blank lines (one in blank) and timestamps
+ * (one in ts) sprinkled between them; 0 leaves either out.
+ */
+static void add_noise(mmfile_t *out, mmfile_t const *in, uint64_t *seed,
+		      int blank, int ts)
+{
+	char const *p = in->ptr, *top = in->ptr + in->size, *nl;
+	char *o = xmalloc(in->size * 3 + 64);
+	long n = 0;
+
+	for (; p < top; p = nl + 1) {
+		nl = memchr(p, '\n', top - p);
+		if (blank && !(t_rand(seed) % blank))
+			o[n++] = '\n';
+		if (ts && !(t_rand(seed) % ts))
+			n += sprintf(o + n, "ts %u\n",
+				     (unsigned)(t_rand(seed) % 100000));
+		memcpy(o + n, p, nl - p + 1);
+		n += nl - p + 1;
+	}
+	out->ptr = o;
+	out->size = n;
+}
+
+static int ignorable(char const *p, long n, int regex)
+{
+	return !n || (regex && !regexec_buf(&ts_re, p, n, 0, NULL, 0));
+}
+
+/* Every hunk of patch changes some line that is not ignorable. */
+static int hunks_change_something(char const *patch, size_t size, int regex)
+{
+	char const *p = patch, *top = patch + size, *nl;
+	int in_hunk = 0, seen = 1;
+
+	for (; p < top; p = nl + 1) {
+		nl = memchr(p, '\n', top - p);
+		if (*p == '@') {
+			if (in_hunk && !seen)
+				break;
+			in_hunk = 1;
+			seen = 0;
+		} else if ((*p == '+' || *p == '-') &&
+			   !ignorable(p + 1, nl - p - 1, regex))
+			seen = 1;
+	}
+	if (!seen)
+		test_msg("hunk at patch offset %td only changes ignorable lines",
+			 p - patch);
+	return seen;
+}
+
+static void check_filtered(mmfile_t *a, mmfile_t *b, unsigned long flags,
+			   int regex, char const *what)
+{
+	xpparam_t xpp = { 0 };
+	xdoutbuf_t ob;
+
+	xpp.flags = flags | XDF_IGNORE_BLANK_LINES | XDF_FILTER_IGNORED;
+	if (regex)
+		set_regex(&xpp);
+	if (!check_int(t_diff(a, b, &xpp, 3, &ob), ==, 0))
+		return;
+	if (!check_int(t_apply_ignoring(a, b, ob.ptr, ob.size,
+					T_APPLY_IGNORE_BLANK,
+					regex ? &ts_re : NULL), ==, 0) ||
+	    !check(hunks_change_something(ob.ptr, ob.size, regex)))
+		test_msg("%s, flags %#lx", what, flags);
+	xdl_outbuf_release(&ob);
+}
+
+static void t_no_ignorable_lines(void)
+{
+	uint64_t seed = 70;
+	xpparam_t plain = { 0 }, filtered = { 0 };
+	mmfile_t a, b;
+	size_t i;
+
+	t_file_gen(&a, &seed, 5000, 200);
+	t_file_edit(&b, &a, &seed, 80);
+	for (i = 0; i < ARRAY_SIZE(engines); i++) {
+		plain.flags = engines[i] | XDF_IGNORE_BLANK_LINES;
+		filtered.flags = plain.flags | XDF_FILTER_IGNORED;
+		set_regex(&plain);
+		set_regex(&filtered);
+		if (!check(t_same_diff(&a, &b, &plain, &filtered)))
+			test_msg("flags %#lx", engines[i]);
+	}
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_blank_lines(void)
+{
+	uint64_t seed = 71;
+	mmfile_t a0, b0, a, b;
+	size_t i;
+
+	t_file_gen(&a0, &seed, 5000, 200);
+	t_file_edit(&b0, &a0, &seed, 80);
+	add_noise(&a, &a0, &seed, 4, 0);
+	add_noise(&b, &b0, &seed, 4, 0);
+	for (i = 0; i < ARRAY_SIZE(engines); i++)
+		check_filtered(&a, &b, engines[i], 0, "blank lines");
+	t_file_free(&a0);
+	t_file_free(&b0);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_regex(void)
+{
+	uint64_t seed = 72;
+	mmfile_t a0, b0, a, b;
+	size_t i;
+
+	t_file_gen(&a0, &seed, 5000, 200);
+	t_file_edit(&b0, &a0, &seed, 80);
+	add_noise(&a, &a0, &seed, 6, 3);
+	add_noise(&b, &b0, &seed, 6, 3);
+	for (i = 0; i < ARRAY_SIZE(engines); i++)
+		check_filtered(&a, &b, engines[i], 1, "timestamps");
+	t_file_free(&a0);
+	t_file_free(&b0);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_only_noise(void)
+{
+	uint64_t seed = 73;
+	xpparam_t xpp = { 0 };
+	xdoutbuf_t ob;
+	mmfile_t a0, a, b;
+	size_t i;
+
+	t_file_gen(&a0, &seed, 5000, 200);
+	add_noise(&a, &a0, &seed, 5, 4);
+	add_noise(&b, &a0, &seed, 5, 4);
+	for (i = 0; i < ARRAY_SIZE(engines); i++) {
+		xpp.flags = engines[i] | XDF_IGNORE_BLANK_LINES |
+			XDF_FILTER_IGNORED;
+		set_regex(&xpp);
+		if (check_int(t_diff(&a, &b, &xpp, 3, &ob), ==, 0) &&
+		    !check_uint(ob.size, ==, 0))
+			test_msg("flags %#lx:\n%.*s", engines[i],
+				 (int)(ob.size < 400 ? ob.size : 400), ob.ptr);
+		xdl_outbuf_release(&ob);
+	}
+	t_file_free(&a0);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_small(void)
+{
+	xpparam_t xpp = { 0 };
+	xdoutbuf_t ob;
+	mmfile_t a = t_file_str("a\n\nts 1\nb\nc\nd\n");
+	mmfile_t b = t_file_str("a\nts 2\nb\n\nC\nd\nts 3\n");
+	char const *expect = "@@ -5 +4,2 @@\n-c\n+\n+C\n";
+
+	/* the noise around "b" and after "d" is hidden; next to "C" it is not */
+	xpp.flags = XDF_IGNORE_BLANK_LINES | XDF_FILTER_IGNORED;
+	set_regex(&xpp);
+	if (check_int(t_diff(&a, &b, &xpp, 0, &ob), ==, 0))
+		check_mem(ob.ptr, ob.size, expect, strlen(expect));
+	xdl_outbuf_release(&ob);
+}
+
+static void t_merge(void)
+{
+	uint64_t seed = 74;
+	xmparam_t xmp = { 0 };
+	mmbuffer_t plain, filtered;
+	mmfile_t o0, a0, b0, o, a, b;
+	int r1, r2;
+
+	t_file_gen(&o0, &seed, 3000, 100);
+	t_file_edit(&a0, &o0, &seed, 40);
+	t_file_edit(&b0, &o0, &seed, 40);
+	add_noise(&o, &o0, &seed, 5, 0);
+	add_noise(&a, &a0, &seed, 5, 0);
+	add_noise(&b, &b0, &seed, 5, 0);
+	xmp.level = XDL_MERGE_ZEALOUS;
+	xmp.xpp.flags = XDF_IGNORE_BLANK_LINES;
+	r1 = xdl_merge(&o, &a, &b, &xmp, &plain);
+	xmp.xpp.flags |= XDF_FILTER_IGNORED;
+	r2 = xdl_merge(&o, &a, &b, &xmp, &filtered);
+	check_int(r1, >=, 0);
+	if (check_int(r2, ==, r1) && r1 >= 0)
+		check_mem(filtered.ptr, filtered.size, plain.ptr, plain.size);
+	if (r1 >= 0)
+		free(plain.ptr);
+	if (r2 >= 0)
+		free(filtered.ptr);
+	t_file_free(&o0);
+	t_file_free(&a0);
+	t_file_free(&b0);
+	t_file_free(&o);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	if (regcomp(&ts_re, "^ts [0-9]+$", REG_EXTENDED | REG_NEWLINE))
+		BUG("bad regex");
+	TEST(t_no_ignorable_lines(), "without ignorable lines the output is unchanged");
+	TEST(t_blank_lines(), "diffs filtering blank lines apply");
+	TEST(t_regex(), "diffs filtering -I matches apply");
+	TEST(t_only_noise(), "changes to ignorable lines alone give no hunks");
+	TEST(t_small(), "a small filtered diff");
+	TEST(t_merge(), "merges ignore the flag");
+	regfree(&ts_re);
+	return test_done();
+}
@@ -0,0 +1,210 @@
+#include "lib-xdiff.h"
+
+/*
+ * Built-in function header matchers: each language's table accepts
+ * the headers it is meant to and rejects ordinary statements, and
+ * func_lang gives the same hunk headers as a find_func callback doing
+ * the same matching.
+ */
+
+static struct {
+	int lang;
+	char const *line;
+	char const *header;	/* NULL: not a header */
+} const cases[] = {
+	{ XDL_FUNC_LANG_C, "int main(void)\n", "int main(void)" },
+	{ XDL_FUNC_LANG_C, "static void foo(int a)\n", "static void foo(int a)" },
+	{ XDL_FUNC_LANG_C, "struct foo {\n", "struct foo {" },
+	{ XDL_FUNC_LANG_C, "  return 0;\n", NULL },
+	{ XDL_FUNC_LANG_C, "out:\n", NULL },
+	{ XDL_FUNC_LANG_C, "{\n", NULL },
+	{ XDL_FUNC_LANG_C, "#include <stdio.h>\n", NULL },
+	{ XDL_FUNC_LANG_C, "\n", NULL },
+
+	{ XDL_FUNC_LANG_CPP, "std::vector<int> f()\n", "std::vector<int> f()" },
+	{ XDL_FUNC_LANG_CPP, "  class Foo {\n", "class Foo {" },
+	{ XDL_FUNC_LANG_CPP, "namespace x {\n", "namespace x {" },
+	{ XDL_FUNC_LANG_CPP, "template <typename T>\n", "template <typename T>" },
+	{ XDL_FUNC_LANG_CPP, "export class A\n", "export class A" },
+	{ XDL_FUNC_LANG_CPP, "public:\n", NULL },
+	{ XDL_FUNC_LANG_CPP, "  x = 1;\n", NULL },
+
+	{ XDL_FUNC_LANG_PYTHON, "def f(x):\n", "def f(x):" },
+	{ XDL_FUNC_LANG_PYTHON, "    def method(self):\n", "def method(self):" },
+	{ XDL_FUNC_LANG_PYTHON, "async def g():\n", "async def g():" },
+	{ XDL_FUNC_LANG_PYTHON, "class A(B):\n", "class A(B):" },
+	{ XDL_FUNC_LANG_PYTHON, "    return x\n", NULL },
+	{ XDL_FUNC_LANG_PYTHON, "define = 1\n", NULL },
+	{ XDL_FUNC_LANG_PYTHON, "async with x:\n", NULL },
+
+	{ XDL_FUNC_LANG_JS, "function foo(a, b) {\n", "function foo(a, b) {" },
+	{ XDL_FUNC_LANG_JS, "export default async function main() {\n",
+	  "export default async function main() {" },
+	{ XDL_FUNC_LANG_JS, "const handler = async (req) => {\n",
+	  "const handler = async (req) => {" },
+	{ XDL_FUNC_LANG_JS, "  render() {\n", "render() {" },
+	{ XDL_FUNC_LANG_JS, "  static async load(url) {\n", "static async load(url) {" },
+	{ XDL_FUNC_LANG_JS, "interface Props {\n", "interface Props {" },
+	{ XDL_FUNC_LANG_JS, "let x = 5;\n", NULL },
+	{ XDL_FUNC_LANG_JS, "  if (x) {\n", NULL },
+	{ XDL_FUNC_LANG_JS, "  foo(bar);\n", NULL },
+
+	{ XDL_FUNC_LANG_GO, "func (s *Server) Run() error {\n",
+	  "func (s *Server) Run() error {" },
+	{ XDL_FUNC_LANG_GO, "type Config struct {\n", "type Config struct {" },
+	{ XDL_FUNC_LANG_GO, "type ID int\n", NULL },
+	{ XDL_FUNC_LANG_GO, "\tfunc inner() {}\n", NULL },
+
+	{ XDL_FUNC_LANG_RUST, "pub(crate) fn new() -> Self {\n",
+	  "pub(crate) fn new() -> Self {" },
+	{ XDL_FUNC_LANG_RUST, "    pub async fn run(&self) {\n",
+	  "pub async fn run(&self) {" },
+	{ XDL_FUNC_LANG_RUST, "impl<T> Foo for Bar<T> {\n", "impl<T> Foo for Bar<T> {" },
+	{ XDL_FUNC_LANG_RUST, "extern \"C\" fn cb() {\n", "extern \"C\" fn cb() {" },
+	{ XDL_FUNC_LANG_RUST, "let x = 5;\n", NULL },
+	{ XDL_FUNC_LANG_RUST, "fnord();\n", NULL },
+
+	{ XDL_FUNC_LANG_JAVA, "public class Main {\n", "public class Main {" },
+	{ XDL_FUNC_LANG_JAVA, "    public static void main(String[] args) {\n",
+	  "public static void main(String[] args) {" },
+	{ XDL_FUNC_LANG_JAVA, "    List<String> names() {\n", "List<String> names() {" },
+	{ XDL_FUNC_LANG_JAVA, "record Point(int x, int y) {\n",
+	  "record Point(int x, int y) {" },
+	{ XDL_FUNC_LANG_JAVA, "    return foo(x);\n", NULL },
+	{ XDL_FUNC_LANG_JAVA, "    int x = compute(y);\n", NULL },
+	{ XDL_FUNC_LANG_JAVA, "    @Override\n", NULL },
+	{ XDL_FUNC_LANG_JAVA, "    abstract void run();\n", NULL },
+};
+
+static void t_table(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		char buf[80];
+		long n = xdl_func_lang_match(cases[i].lang, cases[i].line,
+					     strlen(cases[i].line), buf, sizeof(buf));
+		int ok;
+
+		if (cases[i].header)
+			ok = n >= 0 && check_mem(buf, n, cases[i].header,
+						 strlen(cases[i].header));
+		else
+			ok = check_int(n, ==, -1);
+		if (!ok)
+			test_msg("language %d: %s", cases[i].lang, cases[i].line);
+	}
+}
+
+static void t_limits(void)
+{
+	char const *line = "int main(void)\n";
+	char buf[16];
+
+	/* truncated to the buffer, then trailing blanks dropped */
+	check_int(xdl_func_lang_match(XDL_FUNC_LANG_C, line, strlen(line), buf, 5), ==, 5);
+	check_mem(buf, 5, "int m", 5);
+	check_int(xdl_func_lang_match(XDL_FUNC_LANG_C, line, strlen(line), buf, 4), ==, 3);
+	check_int(xdl_func_lang_match(XDL_FUNC_LANG_NONE, line, strlen(line), buf, 16), ==, -1);
+	check_int(xdl_func_lang_match(-1, line, strlen(line), buf, 16), ==, -1);
+	check_int(xdl_func_lang_match(XDL_FUNC_LANG_JAVA + 1, line, strlen(line), buf, 16), ==, -1);
+	/* no trailing newline */
+	check_int(xdl_func_lang_match(XDL_FUNC_LANG_GO, "func f()", 8, buf, 16), ==, 8);
+}
+
+static void t_paths(void)
+{
+	static struct {
+		char const *path;
+		int lang;
+	} const paths[] = {
+		{ "a.c", XDL_FUNC_LANG_C }, { "include/x.h", XDL_FUNC_LANG_C },
+		{ "x.cc", XDL_FUNC_LANG_CPP }, { "x.hpp", XDL_FUNC_LANG_CPP },
+		{ "setup.py", XDL_FUNC_LANG_PYTHON }, { "app.tsx", XDL_FUNC_LANG_JS },
+		{ "index.mjs", XDL_FUNC_LANG_JS }, { "main.go", XDL_FUNC_LANG_GO },
+		{ "lib.rs", XDL_FUNC_LANG_RUST }, { "Main.java", XDL_FUNC_LANG_JAVA },
+		{ "Makefile", XDL_FUNC_LANG_NONE }, { "dir.d/x", XDL_FUNC_LANG_NONE },
+		{ "x.c.orig", XDL_FUNC_LANG_NONE }, { "notes.txt", XDL_FUNC_LANG_NONE },
+	};
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(paths); i++)
+		if (!check_int(xdl_func_lang_for_path(paths[i].path), ==, paths[i].lang))
+			test_msg("%s", paths[i].path);
+}
+
+static long find_func(const char *line, long len, char *buf, long sz, void *priv)
+{
+	return xdl_func_lang_match(*(int *)priv, line, len, buf, sz);
+}
+
+/*
+ * A C file of n functions of ten lines each; with edit set, a line in
+ * every 17th function differs.
+ */
+static void gen_c(mmfile_t *mf, uint64_t seed, int n, int edit)
+{
+	char *p;
+	int i, j;
+
+	mf->ptr = p = xmalloc(n * 200);
+	for (i = 0; i < n; i++) {
+		p += sprintf(p, "static int fn%d(int a)\n{\n", i);
+		for (j = 0; j < 7; j++)
+			p += sprintf(p, "\tx%d = %d;\n", j, (int)(t_rand(&seed) % 100) +
+				     (edit && i % 17 == 5 && j == 4 ? 100 : 0));
+		p += sprintf(p, "}\n");
+	}
+	mf->size = p - mf->ptr;
+}
+
+static void diff_funcnames(mmfile_t *a, mmfile_t *b, xdemitconf_t *xecfg,
+			   xdoutbuf_t *ob)
+{
+	xpparam_t xpp = { 0 };
+	xdemitcb_t ecb = { 0 };
+
+	xdl_outbuf_init(ob, 0, (size_t)1 << 32);
+	ecb.priv = ob;
+	ecb.out_line = xdl_outbuf_out_line;
+	xecfg->ctxlen = 3;
+	xecfg->flags = XDL_EMIT_FUNCNAMES;
+	check_int(xdl_diff(a, b, &xpp, xecfg, &ecb), ==, 0);
+}
+
+static int contains(xdoutbuf_t const *ob, char const *s)
+{
+	return memmem(ob->ptr, ob->size, s, strlen(s)) != NULL;
+}
+
+static void t_emit(void)
+{
+	int lang = XDL_FUNC_LANG_C;
+	xdemitconf_t builtin = { 0 }, callback = { 0 };
+	xdoutbuf_t ob1, ob2;
+	mmfile_t a, b;
+
+	gen_c(&a, 140, 300, 0);
+	gen_c(&b, 140, 300, 1);
+	builtin.func_lang = lang;
+	callback.find_func = find_func;
+	callback.find_func_priv = &lang;
+	diff_funcnames(&a, &b, &builtin, &ob1);
+	diff_funcnames(&a, &b, &callback, &ob2);
+	check_mem(ob1.ptr, ob1.size, ob2.ptr, ob2.size);
+	check(contains(&ob1, "@@ -54,7 +54,7 @@ static int fn5(int a)\n"));
+	check(contains(&ob1, "\n@@ -2944,7 +2944,7 @@ static int fn294(int a)\n"));
+	xdl_outbuf_release(&ob1);
+	xdl_outbuf_release(&ob2);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	TEST(t_table(), "headers and non-headers of each language");
+	TEST(t_limits(), "buffer sizes and unknown languages");
+	TEST(t_paths(), "languages picked by file name");
+	TEST(t_emit(), "func_lang emits the same hunk headers as find_func");
+	return test_done();
+}
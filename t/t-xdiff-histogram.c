@@ -0,0 +1,59 @@
+#include "lib-xdiff.h"
+
+/*
+ * Histogram diff scans long stretches of the new file on the pool.
+ * Whatever the shape of the input and the number of workers, the
+ * output must be byte for byte what the serial scan gives.
+ */
+
+static void check_pooled(uint64_t seed, long nlines, long vocab, long nedits)
+{
+	xpparam_t serial = { 0 }, pooled = { 0 };
+	mmfile_t a, b;
+	int nthreads;
+
+	t_file_gen(&a, &seed, nlines, vocab);
+	t_file_edit(&b, &a, &seed, nedits);
+	serial.flags = pooled.flags = XDF_HISTOGRAM_DIFF;
+	check(t_diff_applies(&a, &b, &serial));
+	for (nthreads = 2; nthreads <= 8; nthreads *= 2) {
+		pooled.pool = xdl_pool_new(nthreads);
+		if (!check(t_same_diff(&a, &b, &serial, &pooled)))
+			test_msg("%d threads, seed %"PRIu64, nthreads, seed);
+		xdl_pool_put(pooled.pool);
+	}
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_unique(void)
+{
+	check_pooled(20, 40000, 0, 200);
+}
+
+static void t_repetitive(void)
+{
+	check_pooled(21, 40000, 50, 200);
+	check_pooled(22, 40000, 2000, 500);
+}
+
+static void t_rewritten(void)
+{
+	/* more edits than lines: little is left in common */
+	check_pooled(23, 30000, 300, 30000);
+}
+
+static void t_small(void)
+{
+	/* below the parallel threshold the pool is never used */
+	check_pooled(24, 1000, 20, 30);
+}
+
+int main(void)
+{
+	TEST(t_unique(), "pooled histogram scan of unique lines");
+	TEST(t_repetitive(), "pooled histogram scan of repeated lines");
+	TEST(t_rewritten(), "pooled histogram scan of rewritten files");
+	TEST(t_small(), "pooled histogram diff of small files");
+	return test_done();
+}
@@ -0,0 +1,201 @@
+extern "C" {
+#include "lib-xdiff.h"
+}
+#include "xdiff.hpp"
+
+#include <string>
+#include <type_traits>
+
+/*
+ * The C++ wrapper: its scripts and merges are the C library's, its
+ * line views point into the inputs, spans and string views are
+ * interchangeable, and a thread-unsafe memory resource survives being
+ * used from a pool (run under SANITIZE=thread to see that it is not
+ * raced on).
+ */
+
+static_assert(!std::is_copy_constructible_v<xdl::diff_result>);
+static_assert(std::is_move_constructible_v<xdl::diff_result>);
+static_assert(!std::is_copy_constructible_v<xdl::merge_result>);
+static_assert(std::is_nothrow_move_constructible_v<xdl::merge_result>);
+
+struct gen {
+	mmfile_t a, b;
+
+	gen(uint64_t seed, long nlines, long vocab, long nedits)
+	{
+		t_file_gen(&a, &seed, nlines, vocab);
+		t_file_edit(&b, &a, &seed, nedits);
+	}
+	~gen()
+	{
+		t_file_free(&a);
+		t_file_free(&b);
+	}
+	std::string_view va() const { return std::string_view(a.ptr, a.size); }
+	std::string_view vb() const { return std::string_view(b.ptr, b.size); }
+};
+
+static int add_hunk(long sa, long ca, long sb, long cb, void *priv)
+{
+	static_cast<std::vector<xdl::hunk> *>(priv)->push_back({ sa, ca, sb, cb });
+	return 0;
+}
+
+/* The script the C API hands to hunk_func. */
+static std::vector<xdl::hunk> c_script(mmfile_t *a, mmfile_t *b,
+				       unsigned long flags)
+{
+	std::vector<xdl::hunk> v;
+	xpparam_t xpp = {};
+	xdemitconf_t xecfg = {};
+	xdemitcb_t ecb = {};
+
+	xpp.flags = flags;
+	xecfg.hunk_func = add_hunk;
+	ecb.priv = &v;
+	check_int(xdl_diff(a, b, &xpp, &xecfg, &ecb), ==, 0);
+	return v;
+}
+
+static int same_script(std::span<xdl::hunk const> a,
+		       std::span<xdl::hunk const> b)
+{
+	if (a.size() != b.size()) {
+		test_msg("%zu hunks vs %zu", a.size(), b.size());
+		return 0;
+	}
+	for (std::size_t i = 0; i < a.size(); i++)
+		if (a[i].old_start != b[i].old_start ||
+		    a[i].old_count != b[i].old_count ||
+		    a[i].new_start != b[i].new_start ||
+		    a[i].new_count != b[i].new_count) {
+			test_msg("hunk %zu differs", i);
+			return 0;
+		}
+	return 1;
+}
+
+static void t_script(void)
+{
+	gen g(120, 5000, 200, 60);
+	xdl::diff_result r = xdl::diff(g.va(), g.vb());
+	std::vector<xdl::hunk> expect = c_script(&g.a, &g.b, 0);
+
+	check(same_script(r.script(), expect));
+	check_uint(r.old_lines().size(), ==, 5000);
+
+	/* the views are the lines of the inputs, not copies */
+	for (xdl::hunk_view hv : r.hunks()) {
+		for (long i = 0; i < hv.hunk.old_count; i++) {
+			std::string_view l = hv.old_lines[i];
+			char const *p = g.a.ptr;
+
+			if (!check(l.data() >= p && l.data() + l.size() <= p + g.a.size &&
+				   l.back() == '\n'))
+				return;
+		}
+		if (!hv.new_lines.empty() &&
+		    !check(hv.new_lines.begin()[0] == r.new_lines()[hv.hunk.new_start]))
+			return;
+	}
+
+	/* moving hands over the script without copying it */
+	xdl::hunk const *data = r.script().data();
+	xdl::diff_result moved = std::move(r);
+	check(moved.script().data() == data);
+}
+
+static void t_spans(void)
+{
+	gen g(121, 3000, 0, 40);
+	std::vector<char> va(g.a.ptr, g.a.ptr + g.a.size);
+	std::span<const char> sb(g.b.ptr, g.b.size);
+	std::string sa(g.va());
+	xdl::diff_result r1 = xdl::diff(g.va(), g.vb());
+	xdl::diff_result r2 = xdl::diff(va, sb);
+	xdl::diff_result r3 = xdl::diff(std::span<const char>(va), sb);
+	xdl::diff_result r4 = xdl::diff(sa, std::string(g.vb()));
+
+	check(same_script(r2.script(), r1.script()));
+	check(same_script(r3.script(), r1.script()));
+	check(same_script(r4.script(), r1.script()));
+	check(xdl::diff("a\nb\n", "a\nc\n").script().size() == 1);
+}
+
+static void t_pool(void)
+{
+	static unsigned long const flags[] = {
+		XDF_HISTOGRAM_DIFF, XDF_PATIENCE_DIFF, XDF_UNIQUE_ANCHORS,
+	};
+	gen g(122, 60000, 400, 300);
+	xdpool_t *pool = xdl_pool_new(4);
+
+	for (unsigned long f : flags) {
+		std::pmr::unsynchronized_pool_resource mr;
+		xdl::options opt;
+
+		opt.flags = f;
+		opt.pool = pool;
+		xdl::diff_result r = xdl::diff(g.va(), g.vb(), opt, &mr);
+		if (!check(same_script(r.script(), c_script(&g.a, &g.b, f))))
+			test_msg("flags %lx", f);
+	}
+	xdl_pool_put(pool);
+}
+
+static void t_merge(void)
+{
+	uint64_t seed = 123;
+	xmparam_t xmp = {};
+	mmbuffer_t expect;
+	mmfile_t o, a, b;
+	int r;
+
+	t_file_gen(&o, &seed, 8000, 0);
+	t_file_edit(&a, &o, &seed, 50);
+	t_file_edit(&b, &o, &seed, 50);
+	xmp.level = XDL_MERGE_ZEALOUS;
+	r = xdl_merge(&o, &a, &b, &xmp, &expect);
+	if (check_int(r, >=, 0)) {
+		std::pmr::unsynchronized_pool_resource mr;
+		xdl::options opt;
+		std::span<const char> so(o.ptr, o.size), sa(a.ptr, a.size),
+			sb(b.ptr, b.size);
+
+		opt.pool = xdl_pool_new(4);
+		xdl::merge_result m = xdl::merge(so, sa, sb, xmp, opt, &mr);
+		check_int(m.conflicts(), ==, r);
+		check_mem(m.text().data(), m.text().size(), expect.ptr, expect.size);
+		xdl_pool_put(opt.pool);
+		free(expect.ptr);
+	}
+	t_file_free(&o);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_limit(void)
+{
+	gen g(124, 20000, 0, 100);
+	xdl::options opt;
+	int threw = 0;
+
+	opt.memory_limit = 4096;
+	try {
+		xdl::diff(g.va(), g.vb(), opt);
+	} catch (std::bad_alloc const &) {
+		threw = 1;
+	}
+	check(threw);
+}
+
+int main(void)
+{
+	TEST(t_script(), "scripts match the C API and views point into the inputs");
+	TEST(t_spans(), "spans, string views and strings give the same diff");
+	TEST(t_pool(), "a thread-unsafe resource can serve a pool");
+	TEST(t_merge(), "merges match xdl_merge()");
+	TEST(t_limit(), "the memory limit surfaces as bad_alloc");
+	return test_done();
+}
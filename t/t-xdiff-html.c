@@ -0,0 +1,209 @@
+#include "lib-xdiff.h"
+
+/*
+ * The HTML renderer: escaping follows gitweb's esc_html(), rendering a
+ * diff directly gives the same page as rendering its unified text, and
+ * no byte of the input can break out of the markup.
+ */
+
+static void check_patch(char const *patch, unsigned long flags,
+			char const *expect)
+{
+	xdoutbuf_t ob;
+
+	xdl_outbuf_init(&ob, 0, (size_t)1 << 32);
+	if (check_int(xdl_html_patch(patch, strlen(patch), flags, &ob), ==, 0))
+		check_mem(ob.ptr, ob.size, expect, strlen(expect));
+	xdl_outbuf_release(&ob);
+}
+
+static void t_escape(void)
+{
+	check_patch("@@ -1,3 +1,3 @@ f<x>\n"
+		    " ctx&\n"
+		    "-a<b>&\"'\n"
+		    "+a\tb\001\377 \303\251\n"
+		    "\\ No newline at end of file\n", 0,
+		    "<div class=\"diff chunk_header\"><span class=\"chunk_info\">@@ -1,3 +1,3 @@</span>"
+		    "<span class=\"section\">&nbsp;f&lt;x&gt;</span></div>\n"
+		    "<div class=\"diff ctx\">&nbsp;ctx&amp;</div>\n"
+		    "<div class=\"diff rem\">-a&lt;b&gt;&amp;&quot;&#39;</div>\n"
+		    /* tab to column 8; \xff is taken as Latin-1, the part after it is UTF-8 */
+		    "<div class=\"diff add\">+a&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;b"
+		    "<span class=\"cntrl\">\\ 1</span>\303\277&nbsp;\303\203\302\251</div>\n"
+		    "<div class=\"diff add\">\\&nbsp;No&nbsp;newline&nbsp;at&nbsp;end&nbsp;of&nbsp;file</div>\n");
+	check_patch("@@ -1 +1 @@\n-\303\251t\303\251\n+\303\251t\303\251!\n", 0,
+		    "<div class=\"diff chunk_header\"><span class=\"chunk_info\">@@ -1 +1 @@</span>"
+		    "<span class=\"section\"></span></div>\n"
+		    "<div class=\"diff rem\">-\303\251t\303\251</div>\n"
+		    "<div class=\"diff add\">+\303\251t\303\251!</div>\n");
+}
+
+static void t_highlight(void)
+{
+	check_patch("@@ -1,2 +1,2 @@\n-foo bar\n-\tx = 1;\n+foo baz\n+\tx = 2;\n",
+		    XDL_HTML_HIGHLIGHT | XDL_HTML_SIDEBYSIDE | XDL_HTML_NO_HUNK_HDR,
+		    "<div class=\"chunk_block chg\"><div class=\"old\">"
+		    "<div class=\"diff rem\">-foo&nbsp;ba<span class=\"marked\">r</span></div>\n"
+		    "<div class=\"diff rem\">-&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;x&nbsp;=&nbsp;"
+		    "<span class=\"marked\">1</span>;</div>\n"
+		    "</div><div class=\"new\">"
+		    "<div class=\"diff add\">+foo&nbsp;ba<span class=\"marked\">z</span></div>\n"
+		    "<div class=\"diff add\">+&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;&nbsp;x&nbsp;=&nbsp;"
+		    "<span class=\"marked\">2</span>;</div>\n"
+		    "</div></div>");
+	/* unequal runs of removed and added lines are not paired */
+	check_patch("@@ -1 +1,2 @@\n-foo bar\n+foo baz\n+more\n", XDL_HTML_HIGHLIGHT,
+		    "<div class=\"diff chunk_header\"><span class=\"chunk_info\">@@ -1 +1,2 @@</span>"
+		    "<span class=\"section\"></span></div>\n"
+		    "<div class=\"diff rem\">-foo&nbsp;bar</div>\n"
+		    "<div class=\"diff add\">+foo&nbsp;baz</div>\n"
+		    "<div class=\"diff add\">+more</div>\n");
+}
+
+/* Lines of random bytes, weighted towards the ones that need escaping. */
+static void gen_noise(mmfile_t *mf, uint64_t *seed, long nlines)
+{
+	static char const special[] = "<>&\"' \t\r\001\033\177";
+	char *p;
+	long i, j, len;
+
+	mf->ptr = p = xmalloc(nlines * 41);
+	for (i = 0; i < nlines; i++) {
+		len = t_rand(seed) % 40;
+		for (j = 0; j < len; j++) {
+			uint64_t r = t_rand(seed);
+
+			switch (r % 4) {
+			case 0:
+				*p++ = special[(r >> 8) % (sizeof(special) - 1)];
+				break;
+			case 1:
+				*p++ = (char)(0x80 + (r >> 8) % 0x80);
+				break;
+			default:
+				*p++ = 'a' + (r >> 8) % 26;
+			}
+		}
+		*p++ = '\n';
+	}
+	mf->size = p - mf->ptr;
+}
+
+static int utf8_valid(unsigned char const *p, size_t n)
+{
+	size_t i = 0, len, k;
+
+	while (i < n) {
+		len = p[i] < 0x80 ? 1 : (p[i] & 0xe0) == 0xc0 ? 2 :
+			(p[i] & 0xf0) == 0xe0 ? 3 : (p[i] & 0xf8) == 0xf0 ? 4 : 0;
+		if (!len || i + len > n)
+			return 0;
+		for (k = 1; k < len; k++)
+			if ((p[i + k] & 0xc0) != 0x80)
+				return 0;
+		i += len;
+	}
+	return 1;
+}
+
+/*
+ * Outside of tags there are no markup characters, only known
+ * entities, no control characters but newlines, and valid UTF-8; and
+ * every div and span is closed.
+ */
+static int well_formed(char const *p, size_t n)
+{
+	static char const *const entities[] = {
+		"&amp;", "&lt;", "&gt;", "&quot;", "&#39;", "&nbsp;", NULL,
+	};
+	char const *end = p + n, *q;
+	long divs = 0, spans = 0;
+	int i;
+
+	if (!utf8_valid((unsigned char const *)p, n))
+		return 0;
+	while (p < end) {
+		if (*p == '<') {
+			if (!(q = memchr(p, '>', end - p)))
+				return 0;
+			if (starts_with(p, "<div "))
+				divs++;
+			else if (starts_with(p, "</div>"))
+				divs--;
+			else if (starts_with(p, "<span "))
+				spans++;
+			else if (starts_with(p, "</span>"))
+				spans--;
+			else
+				return 0;
+			if (divs < 0 || spans < 0)
+				return 0;
+			p = q + 1;
+		} else if (*p == '&') {
+			for (i = 0; entities[i]; i++)
+				if ((size_t)(end - p) >= strlen(entities[i]) &&
+				    starts_with(p, entities[i]))
+					break;
+			if (!entities[i])
+				return 0;
+			p += strlen(entities[i]);
+		} else if (*p == '>' || *p == '"' || *p == '\'' ||
+			   (*p != '\n' && (unsigned char)*p < ' ') || *p == 0x7f) {
+			return 0;
+		} else {
+			p++;
+		}
+	}
+	return !divs && !spans;
+}
+
+static void t_direct(void)
+{
+	static unsigned long const flags[] = {
+		0, XDL_HTML_SIDEBYSIDE, XDL_HTML_HIGHLIGHT,
+		XDL_HTML_SIDEBYSIDE | XDL_HTML_HIGHLIGHT | XDL_HTML_NO_HUNK_HDR,
+	};
+	uint64_t seed = 150;
+	int i, j;
+
+	for (i = 0; i < 6; i++) {
+		xpparam_t xpp = { 0 };
+		xdemitconf_t xecfg = { 0 };
+		xdoutbuf_t patch;
+		mmfile_t a, b;
+
+		if (i % 2)
+			gen_noise(&a, &seed, 300 + i * 100);
+		else
+			t_file_gen(&a, &seed, 300 + i * 100, 0);
+		t_file_edit(&b, &a, &seed, 10 + i * 5);
+		xecfg.ctxlen = 3;
+		if (!check_int(t_diff(&a, &b, &xpp, 3, &patch), ==, 0))
+			continue;
+		for (j = 0; j < (int)ARRAY_SIZE(flags); j++) {
+			xdoutbuf_t direct, text;
+
+			xdl_outbuf_init(&direct, 0, (size_t)1 << 32);
+			xdl_outbuf_init(&text, 0, (size_t)1 << 32);
+			check_int(xdl_diff_html(&a, &b, &xpp, &xecfg, flags[j], &direct), ==, 0);
+			check_int(xdl_html_patch(patch.ptr, patch.size, flags[j], &text), ==, 0);
+			if (!check_mem(direct.ptr, direct.size, text.ptr, text.size) |
+			    !check(well_formed(direct.ptr, direct.size)))
+				test_msg("input %d, flags %lx", i, flags[j]);
+			xdl_outbuf_release(&direct);
+			xdl_outbuf_release(&text);
+		}
+		xdl_outbuf_release(&patch);
+		t_file_free(&a);
+		t_file_free(&b);
+	}
+}
+
+int main(void)
+{
+	TEST(t_escape(), "markup, tabs, control bytes and Latin-1 are escaped like gitweb");
+	TEST(t_highlight(), "paired lines get their changes marked");
+	TEST(t_direct(), "diffs render the same as their unified text, well-formed");
+	return test_done();
+}
@@ -0,0 +1,284 @@
+#include "lib-xdiff.h"
+#include <sys/stat.h>
+
+/*
+ * Inputs of 64KB or more are prepared from an index in index_dir when
+ * there is one, and get one written when there is not. Neither may
+ * change the output, and only an undamaged index made from the same
+ * bytes may be used.
+ */
+
+static char const *index_dir;
+
+/* Number of indexes in index_dir; the path of the last one in path. */
+static int list_indexes(char *path, size_t len)
+{
+	DIR *dir = opendir(index_dir);
+	struct dirent *de;
+	int n = 0;
+
+	if (!dir)
+		return -1;
+	while ((de = readdir(dir))) {
+		size_t l = strlen(de->d_name);
+
+		if (l > 4 && !strcmp(de->d_name + l - 4, ".xdi")) {
+			n++;
+			snprintf(path, len, "%s/%s", index_dir, de->d_name);
+		}
+	}
+	closedir(dir);
+	return n;
+}
+
+/* The diff of a and b with xpp is the same with and without indexes. */
+static int same_as_unindexed(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp)
+{
+	xpparam_t plain = *xpp, indexed = *xpp;
+
+	plain.index_dir = NULL;
+	indexed.index_dir = index_dir;
+	return t_same_diff(a, b, &plain, &indexed);
+}
+
+static void check_digest(char const *s, long size, char const *sha256)
+{
+	xpparam_t xpp = { 0 };
+	mmfile_t mf = { (char *)s, size };
+	char path[PATH_MAX], want[PATH_MAX];
+
+	index_dir = t_trash_dir("t-xdiff-index");
+	xpp.index_dir = index_dir;
+	check_int(xdl_index_file(&mf, &xpp, XDL_FUNC_LANG_NONE), ==, 0);
+	snprintf(want, sizeof(want), "%s/%s-0-0.xdi", index_dir, sha256);
+	if (check_int(list_indexes(path, sizeof(path)), ==, 1))
+		check_str(path, want);
+}
+
+static void t_digest(void)
+{
+	char *s = xmalloc(1000000);
+	long i;
+
+	memset(s, 'a', 1000000);
+	check_digest(s, 1000000,
+		     "0741850f36cba4259628355d1073e24ddb9ca0e1bfac36fd39ae5dc2101e23a4");
+	/* the last block full, then one byte long */
+	for (i = 0; i < 65537; i++)
+		s[i] = "abc\n"[i % 4];
+	check_digest(s, 65536,
+		     "ccbc4fb0c32eeaa1dedbd3e00df8c462d683720caf5f37a890eba9092db7b825");
+	check_digest(s, 65537,
+		     "6518eab65f54298c9ac89a84dccde644e868b5d113d97300844da3d5ccdd4491");
+	free(s);
+}
+
+static void check_round_trip(unsigned long flags, uint64_t seed)
+{
+	xpparam_t xpp = { 0 };
+	char path[PATH_MAX];
+	struct stat st1, st2;
+	mmfile_t a, b;
+
+	index_dir = t_trash_dir("t-xdiff-index");
+	t_file_gen(&a, &seed, 20000, 300);
+	t_file_edit(&b, &a, &seed, 200);
+	xpp.flags = flags;
+
+	/* written by the first diff... */
+	if (!check(same_as_unindexed(&a, &b, &xpp)))
+		test_msg("flags %#lx, seed %"PRIu64", no index yet", flags, seed);
+	check_int(list_indexes(path, sizeof(path)), ==, 2);
+
+	/* ... and read, not written again, by the next */
+	if (check_int(stat(path, &st1), ==, 0) &&
+	    !check(same_as_unindexed(&a, &b, &xpp)))
+		test_msg("flags %#lx, seed %"PRIu64", indexed", flags, seed);
+	if (check_int(stat(path, &st2), ==, 0))
+		check_uint(st2.st_ino, ==, st1.st_ino);
+	check_int(list_indexes(path, sizeof(path)), ==, 2);
+
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_round_trip(void)
+{
+	check_round_trip(0, 60);
+	check_round_trip(XDF_NEED_MINIMAL, 61);
+	check_round_trip(XDF_IGNORE_WHITESPACE, 62);
+	check_round_trip(XDF_IGNORE_WHITESPACE_CHANGE | XDF_IGNORE_BLANK_LINES, 63);
+	check_round_trip(XDF_HISTOGRAM_DIFF | XDF_IGNORE_CR_AT_EOL, 64);
+	check_round_trip(XDF_SEGMENT_LINES, 65);
+}
+
+static void t_func_lang(void)
+{
+	uint64_t seed = 66;
+	xpparam_t xpp = { 0 };
+	xdemitconf_t xecfg = { 0 };
+	xdemitcb_t ecb = { 0 };
+	xdoutbuf_t plain, indexed;
+	mmfile_t a, b;
+	int r1, r2;
+
+	index_dir = t_trash_dir("t-xdiff-index");
+	t_file_gen(&a, &seed, 20000, 0);
+	t_file_edit(&b, &a, &seed, 100);
+	xecfg.ctxlen = 3;
+	xecfg.func_lang = XDL_FUNC_LANG_C;
+	ecb.out_line = xdl_outbuf_out_line;
+
+	xdl_outbuf_init(&plain, 0, (size_t)1 << 32);
+	ecb.priv = &plain;
+	r1 = xdl_diff(&a, &b, &xpp, &xecfg, &ecb);
+
+	xpp.index_dir = index_dir;
+	check_int(xdl_index_file(&a, &xpp, XDL_FUNC_LANG_C), ==, 0);
+	check_int(xdl_index_file(&b, &xpp, XDL_FUNC_LANG_C), ==, 0);
+	xdl_outbuf_init(&indexed, 0, (size_t)1 << 32);
+	ecb.priv = &indexed;
+	r2 = xdl_diff(&a, &b, &xpp, &xecfg, &ecb);
+
+	check_int(r1, ==, 0);
+	check_int(r2, ==, 0);
+	check_mem(indexed.ptr, indexed.size, plain.ptr, plain.size);
+	xdl_outbuf_release(&plain);
+	xdl_outbuf_release(&indexed);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+/*
+ * Damage a's index at off with how, diff again, and check the index
+ * is not used but written afresh.
+ */
+#define DAMAGE_FLIP 0
+#define DAMAGE_TRUNCATE 1
+#define DAMAGE_EXTEND 2
+
+static void check_damaged(mmfile_t *a, mmfile_t *b, int how, double where)
+{
+	xpparam_t xpp = { 0 };
+	char path[PATH_MAX];
+	mmfile_t good, bad;
+	size_t off;
+
+	index_dir = t_trash_dir("t-xdiff-index");
+	xpp.index_dir = index_dir;
+	check_int(xdl_index_file(a, &xpp, XDL_FUNC_LANG_NONE), ==, 0);
+	if (!check_int(list_indexes(path, sizeof(path)), ==, 1))
+		return;
+	t_file_read(&good, path);
+	t_file_read(&bad, path);
+	off = (size_t)(where * (bad.size - 1));
+	switch (how) {
+	case DAMAGE_FLIP:
+		bad.ptr[off] ^= 0x10;
+		break;
+	case DAMAGE_TRUNCATE:
+		bad.size = off;
+		break;
+	default:
+		bad.ptr = xrealloc(bad.ptr, bad.size + 8);
+		memset(bad.ptr + bad.size, 0, 8);
+		bad.size += 8;
+		break;
+	}
+	t_file_write(path, bad.ptr, bad.size);
+
+	if (!check(same_as_unindexed(a, b, &xpp)))
+		test_msg("damage %d at %zu", how, off);
+	t_file_free(&bad);
+	t_file_read(&bad, path);
+	if (!check_mem(bad.ptr, bad.size, good.ptr, good.size))
+		test_msg("damage %d at %zu: the index was not replaced", how, off);
+	t_file_free(&good);
+	t_file_free(&bad);
+}
+
+static void t_damaged(void)
+{
+	uint64_t seed = 67;
+	double where[] = { 0.0, 0.05, 0.3, 0.55, 0.85, 0.95, 1.0 };
+	mmfile_t a, b;
+	size_t i;
+
+	t_file_gen(&a, &seed, 20000, 300);
+	t_file_edit(&b, &a, &seed, 200);
+	/* header, record ends, line hashes, indentation, attributes */
+	for (i = 0; i < ARRAY_SIZE(where); i++)
+		check_damaged(&a, &b, DAMAGE_FLIP, where[i]);
+	check_damaged(&a, &b, DAMAGE_TRUNCATE, 0.0);
+	check_damaged(&a, &b, DAMAGE_TRUNCATE, 0.5);
+	check_damaged(&a, &b, DAMAGE_TRUNCATE, 0.99);
+	check_damaged(&a, &b, DAMAGE_EXTEND, 1.0);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+uint64_t xdl_hash_bytes(void const *data, size_t size);
+
+static void t_colliding(void)
+{
+	uint64_t seed = 68;
+	xpparam_t xpp = { 0 };
+	char path[PATH_MAX];
+	mmfile_t a, b, c;
+
+	index_dir = t_trash_dir("t-xdiff-index");
+	t_file_gen(&a, &seed, 20000, 300);
+	t_file_edit(&b, &a, &seed, 200);
+
+	/* c differs from a in two words near the middle, same fast hash */
+	t_file_collide(&c, &a);
+	if (!check_uint(xdl_hash_bytes(c.ptr, c.size), ==,
+			xdl_hash_bytes(a.ptr, a.size)) ||
+	    !check(memcmp(a.ptr, c.ptr, a.size) != 0))
+		goto out;
+
+	/* a's index is not c's */
+	xpp.index_dir = index_dir;
+	check_int(xdl_index_file(&a, &xpp, XDL_FUNC_LANG_NONE), ==, 0);
+	check(same_as_unindexed(&c, &b, &xpp));
+	check(same_as_unindexed(&b, &c, &xpp));
+	check_int(list_indexes(path, sizeof(path)), ==, 3);
+	check(same_as_unindexed(&a, &b, &xpp));
+	check(same_as_unindexed(&c, &b, &xpp));
+	check_int(list_indexes(path, sizeof(path)), ==, 3);
+
+out:
+	t_file_free(&a);
+	t_file_free(&b);
+	t_file_free(&c);
+}
+
+static void t_small(void)
+{
+	uint64_t seed = 69;
+	xpparam_t xpp = { 0 };
+	char path[PATH_MAX];
+	mmfile_t a, b;
+
+	index_dir = t_trash_dir("t-xdiff-index");
+	t_file_gen(&a, &seed, 1000, 100);
+	t_file_edit(&b, &a, &seed, 20);
+	check_int(a.size, <, 1 << 16);
+	check(same_as_unindexed(&a, &b, &xpp));
+	xpp.index_dir = index_dir;
+	check_int(xdl_index_file(&a, &xpp, XDL_FUNC_LANG_NONE), ==, 0);
+	check_int(list_indexes(path, sizeof(path)), ==, 0);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	TEST(t_digest(), "indexes are named by the BLAKE2b-256 of the content");
+	TEST(t_round_trip(), "diffs writing and reading indexes match unindexed ones");
+	TEST(t_func_lang(), "function header bits do not change the output");
+	TEST(t_damaged(), "damaged indexes are not used, and are replaced");
+	TEST(t_colliding(), "an input colliding under the fast hash gets its own index");
+	TEST(t_small(), "inputs under 64KB are not indexed");
+	return test_done();
+}
@@ -0,0 +1,146 @@
+#include "lib-xdiff.h"
+
+/*
+ * The Myers K vectors only back the diagonals the search reaches,
+ * moving and doubling their window as it spreads. Minimal diffs must
+ * still be minimal wherever the window ends up, scripts must still
+ * apply, and memory must follow the changes rather than the files.
+ */
+
+static void check_minimal(long nlines, long vocab, long nedits, uint64_t seed)
+{
+	uint64_t s = seed;
+	xpparam_t xpp = { 0 };
+	mmfile_t a, b;
+	long got, want;
+
+	t_file_gen(&a, &s, nlines, vocab);
+	t_file_edit(&b, &a, &s, nedits);
+	xpp.flags = XDF_NEED_MINIMAL;
+	got = t_changed(&a, &b, &xpp);
+	want = t_edit_distance(&a, &b);
+	if (!check_int(got, ==, want) || !check(t_diff_applies(&a, &b, &xpp)))
+		test_msg("%ld lines, vocab %ld, %ld edits, seed %"PRIu64,
+			 nlines, vocab, nedits, seed);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_minimal(void)
+{
+	/* a few diagonals, then the window moves or doubles many times */
+	check_minimal(2000, 0, 1, 80);
+	check_minimal(2000, 0, 10, 81);
+	check_minimal(2000, 0, 300, 82);
+	check_minimal(20000, 0, 2000, 83);
+	/* repeated lines give long snakes off the middle diagonals */
+	check_minimal(5000, 5, 50, 84);
+	check_minimal(5000, 30, 500, 85);
+	check_minimal(3000, 2, 1000, 86);
+}
+
+/* Two unrelated files of n1 and n2 lines drawn from a few distinct ones. */
+static void check_lopsided(long n1, long n2, uint64_t seed)
+{
+	xpparam_t xpp = { 0 };
+	mmfile_t a, b;
+
+	t_file_gen(&a, &seed, n1, 20);
+	t_file_gen(&b, &seed, n2, 20);
+	xpp.flags = XDF_NEED_MINIMAL;
+	if (!check_int(t_changed(&a, &b, &xpp), ==, t_edit_distance(&a, &b)) ||
+	    !check(t_diff_applies(&a, &b, &xpp)))
+		test_msg("%ld against %ld lines", n1, n2);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_edges(void)
+{
+	mmfile_t empty = t_file_str(""), one = t_file_str("x\n");
+	xpparam_t xpp = { 0 };
+	uint64_t seed = 88;
+	mmfile_t a;
+
+	t_file_gen(&a, &seed, 1000, 0);
+	xpp.flags = XDF_NEED_MINIMAL;
+	check_int(t_changed(&empty, &a, &xpp), ==, 1000);
+	check_int(t_changed(&a, &empty, &xpp), ==, 1000);
+	check_int(t_changed(&one, &a, &xpp), ==, 1001);
+	check_int(t_changed(&a, &a, &xpp), ==, 0);
+	t_file_free(&a);
+
+	/* boxes far from square push the window against either edge */
+	check_lopsided(50, 3000, 87);
+	check_lopsided(3000, 50, 87);
+	check_lopsided(1500, 1500, 87);
+}
+
+static void check_applies(unsigned long flags, uint64_t seed)
+{
+	xpparam_t xpp = { 0 };
+	mmfile_t a, b;
+
+	t_file_gen(&a, &seed, 30000, 500);
+	t_file_edit(&b, &a, &seed, 400);
+	xpp.flags = flags;
+	if (!check(t_diff_applies(&a, &b, &xpp)))
+		test_msg("flags %#lx", flags);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_scripts(void)
+{
+	check_applies(0, 89);
+	check_applies(XDF_INDENT_HEURISTIC, 90);
+	check_applies(XDF_PATIENCE_DIFF, 91);
+	check_applies(XDF_HISTOGRAM_DIFF, 92);
+	check_applies(XDF_UNIQUE_ANCHORS, 93);
+	check_applies(XDF_AUTO_DIFF, 94);
+}
+
+static size_t diff_total(mmfile_t *a, mmfile_t *b)
+{
+	xpparam_t xpp = { 0 };
+	xdalloc_t al = { 0 };
+
+	xpp.alloc = &al;
+	check_int(t_changed(a, b, &xpp), >=, 0);
+	return al.total;
+}
+
+static void t_memory(void)
+{
+	uint64_t seed = 95;
+	long n = 400000;
+	size_t same, edited;
+	mmfile_t a, b;
+
+	/*
+	 * A against itself never gets as far as the search; against a
+	 * copy with a handful of edits spread over the whole file, the
+	 * cleanup pass allocates about a long per line more, and
+	 * dense K vectors took another four: 2 * (n + n). The peak is
+	 * reached while preparing, so count everything allocated. Lines
+	 * repeat, so that the cleanup pass leaves the edits to Myers.
+	 */
+	t_file_gen(&a, &seed, n, 10000);
+	t_file_edit(&b, &a, &seed, 5);
+	same = diff_total(&a, &a);
+	edited = diff_total(&a, &b);
+	if (!check_uint(edited, <, same + 4 * n * sizeof(long)))
+		test_msg("%zu bytes allocated against %zu without a search",
+			 edited, same);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	TEST(t_minimal(), "minimal diffs have the edit distance");
+	TEST(t_edges(), "empty, identical and lopsided inputs");
+	TEST(t_scripts(), "scripts apply with every engine");
+	TEST(t_memory(), "the K vectors take memory for the changes only");
+	return test_done();
+}
@@ -0,0 +1,208 @@
+#include "lib-xdiff.h"
+
+/*
+ * Line maps translate every old line the way the hunks of the same
+ * diff say it moves: unchanged lines shift by the lines added and
+ * removed before them, changed ones land where their replacement
+ * starts. Single and bulk lookups must agree, sorted or not.
+ */
+
+struct script {
+	long n;
+	long (*h)[4];
+};
+
+static int add_hunk(long start_a, long count_a, long start_b, long count_b,
+		    void *priv)
+{
+	struct script *s = priv;
+
+	s->h = xrealloc(s->h, (s->n + 1) * sizeof(*s->h));
+	s->h[s->n][0] = start_a;
+	s->h[s->n][1] = count_a;
+	s->h[s->n][2] = start_b;
+	s->h[s->n][3] = count_b;
+	s->n++;
+	return 0;
+}
+
+/* Where each old line goes by the hunks, and whether it is unchanged. */
+static void translate_by_hunks(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp,
+			       long nrec1, long *out, unsigned char *exact)
+{
+	struct script s = { 0, NULL };
+	xdemitconf_t xecfg = { 0 };
+	xdemitcb_t ecb = { 0 };
+	long i, k = 0, delta = 0;
+
+	xecfg.hunk_func = add_hunk;
+	ecb.priv = &s;
+	check_int(xdl_diff(a, b, xpp, &xecfg, &ecb), ==, 0);
+	for (i = 0; i < nrec1; i++) {
+		while (k < s.n && i >= s.h[k][0] + s.h[k][1]) {
+			delta += s.h[k][3] - s.h[k][1];
+			k++;
+		}
+		if (k < s.n && i >= s.h[k][0]) {
+			out[i] = s.h[k][2];
+			exact[i] = 0;
+		} else {
+			out[i] = i + delta;
+			exact[i] = 1;
+		}
+	}
+	free(s.h);
+}
+
+static void check_map(mmfile_t *a, mmfile_t *b, unsigned long flags,
+		      uint64_t *seed)
+{
+	xpparam_t xpp = { 0 };
+	xdlinemap_t map;
+	long i, n, nexact = 0, *lines, *want, *out;
+	unsigned char *want_exact, *exact;
+
+	xpp.flags = flags;
+	if (!check_int(xdl_diff_linemap(a, b, &xpp, &map), ==, 0))
+		return;
+	n = map.nrec1;
+	want = xmalloc((n + 1) * sizeof(*want));
+	want_exact = xmalloc(n + 1);
+	translate_by_hunks(a, b, &xpp, n, want, want_exact);
+
+	/* one at a time */
+	for (i = 0; i < n; i++) {
+		long o;
+		int r = xdl_linemap_line(&map, i, &o);
+
+		nexact += want_exact[i];
+		if (!check_int(r, ==, want_exact[i]) || !check_int(o, ==, want[i])) {
+			test_msg("line %ld", i);
+			break;
+		}
+	}
+
+	/* all of them, sorted */
+	lines = xmalloc((n + 3) * sizeof(*lines));
+	out = xmalloc((n + 3) * sizeof(*out));
+	exact = xmalloc(n + 3);
+	for (i = 0; i < n; i++)
+		lines[i] = i;
+	check_int(xdl_linemap_translate(&map, lines, n, out, exact), ==, nexact);
+	check_mem((char *)out, n * sizeof(*out), (char *)want, n * sizeof(*want));
+	check_mem((char *)exact, n, (char *)want_exact, n);
+
+	/* random order, repeats and out-of-range lines */
+	for (i = 0; i < n + 3; i++)
+		lines[i] = (long)(t_rand(seed) % (n + 4)) - 2;
+	xdl_linemap_translate(&map, lines, n + 3, out, exact);
+	for (i = 0; i < n + 3; i++) {
+		long l = lines[i];
+		int ok = l < 0 || l >= n ? out[i] == -1 && !exact[i] :
+			out[i] == want[l] && exact[i] == want_exact[l];
+
+		if (!check(ok)) {
+			test_msg("query %ld: line %ld", i, l);
+			break;
+		}
+	}
+
+	free(lines);
+	free(out);
+	free(exact);
+	free(want);
+	free(want_exact);
+	xdl_linemap_free(&map);
+}
+
+static void t_small(void)
+{
+	mmfile_t a = t_file_str("a\nb\nc\nd\ne\nf\n");
+	mmfile_t b = t_file_str("a\nX\nY\nc\nd\nf\ng\n");
+	xpparam_t xpp = { 0 };
+	xdlinemap_t map;
+	long o, lines[] = { 5, 0, 2, 1, 4, 6, -1 }, out[7];
+	unsigned char exact[7];
+
+	if (!check_int(xdl_diff_linemap(&a, &b, &xpp, &map), ==, 0))
+		return;
+	check_int(map.nr, ==, 3);
+	check_int(xdl_linemap_line(&map, 0, &o), ==, 1);
+	check_int(o, ==, 0);
+	check_int(xdl_linemap_line(&map, 1, &o), ==, 0);	/* b -> X Y */
+	check_int(o, ==, 1);
+	check_int(xdl_linemap_line(&map, 3, &o), ==, 1);
+	check_int(o, ==, 4);
+	check_int(xdl_linemap_line(&map, 4, &o), ==, 0);	/* e deleted */
+	check_int(o, ==, 5);
+	check_int(xdl_linemap_line(&map, 5, &o), ==, 1);
+	check_int(o, ==, 5);
+	check_int(xdl_linemap_line(&map, 6, &o), ==, -1);
+	check_int(o, ==, -1);
+
+	check_int(xdl_linemap_translate(&map, lines, 7, out, exact), ==, 3);
+	check_int(out[0], ==, 5);
+	check_int(out[1], ==, 0);
+	check_int(out[2], ==, 3);
+	check_int(out[3], ==, 1);
+	check_int(out[4], ==, 5);
+	check_int(out[5], ==, -1);
+	check_int(out[6], ==, -1);
+	check_mem((char *)exact, 7, "\1\1\1\0\0\0\0", 7);
+	xdl_linemap_free(&map);
+}
+
+static void t_edges(void)
+{
+	mmfile_t empty = t_file_str(""), one = t_file_str("x\n");
+	mmfile_t same = t_file_str("a\nb\nc\n");
+	xpparam_t xpp = { 0 };
+	xdlinemap_t map;
+	long o;
+
+	check_int(xdl_diff_linemap(&empty, &one, &xpp, &map), ==, 0);
+	check_int(map.nr, ==, 0);
+	check_int(xdl_linemap_line(&map, 0, &o), ==, -1);
+	xdl_linemap_free(&map);
+
+	check_int(xdl_diff_linemap(&one, &empty, &xpp, &map), ==, 0);
+	check_int(map.nr, ==, 0);
+	check_int(xdl_linemap_line(&map, 0, &o), ==, 0);
+	check_int(o, ==, 0);
+	xdl_linemap_free(&map);
+
+	check_int(xdl_diff_linemap(&same, &same, &xpp, &map), ==, 0);
+	check_int(map.nr, ==, 1);
+	check_int(xdl_linemap_line(&map, 2, &o), ==, 1);
+	check_int(o, ==, 2);
+	xdl_linemap_free(&map);
+}
+
+static void t_random(void)
+{
+	static unsigned long const flags[] = {
+		0, XDF_NEED_MINIMAL, XDF_PATIENCE_DIFF, XDF_HISTOGRAM_DIFF,
+		XDF_IGNORE_WHITESPACE, XDF_SEGMENT_LINES,
+	};
+	uint64_t seed = 130;
+	int i, j;
+
+	for (i = 0; i < 6; i++) {
+		mmfile_t a, b;
+
+		t_file_gen(&a, &seed, 500 + i * 4000, i % 2 ? 100 : 0);
+		t_file_edit(&b, &a, &seed, 3 + i * 40);
+		for (j = 0; j < (int)ARRAY_SIZE(flags); j++)
+			check_map(&a, &b, flags[j], &seed);
+		t_file_free(&a);
+		t_file_free(&b);
+	}
+}
+
+int main(void)
+{
+	TEST(t_small(), "lookups in a small map");
+	TEST(t_edges(), "empty and identical files");
+	TEST(t_random(), "lookups agree with the hunks of the same diff");
+	return test_done();
+}
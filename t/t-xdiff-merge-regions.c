@@ -0,0 +1,230 @@
+#include "lib-xdiff.h"
+
+/*
+ * xdl_merge_regions() runs the same merge as xdl_merge(): the same
+ * conflict count, and a clean result that is the rendered merge with
+ * its conflict blocks cut out. Each region's coordinates must point at
+ * the lines it took from the sides.
+ */
+
+/* The start of each line in buf, plus one past the end; returns the count. */
+static long split_lines(char const *buf, long size, char const ***lines)
+{
+	char const *p = buf, *end = buf + size;
+	long n = 0;
+
+	*lines = xmalloc((size + 2) * sizeof(**lines));
+	for (; p < end; n++) {
+		(*lines)[n] = p;
+		p = memchr(p, '\n', end - p);
+		p = p ? p + 1 : end;
+	}
+	(*lines)[n] = end;
+	return n;
+}
+
+/* The rendered merge with everything from "<<<<<<<" to ">>>>>>>" dropped. */
+static void strip_conflicts(xdoutbuf_t *ob, char const *buf, long size)
+{
+	char const *p = buf, *end = buf + size, *eol;
+	int in_conflict = 0;
+
+	for (; p < end; p = eol) {
+		eol = memchr(p, '\n', end - p);
+		eol = eol ? eol + 1 : end;
+		if (!in_conflict && starts_with(p, "<<<<<<<"))
+			in_conflict = 1;
+		else if (in_conflict && starts_with(p, ">>>>>>>"))
+			in_conflict = 0;
+		else if (!in_conflict)
+			xdl_outbuf_add(ob, p, eol - p);
+	}
+}
+
+static int same_lines(char const **l1, long i1, char const **l2, long i2,
+		      long n)
+{
+	for (; n; n--, i1++, i2++)
+		if (l1[i1 + 1] - l1[i1] != l2[i2 + 1] - l2[i2] ||
+		    memcmp(l1[i1], l2[i2], l1[i1 + 1] - l1[i1]))
+			return 0;
+	return 1;
+}
+
+static void check_regions(mmfile_t *o, mmfile_t *a, mmfile_t *b,
+			  xmparam_t const *xmp)
+{
+	mmbuffer_t merged;
+	xdoutbuf_t clean, expect;
+	xdmergeregion_t *reg = NULL;
+	char const **lo, **la, **lb, **lc;
+	long i, nr = 0, no, na, nb, nc, conflicts = 0;
+	int r1, r2;
+
+	r1 = xdl_merge(o, a, b, xmp, &merged);
+	xdl_outbuf_init(&clean, 0, (size_t)1 << 32);
+	r2 = xdl_merge_regions(o, a, b, xmp, &reg, &nr, &clean);
+	if (!check_int(r1, >=, 0) || !check_int(r2, ==, r1))
+		goto out;
+
+	xdl_outbuf_init(&expect, 0, (size_t)1 << 32);
+	strip_conflicts(&expect, merged.ptr, merged.size);
+	check_mem(clean.ptr, clean.size, expect.ptr, expect.size);
+	xdl_outbuf_release(&expect);
+
+	no = split_lines(o->ptr, o->size, &lo);
+	na = split_lines(a->ptr, a->size, &la);
+	nb = split_lines(b->ptr, b->size, &lb);
+	nc = split_lines(clean.ptr, clean.size, &lc);
+	for (i = 0; i < nr; i++) {
+		xdmergeregion_t *r = &reg[i];
+		int ok = 1;
+
+		ok &= r->i0 >= 0 && r->i0 + r->chg0 <= no;
+		ok &= r->i1 >= 0 && r->i1 + r->chg1 <= na;
+		ok &= r->i2 >= 0 && r->i2 + r->chg2 <= nb;
+		if (i)
+			ok &= r->i1 >= reg[i - 1].i1 + reg[i - 1].chg1 &&
+			      r->out >= reg[i - 1].out;
+		switch (r->mode) {
+		case XDL_MERGE_REGION_CONFLICT:
+			conflicts++;
+			break;
+		case XDL_MERGE_REGION_OURS:
+			ok &= r->out + r->chg1 <= nc &&
+			      same_lines(lc, r->out, la, r->i1, r->chg1);
+			break;
+		case XDL_MERGE_REGION_THEIRS:
+			ok &= r->out + r->chg2 <= nc &&
+			      same_lines(lc, r->out, lb, r->i2, r->chg2);
+			break;
+		case XDL_MERGE_REGION_BOTH:
+			ok &= r->out + r->chg1 + r->chg2 <= nc &&
+			      same_lines(lc, r->out, la, r->i1, r->chg1) &&
+			      same_lines(lc, r->out + r->chg1, lb, r->i2, r->chg2);
+			break;
+		case XDL_MERGE_REGION_SAME:
+			ok &= r->chg1 == r->chg2 &&
+			      same_lines(la, r->i1, lb, r->i2, r->chg1) &&
+			      r->out + r->chg1 <= nc &&
+			      same_lines(lc, r->out, la, r->i1, r->chg1);
+			break;
+		default:
+			ok = 0;
+		}
+		if (!check(ok)) {
+			test_msg("region %ld: mode %d <%ld,%ld> <%ld,%ld> <%ld,%ld> out %ld",
+				 i, r->mode, r->i0, r->chg0, r->i1, r->chg1,
+				 r->i2, r->chg2, r->out);
+			break;
+		}
+	}
+	/* refinement may split one conflict into several regions */
+	check_int(conflicts, >=, r1);
+	if (!r1)
+		check_int(conflicts, ==, 0);
+	free(lo);
+	free(la);
+	free(lb);
+	free(lc);
+out:
+	if (r1 >= 0)
+		free(merged.ptr);
+	free(reg);
+	xdl_outbuf_release(&clean);
+}
+
+static void t_small(void)
+{
+	mmfile_t o = t_file_str("a\nb\nc\nd\ne\nf\ng\n");
+	mmfile_t a = t_file_str("a\nB\nc\nd\ne\nF\ng\n");
+	mmfile_t b = t_file_str("a\nb\nc\nD\ne\nf2\ng\n");
+	xmparam_t xmp = { 0 };
+	xdmergeregion_t *reg = NULL;
+	xdoutbuf_t clean;
+	long nr = 0;
+
+	xdl_outbuf_init(&clean, 0, (size_t)1 << 32);
+	check_int(xdl_merge_regions(&o, &a, &b, &xmp, &reg, &nr, &clean), ==, 1);
+	if (check_int(nr, ==, 3)) {
+		check_int(reg[0].mode, ==, XDL_MERGE_REGION_OURS);
+		check_int(reg[0].i0, ==, 1);
+		check_int(reg[0].out, ==, 1);
+		check_int(reg[1].mode, ==, XDL_MERGE_REGION_THEIRS);
+		check_int(reg[1].i2, ==, 3);
+		check_int(reg[1].out, ==, 3);
+		check_int(reg[2].mode, ==, XDL_MERGE_REGION_CONFLICT);
+		check_int(reg[2].i0, ==, 5);
+		check_int(reg[2].chg0, ==, 1);
+		check_int(reg[2].out, ==, 5);
+	}
+	check_mem(clean.ptr, clean.size, "a\nB\nc\nD\ne\ng\n", 12);
+	free(reg);
+	xdl_outbuf_release(&clean);
+
+	/* neither output asked for: just the count */
+	check_int(xdl_merge_regions(&o, &a, &b, &xmp, NULL, NULL, NULL), ==, 1);
+}
+
+static void t_random(void)
+{
+	static int const levels[] = {
+		XDL_MERGE_MINIMAL, XDL_MERGE_EAGER,
+		XDL_MERGE_ZEALOUS, XDL_MERGE_ZEALOUS_ALNUM,
+	};
+	uint64_t seed = 90;
+	int i, j;
+
+	for (i = 0; i < 8; i++) {
+		mmfile_t o, a, b;
+
+		t_file_gen(&o, &seed, 2000 + i * 500, i % 2 ? 50 : 0);
+		t_file_edit(&a, &o, &seed, 20 + i * 10);
+		t_file_edit(&b, &o, &seed, 20 + i * 10);
+		for (j = 0; j < (int)ARRAY_SIZE(levels); j++) {
+			xmparam_t xmp = { 0 };
+
+			xmp.level = levels[j];
+			xmp.favor = i % 4 == 3 ? XDL_MERGE_FAVOR_UNION : 0;
+			check_regions(&o, &a, &b, &xmp);
+		}
+		t_file_free(&o);
+		t_file_free(&a);
+		t_file_free(&b);
+	}
+}
+
+static void t_clean_merge(void)
+{
+	uint64_t seed = 91;
+	xmparam_t xmp = { 0 };
+	mmbuffer_t merged;
+	xdoutbuf_t clean;
+	mmfile_t o, a, b;
+
+	/* ours edits only the first half, theirs only the second */
+	t_file_gen(&o, &seed, 4000, 0);
+	t_file_edit(&a, &o, &seed, 0);
+	memcpy(a.ptr, "edit", 4);
+	t_file_edit(&b, &o, &seed, 0);
+	memcpy(b.ptr + b.size - 10, "edit", 4);
+	xdl_outbuf_init(&clean, 0, (size_t)1 << 32);
+	xmp.level = XDL_MERGE_ZEALOUS;
+	if (check_int(xdl_merge(&o, &a, &b, &xmp, &merged), ==, 0)) {
+		check_int(xdl_merge_regions(&o, &a, &b, &xmp, NULL, NULL, &clean), ==, 0);
+		check_mem(clean.ptr, clean.size, merged.ptr, merged.size);
+		free(merged.ptr);
+	}
+	xdl_outbuf_release(&clean);
+	t_file_free(&o);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	TEST(t_small(), "regions and clean output of a small merge");
+	TEST(t_random(), "regions agree with the rendered merge at every level");
+	TEST(t_clean_merge(), "a merge without conflicts renders the same");
+	return test_done();
+}
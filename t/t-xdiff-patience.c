@@ -0,0 +1,64 @@
+#include "lib-xdiff.h"
+
+/*
+ * Patience diff hands large gaps between its common unique lines to
+ * the pool. The output must not depend on which gaps went there.
+ */
+
+/* Repeated filler, with a unique line every spacing lines. */
+static void gen_gappy(mmfile_t *mf, uint64_t *seed, long n, long spacing)
+{
+	long i;
+	char *p;
+
+	mf->ptr = p = xmalloc(n * 32);
+	for (i = 0; i < n; i++)
+		p += i % spacing ? sprintf(p, "fill %d\n", (int)(t_rand(seed) % 40)) :
+				   sprintf(p, "anchor %ld\n", i);
+	mf->size = p - mf->ptr;
+}
+
+static void check_pooled(uint64_t seed, long nlines, long spacing, long nedits)
+{
+	xpparam_t serial = { 0 }, pooled = { 0 };
+	mmfile_t a, b;
+	int nthreads;
+
+	gen_gappy(&a, &seed, nlines, spacing);
+	t_file_edit(&b, &a, &seed, nedits);
+	serial.flags = pooled.flags = XDF_PATIENCE_DIFF;
+	check(t_diff_applies(&a, &b, &serial));
+	for (nthreads = 2; nthreads <= 8; nthreads *= 2) {
+		pooled.pool = xdl_pool_new(nthreads);
+		if (!check(t_same_diff(&a, &b, &serial, &pooled)))
+			test_msg("%d threads, seed %"PRIu64, nthreads, seed);
+		xdl_pool_put(pooled.pool);
+	}
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_large_gaps(void)
+{
+	check_pooled(30, 30000, 3000, 300);
+}
+
+static void t_mixed_gaps(void)
+{
+	/* some gaps above the pool threshold, most below */
+	check_pooled(31, 30000, 700, 300);
+}
+
+static void t_no_anchors(void)
+{
+	/* nothing unique: patience falls back to Myers on the whole */
+	check_pooled(32, 8000, 100000, 100);
+}
+
+int main(void)
+{
+	TEST(t_large_gaps(), "pooled patience gaps match the serial diff");
+	TEST(t_mixed_gaps(), "mixed pooled and inline gaps match the serial diff");
+	TEST(t_no_anchors(), "patience without unique lines");
+	return test_done();
+}
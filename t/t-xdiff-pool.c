@@ -0,0 +1,418 @@
+#include "lib-xdiff.h"
+#include <pthread.h>
+
+/*
+ * The pool on its own: which queued task a free worker takes next,
+ * cancelling queued tasks, the shared default pool's reference count,
+ * and tasks waiting for groups they fan out into. Workers are held in
+ * "gate" tasks until the test has queued what it needs, so that what
+ * runs next is decided by the pool alone.
+ */
+
+#define NWORKERS 4
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int held;		/* workers sitting in a gate */
+static int open_gate[NWORKERS];	/* per worker index */
+static int open_all;
+
+static void gate_reset(void)
+{
+	pthread_mutex_lock(&lock);
+	held = 0;
+	memset(open_gate, 0, sizeof(open_gate));
+	open_all = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+/* Holds the worker running it until its gate or all gates open. */
+static void gate_run(void *priv)
+{
+	xdpool_t *pool = priv;
+	int w = xdl_pool_worker(pool);
+
+	pthread_mutex_lock(&lock);
+	held++;
+	pthread_cond_broadcast(&cond);
+	while (!open_all && !(w >= 0 && open_gate[w]))
+		pthread_cond_wait(&cond, &lock);
+	held--;
+	pthread_mutex_unlock(&lock);
+}
+
+static void wait_held(int n)
+{
+	pthread_mutex_lock(&lock);
+	while (held != n)
+		pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+static void open_worker(int w)
+{
+	pthread_mutex_lock(&lock);
+	open_gate[w] = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+static void wait_open_all(void)
+{
+	pthread_mutex_lock(&lock);
+	while (!open_all)
+		pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+static void open_everything(void)
+{
+	pthread_mutex_lock(&lock);
+	open_all = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+/* Holds n workers of pool in gates of grp. */
+static void hold_workers(xdtask_group_t *grp, xdpool_t *pool, int n)
+{
+	xdtask_t t = { gate_run, NULL, pool, XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY };
+	int i;
+
+	for (i = 0; i < n; i++)
+		check_int(xdl_pool_submit(grp, &t), ==, 0);
+	wait_held(n);
+}
+
+struct record {
+	xdpool_t *pool;
+	int id;
+	int worker;		/* that ran it */
+	int order;		/* when it started */
+	int status;		/* given to done(), or 1 */
+	int ran;
+	uint64_t started;
+	int gated;		/* then wait for all gates to open */
+};
+
+static int started;
+
+static void record_run(void *priv)
+{
+	struct record *r = priv;
+
+	pthread_mutex_lock(&lock);
+	r->worker = xdl_pool_worker(r->pool);
+	r->order = started++;
+	r->ran = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	if (r->gated)
+		wait_open_all();
+}
+
+static void record_done(void *priv, int status, xdtask_times_t const *times)
+{
+	struct record *r = priv;
+
+	r->status = status;
+	r->started = times->started;
+}
+
+static void submit_record(xdtask_group_t *grp, struct record *r, int prio,
+			  int affinity)
+{
+	xdtask_t t = { record_run, record_done, r, prio, affinity };
+
+	r->status = 1;
+	check_int(xdl_pool_submit(grp, &t), ==, 0);
+}
+
+static void t_priorities(void)
+{
+	xdpool_t *pool = xdl_pool_new(1);
+	xdtask_group_t gates, grp;
+	struct record r[12];
+	int i, last_interactive = -1, first_batch = 100;
+
+	gate_reset();
+	started = 0;
+	xdl_group_init(&gates, pool);
+	xdl_group_init(&grp, pool);
+	hold_workers(&gates, pool, 1);
+	/* batch and interactive tasks queued in turns */
+	memset(r, 0, sizeof(r));
+	for (i = 0; i < 12; i++) {
+		r[i].pool = pool;
+		r[i].id = i;
+		submit_record(&grp, &r[i], i % 2 ? XDL_PRIO_BATCH : XDL_PRIO_INTERACTIVE,
+			      XDL_AFFINITY_ANY);
+	}
+	open_everything();
+	check_int(xdl_group_wait(&grp), ==, 0);
+	check_int(xdl_group_wait(&gates), ==, 0);
+	for (i = 0; i < 12; i++) {
+		check_int(r[i].status, ==, 0);
+		check(r[i].started != 0);
+		if (i % 2)
+			first_batch = r[i].order < first_batch ? r[i].order : first_batch;
+		else
+			last_interactive = r[i].order > last_interactive ?
+				r[i].order : last_interactive;
+	}
+	if (!check_int(last_interactive, <, first_batch))
+		test_msg("a batch task started before all interactive ones");
+	xdl_pool_put(pool);
+}
+
+/* Index of the record that was the k-th to start, once one was. */
+static int wait_ran(struct record *r, int n, int k)
+{
+	int i, found = -1;
+
+	pthread_mutex_lock(&lock);
+	while (started <= k)
+		pthread_cond_wait(&cond, &lock);
+	for (i = 0; i < n; i++)
+		if (r[i].ran && r[i].order == k)
+			found = i;
+	pthread_mutex_unlock(&lock);
+	return found;
+}
+
+static void t_affinity(void)
+{
+	xdpool_t *pool = xdl_pool_new(NWORKERS);
+	xdtask_group_t gates, grp;
+	struct record r[NWORKERS];
+	int i, w, n;
+
+	gate_reset();
+	started = 0;
+	xdl_group_init(&gates, pool);
+	xdl_group_init(&grp, pool);
+	hold_workers(&gates, pool, NWORKERS);
+
+	/* one task per worker, indexes past the last one wrapping around */
+	memset(r, 0, sizeof(r));
+	for (i = NWORKERS - 1; i >= 0; i--) {
+		r[i].pool = pool;
+		r[i].id = i;
+		r[i].gated = 1;
+		submit_record(&grp, &r[i], XDL_PRIO_INTERACTIVE,
+			      i % 2 ? i + NWORKERS : i);
+	}
+	/*
+	 * Free the workers one at a time: each finds its own task at
+	 * hand before it could steal another, and then stays in it.
+	 */
+	for (w = 0; w < NWORKERS; w++) {
+		open_worker(w);
+		n = wait_ran(r, NWORKERS, w);
+		if (!check_int(n, ==, w) || !check_int(r[n].worker, ==, w))
+			test_msg("freeing worker %d started the task for %d", w, n);
+	}
+	open_everything();
+	check_int(xdl_group_wait(&grp), ==, 0);
+	check_int(xdl_group_wait(&gates), ==, 0);
+	xdl_pool_put(pool);
+}
+
+static int run_calls;
+
+static void count_run(void *priv)
+{
+	pthread_mutex_lock(&lock);
+	run_calls++;
+	pthread_mutex_unlock(&lock);
+}
+
+static void t_cancel(void)
+{
+	xdpool_t *pool = xdl_pool_new(1);
+	xdtask_group_t gates, grp, other;
+	struct record r[8], keep;
+	xdtask_t t;
+	int i;
+
+	gate_reset();
+	run_calls = 0;
+	xdl_group_init(&gates, pool);
+	xdl_group_init(&grp, pool);
+	xdl_group_init(&other, pool);
+	hold_workers(&gates, pool, 1);
+
+	memset(r, 0, sizeof(r));
+	for (i = 0; i < 8; i++) {
+		t.run = count_run;
+		t.done = record_done;
+		t.priv = &r[i];
+		t.prio = i % 2 ? XDL_PRIO_BATCH : XDL_PRIO_INTERACTIVE;
+		t.affinity = XDL_AFFINITY_ANY;
+		r[i].status = 1;
+		check_int(xdl_pool_submit(&grp, &t), ==, 0);
+	}
+	memset(&keep, 0, sizeof(keep));
+	keep.pool = pool;
+	submit_record(&other, &keep, XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY);
+
+	/* only grp's tasks go, each reported as cancelled */
+	check_int(xdl_pool_cancel(pool, &grp), ==, 8);
+	for (i = 0; i < 8; i++) {
+		check_int(r[i].status, ==, -1);
+		check_uint(r[i].started, ==, 0);
+	}
+	check_int(xdl_pool_cancel(pool, &grp), ==, 0);
+	open_everything();
+	check_int(xdl_group_wait(&grp), ==, -1);
+	check_int(xdl_group_wait(&other), ==, 0);
+	check_int(xdl_group_wait(&gates), ==, 0);
+	check_int(run_calls, ==, 0);
+	check_int(keep.status, ==, 0);
+	check(keep.ran);
+
+	/* a NULL group cancels everything queued */
+	gate_reset();
+	xdl_group_init(&grp, pool);
+	xdl_group_init(&other, pool);
+	hold_workers(&gates, pool, 1);
+	t.run = count_run;
+	t.done = NULL;
+	t.priv = NULL;
+	t.prio = XDL_PRIO_INTERACTIVE;
+	t.affinity = XDL_AFFINITY_ANY;
+	check_int(xdl_pool_submit(&grp, &t), ==, 0);
+	check_int(xdl_pool_submit(&other, &t), ==, 0);
+	check_int(xdl_pool_cancel(pool, NULL), ==, 2);
+	open_everything();
+	check_int(xdl_group_wait(&grp), ==, -1);
+	check_int(xdl_group_wait(&other), ==, -1);
+	check_int(xdl_group_wait(&gates), ==, 0);
+	check_int(run_calls, ==, 0);
+	xdl_pool_put(pool);
+}
+
+/* pool is alive: a task submitted to it runs on one of its workers */
+static int pool_works(xdpool_t *pool)
+{
+	struct record r;
+	xdtask_group_t grp;
+
+	memset(&r, 0, sizeof(r));
+	r.pool = pool;
+	xdl_group_init(&grp, pool);
+	submit_record(&grp, &r, XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY);
+	/* before waiting, which would run it here if it were still queued */
+	pthread_mutex_lock(&lock);
+	while (!r.ran)
+		pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+	return !xdl_group_wait(&grp) && !r.status && r.worker >= 0;
+}
+
+static void t_default(void)
+{
+	xdpool_t *p1, *p2, *p3;
+
+	xdl_pool_set_default_threads(3);
+	p1 = xdl_pool_get_default();
+	p2 = xdl_pool_get_default();
+	check(p1 != NULL);
+	check(p1 == p2);
+	check_int(xdl_pool_threads(p1), ==, 3);
+
+	/* one reference left: still the default, still running */
+	xdl_pool_put(p1);
+	p3 = xdl_pool_get_default();
+	check(p3 == p2);
+	check(pool_works(p3));
+	xdl_pool_put(p3);
+	check(pool_works(p2));
+	xdl_pool_put(p2);
+
+	/* the last reference went: a new default, of the new size */
+	xdl_pool_set_default_threads(2);
+	p1 = xdl_pool_get_default();
+	check_int(xdl_pool_threads(p1), ==, 2);
+	check(pool_works(p1));
+	xdl_pool_put(p1);
+	xdl_pool_set_default_threads(0);
+}
+
+struct fan {
+	xdpool_t *pool;
+	int depth;
+	long *leaves;
+};
+
+static void fan_run(void *priv)
+{
+	struct fan *f = priv, kids[4];
+	xdtask_group_t grp;
+	int i;
+
+	if (!f->depth) {
+		pthread_mutex_lock(&lock);
+		(*f->leaves)++;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	xdl_group_init(&grp, f->pool);
+	for (i = 0; i < 4; i++) {
+		xdtask_t t = { fan_run, NULL, &kids[i],
+			       i % 2 ? XDL_PRIO_BATCH : XDL_PRIO_INTERACTIVE,
+			       XDL_AFFINITY_ANY };
+
+		kids[i].pool = f->pool;
+		kids[i].depth = f->depth - 1;
+		kids[i].leaves = f->leaves;
+		if (xdl_pool_submit(&grp, &t) < 0)
+			fan_run(&kids[i]);
+	}
+	xdl_group_wait(&grp);
+}
+
+static void t_nested(void)
+{
+	xdpool_t *pool = xdl_pool_new(1);
+	xdtask_group_t gates, grp;
+	long leaves = 0;
+	struct fan top = { pool, 4, &leaves };
+	xdtask_t t = { fan_run, NULL, &top, XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY };
+
+	/* the worker waits on its own nested groups, with nobody helping */
+	gate_reset();
+	xdl_group_init(&gates, pool);
+	xdl_group_init(&grp, pool);
+	hold_workers(&gates, pool, 1);
+	check_int(xdl_pool_submit(&grp, &t), ==, 0);
+	open_everything();
+	pthread_mutex_lock(&lock);
+	while (leaves < 256)
+		pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+	check_int(xdl_group_wait(&gates), ==, 0);
+	check_int(xdl_group_wait(&grp), ==, 0);
+	check_int(leaves, ==, 256);
+
+	/* and with the caller helping */
+	leaves = 0;
+	xdl_group_init(&grp, pool);
+	check_int(xdl_pool_submit(&grp, &t), ==, 0);
+	check_int(xdl_group_wait(&grp), ==, 0);
+	check_int(leaves, ==, 256);
+	xdl_pool_put(pool);
+}
+
+int main(void)
+{
+	/* a deadlock fails the run rather than hanging it */
+	alarm(120);
+	TEST(t_priorities(), "interactive tasks run before batch ones");
+	TEST(t_affinity(), "a free worker runs the task placed on it first");
+	TEST(t_cancel(), "cancelled tasks report -1 and never run");
+	TEST(t_default(), "the default pool lives until its last reference");
+	TEST(t_nested(), "nested group waits on a one-thread pool finish");
+	return test_done();
+}
@@ -0,0 +1,314 @@
+#include "lib-xdiff.h"
+
+/*
+ * XDF_SEGMENT_LINES: files without long lines diff exactly as before;
+ * otherwise the line ranges handed to hunk_func form a valid edit
+ * script, and the pieces of each emitted hunk are the bytes found at
+ * the "L:O" position its header gives, on either side.
+ */
+
+/*
+ * Short lines, with every fifth a minified one of about 3000 bytes.
+ * b is drawn from the same seed with a token changed, dropped or
+ * added now and then.
+ */
+static void gen_minified(mmfile_t *mf, uint64_t seed, long nlines, int edit)
+{
+	uint64_t es = seed ^ 0x5eed;
+	char *p;
+	long i, j;
+
+	mf->ptr = p = xmalloc(nlines * 4000);
+	for (i = 0; i < nlines; i++) {
+		long ntok = i % 5 == 2 ? 300 : 0;
+
+		if (!ntok) {
+			p += sprintf(p, "line %ld\n", i);
+			continue;
+		}
+		for (j = 0; j < ntok; j++) {
+			long v = (long)(t_rand(&seed) % 1000);
+			uint64_t r = t_rand(&es) % 400;
+
+			if (edit && r == 0)
+				continue;
+			if (edit && r == 1)
+				p += sprintf(p, "new%ld;", j);
+			p += sprintf(p, "k%ld=%ld%s", j, edit && r == 2 ? v + 1 : v,
+				     j % 7 == 6 ? "},{" : ",");
+		}
+		*p++ = '\n';
+	}
+	mf->size = p - mf->ptr;
+}
+
+struct script {
+	long n;
+	long (*h)[4];
+};
+
+static int add_hunk(long start_a, long count_a, long start_b, long count_b,
+		    void *priv)
+{
+	struct script *s = priv;
+
+	s->h = xrealloc(s->h, (s->n + 1) * sizeof(*s->h));
+	s->h[s->n][0] = start_a;
+	s->h[s->n][1] = count_a;
+	s->h[s->n][2] = start_b;
+	s->h[s->n][3] = count_b;
+	s->n++;
+	return 0;
+}
+
+/* Start of each line of mf, plus one past the end; returns the count. */
+static long split_lines(mmfile_t const *mf, char const ***lines)
+{
+	char const *p = mf->ptr, *end = mf->ptr + mf->size;
+	long n = 0;
+
+	*lines = xmalloc((mf->size + 2) * sizeof(**lines));
+	for (; p < end; n++) {
+		(*lines)[n] = p;
+		p = memchr(p, '\n', end - p);
+		p = p ? p + 1 : end;
+	}
+	(*lines)[n] = end;
+	return n;
+}
+
+static int same_line(char const **la, long i, char const **lb, long j)
+{
+	return la[i + 1] - la[i] == lb[j + 1] - lb[j] &&
+		!memcmp(la[i], lb[j], la[i + 1] - la[i]);
+}
+
+/* Lines outside the hunks pair up in order and are equal. */
+static int check_script(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp)
+{
+	struct script s = { 0, NULL };
+	xdemitconf_t xecfg = { 0 };
+	xdemitcb_t ecb = { 0 };
+	char const **la, **lb;
+	long na, nb, i = 0, j = 0, k;
+	int ok = 1;
+
+	xecfg.hunk_func = add_hunk;
+	ecb.priv = &s;
+	if (!check_int(xdl_diff(a, b, xpp, &xecfg, &ecb), ==, 0))
+		return 0;
+	na = split_lines(a, &la);
+	nb = split_lines(b, &lb);
+	for (k = 0; ok && k <= s.n; k++) {
+		long ea = k < s.n ? s.h[k][0] : na, eb = k < s.n ? s.h[k][2] : nb;
+
+		ok = ea >= i && eb >= j && ea - i == eb - j;
+		for (; ok && i < ea; i++, j++)
+			ok = same_line(la, i, lb, j);
+		if (ok && k < s.n) {
+			i = s.h[k][0] + s.h[k][1];
+			j = s.h[k][2] + s.h[k][3];
+			/* hunks touching the same line are reported as one */
+			ok = k + 1 == s.n || s.h[k + 1][0] > i || s.h[k + 1][2] > j;
+		}
+	}
+	ok = ok && i == na && j == nb;
+	if (!ok)
+		test_msg("script breaks before old line %ld, new line %ld", i, j);
+	free(la);
+	free(lb);
+	free(s.h);
+	return ok;
+}
+
+/* Where "L:O" is in mf with its newlines taken out. */
+static long flat_pos(char const **lines, long nlines, long line, long off)
+{
+	if (line < 1 || line > nlines + 1)
+		return -1;
+	return lines[line - 1] - lines[0] - (line - 1) + off;
+}
+
+static void flatten(mmfile_t const *mf, char **out, long *size)
+{
+	long i, n = 0;
+
+	*out = xmalloc(mf->size + 1);
+	for (i = 0; i < mf->size; i++)
+		if (mf->ptr[i] != '\n')
+			(*out)[n++] = mf->ptr[i];
+	*size = n;
+}
+
+static int parse_side(char const **p, char sign, long *line, long *off)
+{
+	char *end;
+
+	if (**p != sign)
+		return -1;
+	*line = strtol(*p + 1, &end, 10);
+	*off = 0;
+	if (*end == ':')
+		*off = strtol(end + 1, &end, 10);
+	if (*end == ',')
+		strtol(end + 1, &end, 10);
+	*p = end + (*end == ' ');
+	return 0;
+}
+
+/*
+ * Joined up, the context and removed pieces of a hunk are the old
+ * bytes at its old position, and context and added ones the new.
+ */
+static int check_pieces(mmfile_t *a, mmfile_t *b, xpparam_t const *xpp)
+{
+	xdoutbuf_t ob;
+	char const **la, **lb, *p, *end, *eol;
+	char *fa, *fb, *side[2] = { NULL, NULL };
+	long na, nb, sfa, sfb, pos[2] = { -1, -1 }, len[2] = { 0, 0 }, hunks = 0;
+	int ok = 1, k;
+
+	if (!check_int(t_diff(a, b, xpp, 3, &ob), ==, 0))
+		return 0;
+	na = split_lines(a, &la);
+	nb = split_lines(b, &lb);
+	flatten(a, &fa, &sfa);
+	flatten(b, &fb, &sfb);
+	side[0] = xmalloc(sfa + 1);
+	side[1] = xmalloc(sfb + 1);
+
+	for (p = ob.ptr, end = ob.ptr + ob.size; ok && p <= end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		if (eol == end || starts_with(p, "@@ ")) {
+			/* the hunk before this one is complete */
+			if (pos[0] >= 0 || pos[1] >= 0) {
+				ok = (!len[0] || (pos[0] >= 0 && pos[0] + len[0] <= sfa &&
+						  !memcmp(fa + pos[0], side[0], len[0]))) &&
+					(!len[1] || (pos[1] >= 0 && pos[1] + len[1] <= sfb &&
+						     !memcmp(fb + pos[1], side[1], len[1])));
+				if (!ok)
+					test_msg("hunk %ld does not match its position", hunks);
+			}
+			if (eol == end)
+				break;
+			{
+				char const *q = p + 3;
+				long line, off;
+
+				if (parse_side(&q, '-', &line, &off) < 0) {
+					ok = 0;
+					break;
+				}
+				pos[0] = flat_pos(la, na, line, off);
+				if (parse_side(&q, '+', &line, &off) < 0) {
+					ok = 0;
+					break;
+				}
+				pos[1] = flat_pos(lb, nb, line, off);
+			}
+			len[0] = len[1] = 0;
+			hunks++;
+			continue;
+		}
+		for (k = 0; k < 2; k++)
+			if (*p == ' ' || *p == (k ? '+' : '-')) {
+				memcpy(side[k] + len[k], p + 1, eol - p - 1);
+				len[k] += eol - p - 1;
+			}
+	}
+	check_int(hunks, >, 0);
+	free(la);
+	free(lb);
+	free(fa);
+	free(fb);
+	free(side[0]);
+	free(side[1]);
+	xdl_outbuf_release(&ob);
+	return ok;
+}
+
+static void t_short_lines(void)
+{
+	uint64_t seed = 160;
+	xpparam_t plain = { 0 }, seg = { 0 };
+	mmfile_t a, b;
+
+	seg.flags = XDF_SEGMENT_LINES;
+	t_file_gen(&a, &seed, 5000, 100);
+	t_file_edit(&b, &a, &seed, 50);
+	check(t_same_diff(&a, &b, &plain, &seg));
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_minified(void)
+{
+	static unsigned long const flags[] = {
+		0, XDF_NEED_MINIMAL, XDF_PATIENCE_DIFF, XDF_HISTOGRAM_DIFF,
+		XDF_IGNORE_WHITESPACE,
+	};
+	static long const sizes[] = { 0, 64, 200 };
+	int i, j, k;
+
+	for (i = 0; i < 3; i++) {
+		mmfile_t a, b;
+
+		gen_minified(&a, 161 + i, 40 + i * 20, 0);
+		gen_minified(&b, 161 + i, 40 + i * 20, 1);
+		for (j = 0; j < (int)ARRAY_SIZE(flags); j++)
+			for (k = 0; k < (int)ARRAY_SIZE(sizes); k++) {
+				xpparam_t xpp = { 0 };
+
+				xpp.flags = flags[j] | XDF_SEGMENT_LINES;
+				xpp.segment_size = sizes[k];
+				if (!check(check_script(&a, &b, &xpp)) |
+				    !check(check_pieces(&a, &b, &xpp)))
+					test_msg("input %d, flags %lx, size %ld",
+						 i, flags[j], sizes[k]);
+			}
+		t_file_free(&a);
+		t_file_free(&b);
+	}
+}
+
+static void t_one_line(void)
+{
+	xpparam_t xpp = { 0 };
+	xdoutbuf_t ob;
+	mmfile_t a, b;
+	char *p;
+	long i;
+
+	/* a 1MB line with one value changed */
+	a.ptr = p = xmalloc(1 << 21);
+	for (i = 0; i < 100000; i++)
+		p += sprintf(p, "\"k%ld\":%ld,", i, i * 7 % 1000);
+	*p++ = '\n';
+	a.size = p - a.ptr;
+	b.ptr = xmalloc(a.size);
+	b.size = a.size;
+	memcpy(b.ptr, a.ptr, a.size);
+	p = strstr(b.ptr, "\"k50000\":");
+	p[9] = p[9] == '9' ? '8' : '9';
+
+	xpp.flags = XDF_SEGMENT_LINES;
+	if (check_int(t_diff(&a, &b, &xpp, 3, &ob), ==, 0)) {
+		check_uint(ob.size, <, 16384);
+		check(starts_with(ob.ptr, "@@ -1:"));
+		xdl_outbuf_release(&ob);
+	}
+	check(check_script(&a, &b, &xpp));
+	check(check_pieces(&a, &b, &xpp));
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	TEST(t_short_lines(), "files without long lines diff as without the flag");
+	TEST(t_minified(), "scripts are valid and pieces sit where the headers say");
+	TEST(t_one_line(), "one edit in a huge line gives a small hunk");
+	return test_done();
+}
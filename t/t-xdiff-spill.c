@@ -0,0 +1,110 @@
+#include "lib-xdiff.h"
+
+/*
+ * With a spill threshold below what the per-line arrays need, they live
+ * in unlinked temporary files. Nothing about the output may change.
+ */
+
+static char const *spill_dir;
+
+static void check_spilled(unsigned long flags, uint64_t seed, long vocab)
+{
+	xpparam_t mem = { 0 }, disk = { 0 };
+	mmfile_t a, b;
+
+	t_file_gen(&a, &seed, 30000, vocab);
+	t_file_edit(&b, &a, &seed, 300);
+	mem.flags = disk.flags = flags;
+	disk.spill_threshold = 4096;
+	disk.spill_dir = spill_dir;
+	if (!check(t_same_diff(&a, &b, &mem, &disk)))
+		test_msg("flags %#lx, seed %"PRIu64, flags, seed);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_myers(void)
+{
+	check_spilled(0, 50, 0);
+	check_spilled(0, 51, 100);
+	check_spilled(XDF_NEED_MINIMAL, 52, 100);
+	check_spilled(XDF_IGNORE_WHITESPACE, 53, 100);
+}
+
+static void t_other_algorithms(void)
+{
+	check_spilled(XDF_PATIENCE_DIFF, 54, 100);
+	check_spilled(XDF_HISTOGRAM_DIFF, 55, 100);
+	check_spilled(XDF_AUTO_DIFF, 56, 100);
+}
+
+static void t_merge(void)
+{
+	uint64_t seed = 57;
+	xmparam_t xmp = { 0 };
+	mmbuffer_t mem, disk;
+	mmfile_t o, a, b;
+	int r1, r2;
+
+	t_file_gen(&o, &seed, 20000, 200);
+	t_file_edit(&a, &o, &seed, 100);
+	t_file_edit(&b, &o, &seed, 100);
+	xmp.level = XDL_MERGE_ZEALOUS;
+	r1 = xdl_merge(&o, &a, &b, &xmp, &mem);
+	xmp.xpp.spill_threshold = 4096;
+	xmp.xpp.spill_dir = spill_dir;
+	r2 = xdl_merge(&o, &a, &b, &xmp, &disk);
+	check_int(r1, >=, 0);
+	if (check_int(r2, ==, r1) && r1 >= 0)
+		check_mem(disk.ptr, disk.size, mem.ptr, mem.size);
+	if (r1 >= 0)
+		free(mem.ptr);
+	if (r2 >= 0)
+		free(disk.ptr);
+	t_file_free(&o);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_spill_dir(void)
+{
+	uint64_t seed = 58;
+	xpparam_t xpp = { 0 };
+	DIR *dir;
+	struct dirent *de;
+	mmfile_t a, b;
+
+	t_file_gen(&a, &seed, 30000, 0);
+	t_file_edit(&b, &a, &seed, 30);
+
+	/* the threshold only matters once it is exceeded... */
+	xpp.spill_dir = "trash/no-such-dir";
+	check_int(t_changed(&a, &b, &xpp), >, 0);
+	xpp.spill_threshold = (size_t)1 << 40;
+	check_int(t_changed(&a, &b, &xpp), >, 0);
+	/* ... and then the files go to spill_dir */
+	xpp.spill_threshold = 4096;
+	check_int(t_changed(&a, &b, &xpp), ==, -1);
+
+	/* which is left empty */
+	xpp.spill_dir = spill_dir;
+	check_int(t_changed(&a, &b, &xpp), >, 0);
+	if (check((dir = opendir(spill_dir)) != NULL)) {
+		while ((de = readdir(dir)))
+			if (strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+				check_str(de->d_name, "");
+		closedir(dir);
+	}
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	spill_dir = t_trash_dir("t-xdiff-spill");
+	TEST(t_myers(), "spilled Myers diffs match in-memory ones");
+	TEST(t_other_algorithms(), "spilled patience, histogram and auto diffs match");
+	TEST(t_merge(), "spilled merges match in-memory ones");
+	TEST(t_spill_dir(), "spill files go to spill_dir and are unlinked");
+	return test_done();
+}
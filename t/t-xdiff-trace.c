@@ -0,0 +1,209 @@
+#include "lib-xdiff.h"
+
+/*
+ * Phase hooks: every enter is matched by a leave of the same phase on
+ * the same thread, phases nest as documented, the costs they report
+ * agree with the result, and setting them does not change the output.
+ */
+
+#define NPHASES (XDL_TRACE_MERGE + 1)
+
+struct trace {
+	long enters[NPHASES];
+	long leaves[NPHASES];
+	long cost[NPHASES];	/* summed over the leaves */
+	int failed;		/* an unmatched leave or a nonzero status */
+	int bad_nesting;
+};
+
+/* The phases open on this thread, innermost last. */
+static __thread int stack[16];
+static __thread int depth;
+
+static void on_enter(void *priv, int phase, long size1 UNUSED,
+		     long size2 UNUSED)
+{
+	struct trace *t = priv;
+
+	__atomic_add_fetch(&t->enters[phase], 1, __ATOMIC_RELAXED);
+	if (phase == XDL_TRACE_CLEANUP &&
+	    (!depth || stack[depth - 1] != XDL_TRACE_PREPARE))
+		__atomic_store_n(&t->bad_nesting, 1, __ATOMIC_RELAXED);
+	if (depth < (int)ARRAY_SIZE(stack))
+		stack[depth] = phase;
+	depth++;
+}
+
+static void on_leave(void *priv, int phase, long size1 UNUSED,
+		     long size2 UNUSED, long cost, int status)
+{
+	struct trace *t = priv;
+
+	__atomic_add_fetch(&t->leaves[phase], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&t->cost[phase], cost, __ATOMIC_RELAXED);
+	if (!depth || (depth <= (int)ARRAY_SIZE(stack) &&
+		       stack[depth - 1] != phase) || status < 0)
+		__atomic_store_n(&t->failed, 1, __ATOMIC_RELAXED);
+	else
+		depth--;
+}
+
+static void trace_start(xdtrace_t *hooks, struct trace *t)
+{
+	memset(t, 0, sizeof(*t));
+	hooks->enter = on_enter;
+	hooks->leave = on_leave;
+	hooks->priv = t;
+	xdl_trace_set(hooks);
+}
+
+static void check_balanced(struct trace const *t)
+{
+	int i;
+
+	check_int(t->failed, ==, 0);
+	check_int(t->bad_nesting, ==, 0);
+	check_int(depth, ==, 0);
+	for (i = 0; i < NPHASES; i++)
+		if (!check_int(t->enters[i], ==, t->leaves[i]))
+			test_msg("phase %d", i);
+}
+
+static int count_hunk(long start_a UNUSED, long count_a UNUSED,
+		      long start_b UNUSED, long count_b UNUSED, void *priv)
+{
+	(*(long *)priv)++;
+	return 0;
+}
+
+static void check_diff(unsigned long flags, int engine, xdpool_t *pool)
+{
+	uint64_t seed = 100 + flags;
+	xpparam_t xpp = { 0 };
+	xdemitconf_t xecfg = { 0 };
+	xdemitcb_t ecb = { 0 };
+	xdtrace_t hooks;
+	struct trace t;
+	mmfile_t a, b;
+	long hunks = 0, changed;
+
+	t_file_gen(&a, &seed, 20000, 500);
+	t_file_edit(&b, &a, &seed, 150);
+	xpp.flags = flags;
+	changed = t_changed(&a, &b, &xpp);
+
+	trace_start(&hooks, &t);
+	xecfg.hunk_func = count_hunk;
+	ecb.priv = &hunks;
+	check_int(xdl_diff(&a, &b, &xpp, &xecfg, &ecb), ==, 0);
+	xdl_trace_set(NULL);
+	check_balanced(&t);
+	/* patience and histogram prepare again to fall back to Myers */
+	check_int(t.enters[XDL_TRACE_PREPARE], >=, 1);
+	if (engine == XDL_TRACE_MYERS)
+		check_int(t.enters[XDL_TRACE_CLEANUP], ==, 1);
+	check_int(t.enters[engine], ==, 1);
+	check_int(t.enters[XDL_TRACE_COMPACT], ==, 2);
+	check_int(t.enters[XDL_TRACE_BUILD_SCRIPT], ==, 1);
+	check_int(t.enters[XDL_TRACE_EMIT], ==, 1);
+	check_int(t.enters[XDL_TRACE_MERGE], ==, 0);
+	/* compaction moves changes but does not change their number */
+	check_int(t.cost[engine], ==, changed);
+	check_int(t.cost[XDL_TRACE_COMPACT], ==, changed);
+	check_int(t.cost[XDL_TRACE_BUILD_SCRIPT], ==, hunks);
+	check_int(t.cost[XDL_TRACE_EMIT], ==, hunks);
+
+	/* pooled, the workers report their phases as well */
+	if (pool) {
+		xpparam_t pooled = xpp;
+
+		pooled.pool = pool;
+		trace_start(&hooks, &t);
+		check(t_same_diff(&a, &b, &xpp, &pooled));
+		xdl_trace_set(NULL);
+		check_balanced(&t);
+		check_int(t.enters[XDL_TRACE_PREPARE], >=, 2);
+	}
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_engines(void)
+{
+	check_diff(0, XDL_TRACE_MYERS, NULL);
+	check_diff(XDF_NEED_MINIMAL, XDL_TRACE_MYERS, NULL);
+	check_diff(XDF_PATIENCE_DIFF, XDL_TRACE_PATIENCE, NULL);
+	check_diff(XDF_HISTOGRAM_DIFF, XDL_TRACE_HISTOGRAM, NULL);
+}
+
+static void t_pool(void)
+{
+	xdpool_t *pool = xdl_pool_new(4);
+
+	check_diff(XDF_HISTOGRAM_DIFF, XDL_TRACE_HISTOGRAM, pool);
+	check_diff(XDF_PATIENCE_DIFF, XDL_TRACE_PATIENCE, pool);
+	check_diff(XDF_UNIQUE_ANCHORS, XDL_TRACE_MYERS, pool);
+	xdl_pool_put(pool);
+}
+
+static void t_merge(void)
+{
+	uint64_t seed = 110;
+	xmparam_t xmp = { 0 };
+	mmbuffer_t traced, plain;
+	xdtrace_t hooks;
+	struct trace t;
+	mmfile_t o, a, b;
+	int r1, r2;
+
+	t_file_gen(&o, &seed, 10000, 0);
+	t_file_edit(&a, &o, &seed, 60);
+	t_file_edit(&b, &o, &seed, 60);
+	xmp.level = XDL_MERGE_ZEALOUS;
+	r1 = xdl_merge(&o, &a, &b, &xmp, &plain);
+	trace_start(&hooks, &t);
+	r2 = xdl_merge(&o, &a, &b, &xmp, &traced);
+	xdl_trace_set(NULL);
+	check_balanced(&t);
+	check_int(t.enters[XDL_TRACE_MERGE], ==, 1);
+	check_int(t.enters[XDL_TRACE_PREPARE], ==, 2);
+	if (check_int(r1, >=, 0) && check_int(r2, ==, r1)) {
+		check_int(t.cost[XDL_TRACE_MERGE], ==, r1);
+		check_mem(traced.ptr, traced.size, plain.ptr, plain.size);
+	}
+	if (r1 >= 0)
+		free(plain.ptr);
+	if (r2 >= 0)
+		free(traced.ptr);
+	t_file_free(&o);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+static void t_unset(void)
+{
+	uint64_t seed = 111;
+	xpparam_t xpp = { 0 };
+	xdtrace_t hooks;
+	struct trace t;
+	mmfile_t a, b;
+
+	t_file_gen(&a, &seed, 2000, 0);
+	t_file_edit(&b, &a, &seed, 20);
+	trace_start(&hooks, &t);
+	xdl_trace_set(NULL);
+	check(t_diff_applies(&a, &b, &xpp));
+	check_int(t.enters[XDL_TRACE_PREPARE], ==, 0);
+	check_int(t.leaves[XDL_TRACE_EMIT], ==, 0);
+	t_file_free(&a);
+	t_file_free(&b);
+}
+
+int main(void)
+{
+	TEST(t_engines(), "each engine's phases are entered once and balanced");
+	TEST(t_pool(), "phases on pool workers are balanced and output unchanged");
+	TEST(t_merge(), "a merge nests its diffs and reports its conflicts");
+	TEST(t_unset(), "removed hooks are not called");
+	return test_done();
+}
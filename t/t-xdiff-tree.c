@@ -0,0 +1,244 @@
+#include "lib-xdiff.h"
+
+/*
+ * Tree diffs: every file that differs is reported exactly once, in
+ * path order, whatever mix of empty, identical and similar files the
+ * two sides have.
+ */
+
+static void write_file(char const *dir, char const *name, char const *data)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	t_file_write(path, data, strlen(data));
+}
+
+/* "<n> lines of <tag>\n" lines, distinct per tag */
+static char *lines(char const *tag, int n)
+{
+	char *buf = xmalloc(n * 32 + 1), *p = buf;
+	int i;
+
+	*p = '\0';
+	for (i = 0; i < n; i++)
+		p += sprintf(p, "%s %d\n", tag, i);
+	return buf;
+}
+
+struct listing {
+	char buf[16384];
+	size_t len;
+};
+
+static int list_entry(void *priv, xdtreeentry_t const *ent)
+{
+	struct listing *l = priv;
+
+	if (l->len >= sizeof(l->buf))
+		return -1;
+	l->len += snprintf(l->buf + l->len, sizeof(l->buf) - l->len,
+			   "%c %s %s %d%s\n", ent->status,
+			   ent->path1 ? ent->path1 : "-",
+			   ent->path2 ? ent->path2 : "-",
+			   ent->similarity, ent->binary ? " binary" : "");
+	return 0;
+}
+
+static void check_tree(char const *d1, char const *d2, int rename_score,
+		       xdpool_t *pool, char const *exp)
+{
+	struct listing l = { "", 0 };
+	xpparam_t xpp = { 0 };
+	xdemitconf_t xecfg = { 0 };
+	xdtreeconf_t tcf = { rename_score, list_entry, &l };
+
+	xpp.pool = pool;
+	xecfg.ctxlen = 3;
+	if (check_int(xdl_diff_trees(d1, d2, &xpp, &xecfg, &tcf), ==, 0))
+		check_str(l.buf, exp);
+}
+
+static void t_empty_file_deleted(void)
+{
+	char const *d1 = "trash/t-xdiff-tree/empty-a", *d2 = "trash/t-xdiff-tree/empty-b";
+	char name[16];
+	int i;
+
+	mkdir(d1, 0777);
+	mkdir(d2, 0777);
+	write_file(d1, "empty", "");
+	for (i = 1; i <= 6; i++) {
+		char *data;
+
+		snprintf(name, sizeof(name), "f%d", i);
+		data = lines(name, 10 + i);
+		write_file(d1, name, data);
+		free(data);
+	}
+	write_file(d2, "new", "unrelated\n");
+
+	check_tree(d1, d2, 50, NULL,
+		   "D empty - 0\n"
+		   "D f1 - 0\n"
+		   "D f2 - 0\n"
+		   "D f3 - 0\n"
+		   "D f4 - 0\n"
+		   "D f5 - 0\n"
+		   "D f6 - 0\n"
+		   "A - new 0\n");
+}
+
+static void t_renames(void)
+{
+	char const *d1 = "trash/t-xdiff-tree/ren-a", *d2 = "trash/t-xdiff-tree/ren-b";
+	char *same = lines("same", 30), *moved = lines("moved", 30);
+	char *old = lines("edited", 30), *edited = xstrfmt("%sone more\n", old);
+
+	mkdir(d1, 0777);
+	mkdir(d2, 0777);
+	write_file(d1, "empty1", "");
+	write_file(d2, "empty2", "");
+	write_file(d1, "same", same);
+	write_file(d2, "same", same);
+	write_file(d1, "moved", moved);
+	write_file(d2, "moved-to", moved);
+	write_file(d1, "old", old);
+	write_file(d2, "renamed", edited);
+	write_file(d1, "changed", "a\nb\n");
+	write_file(d2, "changed", "a\nc\n");
+
+	check_tree(d1, d2, 50, NULL,
+		   "M changed changed 0\n"
+		   "D empty1 - 0\n"
+		   "A - empty2 0\n"
+		   "R moved moved-to 100\n"
+		   "R old renamed 96\n");
+	/* exact renames only */
+	check_tree(d1, d2, 100, NULL,
+		   "M changed changed 0\n"
+		   "D empty1 - 0\n"
+		   "A - empty2 0\n"
+		   "R moved moved-to 100\n"
+		   "D old - 0\n"
+		   "A - renamed 0\n");
+	/* no renames */
+	check_tree(d1, d2, 0, NULL,
+		   "M changed changed 0\n"
+		   "D empty1 - 0\n"
+		   "A - empty2 0\n"
+		   "D moved - 0\n"
+		   "A - moved-to 0\n"
+		   "D old - 0\n"
+		   "A - renamed 0\n");
+	free(same);
+	free(moved);
+	free(old);
+	free(edited);
+}
+
+static void write_mf(char const *dir, char const *name, mmfile_t const *mf)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	t_file_write(path, mf->ptr, mf->size);
+}
+
+static void t_colliding(void)
+{
+	char const *d1 = "trash/t-xdiff-tree/coll-a", *d2 = "trash/t-xdiff-tree/coll-b";
+	char *data = lines("line", 2000);
+	mmfile_t a = t_file_str(data), c;
+
+	/* the same size and fast hash, different bytes */
+	t_file_collide(&c, &a);
+	mkdir(d1, 0777);
+	mkdir(d2, 0777);
+	write_mf(d1, "file", &a);
+	write_mf(d2, "file", &c);
+	write_mf(d1, "old", &a);
+	write_mf(d2, "new", &c);
+	write_mf(d1, "same", &a);
+	write_mf(d2, "same", &a);
+
+	check_tree(d1, d2, 100, NULL,
+		   "M file file 0\n"
+		   "A - new 0\n"
+		   "D old - 0\n");
+	free(data);
+	t_file_free(&c);
+}
+
+static void t_unreadable_dir(void)
+{
+	char const *d1 = "trash/t-xdiff-tree/unread-a", *d2 = "trash/t-xdiff-tree/unread-b";
+	char const *sub = "trash/t-xdiff-tree/unread-b/sub";
+	DIR *dir;
+
+	mkdir(d1, 0777);
+	mkdir(d2, 0777);
+	mkdir(sub, 0777);
+	write_file(d1, "a", "a\n");
+	write_file(d2, "a", "b\n");
+	write_file(sub, "hidden", "x\n");
+	chmod(sub, 0);
+	if ((dir = opendir(sub))) {
+		/* as root, say */
+		closedir(dir);
+		test_msg("%s stays readable, only checking the walk", sub);
+		check_tree(d1, d2, 50, NULL,
+			   "M a a 0\n"
+			   "A - sub/hidden 0\n");
+	} else {
+		check_tree(d1, d2, 50, NULL, "M a a 0\n");
+	}
+	chmod(sub, 0777);
+}
+
+static void t_pool(void)
+{
+	char const *d1 = "trash/t-xdiff-tree/pool-a", *d2 = "trash/t-xdiff-tree/pool-b";
+	xdpool_t *pool = xdl_pool_new(4);
+	struct listing serial = { "", 0 }, pooled = { "", 0 };
+	xpparam_t xpp = { 0 };
+	xdemitconf_t xecfg = { 0 };
+	xdtreeconf_t tcf = { 50, list_entry, &serial };
+	char name[16];
+	int i;
+
+	mkdir(d1, 0777);
+	mkdir(d2, 0777);
+	for (i = 0; i < 200; i++) {
+		char *data;
+
+		snprintf(name, sizeof(name), "f%03d", i);
+		data = lines(name, 20 + i % 7);
+		if (i % 5)
+			write_file(d1, name, data);
+		if (i % 7) {
+			if (i % 3 == 0)
+				name[0] = 'g';
+			write_file(d2, name, i % 4 ? data : "");
+		}
+		free(data);
+	}
+	xecfg.ctxlen = 3;
+	check_int(xdl_diff_trees(d1, d2, &xpp, &xecfg, &tcf), ==, 0);
+	tcf.priv = &pooled;
+	xpp.pool = pool;
+	check_int(xdl_diff_trees(d1, d2, &xpp, &xecfg, &tcf), ==, 0);
+	check_str(pooled.buf, serial.buf);
+	xdl_pool_put(pool);
+}
+
+int main(void)
+{
+	t_trash_dir("t-xdiff-tree");
+	TEST(t_empty_file_deleted(), "an empty deleted file is reported next to inexact candidates");
+	TEST(t_renames(), "renames, empty files and modifications");
+	TEST(t_colliding(), "files colliding under the fast hash are still diffed");
+	TEST(t_unreadable_dir(), "unreadable subdirectories are skipped");
+	TEST(t_pool(), "tree diffs on a pool report the same entries");
+	return test_done();
+}
@@ -0,0 +1,145 @@
+#include "test-lib.h"
+
+static struct {
+	int count;
+	int failed;
+	int running;
+	int result;	/* of the running test: 1 passed, 0 failed */
+} ctx;
+
+union test__tmp test__tmp[2];
+
+void test_msg(const char *format, ...)
+{
+	va_list ap;
+
+	fputs("# ", stdout);
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+	putc('\n', stdout);
+}
+
+int test_done(void)
+{
+	printf("1..%d\n", ctx.count);
+	if (ctx.failed)
+		test_msg("failed %d test(s) out of %d", ctx.failed, ctx.count);
+	else
+		test_msg("passed all %d test(s)", ctx.count);
+	fflush(stdout);
+	return ctx.failed ? 1 : 0;
+}
+
+int test__run_begin(void)
+{
+	if (ctx.running)
+		BUG("TEST() nested in another test");
+	ctx.running = 1;
+	ctx.result = 1;
+	return 0;
+}
+
+int test__run_end(int was_run UNUSED, const char *location,
+		  const char *format, ...)
+{
+	va_list ap;
+
+	ctx.count++;
+	if (!ctx.result) {
+		ctx.failed++;
+		fputs("not ", stdout);
+	}
+	printf("ok %d - ", ctx.count);
+	va_start(ap, format);
+	vprintf(format, ap);
+	va_end(ap);
+	putc('\n', stdout);
+	if (!ctx.result)
+		test_msg("  at %s", location);
+	fflush(stdout);
+	ctx.running = 0;
+	return ctx.result;
+}
+
+static void test_fail(const char *loc, const char *check)
+{
+	if (!ctx.running)
+		BUG("check outside of a test at %s", loc);
+	ctx.result = 0;
+	test_msg("check \"%s\" failed at %s", check, loc);
+}
+
+int check_bool_loc(const char *loc, const char *check, int ok)
+{
+	if (!ok)
+		test_fail(loc, check);
+	return ok;
+}
+
+int check_int_loc(const char *loc, const char *check, int ok,
+		  intmax_t a, intmax_t b)
+{
+	if (!ok) {
+		test_fail(loc, check);
+		test_msg("   left: %"PRIdMAX, a);
+		test_msg("  right: %"PRIdMAX, b);
+	}
+	return ok;
+}
+
+int check_uint_loc(const char *loc, const char *check, int ok,
+		   uintmax_t a, uintmax_t b)
+{
+	if (!ok) {
+		test_fail(loc, check);
+		test_msg("   left: %"PRIuMAX, a);
+		test_msg("  right: %"PRIuMAX, b);
+	}
+	return ok;
+}
+
+int check_str_loc(const char *loc, const char *check,
+		  const char *a, const char *b)
+{
+	int ok = (!a && !b) || (a && b && !strcmp(a, b));
+
+	if (!ok) {
+		test_fail(loc, check);
+		test_msg("   left: %s", a ? a : "NULL");
+		test_msg("  right: %s", b ? b : "NULL");
+	}
+	return ok;
+}
+
+static void print_context(const char *side, const char *p, size_t n,
+			  size_t at)
+{
+	size_t i = at > 40 ? at - 40 : 0, hi = at + 40 < n ? at + 40 : n;
+
+	printf("# %s: ", side);
+	for (; i < hi; i++) {
+		if (p[i] == '\n')
+			fputs("\\n", stdout);
+		else
+			putc(p[i], stdout);
+	}
+	putc('\n', stdout);
+}
+
+int check_mem_loc(const char *loc, const char *check,
+		  const char *a, size_t na, const char *b, size_t nb)
+{
+	size_t i;
+
+	for (i = 0; i < na && i < nb && a[i] == b[i]; i++)
+		;
+	if (i == na && i == nb)
+		return 1;
+	test_fail(loc, check);
+	test_msg("  first difference at byte %"PRIuMAX" (sizes %"PRIuMAX
+		 " and %"PRIuMAX")", (uintmax_t)i, (uintmax_t)na, (uintmax_t)nb);
+	print_context("   left", a, na, i);
+	print_context("  right", b, nb, i);
+	return 0;
+}
@@ -0,0 +1,84 @@
+#ifndef TEST_LIB_H
+#define TEST_LIB_H
+
+#include "git-compat-util.h"
+
+/*
+ * A small TAP producer for the xdiff tests, after git's unit tests:
+ *
+ *	static void t_empty(void)
+ *	{
+ *		check_int(changed_lines(&a, &a, &xpp), ==, 0);
+ *	}
+ *
+ *	int main(void)
+ *	{
+ *		TEST(t_empty(), "identical files have no changes");
+ *		return test_done();
+ *	}
+ *
+ * A failing check reports where it failed and what it compared, and
+ * fails the test it runs in; the test carries on, so one run shows
+ * everything that is wrong.
+ */
+
+#define TEST_LOCATION() TEST__MAKE_LOCATION(__LINE__)
+#define TEST__MAKE_LOCATION(line) __FILE__ ":" TEST__STR(line)
+#define TEST__STR(x) #x
+
+/* Run the statement t as one test described by the printf arguments. */
+#define TEST(t, ...)						\
+	test__run_end(test__run_begin() ? 0 : (t, 1),		\
+		      TEST_LOCATION(), __VA_ARGS__)
+
+#define check(x)							\
+	check_bool_loc(TEST_LOCATION(), #x, x)
+
+#define check_int(a, op, b)						\
+	(test__tmp[0].i = (a), test__tmp[1].i = (b),			\
+	 check_int_loc(TEST_LOCATION(), #a" "#op" "#b,			\
+		       test__tmp[0].i op test__tmp[1].i,		\
+		       test__tmp[0].i, test__tmp[1].i))
+
+#define check_uint(a, op, b)						\
+	(test__tmp[0].u = (a), test__tmp[1].u = (b),			\
+	 check_uint_loc(TEST_LOCATION(), #a" "#op" "#b,			\
+			test__tmp[0].u op test__tmp[1].u,		\
+			test__tmp[0].u, test__tmp[1].u))
+
+#define check_str(a, b)							\
+	check_str_loc(TEST_LOCATION(), "!strcmp("#a", "#b")", a, b)
+
+/* Compare two buffers of known length, reporting where they differ. */
+#define check_mem(a, na, b, nb)						\
+	check_mem_loc(TEST_LOCATION(), #a" == "#b, a, na, b, nb)
+
+/* Print a TAP comment ("# ...") about the current test. */
+__attribute__((format (printf, 1, 2)))
+void test_msg(const char *format, ...);
+
+/* Summarise the run; returns the exit status of the test program. */
+int test_done(void);
+
+/* Each operand of a check is evaluated once, into these. */
+union test__tmp {
+	intmax_t i;
+	uintmax_t u;
+};
+extern union test__tmp test__tmp[2];
+
+int test__run_begin(void);
+__attribute__((format (printf, 3, 4)))
+int test__run_end(int was_run, const char *location, const char *format, ...);
+
+int check_bool_loc(const char *loc, const char *check, int ok);
+int check_int_loc(const char *loc, const char *check, int ok,
+		  intmax_t a, intmax_t b);
+int check_uint_loc(const char *loc, const char *check, int ok,
+		   uintmax_t a, uintmax_t b);
+int check_str_loc(const char *loc, const char *check,
+		  const char *a, const char *b);
+int check_mem_loc(const char *loc, const char *check,
+		  const char *a, size_t na, const char *b, size_t nb);
+
+#endif /* TEST_LIB_H */
@@ -0,0 +1,159 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * Routing of xdl_malloc() and friends to the allocator of the current
+ * call (xpparam_t.alloc).
+ *
+ * The public entry points make their allocator current for the calling
+ * thread, and the pool hands it on to the tasks it runs, so everything
+ * a diff or merge allocates goes through it. Each block carries a small
+ * header with its size, which is what lets frees be accounted. Memory
+ * that outlives the call (merge results, output buffers) and the pool's
+ * own bookkeeping come from the xdl_sys_*() functions instead, so that
+ * callers keep releasing them with free().
+ */
+
+#if defined(NO_PTHREADS)
+#define XDL_THREAD_LOCAL
+#elif defined(_MSC_VER)
+#define XDL_THREAD_LOCAL __declspec(thread)
+#else
+#define XDL_THREAD_LOCAL __thread
+#endif
+
+typedef union u_xdallochdr {
+	size_t size;
+	long double align;	/* keep blocks aligned like malloc()'s */
+} xdallochdr_t;
+
+static XDL_THREAD_LOCAL xdalloc_t *xdl_alloc_current;
+
+xdalloc_t *xdl_alloc_set(xdalloc_t *alloc)
+{
+	xdalloc_t *prev = xdl_alloc_current;
+
+	xdl_alloc_current = alloc;
+	return prev;
+}
+
+xdalloc_t *xdl_alloc_get(void)
+{
+	return xdl_alloc_current;
+}
+
+static int xdl_alloc_charge(xdalloc_t *a, size_t size)
+{
+	size_t cur = xdl_atomic_add(&a->current, size, XDL_ATOMIC_RELAXED);
+	size_t peak = xdl_atomic_load(&a->peak, XDL_ATOMIC_RELAXED);
+
+	if (a->limit && cur > a->limit) {
+		xdl_atomic_sub(&a->current, size, XDL_ATOMIC_RELAXED);
+		xdl_atomic_add(&a->denied, 1, XDL_ATOMIC_RELAXED);
+		return -1;
+	}
+	xdl_atomic_add(&a->total, size, XDL_ATOMIC_RELAXED);
+	while (peak < cur &&
+	       !xdl_atomic_cas(&a->peak, &peak, cur, XDL_ATOMIC_RELAXED))
+		;
+	return 0;
+}
+
+static void xdl_alloc_credit(xdalloc_t *a, size_t size)
+{
+	xdl_atomic_sub(&a->current, size, XDL_ATOMIC_RELAXED);
+}
+
+void *xdl_alloc_malloc(size_t size)
+{
+	xdalloc_t *a = xdl_alloc_current;
+	xdallochdr_t *h;
+
+	if (!a)
+		return xdl_sys_malloc(size);
+	if (size > SIZE_MAX - sizeof(*h) || xdl_alloc_charge(a, size) < 0)
+		return NULL;
+	h = a->malloc ? a->malloc(a->priv, sizeof(*h) + size) :
+		malloc(sizeof(*h) + size);
+	if (!h) {
+		xdl_alloc_credit(a, size);
+		return NULL;
+	}
+	h->size = size;
+	return h + 1;
+}
+
+void *xdl_alloc_calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (!xdl_alloc_current)
+		return xdl_sys_calloc(nmemb, size);
+	if (size && nmemb > SIZE_MAX / size)
+		return NULL;
+	if ((ptr = xdl_alloc_malloc(nmemb * size)))
+		memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+void *xdl_alloc_realloc(void *ptr, size_t size)
+{
+	xdalloc_t *a = xdl_alloc_current;
+	xdallochdr_t *h;
+	size_t old;
+
+	if (!a)
+		return xdl_sys_realloc(ptr, size);
+	if (!ptr)
+		return xdl_alloc_malloc(size);
+	h = (xdallochdr_t *)ptr - 1;
+	old = h->size;
+	if (size > SIZE_MAX - sizeof(*h) ||
+	    (size > old && xdl_alloc_charge(a, size - old) < 0))
+		return NULL;
+	h = a->realloc ? a->realloc(a->priv, h, sizeof(*h) + size) :
+		realloc(h, sizeof(*h) + size);
+	if (!h) {
+		if (size > old)
+			xdl_alloc_credit(a, size - old);
+		return NULL;
+	}
+	if (size < old)
+		xdl_alloc_credit(a, old - size);
+	h->size = size;
+	return h + 1;
+}
+
+void xdl_alloc_free(void *ptr)
+{
+	xdalloc_t *a = xdl_alloc_current;
+	xdallochdr_t *h;
+
+	if (!a) {
+		xdl_sys_free(ptr);
+		return;
+	}
+	if (!ptr)
+		return;
+	h = (xdallochdr_t *)ptr - 1;
+	xdl_alloc_credit(a, h->size);
+	if (a->free)
+		a->free(a->priv, h);
+	else
+		free(h);
+}
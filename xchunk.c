@@ -0,0 +1,518 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * XDF_CHUNK_PREPASS: diffing huge, nearly identical files.
+ *
+ * Both files are cut into content-defined chunks (FastCDC, "FastCDC:
+ * a Fast and Efficient Content-Defined Chunking Approach for Data
+ * Deduplication", Xia et al.) whose boundaries are moved forward to
+ * the next line end, so that every chunk is a run of whole lines.
+ * Because boundaries only depend on nearby content, an edit disturbs
+ * the chunks around it and the chunking falls back in step right
+ * after. Chunks are matched by a 64-bit hash (confirmed with memcmp)
+ * the same way patience diff matches lines: unique on both sides,
+ * longest increasing run, then grown over identical neighbours.
+ *
+ * Only the regions between matched runs, widened by a few lines of
+ * margin, go through the full preparation and diff; the rest of the
+ * file is merely split into lines so that the script can be built and
+ * emitted with the usual context and function names. The regions are
+ * diffed with the cost limits of the whole files: a small region
+ * would otherwise make Myers give up far earlier than a plain diff of
+ * the same input does, and come back with many more changed lines.
+ *
+ * Chunk matching pins the alignment, which is only safe when the files
+ * really are nearly identical. When the regions come back with more
+ * than 1/XDL_CDC_PLAIN_RATIO of all lines changed (blocks moved around,
+ * wholesale rewrites), the whole files are diffed plainly as well and
+ * whichever result changes fewer lines is kept.
+ */
+
+#define XDL_CDC_MIN (2 * 1024)
+#define XDL_CDC_AVG (8 * 1024)
+#define XDL_CDC_MAX (64 * 1024)
+#define XDL_CDC_MASK_S 0x0003590703530000ULL	/* 15 bits, before AVG */
+#define XDL_CDC_MASK_L 0x0000d90003530000ULL	/* 11 bits, after AVG */
+#define XDL_CDC_MARGIN 32			/* lines diffed around each region */
+#define XDL_CDC_MIN_SIZE (1024 * 1024)		/* smaller inputs skip the pre-pass */
+#define XDL_CDC_PLAIN_RATIO 32			/* changed lines that call for a plain diff */
+
+typedef struct s_xdcdcchunk {
+	size_t off, len;
+	uint64_t hash;
+} xdcdcchunk_t;
+
+typedef struct s_xdcdcfile {
+	uint8_t const *data;
+	size_t size;
+	xdcdcchunk_t *chunks;
+	long nchunk, alloc;
+} xdcdcfile_t;
+
+typedef struct s_xdcdcent {
+	uint64_t hash;
+	long idx;
+	int side;
+} xdcdcent_t;
+
+typedef struct s_xdcdcregion {
+	long s1, e1, s2, e2;	/* line ranges [s, e) still to diff */
+	xdscale_t scale;	/* record counts of the whole files */
+	xdfenv_t *xe;
+	xpparam_t const *xpp;
+	int res;
+} xdcdcregion_t;
+
+static void xdl_cdc_gear(uint64_t *gear)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	int i;
+
+	/* splitmix64; any fixed random table does */
+	for (i = 0; i < 256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+static size_t xdl_cdc_cut(uint64_t const *gear, uint8_t const *p, size_t n)
+{
+	size_t i = XDL_CDC_MIN, normal = XDL_CDC_AVG, lim = n;
+	uint64_t h = 0;
+	uint8_t const *nl;
+
+	if (n <= XDL_CDC_MIN)
+		return n;
+	if (lim > XDL_CDC_MAX)
+		lim = XDL_CDC_MAX;
+	if (normal > lim)
+		normal = lim;
+	for (; i < normal; i++)
+		if (!((h = (h << 1) + gear[p[i]]) & XDL_CDC_MASK_S))
+			goto found;
+	for (; i < lim; i++)
+		if (!((h = (h << 1) + gear[p[i]]) & XDL_CDC_MASK_L))
+			goto found;
+found:
+	/* Snap to the end of the line the cut point falls in. */
+	if (i < n && p[i - 1] != '\n')
+		i = (nl = memchr(p + i, '\n', n - i)) ? (size_t)(nl - p) + 1 : n;
+	return i;
+}
+
+static int xdl_cdc_split(xdcdcfile_t *cf, uint64_t const *gear, xpparam_t const *xpp)
+{
+	size_t off, len;
+	xdcdcchunk_t *ch;
+
+	for (off = 0; off < cf->size; off += len) {
+		if (!(cf->nchunk & XDL_ABORT_POLL_MASK) && xdl_should_abort(xpp))
+			return -1;
+		len = xdl_cdc_cut(gear, cf->data + off, cf->size - off);
+		if (XDL_ALLOC_GROW(cf->chunks, cf->nchunk + 1, cf->alloc))
+			return -1;
+		ch = &cf->chunks[cf->nchunk++];
+		ch->off = off;
+		ch->len = len;
+		ch->hash = xdl_hash_bytes(cf->data + off, len);
+	}
+
+	return 0;
+}
+
+static int xdl_cdc_eq(xdcdcfile_t const *a, long ia, xdcdcfile_t const *b, long ib)
+{
+	xdcdcchunk_t const *ca = &a->chunks[ia], *cb = &b->chunks[ib];
+
+	return ca->hash == cb->hash && ca->len == cb->len &&
+		!memcmp(a->data + ca->off, b->data + cb->off, ca->len);
+}
+
+static int xdl_cdc_cmp(const void *p1, const void *p2)
+{
+	xdcdcent_t const *e1 = p1, *e2 = p2;
+
+	if (e1->hash != e2->hash)
+		return e1->hash < e2->hash ? -1 : 1;
+	if (e1->side != e2->side)
+		return e1->side - e2->side;
+	return e1->idx < e2->idx ? -1 : e1->idx > e2->idx;
+}
+
+/*
+ * Matches chunks [lo1, hi1) of a against [lo2, hi2) of b, filling
+ * match[i] with the index of the chunk in b that a's chunk i is equal
+ * to, or -1.
+ */
+static int xdl_cdc_match(xdcdcfile_t const *a, xdcdcfile_t const *b,
+			 long lo1, long hi1, long lo2, long hi2, long *match)
+{
+	long i, j, n = (hi1 - lo1) + (hi2 - lo2), ncand = 0, len = 0, lo, hi, mid;
+	long *c1 = NULL, *c2 = NULL, *tails = NULL, *prev = NULL;
+	xdcdcent_t *ent;
+	int ret = -1;
+
+	if (!XDL_ALLOC_ARRAY(ent, n + 1))
+		return -1;
+	for (i = lo1, j = 0; i < hi1; i++, j++) {
+		ent[j].hash = a->chunks[i].hash;
+		ent[j].idx = i;
+		ent[j].side = 0;
+	}
+	for (i = lo2; i < hi2; i++, j++) {
+		ent[j].hash = b->chunks[i].hash;
+		ent[j].idx = i;
+		ent[j].side = 1;
+	}
+	QSORT(ent, n, xdl_cdc_cmp);
+
+	if (!XDL_ALLOC_ARRAY(c1, n + 1) || !XDL_ALLOC_ARRAY(c2, n + 1) ||
+	    !XDL_ALLOC_ARRAY(tails, n + 1) || !XDL_ALLOC_ARRAY(prev, n + 1))
+		goto out;
+
+	/* Chunks unique on both sides, in the order of b... */
+	for (i = 0; i + 1 < n; i = j) {
+		for (j = i + 1; j < n && ent[j].hash == ent[i].hash; j++)
+			;
+		if (j - i == 2 && !ent[i].side && ent[i + 1].side &&
+		    xdl_cdc_eq(a, ent[i].idx, b, ent[i + 1].idx))
+			c2[ent[i].idx - lo1] = ent[i + 1].idx;
+		else
+			for (; i < j; i++)
+				if (!ent[i].side)
+					c2[ent[i].idx - lo1] = -1;
+	}
+	if (i < n && !ent[i].side)
+		c2[ent[i].idx - lo1] = -1;
+	/* ... then in the order of a. */
+	for (i = lo1; i < hi1; i++)
+		if (c2[i - lo1] >= 0) {
+			c1[ncand] = i;
+			c2[ncand++] = c2[i - lo1];
+		}
+
+	/* Longest increasing run by b index. */
+	for (i = 0; i < ncand; i++) {
+		for (lo = 0, hi = len; lo < hi;) {
+			mid = lo + (hi - lo) / 2;
+			if (c2[tails[mid]] < c2[i])
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		prev[i] = lo ? tails[lo - 1] : -1;
+		tails[lo] = i;
+		if (lo == len)
+			len++;
+	}
+
+	for (i = lo1; i < hi1; i++)
+		match[i] = -1;
+	for (i = len ? tails[len - 1] : -1; i >= 0; i = prev[i])
+		match[c1[i]] = c2[i];
+	ret = 0;
+out:
+	xdl_free(prev);
+	xdl_free(tails);
+	xdl_free(c2);
+	xdl_free(c1);
+	xdl_free(ent);
+	return ret;
+}
+
+/*
+ * Splits mf into line records without hashing or classifying them;
+ * enough to build and emit a script.
+ */
+static int xdl_cdc_lines(mmfile_t *mf, xdfile_t *xdf)
+{
+	long size;
+	uint8_t const *cur, *top, *nl;
+	size_t n = 0;
+
+	memset(xdf, 0, sizeof(*xdf));
+	if ((cur = xdl_mmfile_first(mf, &size))) {
+		for (top = cur + size; cur < top; n++)
+			cur = (nl = memchr(cur, '\n', top - cur)) ? nl + 1 : top;
+	}
+	if (!XDL_ALLOC_ARRAY(xdf->recs, n + 1) ||
+	    !XDL_CALLOC_ARRAY(xdf->changed, n + 2)) {
+		xdl_free(xdf->recs);
+		return -1;
+	}
+	xdf->changed += 1;
+	if ((cur = xdl_mmfile_first(mf, &size))) {
+		for (top = cur + size; cur < top; xdf->nrec++) {
+			xrecord_t *rec = &xdf->recs[xdf->nrec];
+
+			rec->ptr = cur;
+			cur = (nl = memchr(cur, '\n', top - cur)) ? nl + 1 : top;
+			rec->size = cur - rec->ptr;
+			rec->line_hash = 0;
+			rec->minimal_perfect_hash = 0;
+		}
+	}
+	xdf->dstart = 0;
+	xdf->dend = xdf->nrec - 1;
+
+	return 0;
+}
+
+/* Index of the line starting at byte offset off. */
+static long xdl_cdc_line_at(xdfile_t const *xdf, uint8_t const *base, size_t off)
+{
+	long lo = 0, hi = (long)xdf->nrec, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((size_t)(xdf->recs[mid].ptr - base) < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void xdl_cdc_region_run(void *priv)
+{
+	xdcdcregion_t *rg = priv;
+	xdfile_t *xdf1 = &rg->xe->xdf1, *xdf2 = &rg->xe->xdf2;
+	mmfile_t m1, m2;
+	xpparam_t sxpp;
+	xdfenv_t sub;
+	long i;
+
+	rg->res = -1;
+	m1.ptr = (char *)(rg->e1 > rg->s1 ? xdf1->recs[rg->s1].ptr : NULL);
+	m1.size = rg->e1 > rg->s1 ?
+		(long)(xdf1->recs[rg->e1 - 1].ptr + xdf1->recs[rg->e1 - 1].size -
+		       xdf1->recs[rg->s1].ptr) : 0;
+	m2.ptr = (char *)(rg->e2 > rg->s2 ? xdf2->recs[rg->s2].ptr : NULL);
+	m2.size = rg->e2 > rg->s2 ?
+		(long)(xdf2->recs[rg->e2 - 1].ptr + xdf2->recs[rg->e2 - 1].size -
+		       xdf2->recs[rg->s2].ptr) : 0;
+
+	sxpp = *rg->xpp;
+	sxpp.flags &= ~XDF_CHUNK_PREPASS;
+	sxpp.auto_info = NULL;
+	sxpp.index_dir = NULL;
+	if (xdl_do_diff_region(&m1, &m2, &sxpp, &sub, &rg->scale) < 0)
+		return;
+	if (xdl_change_compact(&sub.xdf1, &sub.xdf2, sxpp.flags) < 0 ||
+	    xdl_change_compact(&sub.xdf2, &sub.xdf1, sxpp.flags) < 0 ||
+	    (long)sub.xdf1.nrec != rg->e1 - rg->s1 ||
+	    (long)sub.xdf2.nrec != rg->e2 - rg->s2) {
+		xdl_free_env(&sub);
+		return;
+	}
+	for (i = 0; i < (long)sub.xdf1.nrec; i++)
+		xdf1->changed[rg->s1 + i] = sub.xdf1.changed[i];
+	for (i = 0; i < (long)sub.xdf2.nrec; i++)
+		xdf2->changed[rg->s2 + i] = sub.xdf2.changed[i];
+	xdl_free_env(&sub);
+	rg->res = 0;
+}
+
+/*
+ * Replaces the chunked result in *xe by a plain diff of the whole
+ * files if that changes fewer lines. *xe is left alone on failure.
+ */
+static int xdl_cdc_plain(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			 xdfenv_t *xe)
+{
+	xdfenv_t plain;
+
+	if (xdl_do_diff(mf1, mf2, xpp, &plain) < 0)
+		return -1;
+	if (xdl_change_compact(&plain.xdf1, &plain.xdf2, xpp->flags) < 0 ||
+	    xdl_change_compact(&plain.xdf2, &plain.xdf1, xpp->flags) < 0) {
+		xdl_free_env(&plain);
+		return -1;
+	}
+	if (xdl_trace_changed(&plain.xdf1) + xdl_trace_changed(&plain.xdf2) <
+	    xdl_trace_changed(&xe->xdf1) + xdl_trace_changed(&xe->xdf2)) {
+		xdl_free_env(xe);
+		*xe = plain;
+	} else
+		xdl_free_env(&plain);
+
+	return 0;
+}
+
+int xdl_do_chunked_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			xdfenv_t *xe)
+{
+	xdcdcfile_t a, b;
+	uint64_t gear[256];
+	long i, j, lo, hi1, hi2, nreg = 0, *match = NULL;
+	long m1, m2, n1, n2, pe1, pe2;
+	xdcdcregion_t *regs = NULL;
+	xdtask_group_t grp;
+	int res = -1;
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	a.data = xdl_mmfile_first(mf1, &n1);
+	a.size = n1;
+	b.data = xdl_mmfile_first(mf2, &n2);
+	b.size = n2;
+
+	xdl_cdc_gear(gear);
+	if (xdl_cdc_split(&a, gear, xpp) < 0 || xdl_cdc_split(&b, gear, xpp) < 0)
+		goto out;
+
+	/* Identical leading and trailing chunks need no hashing lookup. */
+	for (lo = 0; lo < a.nchunk && lo < b.nchunk && xdl_cdc_eq(&a, lo, &b, lo); lo++)
+		;
+	for (hi1 = a.nchunk, hi2 = b.nchunk;
+	     hi1 > lo && hi2 > lo && xdl_cdc_eq(&a, hi1 - 1, &b, hi2 - 1);
+	     hi1--, hi2--)
+		;
+	if (!XDL_ALLOC_ARRAY(match, a.nchunk + 1))
+		goto out;
+	for (i = 0; i < lo; i++)
+		match[i] = i;
+	for (i = hi1; i < a.nchunk; i++)
+		match[i] = hi2 + (i - hi1);
+	if (xdl_cdc_match(&a, &b, lo, hi1, lo, hi2, match) < 0)
+		goto out;
+
+	/*
+	 * Grow matches over identical neighbours, both ways, as long as
+	 * the b side stays strictly increasing.
+	 */
+	for (i = lo, j = lo; i < hi1; i++) {
+		if (match[i] >= 0 || !i || match[i - 1] < 0)
+			continue;
+		for (j = XDL_MAX(j, i + 1); j < a.nchunk && match[j] < 0; j++)
+			;
+		if (match[i - 1] + 1 < (j < a.nchunk ? match[j] : b.nchunk) &&
+		    xdl_cdc_eq(&a, i, &b, match[i - 1] + 1))
+			match[i] = match[i - 1] + 1;
+	}
+	for (i = hi1 - 1, j = hi1 - 1; i >= lo; i--) {
+		if (match[i] >= 0 || i + 1 >= a.nchunk || match[i + 1] < 0)
+			continue;
+		for (j = XDL_MIN(j, i - 1); j >= 0 && match[j] < 0; j--)
+			;
+		if (match[i + 1] - 1 > (j >= 0 ? match[j] : -1) &&
+		    xdl_cdc_eq(&a, i, &b, match[i + 1] - 1))
+			match[i] = match[i + 1] - 1;
+	}
+
+	if (xdl_cdc_lines(mf1, &xe->xdf1) < 0)
+		goto out;
+	if (xdl_cdc_lines(mf2, &xe->xdf2) < 0) {
+		xdl_free_env(xe);
+		goto out;
+	}
+
+	/*
+	 * Every gap between matched chunks is a region to diff; regions
+	 * separated by less than two margins of identical lines are
+	 * merged, then each is widened by the margin.
+	 */
+	if (!XDL_ALLOC_ARRAY(regs, a.nchunk + 2))
+		goto fail;
+	for (i = 0, pe1 = pe2 = 0; i <= a.nchunk; i++) {
+		size_t off1, off2;
+		long s1, s2;
+
+		if (i < a.nchunk && match[i] < 0)
+			continue;
+		off1 = i < a.nchunk ? a.chunks[i].off : a.size;
+		off2 = i < a.nchunk ? b.chunks[match[i]].off : b.size;
+		s1 = xdl_cdc_line_at(&xe->xdf1, a.data, off1);
+		s2 = xdl_cdc_line_at(&xe->xdf2, b.data, off2);
+		if (s1 > pe1 || s2 > pe2) {
+			if (nreg && pe1 - regs[nreg - 1].e1 < 2 * XDL_CDC_MARGIN) {
+				regs[nreg - 1].e1 = s1;
+				regs[nreg - 1].e2 = s2;
+			} else {
+				regs[nreg].s1 = pe1;
+				regs[nreg].s2 = pe2;
+				regs[nreg].e1 = s1;
+				regs[nreg].e2 = s2;
+				nreg++;
+			}
+		}
+		if (i < a.nchunk) {
+			pe1 = xdl_cdc_line_at(&xe->xdf1, a.data, off1 + a.chunks[i].len);
+			pe2 = xdl_cdc_line_at(&xe->xdf2, b.data, off2 + a.chunks[i].len);
+		}
+	}
+	if (nreg && (long)xe->xdf1.nrec - regs[nreg - 1].e1 < 2 * XDL_CDC_MARGIN) {
+		regs[nreg - 1].e1 = (long)xe->xdf1.nrec;
+		regs[nreg - 1].e2 = (long)xe->xdf2.nrec;
+	}
+	for (i = 0; i < nreg; i++) {
+		m1 = XDL_MIN(XDL_CDC_MARGIN, regs[i].s1);
+		m2 = XDL_MIN(XDL_CDC_MARGIN, (long)xe->xdf1.nrec - regs[i].e1);
+		regs[i].s1 -= m1;
+		regs[i].s2 -= m1;
+		regs[i].e1 += m2;
+		regs[i].e2 += m2;
+		regs[i].scale.nrec1 = (long)xe->xdf1.nrec;
+		regs[i].scale.nrec2 = (long)xe->xdf2.nrec;
+		regs[i].xe = xe;
+		regs[i].xpp = xpp;
+		regs[i].res = 0;
+	}
+
+	xdl_group_init(&grp, nreg > 1 ? xpp->pool : NULL);
+	for (j = 0; j < nreg; j++) {
+		xdtask_t t = { xdl_cdc_region_run, NULL, &regs[j],
+			       XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY };
+
+		if (xdl_pool_submit(&grp, &t) < 0)
+			xdl_cdc_region_run(&regs[j]);
+	}
+	if (xdl_group_wait(&grp) < 0)
+		goto fail;
+	for (j = 0; j < nreg; j++)
+		if (regs[j].res < 0)
+			goto fail;
+	if ((xdl_trace_changed(&xe->xdf1) + xdl_trace_changed(&xe->xdf2)) *
+	    XDL_CDC_PLAIN_RATIO > (long)(xe->xdf1.nrec + xe->xdf2.nrec) &&
+	    xdl_cdc_plain(mf1, mf2, xpp, xe) < 0)
+		goto fail;
+	res = 0;
+	goto out;
+
+fail:
+	xdl_free_env(xe);
+out:
+	xdl_free(regs);
+	xdl_free(match);
+	xdl_free(b.chunks);
+	xdl_free(a.chunks);
+	return res;
+}
+
+int xdl_chunk_prepass_wanted(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp)
+{
+	/* the chunk diff prepares whole lines */
+	return (xpp->flags & XDF_CHUNK_PREPASS) &&
+		!(xpp->flags & XDF_SEGMENT_LINES) &&
+		xdl_mmfile_size(mf1) >= XDL_CDC_MIN_SIZE &&
+		xdl_mmfile_size(mf2) >= XDL_CDC_MIN_SIZE;
+}
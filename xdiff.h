@@ -43,9 +43,24 @@ extern "C" {
 
 #define XDF_PATIENCE_DIFF (1 << 14)
 #define XDF_HISTOGRAM_DIFF (1 << 15)
-#define XDF_DIFF_ALGORITHM_MASK (XDF_PATIENCE_DIFF | XDF_HISTOGRAM_DIFF | XDF_NEED_MINIMAL)
+/* pick one of the above (or Myers) from the input; see xdautoinfo_t */
+#define XDF_AUTO_DIFF (1 << 16)
+#define XDF_DIFF_ALGORITHM_MASK (XDF_PATIENCE_DIFF | XDF_HISTOGRAM_DIFF | XDF_NEED_MINIMAL | \
+				 XDF_AUTO_DIFF)
 #define XDF_DIFF_ALG(x) ((x) & XDF_DIFF_ALGORITHM_MASK)
 
+/* split Myers at lines unique to both sides (see xdl_anchored_diff) */
+#define XDF_UNIQUE_ANCHORS (1 << 17)
+
+/* only fully diff the parts of large inputs that differ (see xchunk.c) */
+#define XDF_CHUNK_PREPASS (1 << 18)
+
+/* diff lines longer than xpparam_t.segment_size in pieces (see xprepare.c) */
+#define XDF_SEGMENT_LINES (1 << 19)
+
+/* take lines XDF_IGNORE_BLANK_LINES or -I makes ignorable out before diffing */
+#define XDF_FILTER_IGNORED (1 << 20)
+
 #define XDF_INDENT_HEURISTIC (1 << 23)
 
 /* xdemitconf_t.flags */
@@ -53,6 +68,21 @@ extern "C" {
 #define XDL_EMIT_NO_HUNK_HDR (1 << 1)
 #define XDL_EMIT_FUNCCONTEXT (1 << 2)
 
+/* xdemitconf_t.func_lang: built-in function header matchers */
+#define XDL_FUNC_LANG_NONE 0
+#define XDL_FUNC_LANG_C 1
+#define XDL_FUNC_LANG_CPP 2
+#define XDL_FUNC_LANG_PYTHON 3
+#define XDL_FUNC_LANG_JS 4	/* also TypeScript */
+#define XDL_FUNC_LANG_GO 5
+#define XDL_FUNC_LANG_RUST 6
+#define XDL_FUNC_LANG_JAVA 7
+
+/* xdl_diff_html() and xdl_html_patch() flags */
+#define XDL_HTML_SIDEBYSIDE (1 << 0)
+#define XDL_HTML_HIGHLIGHT (1 << 1)	/* mark changes within paired lines */
+#define XDL_HTML_NO_HUNK_HDR (1 << 2)
+
 /* merge simplification levels */
 #define XDL_MERGE_MINIMAL 0
 #define XDL_MERGE_EAGER 1
@@ -68,6 +98,13 @@ extern "C" {
 #define XDL_MERGE_DIFF3 1
 #define XDL_MERGE_ZEALOUS_DIFF3 2
 
+/* xdmergeregion_t.mode */
+#define XDL_MERGE_REGION_CONFLICT 0
+#define XDL_MERGE_REGION_OURS 1
+#define XDL_MERGE_REGION_THEIRS 2
+#define XDL_MERGE_REGION_BOTH 3
+#define XDL_MERGE_REGION_SAME 4	/* both sides made the same change */
+
 typedef struct s_mmfile {
 	char *ptr;
 	long size;
@@ -78,6 +115,62 @@ typedef struct s_mmbuffer {
 	long size;
 } mmbuffer_t;
 
+/*
+ * Output buffer for results of unknown final size. ptr stays stable
+ * for the lifetime of the buffer when the platform lets us reserve
+ * address space up front (see xoutbuf.c).
+ */
+typedef struct s_xdoutbuf {
+	char *ptr;
+	size_t size;		/* bytes written so far */
+	size_t committed;	/* bytes currently backed by memory */
+	size_t reserved;	/* address space reserved, 0 if not mapped */
+	size_t limit;		/* size may never grow beyond this */
+	int mapped;
+} xdoutbuf_t;
+
+/*
+ * Work-stealing pool for CPU-heavy diff work, sized independently of
+ * whatever threads the embedder does its I/O on (see xpool.c).
+ */
+typedef struct s_xdpool xdpool_t;
+
+/*
+ * What XDF_AUTO_DIFF saw and what it decided. Record counts are taken
+ * after whitespace folding, over the whole of both files.
+ */
+typedef struct s_xdautoinfo {
+	long nrec1, nrec2;	/* records in each file */
+	long nclass;		/* distinct records */
+	long nunique;		/* records occurring exactly once in each file */
+	long nunmatched;	/* records with no counterpart on the other side */
+	long maxdup;		/* highest multiplicity of a shared record */
+	long breaks;		/* unique records appearing out of order */
+	unsigned long alg;	/* XDF_DIFF_ALG() value that was used */
+	long mxcost;		/* Myers cost limit, if Myers was picked */
+} xdautoinfo_t;
+
+/*
+ * Allocator for everything a diff or merge allocates internally,
+ * including on pool threads (see xdl_pool_worker() for placing memory
+ * per worker), so with xpp->pool set the hooks are called from several
+ * threads at once. NULL functions mean malloc(), realloc() and free().
+ * When an allocation would take current over limit, it fails and the
+ * call returns -1. The counters accumulate over calls until reset.
+ */
+typedef struct s_xdalloc {
+	void *(*malloc)(void *priv, size_t size);
+	void *(*realloc)(void *priv, void *ptr, size_t size);
+	void (*free)(void *priv, void *ptr);
+	void *priv;
+	size_t limit;		/* bytes live at once; 0: no limit */
+
+	size_t current;		/* bytes live now */
+	size_t peak;		/* most bytes live at once */
+	size_t total;		/* bytes ever allocated */
+	unsigned long denied;	/* allocations refused by the limit */
+} xdalloc_t;
+
 typedef struct s_xpparam {
 	unsigned long flags;
 
@@ -88,8 +181,114 @@ typedef struct s_xpparam {
 	/* See Documentation/diff-options.adoc. */
 	char **anchors;
 	size_t anchors_nr;
+
+	/*
+	 * Polled periodically while diffing (and by merges, which diff
+	 * internally). A non-zero return abandons the operation, which
+	 * then fails with -1 after releasing everything it allocated.
+	 */
+	int (*abort_check)(void *priv);
+	void *abort_priv;
+
+	/*
+	 * Optional pool that parallel phases may fan out to. NULL runs
+	 * everything on the calling thread.
+	 */
+	xdpool_t *pool;
+
+	/* Receives the decision of XDF_AUTO_DIFF, if not NULL. */
+	xdautoinfo_t *auto_info;
+
+	/*
+	 * When the per-line arrays of both files (records, changed[] and
+	 * the index and class arrays) are expected to take more than
+	 * spill_threshold bytes (0: never), they are kept in unlinked
+	 * temporary files created in spill_dir (NULL: $TMPDIR, or /tmp)
+	 * and mapped, and Myers runs on a compact stream of line classes.
+	 * The result is the same as in memory.
+	 *
+	 * This takes those arrays off the heap, nothing more: it is not a
+	 * bound on resident memory. The line classifier built while
+	 * preparing, which takes a record's worth for every distinct
+	 * line, the engine's own working memory and the inputs stay in
+	 * memory, and mapped pages count as resident while in use.
+	 */
+	size_t spill_threshold;
+	char const *spill_dir;
+
+	/* Allocator for the call, or NULL for the default one. */
+	xdalloc_t *alloc;
+
+	/*
+	 * With XDF_SEGMENT_LINES, lines longer than this many bytes (0:
+	 * 1024) are diffed as a run of pieces cut after punctuation, so
+	 * that a change in a minified file costs about what it changes.
+	 * Hunk headers then read "@@ -L:O,N +L:O,N @@", giving the line
+	 * and byte offset a hunk starts at and the lines it touches; the
+	 * pieces of a line are emitted one per output line. Whitespace
+	 * options apply to each piece on its own. Merges and line maps
+	 * ignore the flag.
+	 */
+	long segment_size;
+
+	/*
+	 * Directory of prepared-file indexes, or NULL. An input of 64KB
+	 * or more that has an index there, made with the same whitespace
+	 * and XDF_SEGMENT_LINES options, is not hashed again; one that
+	 * has none gets it written for the next process. Indexes are
+	 * keyed by the BLAKE2b-256 of the content and checksummed, so
+	 * an input never gets another's index and a damaged one is not
+	 * used. A forged one can make the diff less minimal or move
+	 * hunk boundaries and headers, but not hide a change: keep the
+	 * directory writable only by those trusted with the output.
+	 * Nothing is ever removed from it. Digesting an input costs
+	 * about what hashing its records does without whitespace
+	 * options, so indexes only pay off with them.
+	 */
+	char const *index_dir;
 } xpparam_t;
 
+/*
+ * Ready-made abort_check state: cancel it from any thread with
+ * xdl_cancel_request(), or give it a CLOCK_MONOTONIC deadline.
+ */
+typedef struct s_xdcancel {
+	volatile int cancelled;
+	uint64_t deadline_ns;	/* 0 means no deadline */
+} xdcancel_t;
+
+/* xdtask_t.prio */
+#define XDL_PRIO_INTERACTIVE 0
+#define XDL_PRIO_BATCH 1
+
+/* xdtask_t.affinity: no preferred worker */
+#define XDL_AFFINITY_ANY (-1)
+
+typedef struct s_xdtask_times {
+	uint64_t queued;	/* CLOCK_MONOTONIC ns */
+	uint64_t started;	/* 0 if the task was cancelled */
+	uint64_t finished;
+} xdtask_times_t;
+
+typedef struct s_xdtask {
+	void (*run)(void *priv);
+	/*
+	 * Called on the thread that ran (or cancelled) the task, with
+	 * status 0 after it ran and -1 if it was cancelled while queued.
+	 */
+	void (*done)(void *priv, int status, xdtask_times_t const *times);
+	void *priv;
+	int prio;
+	int affinity;	/* worker index hint, or XDL_AFFINITY_ANY */
+} xdtask_t;
+
+/* Tasks submitted together; waited for and cancelled as a unit. */
+typedef struct s_xdtask_group {
+	xdpool_t *pool;
+	long pending;
+	long cancelled;
+} xdtask_group_t;
+
 typedef struct s_xdemitcb {
 	void *priv;
 	int (*out_hunk)(void *,
@@ -112,17 +311,80 @@ typedef struct s_xdemitconf {
 	find_func_t find_func;
 	void *find_func_priv;
 	xdl_emit_hunk_consume_func_t hunk_func;
+	int func_lang;	/* used when find_func is NULL */
 } xdemitconf_t;
 
 typedef struct s_bdiffparam {
 	long bsize;
 } bdiffparam_t;
 
+/* xdtrace_t phases */
+#define XDL_TRACE_PREPARE 0	/* bytes in; records out, cost: settled lines */
+#define XDL_TRACE_CLEANUP 1	/* records; cost: records discarded */
+#define XDL_TRACE_MYERS 2	/* records; cost: changed lines */
+#define XDL_TRACE_HISTOGRAM 3
+#define XDL_TRACE_PATIENCE 4
+#define XDL_TRACE_COMPACT 5	/* records; cost: changed lines */
+#define XDL_TRACE_BUILD_SCRIPT 6	/* records; cost: hunks */
+#define XDL_TRACE_EMIT 7	/* records; cost: hunks */
+#define XDL_TRACE_MERGE 8	/* bytes of the two sides; cost: conflicts */
+
+/*
+ * Process-wide hooks called at the entry and exit of every phase, on
+ * whichever thread runs it (pool workers included), so they must be
+ * thread safe. Phases nest: cleanup runs inside prepare, and a merge
+ * contains all the others.
+ */
+typedef struct s_xdtrace {
+	void (*enter)(void *priv, int phase, long size1, long size2);
+	void (*leave)(void *priv, int phase, long size1, long size2,
+		      long cost, int status);
+	void *priv;
+} xdtrace_t;
+
+
+/*
+ * Memory that is handed back to the caller, and the pool's own
+ * bookkeeping, always comes from these.
+ */
+#define xdl_sys_malloc(x) xmalloc(x)
+#define xdl_sys_calloc(n, sz) xcalloc(n, sz)
+#define xdl_sys_free(ptr) free(ptr)
+#define xdl_sys_realloc(ptr,x) xrealloc(ptr,x)
 
-#define xdl_malloc(x) xmalloc(x)
-#define xdl_calloc(n, sz) xcalloc(n, sz)
-#define xdl_free(ptr) free(ptr)
-#define xdl_realloc(ptr,x) xrealloc(ptr,x)
+/* Everything else goes to the allocator of the current call, if any. */
+#define xdl_malloc(x) xdl_alloc_malloc(x)
+#define xdl_calloc(n, sz) xdl_alloc_calloc(n, sz)
+#define xdl_free(ptr) xdl_alloc_free(ptr)
+#define xdl_realloc(ptr,x) xdl_alloc_realloc(ptr,x)
+
+void *xdl_alloc_malloc(size_t size);
+void *xdl_alloc_calloc(size_t nmemb, size_t size);
+void *xdl_alloc_realloc(void *ptr, size_t size);
+void xdl_alloc_free(void *ptr);
+
+/* Makes alloc (or NULL: the xdl_sys_*() functions) current for this thread. */
+xdalloc_t *xdl_alloc_set(xdalloc_t *alloc);
+xdalloc_t *xdl_alloc_get(void);
+
+/* Installs (or, with NULL, removes) the phase hooks. */
+void xdl_trace_set(xdtrace_t const *hooks);
+
+xdpool_t *xdl_pool_new(int nthreads);	/* 0: one thread per online CPU */
+xdpool_t *xdl_pool_get_default(void);	/* process-wide, refcounted */
+void xdl_pool_set_default_threads(int nthreads);
+void xdl_pool_put(xdpool_t *pool);
+int xdl_pool_threads(xdpool_t const *pool);
+int xdl_pool_worker(xdpool_t *pool);	/* index of the calling worker, or -1 */
+int xdl_pool_cancel(xdpool_t *pool, xdtask_group_t *grp);	/* NULL grp: all */
+
+void xdl_group_init(xdtask_group_t *grp, xdpool_t *pool);
+int xdl_pool_submit(xdtask_group_t *grp, xdtask_t const *task);
+int xdl_group_wait(xdtask_group_t *grp);
+
+void xdl_cancel_init(xdcancel_t *c, uint64_t timeout_ns);
+void xdl_cancel_request(xdcancel_t *c);
+int xdl_cancel_check(void *priv);	/* abort_check for an xdcancel_t */
 
 void *xdl_mmfile_first(mmfile_t *mmf, long *size);
 long xdl_mmfile_size(mmfile_t *mmf);
@@ -130,6 +392,43 @@ long xdl_mmfile_size(mmfile_t *mmf);
 int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	     xdemitconf_t const *xecfg, xdemitcb_t *ecb);
 
+/* xdtreeentry_t.status */
+#define XDL_TREE_ADDED 'A'
+#define XDL_TREE_DELETED 'D'
+#define XDL_TREE_MODIFIED 'M'
+#define XDL_TREE_RENAMED 'R'
+
+typedef struct s_xdtreeentry {
+	int status;
+	char const *path1;	/* NULL for XDL_TREE_ADDED */
+	char const *path2;	/* NULL for XDL_TREE_DELETED */
+	int similarity;		/* percent, for XDL_TREE_RENAMED */
+	int binary;		/* no diff was made */
+	char const *diff;	/* emitted hunks, valid during the callback */
+	size_t size;
+} xdtreeentry_t;
+
+typedef struct s_xdtreeconf {
+	/*
+	 * Minimum similarity percentage for pairing a deleted and an added
+	 * file as a rename; 0 disables rename detection, 100 only pairs
+	 * identical files.
+	 */
+	int rename_score;
+	/* Called in path order; a nonzero return stops the walk. */
+	int (*entry)(void *priv, xdtreeentry_t const *ent);
+	void *priv;
+} xdtreeconf_t;
+
+/*
+ * Diffs all regular files below root1 against those below root2.
+ * Files whose contents match are not reported; everything else is
+ * diffed on xpp->pool and reported to tcf->entry() in path order.
+ * Subdirectories that cannot be read are taken as empty.
+ */
+int xdl_diff_trees(char const *root1, char const *root2, xpparam_t const *xpp,
+		   xdemitconf_t const *xecfg, xdtreeconf_t const *tcf);
+
 typedef struct s_xmparam {
 	xpparam_t xpp;
 	int marker_size;
@@ -146,6 +445,110 @@ typedef struct s_xmparam {
 int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
 		xmparam_t const *xmp, mmbuffer_t *result);
 
+/*
+ * Like xdl_merge(), but renders the result in a single pass into an
+ * initialized output buffer instead of sizing it first.
+ */
+int xdl_merge_outbuf(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		     xmparam_t const *xmp, xdoutbuf_t *ob);
+
+/*
+ * A changed region of a merge. Line numbers are 0-based: <i0,chg0> in
+ * the ancestor, <i1,chg1> and <i2,chg2> in the two sides, and out is
+ * where the region starts in the clean output of xdl_merge_regions().
+ * Conflicts split up by refinement all report the ancestor range of
+ * the overlapping change they came from.
+ */
+typedef struct s_xdmergeregion {
+	int mode;
+	long i0, chg0;
+	long i1, chg1;
+	long i2, chg2;
+	long out;
+} xdmergeregion_t;
+
+/*
+ * Runs a merge like xdl_merge() but does not render it. The changed
+ * regions are returned in *regions (to be free()d by the caller), when
+ * regions is not NULL. When clean is not NULL, the merge result is
+ * appended to it with every conflict left out (neither side). Returns
+ * the number of conflicts, or -1 on error.
+ */
+int xdl_merge_regions(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		      xmparam_t const *xmp, xdmergeregion_t **regions,
+		      long *nr, xdoutbuf_t *clean);
+
+/*
+ * Old-to-new line translation. The runs of lines a diff leaves
+ * unchanged, by their 0-based start on either side.
+ */
+typedef struct s_xdlinemap {
+	long *start1;
+	long *start2;
+	long *count;
+	long nr;
+	long nrec1, nrec2;
+} xdlinemap_t;
+
+/* Diffs mf1 and mf2 into a translation map; free it with xdl_linemap_free(). */
+int xdl_diff_linemap(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		     xdlinemap_t *map);
+void xdl_linemap_free(xdlinemap_t *map);
+
+/*
+ * Translates 0-based old line number line into *out. Returns 1 if the
+ * line is unchanged, 0 if it was changed or deleted (*out is then where
+ * its replacement starts) and -1 if it is out of range (*out = -1).
+ */
+int xdl_linemap_line(xdlinemap_t const *map, long line, long *out);
+
+/*
+ * Translates n lines at once, in O(n + runs) when lines is sorted (any
+ * order works). exact, if not NULL, receives the per-line 1/0 of
+ * xdl_linemap_line(). Returns the number of unchanged lines.
+ */
+long xdl_linemap_translate(xdlinemap_t const *map, long const *lines, long n,
+			   long *out, unsigned char *exact);
+
+/*
+ * Matches rec against the built-in header rules for lang, with the
+ * find_func_t contract: copies the header to buf and returns its
+ * length, or -1 if the line is not a header.
+ */
+long xdl_func_lang_match(int lang, char const *rec, long len, char *buf, long sz);
+/* Picks an XDL_FUNC_LANG_* from the file name extension. */
+int xdl_func_lang_for_path(char const *path);
+
+/*
+ * Renders the diff of mf1 and mf2 as HTML using gitweb's markup and
+ * appends it to ob.
+ */
+int xdl_diff_html(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		  xdemitconf_t const *xecfg, unsigned long flags, xdoutbuf_t *ob);
+/*
+ * Renders existing unified diff text the same way. Each file's
+ * headers are skipped up to its first hunk.
+ */
+int xdl_html_patch(char const *patch, long size, unsigned long flags,
+		   xdoutbuf_t *ob);
+
+/*
+ * Writes the index of mf to xpp->index_dir ahead of time. Unlike the
+ * ones written while diffing, it also records which lines are headers
+ * for func_lang (XDL_FUNC_LANG_NONE: none), so that emitting hunks
+ * with that language does not have to try every line.
+ */
+int xdl_index_file(mmfile_t *mf, xpparam_t const *xpp, int func_lang);
+
+int xdl_outbuf_init(xdoutbuf_t *ob, size_t initial, size_t max_size);
+int xdl_outbuf_commit(xdoutbuf_t *ob, size_t n);
+char *xdl_outbuf_grow(xdoutbuf_t *ob, size_t n);
+int xdl_outbuf_add(xdoutbuf_t *ob, char const *data, size_t n);
+void xdl_outbuf_release(xdoutbuf_t *ob);
+
+/* xdemitcb_t.out_line callback appending to the xdoutbuf_t in priv */
+int xdl_outbuf_out_line(void *priv, mmbuffer_t *mb, int nbuf);
+
 #ifdef __cplusplus
 }
 #endif /* #ifdef __cplusplus */
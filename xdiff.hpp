@@ -0,0 +1,478 @@
+/*
+ *  LibXDiff by Davide Libenzi ( File Differential Library )
+ *  Copyright (C) 2003  Davide Libenzi
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ *  Davide Libenzi <davidel@xmailserver.org>
+ *
+ */
+
+#if !defined(XDIFF_HPP)
+#define XDIFF_HPP
+
+/*
+ * Header-only C++20 layer over xdiff.h.
+ *
+ * Inputs are taken as std::string_view or std::span<const char> and
+ * are never copied; they must outlive the results, which refer to them. What xdiff allocates while
+ * it runs, and the edit scripts and line tables of diff results, come
+ * from a std::pmr::memory_resource (xdiff's side goes through
+ * xpparam_t.alloc). Rendered merges live in an xdoutbuf_t. Results are
+ * move-only. Errors are reported with exceptions.
+ *
+ * Like xdiff.h, this expects the system headers it needs (<regex.h>
+ * for regex_t) to have been included already.
+ */
+
+#include <concepts>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+#if __has_include(<generator>)
+#include <generator>
+#endif
+
+#include "xdiff.h"
+
+namespace xdl {
+
+/*
+ * Binds an xdalloc_t to a memory resource. The hooks get no size on
+ * free, so every block starts with a header holding it.
+ *
+ * Calls on a pool allocate from its worker threads at the same time,
+ * and most memory resources (unsynchronized_pool_resource,
+ * monotonic_buffer_resource) are not thread safe. Pass shared for
+ * those calls to have the hooks take a mutex around the resource.
+ */
+class pmr_alloc {
+public:
+	explicit pmr_alloc(std::pmr::memory_resource *mr, std::size_t limit = 0,
+			   bool shared = false)
+		: mr_(mr), shared_(shared)
+	{
+		std::memset(&alloc_, 0, sizeof(alloc_));
+		alloc_.malloc = do_malloc;
+		alloc_.realloc = do_realloc;
+		alloc_.free = do_free;
+		alloc_.priv = this;
+		alloc_.limit = limit;
+	}
+	pmr_alloc(pmr_alloc const &) = delete;
+	pmr_alloc &operator=(pmr_alloc const &) = delete;
+
+	xdalloc_t *get() { return &alloc_; }
+	std::size_t peak() const { return alloc_.peak; }
+
+private:
+	static constexpr std::size_t hdr = alignof(std::max_align_t);
+
+	std::unique_lock<std::mutex> lock()
+	{
+		return shared_ ? std::unique_lock<std::mutex>(mutex_) :
+			std::unique_lock<std::mutex>();
+	}
+
+	static void *do_malloc(void *priv, std::size_t size)
+	{
+		auto *self = static_cast<pmr_alloc *>(priv);
+
+		if (size > SIZE_MAX - hdr)
+			return nullptr;
+		auto guard = self->lock();
+		try {
+			auto *p = static_cast<char *>(
+				self->mr_->allocate(hdr + size, hdr));
+			std::memcpy(p, &size, sizeof(size));
+			return p + hdr;
+		} catch (std::bad_alloc const &) {
+			return nullptr;
+		}
+	}
+
+	static std::size_t size_of(void *ptr)
+	{
+		std::size_t size;
+
+		std::memcpy(&size, static_cast<char *>(ptr) - hdr, sizeof(size));
+		return size;
+	}
+
+	static void do_free(void *priv, void *ptr)
+	{
+		auto *self = static_cast<pmr_alloc *>(priv);
+
+		if (ptr) {
+			auto guard = self->lock();
+
+			self->mr_->deallocate(static_cast<char *>(ptr) - hdr,
+					      hdr + size_of(ptr), hdr);
+		}
+	}
+
+	static void *do_realloc(void *priv, void *ptr, std::size_t size)
+	{
+		void *p = do_malloc(priv, size);
+
+		if (p && ptr) {
+			std::size_t old = size_of(ptr);
+
+			std::memcpy(p, ptr, old < size ? old : size);
+			do_free(priv, ptr);
+		}
+		return p;
+	}
+
+	std::pmr::memory_resource *mr_;
+	bool shared_;
+	std::mutex mutex_;
+	xdalloc_t alloc_;
+};
+
+/*
+ * With a pool, the memory resource is only used under a lock (see
+ * pmr_alloc), so any resource will do.
+ */
+struct options {
+	unsigned long flags = 0;	/* XDF_* */
+	xdpool_t *pool = nullptr;
+	std::size_t memory_limit = 0;	/* xdalloc_t.limit */
+};
+
+/* One edit, with 0-based line numbers as for xdl_emit_hunk_consume_func_t. */
+struct hunk {
+	long old_start, old_count;
+	long new_start, new_count;
+};
+
+/* Start offsets of the lines of a buffer, for handing out line views. */
+class line_index {
+public:
+	line_index(std::string_view text, std::pmr::memory_resource *mr)
+		: text_(text), starts_(mr)
+	{
+		std::size_t pos = 0;
+
+		while (pos < text.size()) {
+			starts_.push_back(pos);
+			std::size_t nl = text.find('\n', pos);
+			pos = nl == std::string_view::npos ? text.size() : nl + 1;
+		}
+		starts_.push_back(text.size());
+	}
+
+	std::size_t size() const { return starts_.size() - 1; }
+	std::string_view operator[](std::size_t i) const
+	{
+		return text_.substr(starts_[i], starts_[i + 1] - starts_[i]);
+	}
+
+private:
+	std::string_view text_;
+	std::pmr::vector<std::size_t> starts_;
+};
+
+/* A run of lines of one side, each a view into the caller's buffer. */
+class line_range {
+public:
+	class iterator {
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = std::string_view;
+		using difference_type = std::ptrdiff_t;
+
+		iterator() = default;
+		iterator(line_index const *idx, long i) : idx_(idx), i_(i) {}
+
+		std::string_view operator*() const { return (*idx_)[i_]; }
+		std::string_view operator[](difference_type n) const { return (*idx_)[i_ + n]; }
+		iterator &operator++() { ++i_; return *this; }
+		iterator operator++(int) { iterator t = *this; ++i_; return t; }
+		iterator &operator--() { --i_; return *this; }
+		iterator operator--(int) { iterator t = *this; --i_; return t; }
+		iterator &operator+=(difference_type n) { i_ += n; return *this; }
+		iterator &operator-=(difference_type n) { i_ -= n; return *this; }
+		friend iterator operator+(iterator it, difference_type n) { return it += n; }
+		friend iterator operator+(difference_type n, iterator it) { return it += n; }
+		friend iterator operator-(iterator it, difference_type n) { return it -= n; }
+		friend difference_type operator-(iterator a, iterator b) { return a.i_ - b.i_; }
+		friend bool operator==(iterator a, iterator b) { return a.i_ == b.i_; }
+		friend auto operator<=>(iterator a, iterator b) { return a.i_ <=> b.i_; }
+
+	private:
+		line_index const *idx_ = nullptr;
+		long i_ = 0;
+	};
+
+	line_range(line_index const *idx, long start, long count)
+		: idx_(idx), start_(start), count_(count) {}
+
+	iterator begin() const { return iterator(idx_, start_); }
+	iterator end() const { return iterator(idx_, start_ + count_); }
+	std::size_t size() const { return static_cast<std::size_t>(count_); }
+	bool empty() const { return !count_; }
+	std::string_view operator[](std::size_t i) const { return (*idx_)[start_ + i]; }
+
+private:
+	line_index const *idx_;
+	long start_, count_;
+};
+
+struct hunk_view {
+	xdl::hunk hunk;
+	line_range old_lines;
+	line_range new_lines;
+};
+
+/*
+ * The edit script of a diff. Line views are made on demand from the
+ * inputs, which must stay alive as long as the result.
+ */
+class diff_result {
+public:
+	diff_result(std::string_view a, std::string_view b,
+		    std::pmr::memory_resource *mr)
+		: hunks_(mr), old_(a, mr), new_(b, mr) {}
+	diff_result(diff_result &&) = default;
+	diff_result &operator=(diff_result &&) = default;
+	diff_result(diff_result const &) = delete;
+	diff_result &operator=(diff_result const &) = delete;
+
+	std::span<hunk const> script() const { return hunks_; }
+	bool empty() const { return hunks_.empty(); }
+	line_index const &old_lines() const { return old_; }
+	line_index const &new_lines() const { return new_; }
+
+	hunk_view view(hunk const &h) const
+	{
+		return { h, line_range(&old_, h.old_start, h.old_count),
+			 line_range(&new_, h.new_start, h.new_count) };
+	}
+
+	/* Lazy range of hunk_view over the script. */
+	class hunk_range {
+	public:
+		class iterator {
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = hunk_view;
+			using difference_type = std::ptrdiff_t;
+
+			iterator() = default;
+			iterator(diff_result const *r, hunk const *h) : r_(r), h_(h) {}
+
+			hunk_view operator*() const { return r_->view(*h_); }
+			iterator &operator++() { ++h_; return *this; }
+			iterator operator++(int) { iterator t = *this; ++h_; return t; }
+			friend bool operator==(iterator a, iterator b) { return a.h_ == b.h_; }
+
+		private:
+			diff_result const *r_ = nullptr;
+			hunk const *h_ = nullptr;
+		};
+
+		explicit hunk_range(diff_result const *r) : r_(r) {}
+		iterator begin() const { return iterator(r_, r_->hunks_.data()); }
+		iterator end() const
+		{
+			return iterator(r_, r_->hunks_.data() + r_->hunks_.size());
+		}
+
+	private:
+		diff_result const *r_;
+	};
+
+	hunk_range hunks() const { return hunk_range(this); }
+
+#if defined(__cpp_lib_generator)
+	std::generator<hunk_view> generate() const
+	{
+		for (hunk const &h : hunks_)
+			co_yield view(h);
+	}
+#endif
+
+private:
+	friend diff_result diff(std::string_view, std::string_view,
+				options const &, std::pmr::memory_resource *);
+
+	std::pmr::vector<hunk> hunks_;
+	line_index old_, new_;
+};
+
+namespace detail {
+
+inline mmfile_t mmfile(std::string_view s)
+{
+	mmfile_t mf;
+
+	/* xdiff never writes through its inputs. */
+	mf.ptr = const_cast<char *>(s.data());
+	mf.size = static_cast<long>(s.size());
+	return mf;
+}
+
+/*
+ * Contiguous chars that are not already a string_view, for the
+ * std::span<const char> overloads; strings and literals keep going to
+ * the string_view ones.
+ */
+template <class T>
+concept char_span = std::convertible_to<T const &, std::span<const char>> &&
+	!std::convertible_to<T const &, std::string_view>;
+
+inline std::string_view view(std::span<const char> s)
+{
+	return std::string_view(s.data(), s.size());
+}
+
+inline void prepare(xpparam_t &xpp, options const &opt, pmr_alloc &alloc)
+{
+	std::memset(&xpp, 0, sizeof(xpp));
+	xpp.flags = opt.flags;
+	xpp.pool = opt.pool;
+	xpp.alloc = alloc.get();
+}
+
+} /* namespace detail */
+
+inline diff_result diff(std::string_view a, std::string_view b,
+			options const &opt = {},
+			std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+{
+	struct state {
+		diff_result *res;
+		std::exception_ptr err;
+	};
+	diff_result res(a, b, mr);
+	state st = { &res, nullptr };
+	pmr_alloc alloc(mr, opt.memory_limit, opt.pool != nullptr);
+	mmfile_t mf1 = detail::mmfile(a), mf2 = detail::mmfile(b);
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	xdemitcb_t ecb;
+
+	detail::prepare(xpp, opt, alloc);
+	std::memset(&xecfg, 0, sizeof(xecfg));
+	xecfg.hunk_func = +[](long sa, long ca, long sb, long cb, void *priv) -> int {
+		auto *s = static_cast<state *>(priv);
+
+		try {
+			s->res->hunks_.push_back({ sa, ca, sb, cb });
+		} catch (...) {
+			s->err = std::current_exception();
+			return -1;
+		}
+		return 0;
+	};
+	std::memset(&ecb, 0, sizeof(ecb));
+	ecb.priv = &st;
+
+	if (xdl_diff(&mf1, &mf2, &xpp, &xecfg, &ecb) < 0) {
+		if (st.err)
+			std::rethrow_exception(st.err);
+		throw std::bad_alloc();
+	}
+	return res;
+}
+
+template <detail::char_span A, detail::char_span B>
+inline diff_result diff(A const &a, B const &b, options const &opt = {},
+			std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+{
+	return diff(detail::view(a), detail::view(b), opt, mr);
+}
+
+/* A rendered merge, owning its output buffer. */
+class merge_result {
+public:
+	merge_result() { std::memset(&ob_, 0, sizeof(ob_)); }
+	merge_result(merge_result &&o) noexcept
+		: ob_(o.ob_), conflicts_(o.conflicts_)
+	{
+		std::memset(&o.ob_, 0, sizeof(o.ob_));
+	}
+	merge_result &operator=(merge_result &&o) noexcept
+	{
+		if (this != &o) {
+			xdl_outbuf_release(&ob_);
+			ob_ = o.ob_;
+			conflicts_ = o.conflicts_;
+			std::memset(&o.ob_, 0, sizeof(o.ob_));
+		}
+		return *this;
+	}
+	merge_result(merge_result const &) = delete;
+	merge_result &operator=(merge_result const &) = delete;
+	~merge_result() { xdl_outbuf_release(&ob_); }
+
+	std::string_view text() const { return std::string_view(ob_.ptr, ob_.size); }
+	int conflicts() const { return conflicts_; }
+
+private:
+	friend merge_result merge(std::string_view, std::string_view,
+				  std::string_view, xmparam_t const &,
+				  options const &, std::pmr::memory_resource *);
+
+	xdoutbuf_t ob_;
+	int conflicts_ = 0;
+};
+
+/*
+ * Three-way merge of a and b against their ancestor o, rendered with
+ * xdl_merge_outbuf(); xmp.xpp is filled in from opt.
+ */
+inline merge_result merge(std::string_view o, std::string_view a,
+			  std::string_view b, xmparam_t const &xmp,
+			  options const &opt = {},
+			  std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+{
+	merge_result res;
+	pmr_alloc alloc(mr, opt.memory_limit, opt.pool != nullptr);
+	mmfile_t mfo = detail::mmfile(o), mf1 = detail::mmfile(a),
+		mf2 = detail::mmfile(b);
+	xmparam_t p = xmp;
+	std::size_t max = std::size_t(1) << (sizeof(std::size_t) > 4 ? 34 : 30);
+
+	detail::prepare(p.xpp, opt, alloc);
+	if (xdl_outbuf_init(&res.ob_, 0, max) < 0)
+		throw std::bad_alloc();
+	if ((res.conflicts_ = xdl_merge_outbuf(&mfo, &mf1, &mf2, &p, &res.ob_)) < 0)
+		throw std::bad_alloc();
+	return res;
+}
+
+template <detail::char_span O, detail::char_span A, detail::char_span B>
+inline merge_result merge(O const &o, A const &a, B const &b,
+			  xmparam_t const &xmp, options const &opt = {},
+			  std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+{
+	return merge(detail::view(o), detail::view(a), detail::view(b), xmp,
+		     opt, mr);
+}
+
+} /* namespace xdl */
+
+#endif /* #if !defined(XDIFF_HPP) */
@@ -24,6 +24,8 @@
 
 static size_t get_hash(xdfile_t *xdf, long index)
 {
+	if (xdf->reference_class)
+		return xdf->reference_class[index];
 	return xdf->recs[xdf->reference_index[index]].minimal_perfect_hash;
 }
 
@@ -32,12 +34,70 @@ static size_t get_hash(xdfile_t *xdf, long index)
 #define XDL_LINE_MAX (long)((1UL << (CHAR_BIT * sizeof(long) - 1)) - 1)
 #define XDL_SNAKE_CNT 20
 #define XDL_K_HEUR 4
+#define XDL_ANCHOR_TASK_RECS 8192
+#define XDL_KVEC_MIN 64
 
 typedef struct s_xdpsplit {
 	long i1, i2;
 	int min_lo, min_hi;
 } xdpsplit_t;
 
+/*
+ * Starts kv over for a split whose search starts on diagonal mid, and
+ * returns the vector to index by diagonal. Nothing is carried over from
+ * the previous split.
+ */
+static long *xdl_kvec_center(xdkvec_t *kv, long mid) {
+
+	if (kv->alloc < XDL_KVEC_MIN) {
+		xdl_free(kv->buf);
+		kv->alloc = 0;
+		if (!XDL_ALLOC_ARRAY(kv->buf, XDL_KVEC_MIN))
+			return NULL;
+		kv->alloc = XDL_KVEC_MIN;
+	}
+	kv->lo = mid - kv->alloc / 2;
+
+	return kv->buf - kv->lo;
+}
+
+/*
+ * Moves or widens kv so that it covers diagonals lo to hi, keeping the
+ * values of those from keep_lo to keep_hi, and returns the vector to
+ * index by diagonal. The window doubles when it has to grow, but not
+ * past the 'full' diagonals of the whole box; the memory taken is thus
+ * bounded by the edit cost a search reaches, not by the file sizes.
+ */
+static long *xdl_kvec_grow(xdkvec_t *kv, long lo, long hi,
+			   long keep_lo, long keep_hi, long full) {
+	long alloc = kv->alloc, nlo;
+	long *buf = kv->buf;
+
+	if (hi - lo + 1 > alloc) {
+		alloc = XDL_MAX(hi - lo + 1, XDL_MIN(2 * alloc, full));
+		if (!XDL_ALLOC_ARRAY(buf, alloc))
+			return NULL;
+	}
+	nlo = lo - (alloc - (hi - lo + 1)) / 2;
+	memmove(buf + (keep_lo - nlo), kv->buf + (keep_lo - kv->lo),
+		(keep_hi - keep_lo + 1) * sizeof(long));
+	if (buf != kv->buf) {
+		xdl_free(kv->buf);
+		kv->buf = buf;
+		kv->alloc = alloc;
+	}
+	kv->lo = nlo;
+
+	return buf - nlo;
+}
+
+static void xdl_kvec_free(xdkvec_t *kv) {
+
+	xdl_free(kv->buf);
+	kv->buf = NULL;
+	kv->alloc = 0;
+}
+
 /*
  * See "An O(ND) Difference Algorithm and its Variations", by Eugene Myers.
  * Basically considers a "box" (off1, off2, lim1, lim2) and scan from both
@@ -49,14 +109,19 @@ typedef struct s_xdpsplit {
  */
 static long xdl_split(xdfile_t *xdf1, long off1, long lim1,
 		      xdfile_t *xdf2, long off2, long lim2,
-		      long *kvdf, long *kvdb, int need_min, xdpsplit_t *spl,
+		      xdkvec_t *kvf, xdkvec_t *kvb, int need_min, xdpsplit_t *spl,
 		      xdalgoenv_t *xenv) {
 	long dmin = off1 - lim2, dmax = lim1 - off2;
 	long fmid = off1 - off2, bmid = lim1 - lim2;
 	long odd = (fmid - bmid) & 1;
 	long fmin = fmid, fmax = fmid;
 	long bmin = bmid, bmax = bmid;
-	long ec, d, i1, i2, prev1, best, dd, v, k;
+	long ec, d, i1, i2, prev1, best, dd, v, k, lo, hi;
+	long *kvdf, *kvdb;
+
+	if (!(kvdf = xdl_kvec_center(kvf, fmid)) ||
+	    !(kvdb = xdl_kvec_center(kvb, bmid)))
+		return -1;
 
 	/*
 	 * Set initial diagonal values for both forward and backward path.
@@ -67,6 +132,9 @@ static long xdl_split(xdfile_t *xdf1, long off1, long lim1,
 	for (ec = 1;; ec++) {
 		int got_snake = 0;
 
+		if (!(ec & XDL_ABORT_POLL_MASK) && xdl_should_abort(xenv->xpp))
+			return -1;
+
 		/*
 		 * We need to extend the diagonal "domain" by one. If the next
 		 * values exits the box boundaries we need to change it in the
@@ -76,6 +144,12 @@ static long xdl_split(xdfile_t *xdf1, long off1, long lim1,
 		 * Also we initialize the external K value to -1 so that we can
 		 * avoid extra conditions in the check inside the core loop.
 		 */
+		lo = XDL_MAX(fmin - 2, dmin - 1);
+		hi = XDL_MIN(fmax + 2, dmax + 1);
+		if ((lo < kvf->lo || hi >= kvf->lo + kvf->alloc) &&
+		    !(kvdf = xdl_kvec_grow(kvf, lo, hi, fmin - 1, fmax + 1,
+					   dmax - dmin + 3)))
+			return -1;
 		if (fmin > dmin)
 			kvdf[--fmin - 1] = -1;
 		else
@@ -113,6 +187,12 @@ static long xdl_split(xdfile_t *xdf1, long off1, long lim1,
 		 * Also we initialize the external K value to -1 so that we can
 		 * avoid extra conditions in the check inside the core loop.
 		 */
+		lo = XDL_MAX(bmin - 2, dmin - 1);
+		hi = XDL_MIN(bmax + 2, dmax + 1);
+		if ((lo < kvb->lo || hi >= kvb->lo + kvb->alloc) &&
+		    !(kvdb = xdl_kvec_grow(kvb, lo, hi, bmin - 1, bmax + 1,
+					   dmax - dmin + 3)))
+			return -1;
 		if (bmin > dmin)
 			kvdb[--bmin - 1] = XDL_LINE_MAX;
 		else
@@ -264,7 +344,10 @@ static long xdl_split(xdfile_t *xdf1, long off1, long lim1,
  */
 int xdl_recs_cmp(xdfile_t *xdf1, long off1, long lim1,
 		 xdfile_t *xdf2, long off2, long lim2,
-		 long *kvdf, long *kvdb, int need_min, xdalgoenv_t *xenv) {
+		 xdkvec_t *kvf, xdkvec_t *kvb, int need_min, xdalgoenv_t *xenv) {
+
+	if (!(++xenv->npoll & XDL_ABORT_POLL_MASK) && xdl_should_abort(xenv->xpp))
+		return -1;
 
 	/*
 	 * Shrink the box by walking through each diagonal snake (SW and NE).
@@ -289,7 +372,7 @@ int xdl_recs_cmp(xdfile_t *xdf1, long off1, long lim1,
 		/*
 		 * Divide ...
 		 */
-		if (xdl_split(xdf1, off1, lim1, xdf2, off2, lim2, kvdf, kvdb,
+		if (xdl_split(xdf1, off1, lim1, xdf2, off2, lim2, kvf, kvb,
 			      need_min, &spl, xenv) < 0) {
 
 			return -1;
@@ -299,9 +382,9 @@ int xdl_recs_cmp(xdfile_t *xdf1, long off1, long lim1,
 		 * ... et Impera.
 		 */
 		if (xdl_recs_cmp(xdf1, off1, spl.i1, xdf2, off2, spl.i2,
-				 kvdf, kvdb, spl.min_lo, xenv) < 0 ||
+				 kvf, kvb, spl.min_lo, xenv) < 0 ||
 		    xdl_recs_cmp(xdf1, spl.i1, lim1, xdf2, spl.i2, lim2,
-				 kvdf, kvdb, spl.min_hi, xenv) < 0) {
+				 kvf, kvb, spl.min_hi, xenv) < 0) {
 
 			return -1;
 		}
@@ -311,16 +394,258 @@ int xdl_recs_cmp(xdfile_t *xdf1, long off1, long lim1,
 }
 
 
-int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-		xdfenv_t *xe) {
+/*
+ * XDF_UNIQUE_ANCHORS: records occurring exactly once among the kept
+ * records of each file, matched to each other and in increasing order
+ * on both sides (the longest such sequence, as patience diff does),
+ * can only ever be matched to each other. They cut the Myers problem
+ * into independent boxes that are much cheaper than one big one (the
+ * cost grows with D squared) and can be solved on different threads.
+ * Every box is diffed with the cost limit of the whole files, so that
+ * a small box does not give up where a plain diff would keep looking.
+ */
+typedef struct s_xdanchorbox {
+	long off1, lim1, off2, lim2;
+} xdanchorbox_t;
+
+typedef struct s_xdanchortask {
+	xdfenv_t *xe;
+	xpparam_t const *xpp;
+	xdanchorbox_t *boxes;
+	long nbox;
+	long mxcost;
+	int res;
+} xdanchortask_t;
+
+/*
+ * Returns the number of anchors, stored as index pairs into the
+ * reference_index arrays of both files, or -1 on error.
+ */
+static long xdl_find_anchors(xdfenv_t *xe, long **pa1, long **pa2)
+{
+	xdfile_t *xdf1 = &xe->xdf1, *xdf2 = &xe->xdf2;
+	long n1 = (long)xdf1->nreff, n2 = (long)xdf2->nreff;
+	long i, k, nclass = 0, ncand = 0, len = 0, lo, hi, mid;
+	uint8_t *cnt1 = NULL, *cnt2 = NULL;
+	long *pos2 = NULL, *c1 = NULL, *c2 = NULL, *tails = NULL, *prev = NULL;
+	long *a1 = NULL, *a2 = NULL;
+	size_t h;
+
+	*pa1 = *pa2 = NULL;
+	for (i = 0; i < n1; i++)
+		if ((long)get_hash(xdf1, i) >= nclass)
+			nclass = (long)get_hash(xdf1, i) + 1;
+	for (i = 0; i < n2; i++)
+		if ((long)get_hash(xdf2, i) >= nclass)
+			nclass = (long)get_hash(xdf2, i) + 1;
+
+	if (!XDL_CALLOC_ARRAY(cnt1, nclass) ||
+	    !XDL_CALLOC_ARRAY(cnt2, nclass) ||
+	    !XDL_ALLOC_ARRAY(pos2, nclass))
+		goto error;
+	for (i = 0; i < n1; i++)
+		if (cnt1[h = get_hash(xdf1, i)] < 2)
+			cnt1[h]++;
+	for (i = 0; i < n2; i++) {
+		if (cnt2[h = get_hash(xdf2, i)] < 2)
+			cnt2[h]++;
+		pos2[h] = i;
+	}
+
+	/* Candidates in file 1 order; their file 2 positions are distinct. */
+	k = XDL_MIN(n1, n2);
+	if (!XDL_ALLOC_ARRAY(c1, k + 1) || !XDL_ALLOC_ARRAY(c2, k + 1))
+		goto error;
+	for (i = 0; i < n1; i++) {
+		h = get_hash(xdf1, i);
+		if (cnt1[h] == 1 && cnt2[h] == 1) {
+			c1[ncand] = i;
+			c2[ncand++] = pos2[h];
+		}
+	}
+
+	/* Longest increasing subsequence of c2, by patience sorting. */
+	if (!XDL_ALLOC_ARRAY(tails, ncand + 1) || !XDL_ALLOC_ARRAY(prev, ncand + 1))
+		goto error;
+	for (i = 0; i < ncand; i++) {
+		for (lo = 0, hi = len; lo < hi;) {
+			mid = lo + (hi - lo) / 2;
+			if (c2[tails[mid]] < c2[i])
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		prev[i] = lo ? tails[lo - 1] : -1;
+		tails[lo] = i;
+		if (lo == len)
+			len++;
+	}
+
+	if (len) {
+		if (!XDL_ALLOC_ARRAY(a1, len) || !XDL_ALLOC_ARRAY(a2, len))
+			goto error;
+		for (i = tails[len - 1], k = len - 1; i >= 0; i = prev[i], k--) {
+			a1[k] = c1[i];
+			a2[k] = c2[i];
+		}
+	}
+	*pa1 = a1;
+	*pa2 = a2;
+
+	xdl_free(prev);
+	xdl_free(tails);
+	xdl_free(c2);
+	xdl_free(c1);
+	xdl_free(pos2);
+	xdl_free(cnt2);
+	xdl_free(cnt1);
+	return len;
+
+error:
+	xdl_free(a2);
+	xdl_free(a1);
+	xdl_free(prev);
+	xdl_free(tails);
+	xdl_free(c2);
+	xdl_free(c1);
+	xdl_free(pos2);
+	xdl_free(cnt2);
+	xdl_free(cnt1);
+	return -1;
+}
+
+static void xdl_anchor_task_run(void *priv)
+{
+	xdanchortask_t *task = priv;
+	xdfenv_t *xe = task->xe;
+	xdkvec_t kvf = { NULL, 0, 0 }, kvb = { NULL, 0, 0 };
+	long i;
+	xdalgoenv_t xenv;
+
+	task->res = -1;
+	xenv.mxcost = task->mxcost;
+	xenv.snake_cnt = XDL_SNAKE_CNT;
+	xenv.heur_min = XDL_HEUR_MIN_COST;
+	xenv.xpp = task->xpp;
+	xenv.npoll = 0;
+	for (i = 0; i < task->nbox; i++) {
+		xdanchorbox_t *box = &task->boxes[i];
+
+		if (xdl_recs_cmp(&xe->xdf1, box->off1, box->lim1,
+				 &xe->xdf2, box->off2, box->lim2, &kvf, &kvb,
+				 (task->xpp->flags & XDF_NEED_MINIMAL) != 0,
+				 &xenv) < 0)
+			goto out;
+	}
+	task->res = 0;
+ out:
+	xdl_kvec_free(&kvb);
+	xdl_kvec_free(&kvf);
+}
+
+static int xdl_anchored_diff(xpparam_t const *xpp, xdfenv_t *xe, long mxcost)
+{
+	long *a1, *a2, nanchor, nbox = 0, ntask = 0, i, p1, p2, size, work;
+	xdanchorbox_t *boxes = NULL;
+	xdanchortask_t *tasks = NULL;
+	xdtask_group_t grp;
+	int res = -1;
+
+	if ((nanchor = xdl_find_anchors(xe, &a1, &a2)) < 0)
+		return -1;
+	if (!XDL_ALLOC_ARRAY(boxes, nanchor + 1) ||
+	    !XDL_ALLOC_ARRAY(tasks, nanchor + 1))
+		goto out;
+
+	/* The gaps between consecutive anchors, and after the last one. */
+	for (i = 0, p1 = p2 = 0; i <= nanchor; i++) {
+		xdanchorbox_t *box = &boxes[nbox];
+
+		box->off1 = p1;
+		box->off2 = p2;
+		box->lim1 = i < nanchor ? a1[i] : (long)xe->xdf1.nreff;
+		box->lim2 = i < nanchor ? a2[i] : (long)xe->xdf2.nreff;
+		if (box->lim1 > box->off1 || box->lim2 > box->off2)
+			nbox++;
+		p1 = box->lim1 + 1;
+		p2 = box->lim2 + 1;
+	}
+
+	/* Hand out runs of neighbouring boxes worth a task each. */
+	for (i = 0; i < nbox; ntask++) {
+		xdanchortask_t *task = &tasks[ntask];
+
+		task->xe = xe;
+		task->xpp = xpp;
+		task->boxes = &boxes[i];
+		task->nbox = 0;
+		task->mxcost = mxcost;
+		task->res = 0;
+		for (work = 0; i < nbox && (!task->nbox || work < XDL_ANCHOR_TASK_RECS); i++) {
+			size = (boxes[i].lim1 - boxes[i].off1) +
+				(boxes[i].lim2 - boxes[i].off2);
+			work += size;
+			task->nbox++;
+		}
+	}
+
+	xdl_group_init(&grp, ntask > 1 ? xpp->pool : NULL);
+	for (i = 0; i < ntask; i++) {
+		xdtask_t t = { xdl_anchor_task_run, NULL, &tasks[i],
+			       XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY };
+
+		if (xdl_pool_submit(&grp, &t) < 0)
+			xdl_anchor_task_run(&tasks[i]);
+	}
+	if (xdl_group_wait(&grp) < 0)
+		goto out;
+
+	res = 0;
+	for (i = 0; i < ntask; i++)
+		if (tasks[i].res < 0)
+			res = -1;
+out:
+	xdl_free(tasks);
+	xdl_free(boxes);
+	xdl_free(a2);
+	xdl_free(a1);
+	return res;
+}
+
+
+static int xdl_do_diff_0(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			xdfenv_t *xe, int unfilter, xdscale_t const *scale) {
 	long ndiags;
-	long *kvd, *kvdf, *kvdb;
+	xdkvec_t kvf = { NULL, 0, 0 }, kvb = { NULL, 0, 0 };
 	xdalgoenv_t xenv;
-	int res;
+	xpparam_t axpp;
+	xdautoinfo_t ai, *aip = NULL;
+	int res, phase;
 
-	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0)
+	if (XDF_DIFF_ALG(xpp->flags) == XDF_AUTO_DIFF) {
+		/*
+		 * Let the preparation pick the engine, then carry on as if
+		 * the caller had asked for it.
+		 */
+		aip = xpp->auto_info ? xpp->auto_info : &ai;
+		if (xdl_prepare_env_scaled(mf1, mf2, xpp, xe, aip, scale) < 0)
+			return -1;
+		axpp = *xpp;
+		axpp.flags = (xpp->flags & ~XDF_DIFF_ALGORITHM_MASK) | aip->alg;
+		axpp.auto_info = NULL;
+		xpp = &axpp;
+	} else if (xdl_prepare_env_scaled(mf1, mf2, xpp, xe, NULL, scale) < 0)
 		return -1;
 
+	if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF)
+		phase = XDL_TRACE_PATIENCE;
+	else if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
+		phase = XDL_TRACE_HISTOGRAM;
+	else
+		phase = XDL_TRACE_MYERS;
+	xdl_trace_enter(phase, phase == XDL_TRACE_MYERS ? xe->xdf1.nreff : xe->xdf1.nrec,
+			phase == XDL_TRACE_MYERS ? xe->xdf2.nreff : xe->xdf2.nrec);
+
 	if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF) {
 		res = xdl_do_patience_diff(xpp, xe);
 		goto out;
@@ -331,41 +656,76 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		goto out;
 	}
 
-	/*
-	 * Allocate and setup K vectors to be used by the differential
-	 * algorithm.
-	 *
-	 * One is to store the forward path and one to store the backward path.
-	 */
-	ndiags = xe->xdf1.nreff + xe->xdf2.nreff + 3;
-	if (!XDL_ALLOC_ARRAY(kvd, 2 * ndiags + 2)) {
-
-		xdl_free_env(xe);
-		return -1;
-	}
-	kvdf = kvd;
-	kvdb = kvdf + ndiags;
-	kvdf += xe->xdf2.nreff + 1;
-	kvdb += xe->xdf2.nreff + 1;
-
+	ndiags = scale ? scale->nrec1 + scale->nrec2 + 3 :
+		xe->xdf1.nreff + xe->xdf2.nreff + 3;
 	xenv.mxcost = xdl_bogosqrt(ndiags);
 	if (xenv.mxcost < XDL_MAX_COST_MIN)
 		xenv.mxcost = XDL_MAX_COST_MIN;
+	if (aip)
+		aip->mxcost = xenv.mxcost;
+
+	if (xpp->flags & XDF_UNIQUE_ANCHORS) {
+		res = xdl_anchored_diff(xpp, xe, xenv.mxcost);
+		goto out;
+	}
+
+	/*
+	 * The K vectors, one for the forward path and one for the backward
+	 * path, are allocated by the splits as their searches widen.
+	 */
 	xenv.snake_cnt = XDL_SNAKE_CNT;
 	xenv.heur_min = XDL_HEUR_MIN_COST;
+	xenv.xpp = xpp;
+	xenv.npoll = 0;
 
 	res = xdl_recs_cmp(&xe->xdf1, 0, xe->xdf1.nreff, &xe->xdf2, 0, xe->xdf2.nreff,
-			   kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0,
+			   &kvf, &kvb, (xpp->flags & XDF_NEED_MINIMAL) != 0,
 			   &xenv);
-	xdl_free(kvd);
+	xdl_kvec_free(&kvb);
+	xdl_kvec_free(&kvf);
  out:
-	if (res < 0)
+	if (res >= 0 && unfilter)
+		xdl_unfilter_env(xe);
+	if (res < 0) {
+		xdl_trace_leave(phase, 0, 0, 0, res);
 		xdl_free_env(xe);
+	} else
+		xdl_trace_leave(phase, xe->xdf1.nrec, xe->xdf2.nrec,
+				xdl_trace_changed(&xe->xdf1) +
+				xdl_trace_changed(&xe->xdf2), res);
 
 	return res;
 }
 
 
+int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		xdfenv_t *xe) {
+
+	return xdl_do_diff_0(mf1, mf2, xpp, xe, 1, NULL);
+}
+
+/*
+ * Like xdl_do_diff(), but leaves out of *xe the records XDF_FILTER_IGNORED
+ * took out, for a run on a range of a filtered file (xdl_fall_back_diff()).
+ */
+int xdl_do_diff_filtered(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			 xdfenv_t *xe) {
+
+	return xdl_do_diff_0(mf1, mf2, xpp, xe, 0, NULL);
+}
+
+/*
+ * Like xdl_do_diff(), for mf1 and mf2 cut out of files of scale->nrec1
+ * and scale->nrec2 records: the heuristics give up where a diff of the
+ * whole files would, not earlier because the region is small.
+ */
+int xdl_do_diff_region(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		       xdfenv_t *xe, xdscale_t const *scale) {
+
+	return xdl_do_diff_0(mf1, mf2, xpp, xe, 1, scale);
+}
+
+
 static xdchange_t *xdl_add_change(xdchange_t *xscr, long i1, long i2, long chg1, long chg2) {
 	xdchange_t *xch;
 
@@ -389,9 +749,9 @@ static int recs_match(xrecord_t *rec1, xrecord_t *rec2)
 }
 
 /*
- * If a line is indented more than this, get_indent() just returns this value.
+ * If a line is indented more than this, xdl_rec_indent() just returns this value.
  * This avoids having to do absurd amounts of work for data that are not
- * human-readable text, and also ensures that the output of get_indent fits
+ * human-readable text, and also ensures that the output of xdl_rec_indent() fits
  * within an int.
  */
 #define MAX_INDENT 200
@@ -401,7 +761,7 @@ static int recs_match(xrecord_t *rec1, xrecord_t *rec2)
  * columns. Return -1 if line is empty or contains only whitespace. Clamp the
  * output value at MAX_INDENT.
  */
-static int get_indent(xrecord_t *rec)
+int xdl_rec_indent(xrecord_t const *rec)
 {
 	int ret = 0;
 
@@ -424,6 +784,15 @@ static int get_indent(xrecord_t *rec)
 	return -1;
 }
 
+
+/* Like xdl_rec_indent(), from the prepared-file index if there is one. */
+static int get_indent(const xdfile_t *xdf, long ri)
+{
+	if (xdf->index)
+		return xdl_index_indent(xdf->index, ri);
+	return xdl_rec_indent(&xdf->recs[ri]);
+}
+
 /*
  * If more than this number of consecutive blank rows are found, just return
  * this value. This avoids requiring O(N^2) work for pathological cases, and
@@ -488,13 +857,13 @@ static void measure_split(const xdfile_t *xdf, long split,
 		m->indent = -1;
 	} else {
 		m->end_of_file = 0;
-		m->indent = get_indent(&xdf->recs[split]);
+		m->indent = get_indent(xdf, split);
 	}
 
 	m->pre_blank = 0;
 	m->pre_indent = -1;
 	for (i = split - 1; i >= 0; i--) {
-		m->pre_indent = get_indent(&xdf->recs[i]);
+		m->pre_indent = get_indent(xdf, i);
 		if (m->pre_indent != -1)
 			break;
 		m->pre_blank += 1;
@@ -507,7 +876,7 @@ static void measure_split(const xdfile_t *xdf, long split,
 	m->post_blank = 0;
 	m->post_indent = -1;
 	for (i = split + 1; i < (long)xdf->nrec; i++) {
-		m->post_indent = get_indent(&xdf->recs[i]);
+		m->post_indent = get_indent(xdf, i);
 		if (m->post_indent != -1)
 			break;
 		m->post_blank += 1;
@@ -790,7 +1159,7 @@ static int group_slide_up(xdfile_t *xdf, struct xdlgroup *g)
  * This also helps in finding joinable change groups and reducing the diff
  * size.
  */
-int xdl_change_compact(xdfile_t *xdf, xdfile_t *xdfo, long flags) {
+static int xdl_change_compact_0(xdfile_t *xdf, xdfile_t *xdfo, long flags) {
 	struct xdlgroup g, go;
 	long earliest_end, end_matching_other;
 	long groupsize;
@@ -928,12 +1297,25 @@ int xdl_change_compact(xdfile_t *xdf, xdfile_t *xdfo, long flags) {
 	return 0;
 }
 
+int xdl_change_compact(xdfile_t *xdf, xdfile_t *xdfo, long flags) {
+	int ret;
+
+	xdl_trace_enter(XDL_TRACE_COMPACT, xdf->nrec, xdfo->nrec);
+	ret = xdl_change_compact_0(xdf, xdfo, flags);
+	xdl_trace_leave(XDL_TRACE_COMPACT, xdf->nrec, xdfo->nrec,
+			xdl_trace_changed(xdf), ret);
+
+	return ret;
+}
+
 
 int xdl_build_script(xdfenv_t *xe, xdchange_t **xscr) {
 	xdchange_t *cscr = NULL, *xch;
 	bool *changed1 = xe->xdf1.changed, *changed2 = xe->xdf2.changed;
 	long i1, i2, l1, l2;
 
+	xdl_trace_enter(XDL_TRACE_BUILD_SCRIPT, xe->xdf1.nrec, xe->xdf2.nrec);
+
 	/*
 	 * Trivial. Collects "groups" of changes and creates an edit script.
 	 */
@@ -944,12 +1326,16 @@ int xdl_build_script(xdfenv_t *xe, xdchange_t **xscr) {
 
 			if (!(xch = xdl_add_change(cscr, i1, i2, l1 - i1, l2 - i2))) {
 				xdl_free_script(cscr);
+				xdl_trace_leave(XDL_TRACE_BUILD_SCRIPT, xe->xdf1.nrec,
+						xe->xdf2.nrec, 0, -1);
 				return -1;
 			}
 			cscr = xch;
 		}
 
 	*xscr = cscr;
+	xdl_trace_leave(XDL_TRACE_BUILD_SCRIPT, xe->xdf1.nrec, xe->xdf2.nrec,
+			xdl_trace_hunks(cscr), 0);
 
 	return 0;
 }
@@ -964,23 +1350,64 @@ void xdl_free_script(xdchange_t *xscr) {
 	}
 }
 
-static int xdl_call_hunk_func(xdfenv_t *xe UNUSED, xdchange_t *xscr, xdemitcb_t *ecb,
-			      xdemitconf_t const *xecfg)
+static int xdl_call_hunk_func_0(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb,
+				xdemitconf_t const *xecfg)
 {
 	xdchange_t *xch, *xche;
+	xdlinepos_t pos1 = { 0 }, pos2 = { 0 };
+	bool seg = xe->xdf1.nsplit || xe->xdf2.nsplit;
+	long h[4], p[4] = { 0, -1, 0, 0 }, off;
 
 	for (xch = xscr; xch; xch = xche->next) {
 		xche = xdl_get_hunk(&xch, xecfg);
 		if (!xch)
 			break;
-		if (xecfg->hunk_func(xch->i1, xche->i1 + xche->chg1 - xch->i1,
-				     xch->i2, xche->i2 + xche->chg2 - xch->i2,
-				     ecb->priv) < 0)
+		h[0] = xch->i1;
+		h[1] = xche->i1 + xche->chg1 - xch->i1;
+		h[2] = xch->i2;
+		h[3] = xche->i2 + xche->chg2 - xch->i2;
+		if (!seg) {
+			if (xecfg->hunk_func(h[0], h[1], h[2], h[3], ecb->priv) < 0)
+				return -1;
+			continue;
+		}
+
+		/*
+		 * Hunks in different pieces of one line touch the same
+		 * line; callers get them as one.
+		 */
+		h[1] = xdl_seg_lines(&xe->xdf1, &pos1, h[0], h[0] + h[1], &h[0], &off);
+		h[3] = xdl_seg_lines(&xe->xdf2, &pos2, h[2], h[2] + h[3], &h[2], &off);
+		if (p[1] >= 0 && (h[0] < p[0] + p[1] || h[2] < p[2] + p[3])) {
+			p[1] = XDL_MAX(p[0] + p[1], h[0] + h[1]) - p[0];
+			p[3] = XDL_MAX(p[2] + p[3], h[2] + h[3]) - p[2];
+			continue;
+		}
+		if (p[1] >= 0 &&
+		    xecfg->hunk_func(p[0], p[1], p[2], p[3], ecb->priv) < 0)
 			return -1;
+		memcpy(p, h, sizeof(p));
 	}
+	if (seg && p[1] >= 0 &&
+	    xecfg->hunk_func(p[0], p[1], p[2], p[3], ecb->priv) < 0)
+		return -1;
 	return 0;
 }
 
+/* Handing hunks to hunk_func is the emit phase of such diffs. */
+static int xdl_call_hunk_func(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb,
+			      xdemitconf_t const *xecfg)
+{
+	int ret;
+
+	xdl_trace_enter(XDL_TRACE_EMIT, xe->xdf1.nrec, xe->xdf2.nrec);
+	ret = xdl_call_hunk_func_0(xe, xscr, ecb, xecfg);
+	xdl_trace_leave(XDL_TRACE_EMIT, xe->xdf1.nrec, xe->xdf2.nrec,
+			xdl_trace_hunks(xscr), ret);
+
+	return ret;
+}
+
 static void xdl_mark_ignorable_lines(xdchange_t *xscr, xdfenv_t *xe, long flags)
 {
 	xdchange_t *xch;
@@ -1002,18 +1429,6 @@ static void xdl_mark_ignorable_lines(xdchange_t *xscr, xdfenv_t *xe, long flags)
 	}
 }
 
-static int record_matches_regex(xrecord_t *rec, xpparam_t const *xpp) {
-	regmatch_t regmatch;
-	size_t i;
-
-	for (i = 0; i < xpp->ignore_regex_nr; i++)
-		if (!regexec_buf(xpp->ignore_regex[i], (const char *)rec->ptr, rec->size, 1,
-				 &regmatch, 0))
-			return 1;
-
-	return 0;
-}
-
 static void xdl_mark_ignorable_regex(xdchange_t *xscr, const xdfenv_t *xe,
 				     xpparam_t const *xpp)
 {
@@ -1032,39 +1447,87 @@ static void xdl_mark_ignorable_regex(xdchange_t *xscr, const xdfenv_t *xe,
 
 		rec = &xe->xdf1.recs[xch->i1];
 		for (i = 0; i < xch->chg1 && ignore; i++)
-			ignore = record_matches_regex(&rec[i], xpp);
+			ignore = xdl_record_matches_regex(&rec[i], xpp);
 
 		rec = &xe->xdf2.recs[xch->i2];
 		for (i = 0; i < xch->chg2 && ignore; i++)
-			ignore = record_matches_regex(&rec[i], xpp);
+			ignore = xdl_record_matches_regex(&rec[i], xpp);
 
 		xch->ignore = ignore;
 	}
 }
 
-int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-	     xdemitconf_t const *xecfg, xdemitcb_t *ecb) {
-	xdchange_t *xscr;
-	xdfenv_t xe;
-	emit_func_t ef = xecfg->hunk_func ? xdl_call_hunk_func : xdl_emit_diff;
+/*
+ * With XDF_FILTER_IGNORED the changes are made of ignorable records
+ * the engine never saw, and blank lines and -I matches can end up in
+ * the same one, so either kind counts.
+ */
+static void xdl_mark_ignorable_filtered(xdchange_t *xscr, const xdfenv_t *xe,
+					xpparam_t const *xpp)
+{
+	xdchange_t *xch;
+
+	for (xch = xscr; xch; xch = xch->next) {
+		int ignore = 1;
+		long i;
+
+		for (i = 0; i < xch->chg1 && ignore; i++)
+			ignore = xdl_record_ignorable(&xe->xdf1, xch->i1 + i, xpp);
+		for (i = 0; i < xch->chg2 && ignore; i++)
+			ignore = xdl_record_ignorable(&xe->xdf2, xch->i2 + i, xpp);
+
+		xch->ignore = ignore;
+	}
+}
+
+/*
+ * Diffs mf1 and mf2 into *xe and builds the edit script from it. On
+ * failure, *xe is already freed.
+ */
+int xdl_diff_script(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		    xdfenv_t *xe, xdchange_t **xscr) {
+
+	if (xdl_chunk_prepass_wanted(mf1, mf2, xpp)) {
+		/* Comes back with the differing regions already compacted. */
+		if (xdl_do_chunked_diff(mf1, mf2, xpp, xe) < 0)
+			return -1;
+	} else if (xdl_do_diff(mf1, mf2, xpp, xe) < 0) {
 
-	if (xdl_do_diff(mf1, mf2, xpp, &xe) < 0) {
+		return -1;
+	} else if (xdl_change_compact(&xe->xdf1, &xe->xdf2, xpp->flags) < 0 ||
+		   xdl_change_compact(&xe->xdf2, &xe->xdf1, xpp->flags) < 0) {
 
+		xdl_free_env(xe);
 		return -1;
 	}
-	if (xdl_change_compact(&xe.xdf1, &xe.xdf2, xpp->flags) < 0 ||
-	    xdl_change_compact(&xe.xdf2, &xe.xdf1, xpp->flags) < 0 ||
-	    xdl_build_script(&xe, &xscr) < 0) {
+	if (xdl_build_script(xe, xscr) < 0) {
 
-		xdl_free_env(&xe);
+		xdl_free_env(xe);
 		return -1;
 	}
-	if (xscr) {
-		if (xpp->flags & XDF_IGNORE_BLANK_LINES)
-			xdl_mark_ignorable_lines(xscr, &xe, xpp->flags);
 
-		if (xpp->ignore_regex)
-			xdl_mark_ignorable_regex(xscr, &xe, xpp);
+	return 0;
+}
+
+static int xdl_diff_0(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		      xdemitconf_t const *xecfg, xdemitcb_t *ecb) {
+	xdchange_t *xscr;
+	xdfenv_t xe;
+	emit_func_t ef = xecfg->hunk_func ? xdl_call_hunk_func : xdl_emit_diff;
+
+	if (xdl_diff_script(mf1, mf2, xpp, &xe, &xscr) < 0)
+		return -1;
+	if (xscr) {
+		if ((xpp->flags & XDF_FILTER_IGNORED) &&
+		    ((xpp->flags & XDF_IGNORE_BLANK_LINES) || xpp->ignore_regex))
+			xdl_mark_ignorable_filtered(xscr, &xe, xpp);
+		else {
+			if (xpp->flags & XDF_IGNORE_BLANK_LINES)
+				xdl_mark_ignorable_lines(xscr, &xe, xpp->flags);
+
+			if (xpp->ignore_regex)
+				xdl_mark_ignorable_regex(xscr, &xe, xpp);
+		}
 
 		if (ef(&xe, xscr, ecb, xecfg) < 0) {
 
@@ -1078,3 +1541,15 @@ int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 
 	return 0;
 }
+
+int xdl_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+	     xdemitconf_t const *xecfg, xdemitcb_t *ecb) {
+	xdalloc_t *prev;
+	int ret;
+
+	prev = xdl_alloc_set(xpp->alloc ? xpp->alloc : xdl_alloc_get());
+	ret = xdl_diff_0(mf1, mf2, xpp, xecfg, ecb);
+	xdl_alloc_set(prev);
+
+	return ret;
+}
@@ -28,8 +28,20 @@ typedef struct s_xdalgoenv {
 	long mxcost;
 	long snake_cnt;
 	long heur_min;
+	xpparam_t const *xpp;
+	unsigned long npoll;
 } xdalgoenv_t;
 
+/*
+ * A K vector of the Myers search, indexed by diagonal. Only the
+ * diagonals a split reaches are backed by memory (see xdl_kvec_grow()).
+ */
+typedef struct s_xdkvec {
+	long *buf;
+	long alloc;	/* entries in buf */
+	long lo;	/* diagonal stored in buf[0] */
+} xdkvec_t;
+
 typedef struct s_xdchange {
 	struct s_xdchange *next;
 	long i1, i2;
@@ -41,15 +53,26 @@ typedef struct s_xdchange {
 
 int xdl_recs_cmp(xdfile_t *xdf1, long off1, long lim1,
 		 xdfile_t *xdf2, long off2, long lim2,
-		 long *kvdf, long *kvdb, int need_min, xdalgoenv_t *xenv);
+		 xdkvec_t *kvf, xdkvec_t *kvb, int need_min, xdalgoenv_t *xenv);
 int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		xdfenv_t *xe);
+int xdl_do_diff_filtered(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			 xdfenv_t *xe);
+int xdl_do_diff_region(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		       xdfenv_t *xe, xdscale_t const *scale);
 int xdl_change_compact(xdfile_t *xdf, xdfile_t *xdfo, long flags);
 int xdl_build_script(xdfenv_t *xe, xdchange_t **xscr);
+int xdl_diff_script(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		    xdfenv_t *xe, xdchange_t **xscr);
 void xdl_free_script(xdchange_t *xscr);
+long xdl_trace_hunks(xdchange_t const *xscr);
 int xdl_emit_diff(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb,
 		  xdemitconf_t const *xecfg);
 int xdl_do_patience_diff(xpparam_t const *xpp, xdfenv_t *env);
 int xdl_do_histogram_diff(xpparam_t const *xpp, xdfenv_t *env);
+int xdl_rec_indent(xrecord_t const *rec);
+int xdl_chunk_prepass_wanted(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp);
+int xdl_do_chunked_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			xdfenv_t *xe);
 
 #endif /* #if !defined(XDIFFI_H) */
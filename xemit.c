@@ -26,6 +26,19 @@
 static int xdl_emit_record(xdfile_t *xdf, long ri, char const *pre, xdemitcb_t *ecb)
 {
 	xrecord_t *rec = &xdf->recs[ri];
+	mmbuffer_t mb[3];
+
+	/* a piece of a cut line goes on an output line of its own */
+	if (xdf->nsplit && ri + 1 < (long)xdf->nrec &&
+	    rec->size && rec->ptr[rec->size - 1] != '\n') {
+		mb[0].ptr = (char *)pre;
+		mb[0].size = strlen(pre);
+		mb[1].ptr = (char *)rec->ptr;
+		mb[1].size = (long)rec->size;
+		mb[2].ptr = (char *)"\n";
+		mb[2].size = 1;
+		return ecb->out_line(ecb->priv, mb, 3) < 0 ? -1 : 0;
+	}
 
 	if (xdl_emit_diffrec((char const *)rec->ptr, (long)rec->size, pre, strlen(pre), ecb) < 0)
 		return -1;
@@ -112,6 +125,16 @@ static long match_func_rec(xdfile_t *xdf, xdemitconf_t const *xecfg, long ri,
 {
 	xrecord_t *rec = &xdf->recs[ri];
 
+	/* only the first piece of a cut line can be a function header */
+	if (xdf->nsplit && ri > 0 && xdf->recs[ri - 1].size &&
+	    xdf->recs[ri - 1].ptr[xdf->recs[ri - 1].size - 1] != '\n')
+		return -1;
+	if (!xecfg->find_func && xecfg->func_lang && xdf->index &&
+	    !xdl_index_maybe_func(xdf->index, xecfg->func_lang, ri))
+		return -1;
+	if (!xecfg->find_func && xecfg->func_lang)
+		return xdl_func_lang_match(xecfg->func_lang, (const char *)rec->ptr,
+					   (long)rec->size, buf, sz);
 	if (!xecfg->find_func)
 		return def_ff((const char *)rec->ptr, (long)rec->size, buf, sz);
 	return xecfg->find_func((const char *)rec->ptr, (long)rec->size, buf, sz, xecfg->find_func_priv);
@@ -158,12 +181,14 @@ static int is_empty_rec(xdfile_t *xdf, long ri)
 	return i == rec->size;
 }
 
-int xdl_emit_diff(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb,
-		  xdemitconf_t const *xecfg) {
+static int xdl_emit_diff_0(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb,
+			   xdemitconf_t const *xecfg) {
 	long s1, s2, e1, e2, lctx;
 	xdchange_t *xch, *xche;
 	long funclineprev = -1;
 	struct func_line func_line = { 0 };
+	xdlinepos_t pos1 = { 0 }, pos2 = { 0 };
+	bool seg = xe->xdf1.nsplit || xe->xdf2.nsplit;
 
 	for (xch = xscr; xch; xch = xche->next) {
 		xdchange_t *xchp = xch;
@@ -272,9 +297,18 @@ pre_context_calculation:
 				      s1 - 1, funclineprev);
 			funclineprev = s1 - 1;
 		}
-		if (!(xecfg->flags & XDL_EMIT_NO_HUNK_HDR) &&
-		    xdl_emit_hunk_hdr(s1 + 1, e1 - s1, s2 + 1, e2 - s2,
-				      func_line.buf, func_line.len, ecb) < 0)
+		if (!(xecfg->flags & XDL_EMIT_NO_HUNK_HDR) && seg) {
+			long l1, o1, n1, l2, o2, n2;
+
+			n1 = xdl_seg_lines(&xe->xdf1, &pos1, s1, e1, &l1, &o1);
+			n2 = xdl_seg_lines(&xe->xdf2, &pos2, s2, e2, &l2, &o2);
+			if (xdl_emit_seg_hunk_hdr(l1 + 1, o1, n1, l2 + 1, o2, n2,
+						  func_line.buf, func_line.len,
+						  ecb) < 0)
+				return -1;
+		} else if (!(xecfg->flags & XDL_EMIT_NO_HUNK_HDR) &&
+			   xdl_emit_hunk_hdr(s1 + 1, e1 - s1, s2 + 1, e2 - s2,
+					     func_line.buf, func_line.len, ecb) < 0)
 			return -1;
 
 		/*
@@ -322,3 +356,15 @@ pre_context_calculation:
 
 	return 0;
 }
+
+int xdl_emit_diff(xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb,
+		  xdemitconf_t const *xecfg) {
+	int ret;
+
+	xdl_trace_enter(XDL_TRACE_EMIT, xe->xdf1.nrec, xe->xdf2.nrec);
+	ret = xdl_emit_diff_0(xe, xscr, ecb, xecfg);
+	xdl_trace_leave(XDL_TRACE_EMIT, xe->xdf1.nrec, xe->xdf2.nrec,
+			xdl_trace_hunks(xscr), ret);
+
+	return ret;
+}
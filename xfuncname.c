@@ -0,0 +1,295 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * Built-in function header matchers (xdemitconf_t.func_lang).
+ *
+ * Instead of running a regular expression per line, every language is
+ * described by a table: the words that may introduce a header, the
+ * modifiers that may precede them, and a few shapes that need more
+ * than a leading keyword (C definitions at column 0, methods, JS
+ * functions assigned to a variable). A line is matched by reading its
+ * leading words once, left to right, and stopping at the first one
+ * that settles it, which for nearly all lines is the first.
+ */
+
+#define XDL_FN_INDENT 1		/* keyword headers may be indented */
+#define XDL_FN_COL0 2		/* an identifier at column 0 starts a header */
+#define XDL_FN_METHOD 4		/* "type name(...)" lines not ending in ';' */
+#define XDL_FN_ASSIGN 8		/* "const name = function/arrow" */
+
+typedef struct s_xdfnhead {
+	char const *word;
+	char const *need;	/* must also occur later on the line, or NULL */
+} xdfnhead_t;
+
+typedef struct s_xdfnlang {
+	char const *const *mods;
+	xdfnhead_t const *heads;
+	unsigned flags;
+} xdfnlang_t;
+
+static char const *const xdl_fn_no_mods[] = { NULL };
+
+static xdfnhead_t const xdl_fn_c_heads[] = { { NULL, NULL } };
+
+static char const *const xdl_fn_cpp_mods[] = { "export", NULL };
+static xdfnhead_t const xdl_fn_cpp_heads[] = {
+	{ "class", NULL }, { "struct", NULL }, { "namespace", NULL },
+	{ "union", NULL }, { "template", NULL }, { NULL, NULL }
+};
+
+static char const *const xdl_fn_py_mods[] = { "async", NULL };
+static xdfnhead_t const xdl_fn_py_heads[] = {
+	{ "def", NULL }, { "class", NULL }, { NULL, NULL }
+};
+
+static char const *const xdl_fn_js_mods[] = {
+	"export", "default", "async", "abstract", "declare", "static",
+	"public", "private", "protected", "readonly", "get", "set", NULL
+};
+static xdfnhead_t const xdl_fn_js_heads[] = {
+	{ "function", NULL }, { "class", NULL }, { "interface", NULL },
+	{ "enum", NULL }, { "namespace", NULL }, { "module", NULL },
+	{ NULL, NULL }
+};
+
+static xdfnhead_t const xdl_fn_go_heads[] = {
+	{ "func", NULL }, { "type", "struct" }, { "type", "interface" },
+	{ NULL, NULL }
+};
+
+static char const *const xdl_fn_rust_mods[] = {
+	"pub", "async", "const", "unsafe", "extern", "default", NULL
+};
+static xdfnhead_t const xdl_fn_rust_heads[] = {
+	{ "fn", NULL }, { "struct", NULL }, { "enum", NULL },
+	{ "union", NULL }, { "trait", NULL }, { "impl", NULL },
+	{ "mod", NULL }, { "macro_rules", NULL }, { NULL, NULL }
+};
+
+static char const *const xdl_fn_java_mods[] = {
+	"public", "protected", "private", "static", "abstract", "final",
+	"native", "synchronized", "strictfp", "default", "sealed", NULL
+};
+static xdfnhead_t const xdl_fn_java_heads[] = {
+	{ "class", NULL }, { "interface", NULL }, { "enum", NULL },
+	{ "record", NULL }, { NULL, NULL }
+};
+
+/* Indexed by XDL_FUNC_LANG_*. */
+static xdfnlang_t const xdl_fn_langs[] = {
+	{ xdl_fn_no_mods, xdl_fn_c_heads, 0 },
+	{ xdl_fn_no_mods, xdl_fn_c_heads, XDL_FN_COL0 },
+	{ xdl_fn_cpp_mods, xdl_fn_cpp_heads, XDL_FN_COL0 | XDL_FN_INDENT },
+	{ xdl_fn_py_mods, xdl_fn_py_heads, XDL_FN_INDENT },
+	{ xdl_fn_js_mods, xdl_fn_js_heads, XDL_FN_INDENT | XDL_FN_METHOD | XDL_FN_ASSIGN },
+	{ xdl_fn_no_mods, xdl_fn_go_heads, 0 },
+	{ xdl_fn_rust_mods, xdl_fn_rust_heads, XDL_FN_INDENT },
+	{ xdl_fn_java_mods, xdl_fn_java_heads, XDL_FN_INDENT | XDL_FN_METHOD },
+};
+
+/* Words that start statements, never a method header. */
+static char const *const xdl_fn_control[] = {
+	"if", "else", "for", "while", "do", "switch", "case", "catch",
+	"return", "new", "throw", "try", "finally", "await", "yield",
+	"typeof", "delete", "super", "this", NULL
+};
+
+/* Declarations that may bind a function expression. */
+static char const *const xdl_fn_decl[] = { "const", "let", "var", NULL };
+
+static int xdl_fn_idstart(char c)
+{
+	return isalpha((unsigned char)c) || c == '_' || c == '$';
+}
+
+static int xdl_fn_idchar(char c)
+{
+	return xdl_fn_idstart(c) || isdigit((unsigned char)c);
+}
+
+static char const *xdl_fn_blank(char const *p, char const *top)
+{
+	while (p < top && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+static char const *xdl_fn_word(char const *p, char const *top)
+{
+	if (p < top && xdl_fn_idstart(*p))
+		for (p++; p < top && xdl_fn_idchar(*p); p++)
+			;
+	return p;
+}
+
+static int xdl_fn_in(char const *const *words, char const *w, long len)
+{
+	for (; *words; words++)
+		if ((long)strlen(*words) == len && !memcmp(*words, w, len))
+			return 1;
+	return 0;
+}
+
+static int xdl_fn_contains(char const *p, char const *top, char const *s)
+{
+	long n = strlen(s);
+
+	for (; top - p >= n; p++)
+		if (!memcmp(p, s, n))
+			return 1;
+	return 0;
+}
+
+/* Skips "(crate)" after pub and the ABI string after extern. */
+static char const *xdl_fn_skip_arg(char const *p, char const *top)
+{
+	char close;
+
+	if (p >= top || (*p != '(' && *p != '"'))
+		return p;
+	close = *p == '(' ? ')' : '"';
+	for (p++; p < top && *p != close; p++)
+		;
+	return xdl_fn_blank(p < top ? p + 1 : p, top);
+}
+
+/* A goto label or access specifier: "name:" with nothing after it. */
+static int xdl_fn_is_label(char const *p, char const *top)
+{
+	char const *e = xdl_fn_word(p, top);
+
+	if (e == p)
+		return 0;
+	e = xdl_fn_blank(e, top);
+	if (e >= top || *e != ':' || (e + 1 < top && e[1] == ':'))
+		return 0;
+	e = xdl_fn_blank(e + 1, top);
+	return e >= top || isspace((unsigned char)*e) ||
+		(e + 1 < top && e[0] == '/' && (e[1] == '/' || e[1] == '*'));
+}
+
+static int xdl_fn_is_method(char const *p, char const *top)
+{
+	char const *w = p, *e = xdl_fn_word(p, top), *last = top, *name;
+
+	if (e == w || xdl_fn_in(xdl_fn_control, w, e - w))
+		return 0;
+	/* An optional return type and a name, then the parameter list. */
+	for (p = e, name = e; p < top && *p != '('; p++) {
+		if (!xdl_fn_idchar(*p) && !strchr(" \t<>[],.?", *p))
+			return 0;
+		if (*p != ' ' && *p != '\t')
+			name = p + 1;
+	}
+	if (p >= top || !xdl_fn_idchar(name[-1]))
+		return 0;
+	while (last > p && isspace((unsigned char)last[-1]))
+		last--;
+	return last[-1] != ';' && last[-1] != ',' && xdl_fn_contains(p, last, ")");
+}
+
+static int xdl_fn_is_assign(char const *p, char const *top)
+{
+	p = xdl_fn_blank(xdl_fn_word(p, top), top);
+	if (p >= top || *p != '=' || (p + 1 < top && (p[1] == '=' || p[1] == '>')))
+		return 0;
+	p = xdl_fn_blank(p + 1, top);
+	if (top - p >= 5 && !memcmp(p, "async", 5))
+		p = xdl_fn_blank(p + 5, top);
+	return (top - p >= 8 && !memcmp(p, "function", 8)) ||
+		xdl_fn_contains(p, top, "=>");
+}
+
+static int xdl_fn_match(xdfnlang_t const *lang, char const *rec, long len,
+			char const **start)
+{
+	char const *top = rec + len, *p = xdl_fn_blank(rec, top), *w, *e;
+	xdfnhead_t const *h;
+	int mods = 0;
+
+	*start = p;
+	if (p >= top)
+		return 0;
+	if (p > rec && !(lang->flags & (XDL_FN_INDENT | XDL_FN_METHOD)))
+		return 0;
+
+	for (w = p; (e = xdl_fn_word(w, top)) > w; mods++) {
+		for (h = lang->heads; h->word; h++)
+			if ((long)strlen(h->word) == e - w && !memcmp(h->word, w, e - w) &&
+			    (e >= top || !xdl_fn_idchar(*e)) &&
+			    (!h->need || xdl_fn_contains(e, top, h->need)))
+				return p == rec || (lang->flags & XDL_FN_INDENT);
+		if (!xdl_fn_in(lang->mods, w, e - w))
+			break;
+		w = xdl_fn_skip_arg(xdl_fn_blank(e, top), top);
+	}
+
+	if ((lang->flags & XDL_FN_COL0) && p == rec && xdl_fn_idstart(*p))
+		return !xdl_fn_is_label(p, top);
+	if ((lang->flags & XDL_FN_ASSIGN) && xdl_fn_in(xdl_fn_decl, w, e - w))
+		return xdl_fn_is_assign(xdl_fn_blank(e, top), top);
+	if (lang->flags & XDL_FN_METHOD)
+		return xdl_fn_is_method(w, top);
+	return 0;
+}
+
+long xdl_func_lang_match(int lang, char const *rec, long len, char *buf, long sz)
+{
+	char const *start;
+
+	if (lang <= 0 || lang >= (int)(sizeof(xdl_fn_langs) / sizeof(xdl_fn_langs[0])) ||
+	    !xdl_fn_match(&xdl_fn_langs[lang], rec, len, &start))
+		return -1;
+	len -= start - rec;
+	if (len > sz)
+		len = sz;
+	while (0 < len && isspace((unsigned char)start[len - 1]))
+		len--;
+	memcpy(buf, start, len);
+	return len;
+}
+
+int xdl_func_lang_for_path(char const *path)
+{
+	static struct {
+		char const *ext;
+		int lang;
+	} const exts[] = {
+		{ "c", XDL_FUNC_LANG_C }, { "h", XDL_FUNC_LANG_C },
+		{ "cc", XDL_FUNC_LANG_CPP }, { "cpp", XDL_FUNC_LANG_CPP },
+		{ "cxx", XDL_FUNC_LANG_CPP }, { "hh", XDL_FUNC_LANG_CPP },
+		{ "hpp", XDL_FUNC_LANG_CPP }, { "hxx", XDL_FUNC_LANG_CPP },
+		{ "py", XDL_FUNC_LANG_PYTHON }, { "pyi", XDL_FUNC_LANG_PYTHON },
+		{ "js", XDL_FUNC_LANG_JS }, { "mjs", XDL_FUNC_LANG_JS },
+		{ "cjs", XDL_FUNC_LANG_JS }, { "jsx", XDL_FUNC_LANG_JS },
+		{ "ts", XDL_FUNC_LANG_JS }, { "tsx", XDL_FUNC_LANG_JS },
+		{ "go", XDL_FUNC_LANG_GO }, { "rs", XDL_FUNC_LANG_RUST },
+		{ "java", XDL_FUNC_LANG_JAVA },
+	};
+	char const *dot = strrchr(path, '.');
+	size_t i;
+
+	if (!dot || strchr(dot, '/'))
+		return XDL_FUNC_LANG_NONE;
+	for (i = 0; i < sizeof(exts) / sizeof(exts[0]); i++)
+		if (!strcmp(dot + 1, exts[i].ext))
+			return exts[i].lang;
+	return XDL_FUNC_LANG_NONE;
+}
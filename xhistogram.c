@@ -46,6 +46,10 @@
 #define MAX_PTR	UINT_MAX
 #define MAX_CNT	UINT_MAX
 
+/* B regions at least this long are scanned in parallel when xpp->pool is set */
+#define PAR_MIN_COUNT2	16384
+#define PAR_MIN_CHUNK	4096
+
 #define LINE_END(n) (line##n + count##n - 1)
 #define LINE_END_PTR(n) (*line##n + *count##n - 1)
 
@@ -77,6 +81,34 @@ struct region {
 	unsigned int begin2, end2;
 };
 
+/*
+ * Parallel find_lcs(): B is cut into chunks that are scanned on the
+ * pool without touching the shared state, each recording for every
+ * b_ptr it visits the common runs try_lcs() would look at. The serial
+ * loop then replays these records in order, applying the filter on
+ * the running cnt itself, and only calls try_lcs() for the b_ptrs a
+ * chunk did not visit, so the result is exactly that of the serial
+ * scan.
+ */
+struct lcs_span {
+	unsigned int rcnt; /* rec->cnt on a record's first run, 0 after */
+	unsigned int as, ae, bs, be, rc; /* as == 0: a skipped common record */
+};
+
+struct lcs_pos {
+	int first, n; /* runs of a visited b_ptr, first == -1 if not visited */
+};
+
+struct lcs_trace {
+	struct histindex *index;
+	struct lcs_pos *pos; /* shared, indexed by b_ptr - line2 */
+	struct lcs_span *spans;
+	long nspans, alloc;
+	int line1, count1, line2, count2;
+	int from, to; /* the part of B this trace scans */
+	int ok;
+};
+
 #define LINE_MAP(i, a) (i->line_map[(a) - i->ptr_shift])
 
 #define NEXT_PTR(index, ptr) \
@@ -153,17 +185,45 @@ continue_scan:
 	return 0;
 }
 
+static int trace_span(struct lcs_trace *trace, unsigned int rcnt,
+	unsigned int as, unsigned int ae, unsigned int bs, unsigned int be,
+	unsigned int rc)
+{
+	struct lcs_span *sp;
+
+	if (XDL_ALLOC_GROW(trace->spans, trace->nspans + 1, trace->alloc)) {
+		trace->ok = 0;
+		return -1;
+	}
+	sp = &trace->spans[trace->nspans++];
+	sp->rcnt = rcnt;
+	sp->as = as;
+	sp->ae = ae;
+	sp->bs = bs;
+	sp->be = be;
+	sp->rc = rc;
+	return 0;
+}
+
+/*
+ * With a trace, index and lcs are left alone and the runs found are
+ * recorded instead.
+ */
 static int try_lcs(struct histindex *index, struct region *lcs, int b_ptr,
-	int line1, int count1, int line2, int count2)
+	int line1, int count1, int line2, int count2, struct lcs_trace *trace)
 {
 	unsigned int b_next = b_ptr + 1;
 	struct record *rec = index->records[TABLE_HASH(index, 2, b_ptr)];
 	unsigned int as, ae, bs, be, np, rc;
-	int should_break;
+	int should_break, first;
 
 	for (; rec; rec = rec->next) {
 		if (rec->cnt > index->cnt) {
-			if (!index->has_common)
+			if (trace) {
+				if (CMP(index, 1, rec->ptr, 2, b_ptr) &&
+				    trace_span(trace, rec->cnt, 0, 0, 0, 0, 0) < 0)
+					return b_next;
+			} else if (!index->has_common)
 				index->has_common = CMP(index, 1, rec->ptr, 2, b_ptr);
 			continue;
 		}
@@ -172,8 +232,9 @@ static int try_lcs(struct histindex *index, struct region *lcs, int b_ptr,
 		if (!CMP(index, 1, as, 2, b_ptr))
 			continue;
 
-		index->has_common = 1;
-		for (;;) {
+		if (!trace)
+			index->has_common = 1;
+		for (first = 1;; first = 0) {
 			should_break = 0;
 			np = NEXT_PTR(index, as);
 			bs = b_ptr;
@@ -198,7 +259,11 @@ static int try_lcs(struct histindex *index, struct region *lcs, int b_ptr,
 
 			if (b_next <= be)
 				b_next = be + 1;
-			if (lcs->end1 - lcs->begin1 < ae - as || rc < index->cnt) {
+			if (trace) {
+				if (trace_span(trace, first ? rec->cnt : 0,
+					       as, ae, bs, be, rc) < 0)
+					return b_next;
+			} else if (lcs->end1 - lcs->begin1 < ae - as || rc < index->cnt) {
 				lcs->begin1 = as;
 				lcs->begin2 = bs;
 				lcs->end1 = ae;
@@ -226,13 +291,119 @@ static int try_lcs(struct histindex *index, struct region *lcs, int b_ptr,
 	return b_next;
 }
 
+/*
+ * Does what try_lcs() would do at b_ptr, from the runs a trace recorded
+ * there.
+ */
+static int replay_lcs(struct histindex *index, struct region *lcs, int b_ptr,
+	struct lcs_span const *sp, int n)
+{
+	unsigned int b_next = b_ptr + 1;
+	int skip = 0;
+
+	for (; n--; sp++) {
+		if (sp->rcnt) {
+			index->has_common = 1;
+			if ((skip = sp->rcnt > index->cnt))
+				continue;
+		} else if (skip)
+			continue;
+
+		if (b_next <= sp->be)
+			b_next = sp->be + 1;
+		if (lcs->end1 - lcs->begin1 < sp->ae - sp->as || sp->rc < index->cnt) {
+			lcs->begin1 = sp->as;
+			lcs->begin2 = sp->bs;
+			lcs->end1 = sp->ae;
+			lcs->end2 = sp->be;
+			index->cnt = sp->rc;
+		}
+	}
+	return b_next;
+}
+
+static void trace_lcs_run(void *priv)
+{
+	struct lcs_trace *trace = priv;
+	struct lcs_pos *pos;
+	long first;
+	int b_ptr;
+
+	for (b_ptr = trace->from; b_ptr <= trace->to; ) {
+		if (!((b_ptr - trace->from + 1) & XDL_ABORT_POLL_MASK) &&
+		    xdl_should_abort(trace->index->xpp))
+			return;
+		first = trace->nspans;
+		pos = &trace->pos[b_ptr - trace->line2];
+		b_ptr = try_lcs(trace->index, NULL, b_ptr,
+				trace->line1, trace->count1,
+				trace->line2, trace->count2, trace);
+		if (!trace->ok)
+			return;
+		pos->first = first;
+		pos->n = trace->nspans - first;
+	}
+}
+
+/*
+ * Scans B on the pool, returning the per-b_ptr records (NULL if B is
+ * to be scanned serially) and the traces they point into.
+ */
+static struct lcs_pos *trace_lcs(struct histindex *index,
+	struct lcs_trace **traces, int *ntrace, int *chunk,
+	int line1, int count1, int line2, int count2)
+{
+	xdpool_t *pool = index->xpp->pool;
+	struct lcs_pos *pos;
+	xdtask_group_t grp;
+	int i, nthreads;
+
+	*traces = NULL;
+	if (!pool || count2 < PAR_MIN_COUNT2 ||
+	    (nthreads = xdl_pool_threads(pool)) < 2)
+		return NULL;
+
+	*chunk = XDL_MAX(PAR_MIN_CHUNK, (count2 + nthreads * 4 - 1) / (nthreads * 4));
+	*ntrace = (count2 + *chunk - 1) / *chunk;
+	if (!XDL_ALLOC_ARRAY(pos, count2))
+		return NULL;
+	if (!XDL_CALLOC_ARRAY(*traces, *ntrace)) {
+		xdl_free(pos);
+		return NULL;
+	}
+	for (i = 0; i < count2; i++)
+		pos[i].first = -1;
+
+	xdl_group_init(&grp, pool);
+	for (i = 0; i < *ntrace; i++) {
+		struct lcs_trace *trace = &(*traces)[i];
+		xdtask_t t = { trace_lcs_run, NULL, trace,
+			       XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY };
+
+		trace->index = index;
+		trace->pos = pos;
+		trace->line1 = line1;
+		trace->count1 = count1;
+		trace->line2 = line2;
+		trace->count2 = count2;
+		trace->from = line2 + i * *chunk;
+		trace->to = XDL_MIN(trace->from + *chunk - 1, LINE_END(2));
+		trace->ok = 1;
+		if (xdl_pool_submit(&grp, &t) < 0)
+			trace_lcs_run(trace);
+	}
+	/* Cancelled chunks did not record anything; they are scanned serially. */
+	xdl_group_wait(&grp);
+
+	return pos;
+}
+
 static int fall_back_to_classic_diff(xpparam_t const *xpp, xdfenv_t *env,
 		int line1, int count1, int line2, int count2)
 {
 	xpparam_t xpparam;
 
-	memset(&xpparam, 0, sizeof(xpparam));
-	xpparam.flags = xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
+	xdl_fallback_xpparam(&xpparam, xpp);
 
 	return xdl_fall_back_diff(env, &xpparam,
 				  line1, count1, line2, count2);
@@ -250,9 +421,11 @@ static int find_lcs(xpparam_t const *xpp, xdfenv_t *env,
 		    struct region *lcs,
 		    int line1, int count1, int line2, int count2)
 {
-	int b_ptr;
+	int b_ptr, i, ntrace = 0, chunk = 0;
 	int ret = -1;
 	struct histindex index;
+	struct lcs_trace *traces = NULL;
+	struct lcs_pos *pos = NULL, *p;
 
 	memset(&index, 0, sizeof(index));
 
@@ -288,8 +461,21 @@ static int find_lcs(xpparam_t const *xpp, xdfenv_t *env,
 
 	index.cnt = index.max_chain_length + 1;
 
-	for (b_ptr = line2; b_ptr <= LINE_END(2); )
-		b_ptr = try_lcs(&index, lcs, b_ptr, line1, count1, line2, count2);
+	pos = trace_lcs(&index, &traces, &ntrace, &chunk,
+			line1, count1, line2, count2);
+
+	for (b_ptr = line2; b_ptr <= LINE_END(2); ) {
+		if (!((b_ptr - line2 + 1) & XDL_ABORT_POLL_MASK) &&
+		    xdl_should_abort(xpp))
+			goto cleanup;
+		if (pos && (p = &pos[b_ptr - line2])->first >= 0)
+			b_ptr = replay_lcs(&index, lcs, b_ptr,
+					   traces[(b_ptr - line2) / chunk].spans + p->first,
+					   p->n);
+		else
+			b_ptr = try_lcs(&index, lcs, b_ptr,
+					line1, count1, line2, count2, NULL);
+	}
 
 	if (index.has_common && index.max_chain_length < index.cnt)
 		ret = 1;
@@ -297,6 +483,12 @@ static int find_lcs(xpparam_t const *xpp, xdfenv_t *env,
 		ret = 0;
 
 cleanup:
+	if (traces) {
+		for (i = 0; i < ntrace; i++)
+			xdl_free(traces[i].spans);
+		xdl_free(traces);
+		xdl_free(pos);
+	}
 	free_index(&index);
 	return ret;
 }
@@ -0,0 +1,490 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * HTML rendering of unified diffs with the markup gitweb builds in
+ * Perl: one <div class="diff ..."> per line, either inline or as
+ * side-by-side "chunk_block" pairs, plus an optional intra-line pass
+ * that marks what differs between paired removed and added lines.
+ *
+ * Body lines are collected per block as pointers into the caller's
+ * data (the diffed files, or the patch text) and escaped straight
+ * into the output buffer when the block ends, so nothing is copied
+ * or parsed twice on the way.
+ */
+
+#define XDL_HTML_TABSIZE 8
+
+typedef struct s_xdhtmlline {
+	char const *ptr;
+	long size;		/* without the newline */
+	char sign;
+} xdhtmlline_t;
+
+typedef struct s_xdhtmlblock {
+	xdhtmlline_t *lines;
+	long nr, alloc;
+} xdhtmlblock_t;
+
+typedef struct s_xdhtml {
+	unsigned long flags;
+	xdoutbuf_t *ob;
+	xdhtmlblock_t ctx, rem, add;
+	char prev;		/* class of the last body line, 0 if none */
+	char *tab[2];		/* tab-expanded copies of a highlighted pair */
+	long tab_alloc[2];
+} xdhtml_t;
+
+static char const xdl_html_no_eol[] = " No newline at end of file";
+
+static int xdl_html_put(xdhtml_t *h, char const *s)
+{
+	return xdl_outbuf_add(h->ob, s, strlen(s));
+}
+
+static long xdl_html_utf8_len(unsigned char const *p, long n)
+{
+	long len, i;
+
+	if (p[0] < 0xc2 || p[0] > 0xf4)
+		return 0;
+	len = p[0] < 0xe0 ? 2 : p[0] < 0xf0 ? 3 : 4;
+	if (len > n)
+		return 0;
+	for (i = 1; i < len; i++)
+		if ((p[i] & 0xc0) != 0x80)
+			return 0;
+	if ((p[0] == 0xe0 && p[1] < 0xa0) || (p[0] == 0xf0 && p[1] < 0x90) ||
+	    (p[0] == 0xed && p[1] >= 0xa0) || (p[0] == 0xf4 && p[1] >= 0x90))
+		return 0;
+	return len;
+}
+
+static int xdl_html_utf8_valid(unsigned char const *p, long n)
+{
+	long i, len;
+
+	for (i = 0; i < n; i += len)
+		if (p[i] < 0x80)
+			len = 1;
+		else if (!(len = xdl_html_utf8_len(p + i, n - i)))
+			return 0;
+	return 1;
+}
+
+static char const *xdl_html_cntrl(unsigned char c, char *buf)
+{
+	switch (c) {
+	case '\n': return "\\n";
+	case '\r': return "\\r";
+	case '\f': return "\\f";
+	case '\b': return "\\b";
+	case '\a': return "\\a";
+	case '\033': return "\\e";
+	case '\013': return "\\v";
+	case '\0': return "\\0";
+	}
+	snprintf(buf, 8, "\\%2x", c);
+	return buf;
+}
+
+/*
+ * Escapes ptr[0..size) as gitweb's esc_html(): entities for markup
+ * characters, tabs expanded against *col, control characters spelled
+ * out, and bytes that are not UTF-8 taken as Latin-1. With nbsp,
+ * spaces become &nbsp; so the line keeps its shape. The bytes in
+ * [hl0, hl1) are wrapped in a "marked" span. Like gitweb, columns
+ * count bytes and each of the three parts falls back to Latin-1 on
+ * its own.
+ */
+static int xdl_html_esc(xdhtml_t *h, char const *ptr, long size, long *col,
+			long hl0, long hl1, int nbsp)
+{
+	unsigned char const *p = (unsigned char const *)ptr;
+	long i = 0, run, stop, n, seg = 0;
+	char tmp[8];
+	char const *ent;
+	int marked = 0, latin1 = 0;
+
+	while (i < size) {
+		if (!marked && i >= hl0 && i < hl1) {
+			if (xdl_html_put(h, "<span class=\"marked\">") < 0)
+				return -1;
+			marked = 1;
+		}
+		stop = i < hl0 ? hl0 : i < hl1 ? hl1 : size;
+		if (stop > size)
+			stop = size;
+		if (i >= seg) {
+			latin1 = !xdl_html_utf8_valid(p + i, stop - i);
+			seg = stop;
+		}
+		for (run = i; run < stop && p[run] > ' ' && p[run] < 0x7f &&
+			     !strchr("&<>\"'", p[run]); run++)
+			;
+		if (run > i) {
+			if (xdl_outbuf_add(h->ob, ptr + i, run - i) < 0)
+				return -1;
+			*col += run - i;
+			i = run;
+		} else if (p[i] == '\t') {
+			for (n = XDL_HTML_TABSIZE - *col % XDL_HTML_TABSIZE; n; n--, (*col)++)
+				if (xdl_html_put(h, nbsp ? "&nbsp;" : " ") < 0)
+					return -1;
+			i++;
+		} else if (p[i] < ' ' || p[i] == 0x7f) {
+			if (xdl_html_put(h, "<span class=\"cntrl\">") < 0 ||
+			    xdl_html_put(h, xdl_html_cntrl(p[i], tmp)) < 0 ||
+			    xdl_html_put(h, "</span>") < 0)
+				return -1;
+			(*col)++;
+			i++;
+		} else if (p[i] < 0x80) {
+			switch (p[i]) {
+			case '&': ent = "&amp;"; break;
+			case '<': ent = "&lt;"; break;
+			case '>': ent = "&gt;"; break;
+			case '"': ent = "&quot;"; break;
+			case '\'': ent = "&#39;"; break;
+			default: ent = nbsp ? "&nbsp;" : " "; break;
+			}
+			if (xdl_html_put(h, ent) < 0)
+				return -1;
+			(*col)++;
+			i++;
+		} else if (!latin1 && (n = xdl_html_utf8_len(p + i, size - i)) > 0) {
+			if (xdl_outbuf_add(h->ob, ptr + i, n) < 0)
+				return -1;
+			*col += n;
+			i += n;
+		} else {
+			tmp[0] = (char)(0xc0 | (p[i] >> 6));
+			tmp[1] = (char)(0x80 | (p[i] & 0x3f));
+			if (xdl_outbuf_add(h->ob, tmp, 2) < 0)
+				return -1;
+			(*col)++;
+			i++;
+		}
+		if (marked && i >= hl1) {
+			if (xdl_html_put(h, "</span>") < 0)
+				return -1;
+			marked = 0;
+		}
+	}
+	return marked ? xdl_html_put(h, "</span>") : 0;
+}
+
+static int xdl_html_line(xdhtml_t *h, char const *cls, xdhtmlline_t const *l,
+			 long hl0, long hl1)
+{
+	long col = 0;
+
+	if (xdl_html_put(h, "<div class=\"diff ") < 0 ||
+	    xdl_html_put(h, cls) < 0 || xdl_html_put(h, "\">") < 0 ||
+	    xdl_html_esc(h, &l->sign, 1, &col, 0, 0, 1) < 0 ||
+	    xdl_html_esc(h, l->ptr, l->size, &col, hl0, hl1, 1) < 0)
+		return -1;
+	return xdl_html_put(h, "</div>\n");
+}
+
+/*
+ * Finds the part of r (or, with a_side, of a) between the longest
+ * common prefix and suffix of the pair, as contrib/diff-highlight
+ * does. Lines with nothing but whitespace in common get no marks.
+ */
+static void xdl_html_changed(xdhtmlline_t const *r, xdhtmlline_t const *a,
+			     int a_side, long *hl0, long *hl1)
+{
+	xdhtmlline_t const *l = a_side ? a : r;
+	long shorter = XDL_MIN(r->size, a->size), pre = 0, suf = 0;
+	int nonspace = 0;
+
+	*hl0 = *hl1 = 0;
+	for (; pre < shorter && r->ptr[pre] == a->ptr[pre]; pre++)
+		nonspace |= !XDL_ISSPACE(r->ptr[pre]);
+	for (; pre + suf < shorter &&
+		     r->ptr[r->size - 1 - suf] == a->ptr[a->size - 1 - suf]; suf++)
+		nonspace |= !XDL_ISSPACE(r->ptr[r->size - 1 - suf]);
+	if (!nonspace)
+		return;
+
+	/* Keep multi-byte characters whole. */
+	while (pre > 0 && pre < l->size && (l->ptr[pre] & 0xc0) == 0x80)
+		pre--;
+	while (suf > 0 && (l->ptr[l->size - suf] & 0xc0) == 0x80)
+		suf--;
+	*hl0 = pre;
+	*hl1 = l->size - suf;
+}
+
+/*
+ * gitweb compares paired lines after expanding their tabs, so a
+ * marked change may start inside one; work on a copy the same way.
+ */
+static int xdl_html_untabify(xdhtml_t *h, int k, xdhtmlline_t const *l,
+			     xdhtmlline_t *out)
+{
+	long i, n = 0, col = 1, tabs = 0;
+
+	*out = *l;
+	for (i = 0; i < l->size; i++)
+		tabs += l->ptr[i] == '\t';
+	if (!tabs)
+		return 0;
+	if (XDL_ALLOC_GROW(h->tab[k], l->size + tabs * (XDL_HTML_TABSIZE - 1),
+			   h->tab_alloc[k]))
+		return -1;
+	for (i = 0; i < l->size; i++) {
+		if (l->ptr[i] != '\t') {
+			h->tab[k][n++] = l->ptr[i];
+			col++;
+			continue;
+		}
+		do {
+			h->tab[k][n++] = ' ';
+		} while (++col % XDL_HTML_TABSIZE);
+	}
+	out->ptr = h->tab[k];
+	out->size = n;
+
+	return 0;
+}
+
+static int xdl_html_lines(xdhtml_t *h, char const *cls, xdhtmlblock_t const *blk,
+			  xdhtmlblock_t const *rem, xdhtmlblock_t const *add)
+{
+	xdhtmlline_t r, a;
+	long i, hl0 = 0, hl1 = 0;
+
+	for (i = 0; i < blk->nr; i++) {
+		if (!rem) {
+			if (xdl_html_line(h, cls, &blk->lines[i], 0, 0) < 0)
+				return -1;
+			continue;
+		}
+		if (xdl_html_untabify(h, 0, &rem->lines[i], &r) < 0 ||
+		    xdl_html_untabify(h, 1, &add->lines[i], &a) < 0)
+			return -1;
+		xdl_html_changed(&r, &a, blk == add, &hl0, &hl1);
+		if (xdl_html_line(h, cls, blk == add ? &a : &r, hl0, hl1) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int xdl_html_flush(xdhtml_t *h)
+{
+	xdhtmlblock_t *rem = NULL, *add = NULL;
+	int ret = 0;
+
+	if ((h->flags & XDL_HTML_HIGHLIGHT) && h->rem.nr && h->rem.nr == h->add.nr) {
+		rem = &h->rem;
+		add = &h->add;
+	}
+
+	if (!(h->flags & XDL_HTML_SIDEBYSIDE)) {
+		ret = xdl_html_lines(h, "ctx", &h->ctx, NULL, NULL) < 0 ||
+			xdl_html_lines(h, "rem", &h->rem, rem, add) < 0 ||
+			xdl_html_lines(h, "add", &h->add, rem, add) < 0;
+	} else {
+		if (h->ctx.nr)
+			ret = xdl_html_put(h, "<div class=\"chunk_block ctx\"><div class=\"old\">") < 0 ||
+				xdl_html_lines(h, "ctx", &h->ctx, NULL, NULL) < 0 ||
+				xdl_html_put(h, "</div><div class=\"new\">") < 0 ||
+				xdl_html_lines(h, "ctx", &h->ctx, NULL, NULL) < 0 ||
+				xdl_html_put(h, "</div></div>") < 0;
+		if (!ret && (h->rem.nr || h->add.nr)) {
+			ret = xdl_html_put(h, !h->add.nr ? "<div class=\"chunk_block rem\">" :
+					   !h->rem.nr ? "<div class=\"chunk_block add\">" :
+					   "<div class=\"chunk_block chg\">") < 0;
+			if (!ret && h->rem.nr)
+				ret = xdl_html_put(h, "<div class=\"old\">") < 0 ||
+					xdl_html_lines(h, "rem", &h->rem, rem, add) < 0 ||
+					xdl_html_put(h, "</div>") < 0;
+			if (!ret && h->add.nr)
+				ret = xdl_html_put(h, "<div class=\"new\">") < 0 ||
+					xdl_html_lines(h, "add", &h->add, rem, add) < 0 ||
+					xdl_html_put(h, "</div>") < 0;
+			if (!ret)
+				ret = xdl_html_put(h, "</div>") < 0;
+		}
+	}
+	h->ctx.nr = h->rem.nr = h->add.nr = 0;
+
+	return ret ? -1 : 0;
+}
+
+static int xdl_html_body(xdhtml_t *h, char sign, char const *ptr, long size)
+{
+	xdhtmlblock_t *blk;
+	char cls = sign;
+
+	if (cls == '\\')
+		cls = h->prev ? h->prev : ' ';
+	if (size && ptr[size - 1] == '\n')
+		size--;
+
+	/* Same block boundaries as gitweb's print_diff_chunk(). */
+	if (((h->rem.nr || h->add.nr) && cls == ' ') ||
+	    (h->rem.nr && h->add.nr && cls != h->prev)) {
+		if (xdl_html_flush(h) < 0)
+			return -1;
+	}
+
+	blk = cls == '-' ? &h->rem : cls == '+' ? &h->add : &h->ctx;
+	if (XDL_ALLOC_GROW(blk->lines, blk->nr + 1, blk->alloc))
+		return -1;
+	blk->lines[blk->nr].ptr = ptr;
+	blk->lines[blk->nr].size = size;
+	blk->lines[blk->nr].sign = sign;
+	blk->nr++;
+	h->prev = cls;
+
+	return 0;
+}
+
+static int xdl_html_hunk_hdr(xdhtml_t *h, char const *ptr, long size)
+{
+	char const *end;
+	long col = 0, info;
+
+	if (xdl_html_flush(h) < 0)
+		return -1;
+	h->prev = 0;
+	if (h->flags & XDL_HTML_NO_HUNK_HDR)
+		return 0;
+
+	if (size && ptr[size - 1] == '\n')
+		size--;
+	for (end = ptr + 2; end + 3 <= ptr + size && memcmp(end, " @@", 3); end++)
+		;
+	if (end + 3 > ptr + size)
+		return xdl_html_put(h, "<div class=\"diff chunk_header\">") < 0 ||
+			xdl_html_esc(h, ptr, size, &col, 0, 0, 1) < 0 ||
+			xdl_html_put(h, "</div>\n") < 0 ? -1 : 0;
+	info = end + 3 - ptr;
+
+	return xdl_html_put(h, "<div class=\"diff chunk_header\"><span class=\"chunk_info\">") < 0 ||
+		xdl_html_esc(h, ptr, info, &col, 0, 0, 0) < 0 ||
+		xdl_html_put(h, "</span><span class=\"section\">") < 0 ||
+		xdl_html_esc(h, ptr + info, size - info, &col, 0, 0, 1) < 0 ||
+		xdl_html_put(h, "</span></div>\n") < 0 ? -1 : 0;
+}
+
+/* One line of unified diff text, from a patch or a formatted hunk header. */
+static int xdl_html_text(xdhtml_t *h, char const *ptr, long size)
+{
+	if (size >= 3 && !memcmp(ptr, "@@ ", 3))
+		return xdl_html_hunk_hdr(h, ptr, size);
+	if (size && *ptr && strchr(" -+\\", *ptr))
+		return xdl_html_body(h, *ptr, ptr + 1, size - 1);
+
+	/* Anything else ends the block and is not shown. */
+	h->prev = 0;
+	return xdl_html_flush(h);
+}
+
+static int xdl_html_out_line(void *priv, mmbuffer_t *mb, int nbuf)
+{
+	xdhtml_t *h = (xdhtml_t *)priv;
+
+	if (nbuf == 1)
+		return xdl_html_text(h, mb[0].ptr, mb[0].size);
+	if (xdl_html_body(h, mb[0].size ? mb[0].ptr[0] : ' ',
+			  mb[1].ptr, mb[1].size) < 0)
+		return -1;
+	/* a third buffer of just "\n" ends a piece of a cut line */
+	if (nbuf > 2 && mb[2].size > 1)
+		return xdl_html_body(h, '\\', xdl_html_no_eol,
+				     (long)sizeof(xdl_html_no_eol) - 1);
+	return 0;
+}
+
+static void xdl_html_init(xdhtml_t *h, unsigned long flags, xdoutbuf_t *ob)
+{
+	memset(h, 0, sizeof(*h));
+	h->flags = flags;
+	h->ob = ob;
+}
+
+static int xdl_html_finish(xdhtml_t *h, int ret)
+{
+	if (ret >= 0 && xdl_html_flush(h) < 0)
+		ret = -1;
+	xdl_free(h->ctx.lines);
+	xdl_free(h->rem.lines);
+	xdl_free(h->add.lines);
+	xdl_free(h->tab[0]);
+	xdl_free(h->tab[1]);
+
+	return ret;
+}
+
+int xdl_diff_html(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		  xdemitconf_t const *xecfg, unsigned long flags, xdoutbuf_t *ob)
+{
+	xdalloc_t *prev;
+	xdemitconf_t cfg = *xecfg;
+	xdemitcb_t ecb;
+	xdhtml_t h;
+	int ret;
+
+	/* The renderer needs the lines, not just the hunk ranges. */
+	cfg.hunk_func = NULL;
+	ecb.priv = &h;
+	ecb.out_hunk = NULL;
+	ecb.out_line = xdl_html_out_line;
+
+	prev = xdl_alloc_set(xpp->alloc ? xpp->alloc : xdl_alloc_get());
+	xdl_html_init(&h, flags, ob);
+	ret = xdl_html_finish(&h, xdl_diff(mf1, mf2, xpp, &cfg, &ecb));
+	xdl_alloc_set(prev);
+
+	return ret;
+}
+
+int xdl_html_patch(char const *patch, long size, unsigned long flags,
+		   xdoutbuf_t *ob)
+{
+	char const *top = patch + size, *eol;
+	int in_hunk = 0, ret = 0;
+	xdhtml_t h;
+
+	xdl_html_init(&h, flags, ob);
+	for (; patch < top && ret >= 0; patch = eol) {
+		if (!(eol = memchr(patch, '\n', top - patch)))
+			eol = top;
+		else
+			eol++;
+
+		/* Headers up to the first hunk of each file are skipped. */
+		if (eol - patch >= 4 && !memcmp(patch, "diff", 4) &&
+		    (eol - patch == 4 || XDL_ISSPACE(patch[4]))) {
+			in_hunk = 0;
+			h.prev = 0;
+			ret = xdl_html_flush(&h);
+			continue;
+		}
+		if (!in_hunk && (eol - patch < 3 || memcmp(patch, "@@ ", 3)))
+			continue;
+		in_hunk = 1;
+		ret = xdl_html_text(&h, patch, (long)(eol - patch));
+	}
+
+	return xdl_html_finish(&h, ret);
+}
@@ -0,0 +1,477 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * Prepared-file indexes (see xpparam_t.index_dir).
+ *
+ * Preparing an input mostly means finding its records and hashing
+ * them, which every process diffing the same file does again. An
+ * index keeps the result on disk, keyed by the BLAKE2b of the content
+ * and by the options that decide how records are cut and hashed, so
+ * that the next process only has to map it and classify the records.
+ * Unlike a fast hash the digest cannot be made to collide: an input
+ * only ever gets the index of the same bytes.
+ *
+ * The file is a header followed by, for each record, its end offset
+ * and line hash (uint64_t), its indentation and its attribute bits
+ * (uint8_t), all in the byte order of the writer. The header carries
+ * a checksum of the records, so a damaged file is not used. The name
+ * repeats the key, so looking an input up is a single open().
+ *
+ * What an index says about its records is not checked against the
+ * content beyond that; it is relied on only where being wrong cannot
+ * hide a change. Records still need xdl_recmatch() to be classed
+ * together, so a wrong line hash can only split lines that are equal,
+ * and blank lines are always tested on the content itself.
+ */
+
+#define XDL_INDEX_MAGIC 0x58444958	/* "XDIX" */
+#define XDL_INDEX_VERSION 2
+#define XDL_INDEX_ORDER 0x01020304
+
+/* the options that change how records are cut or hashed */
+#define XDL_INDEX_FLAGS (XDF_WHITESPACE_FLAGS | XDF_SEGMENT_LINES)
+
+#define XDL_INDEX_FUNC (1 << 0)		/* function header for func_lang */
+#define XDL_INDEX_NO_INDENT 255		/* whitespace only */
+
+/* the per-record sections, in file order */
+#define XDL_INDEX_SEC_END 0
+#define XDL_INDEX_SEC_HASH 1
+#define XDL_INDEX_SEC_INDENT 2
+#define XDL_INDEX_SEC_ATTR 3
+
+/* records written per write() */
+#define XDL_INDEX_CHUNK 4096
+
+typedef struct s_xdlindexhdr {
+	uint32_t magic;
+	uint32_t version;
+	uint8_t digest[XDL_INDEX_DIGEST_SIZE];	/* BLAKE2b-256 of the content */
+	uint64_t size;		/* bytes of content */
+	uint64_t flags;		/* XDL_INDEX_FLAGS the records were made with */
+	uint64_t segment_size;	/* xpparam_t.segment_size, with XDF_SEGMENT_LINES */
+	uint64_t nrec;
+	uint32_t func_lang;	/* XDL_INDEX_FUNC is valid for this, if not 0 */
+	uint32_t order;		/* XDL_INDEX_ORDER */
+	uint64_t check;		/* xdl_index_fold() of the sections */
+} xdlindexhdr_t;
+
+struct s_xdindex {
+	void *map;
+	size_t len;
+	int mapped;
+	xdlindexhdr_t const *hdr;
+	uint64_t const *end, *hash;
+	uint8_t const *indent, *attr;
+};
+
+static uint64_t const xdl_blake2b_iv[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+	0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static uint8_t const xdl_blake2b_sigma[12][16] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+	{ 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+	{ 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+	{ 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+	{ 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+	{ 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+	{ 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+	{ 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+	{ 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+};
+
+#define XDL_ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+#define XDL_BLAKE2B_G(a, b, c, d, x, y) do { \
+	a += b + (x); d = XDL_ROR64(d ^ a, 32); \
+	c += d; b = XDL_ROR64(b ^ c, 24); \
+	a += b + (y); d = XDL_ROR64(d ^ a, 16); \
+	c += d; b = XDL_ROR64(b ^ c, 63); \
+} while (0)
+
+static void xdl_blake2b_block(uint64_t *h, uint8_t const *p, uint64_t count,
+			      int last)
+{
+	uint64_t m[16], v[16];
+	int i;
+
+	for (i = 0; i < 16; i++, p += 8)
+		m[i] = (uint64_t)p[0] | (uint64_t)p[1] << 8 |
+			(uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+			(uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+			(uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+	for (i = 0; i < 8; i++) {
+		v[i] = h[i];
+		v[i + 8] = xdl_blake2b_iv[i];
+	}
+	v[12] ^= count;
+	if (last)
+		v[14] = ~v[14];
+	for (i = 0; i < 12; i++) {
+		uint8_t const *s = xdl_blake2b_sigma[i];
+
+		XDL_BLAKE2B_G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+		XDL_BLAKE2B_G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+		XDL_BLAKE2B_G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+		XDL_BLAKE2B_G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+		XDL_BLAKE2B_G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+		XDL_BLAKE2B_G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+		XDL_BLAKE2B_G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+		XDL_BLAKE2B_G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+	}
+	for (i = 0; i < 8; i++)
+		h[i] ^= v[i] ^ v[i + 8];
+}
+
+/*
+ * The BLAKE2b-256 of a block of bytes. Only indexes need a digest, so
+ * it lives here rather than in a dependency the rest of the library
+ * does not have.
+ */
+void xdl_index_digest(void const *data, size_t size,
+		      uint8_t digest[XDL_INDEX_DIGEST_SIZE])
+{
+	uint8_t const *p = data;
+	uint8_t tail[128] = { 0 };
+	uint64_t h[8];
+	size_t left = size;
+	int i;
+
+	memcpy(h, xdl_blake2b_iv, sizeof(h));
+	h[0] ^= 0x01010000 | XDL_INDEX_DIGEST_SIZE;
+	for (; left > 128; left -= 128, p += 128)
+		xdl_blake2b_block(h, p, (uint64_t)(size - left + 128), 0);
+	memcpy(tail, p, left);
+	xdl_blake2b_block(h, tail, (uint64_t)size, 1);
+	for (i = 0; i < XDL_INDEX_DIGEST_SIZE; i++)
+		digest[i] = (uint8_t)(h[i / 8] >> (8 * (i % 8)));
+}
+
+static void xdl_index_key(xpparam_t const *xpp,
+			  uint8_t const digest[XDL_INDEX_DIGEST_SIZE],
+			  uint64_t size, xdlindexhdr_t *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = XDL_INDEX_MAGIC;
+	hdr->version = XDL_INDEX_VERSION;
+	memcpy(hdr->digest, digest, sizeof(hdr->digest));
+	hdr->size = size;
+	hdr->flags = xpp->flags & XDL_INDEX_FLAGS;
+	if ((xpp->flags & XDF_SEGMENT_LINES) && xpp->segment_size > 0)
+		hdr->segment_size = (uint64_t)xpp->segment_size;
+	hdr->order = XDL_INDEX_ORDER;
+}
+
+static char *xdl_index_path(char const *dir, xdlindexhdr_t const *key)
+{
+	size_t len = strlen(dir) + 2 * XDL_INDEX_DIGEST_SIZE + 48, i;
+	char *path, *p;
+
+	if (!(path = xdl_malloc(len)))
+		return NULL;
+	p = path + snprintf(path, len, "%s/", dir);
+	for (i = 0; i < XDL_INDEX_DIGEST_SIZE; i++, p += 2)
+		snprintf(p, 3, "%02x", key->digest[i]);
+	snprintf(p, len - (p - path), "-%" PRIx64 "-%" PRIx64 ".xdi",
+		 key->flags, key->segment_size);
+	return path;
+}
+
+static size_t xdl_index_bytes(uint64_t nrec)
+{
+	return sizeof(xdlindexhdr_t) + nrec * (2 * sizeof(uint64_t) + 2);
+}
+
+/*
+ * The checksum takes each section XDL_INDEX_CHUNK records at a time,
+ * the way xdl_index_store() writes it, so that the writer does not
+ * have to keep a section around.
+ */
+static uint64_t xdl_index_fold(uint64_t check, void const *buf, size_t len)
+{
+	return (check ^ xdl_hash_bytes(buf, len)) * 0x9e3779b97f4a7c15ULL;
+}
+
+static uint64_t xdl_index_sum(xdindex_t const *xi)
+{
+	uint8_t const *p = (uint8_t const *)(xi->hdr + 1);
+	uint64_t nrec = xi->hdr->nrec, check = 0, i, n;
+	int what;
+
+	for (what = XDL_INDEX_SEC_END; what <= XDL_INDEX_SEC_ATTR; what++) {
+		size_t width = what < XDL_INDEX_SEC_INDENT ? sizeof(uint64_t) : 1;
+
+		for (i = 0; i < nrec; i += n, p += n * width) {
+			n = XDL_MIN(nrec - i, XDL_INDEX_CHUNK);
+			check = xdl_index_fold(check, p, n * width);
+		}
+	}
+	return check;
+}
+
+/*
+ * An index is used only for the content it was made from, and only
+ * if its records checksum right and tile that content exactly, so
+ * that a damaged file never sends xdl_prepare_ctx() outside the input.
+ */
+static int xdl_index_check(xdindex_t *xi, xdlindexhdr_t const *key)
+{
+	xdlindexhdr_t const *hdr = xi->map;
+	uint64_t i, prev = 0;
+
+	if (xi->len < sizeof(*hdr) ||
+	    hdr->magic != key->magic || hdr->version != key->version ||
+	    hdr->order != key->order ||
+	    memcmp(hdr->digest, key->digest, sizeof(hdr->digest)) ||
+	    hdr->size != key->size || hdr->flags != key->flags ||
+	    hdr->segment_size != key->segment_size ||
+	    hdr->nrec > hdr->size || xi->len != xdl_index_bytes(hdr->nrec))
+		return -1;
+
+	xi->hdr = hdr;
+	if (xdl_index_sum(xi) != hdr->check)
+		return -1;
+	xi->end = (uint64_t const *)(hdr + 1);
+	xi->hash = xi->end + hdr->nrec;
+	xi->indent = (uint8_t const *)(xi->hash + hdr->nrec);
+	xi->attr = xi->indent + hdr->nrec;
+	for (i = 0; i < hdr->nrec; prev = xi->end[i++])
+		if (xi->end[i] <= prev)
+			return -1;
+	return prev == hdr->size ? 0 : -1;
+}
+
+xdindex_t *xdl_index_open(xpparam_t const *xpp,
+			  uint8_t const digest[XDL_INDEX_DIGEST_SIZE], long size)
+{
+	xdlindexhdr_t key;
+	xdindex_t *xi;
+	struct stat st;
+	char *path;
+	int fd;
+
+	if (size < XDL_INDEX_MIN_SIZE)
+		return NULL;
+	xdl_index_key(xpp, digest, (uint64_t)size, &key);
+	if (!(path = xdl_index_path(xpp->index_dir, &key)))
+		return NULL;
+	fd = open(path, O_RDONLY);
+	xdl_free(path);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || !(xi = xdl_malloc(sizeof(*xi)))) {
+		close(fd);
+		return NULL;
+	}
+	xi->len = (size_t)st.st_size;
+	xi->mapped = 0;
+
+#ifndef NO_MMAP
+	xi->map = mmap(NULL, xi->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (xi->map != MAP_FAILED)
+		xi->mapped = 1;
+	else
+#endif
+	if ((xi->map = xdl_malloc(xi->len))) {
+		size_t got = 0;
+		ssize_t n;
+
+		while (got < xi->len &&
+		       (n = read(fd, (char *)xi->map + got, xi->len - got)) > 0)
+			got += n;
+		if (got != xi->len) {
+			xdl_free(xi->map);
+			xi->map = NULL;
+		}
+	}
+	close(fd);
+
+	if (!xi->map || xdl_index_check(xi, &key) < 0) {
+		xdl_index_close(xi);
+		return NULL;
+	}
+	return xi;
+}
+
+void xdl_index_close(xdindex_t *xi)
+{
+	if (!xi)
+		return;
+#ifndef NO_MMAP
+	if (xi->mapped)
+		munmap(xi->map, xi->len);
+	else
+#endif
+		xdl_free(xi->map);
+	xdl_free(xi);
+}
+
+uint64_t xdl_index_record(xdindex_t const *xi, size_t ri,
+			  uint8_t const *base, uint8_t const **cur)
+{
+	*cur = base + xi->end[ri];
+	return xi->hash[ri];
+}
+
+int xdl_index_indent(xdindex_t const *xi, long ri)
+{
+	return xi->indent[ri] == XDL_INDEX_NO_INDENT ? -1 : xi->indent[ri];
+}
+
+int xdl_index_maybe_func(xdindex_t const *xi, int func_lang, long ri)
+{
+	return !xi->hdr->func_lang || xi->hdr->func_lang != (uint32_t)func_lang ||
+		(xi->attr[ri] & XDL_INDEX_FUNC);
+}
+
+static int xdl_index_write(int fd, void const *buf, size_t len)
+{
+	char const *p = buf;
+	ssize_t n;
+
+	for (; len; p += n, len -= n)
+		if ((n = write(fd, p, len)) <= 0)
+			return -1;
+	return 0;
+}
+
+/* Writes one per-record section, XDL_INDEX_CHUNK records at a time. */
+static int xdl_index_section(int fd, xdfile_t const *xdf, int func_lang,
+			     int what, uint64_t *buf, uint64_t *check)
+{
+	uint8_t *b8 = (uint8_t *)buf;
+	size_t i, n, len, base = 0;
+	char dummy[1];
+
+	for (i = 0; i < xdf->nrec; i += n) {
+		n = XDL_MIN(xdf->nrec - i, XDL_INDEX_CHUNK);
+		for (size_t j = 0; j < n; j++) {
+			xrecord_t const *rec = &xdf->recs[i + j];
+			int indent;
+
+			switch (what) {
+			case XDL_INDEX_SEC_END:
+				base += rec->size;
+				buf[j] = base;
+				break;
+			case XDL_INDEX_SEC_HASH:
+				buf[j] = rec->line_hash;
+				break;
+			case XDL_INDEX_SEC_INDENT:
+				indent = xdl_rec_indent(rec);
+				b8[j] = indent < 0 ? XDL_INDEX_NO_INDENT : indent;
+				break;
+			default:
+				b8[j] = 0;
+				if (func_lang &&
+				    xdl_func_lang_match(func_lang, (char const *)rec->ptr,
+							(long)rec->size, dummy,
+							sizeof(dummy)) >= 0)
+					b8[j] |= XDL_INDEX_FUNC;
+				break;
+			}
+		}
+		len = what < XDL_INDEX_SEC_INDENT ? n * sizeof(*buf) : n;
+		*check = xdl_index_fold(*check, buf, len);
+		if (xdl_index_write(fd, buf, len) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Writes the index of a prepared input under a temporary name and
+ * renames it into place, so that readers never see a partial file.
+ * The header goes in last, once the checksum is known.
+ */
+int xdl_index_store(xpparam_t const *xpp,
+		    uint8_t const digest[XDL_INDEX_DIGEST_SIZE],
+		    xdfile_t const *xdf, long size, int func_lang)
+{
+	static char const suffix[] = ".XXXXXX";
+	xdlindexhdr_t hdr;
+	uint64_t *buf = NULL;
+	char *path, *tmp = NULL;
+	size_t len;
+	int what, fd = -1, ret = -1;
+
+	if (size < XDL_INDEX_MIN_SIZE)
+		return 0;
+	xdl_index_key(xpp, digest, (uint64_t)size, &hdr);
+	hdr.nrec = xdf->nrec;
+	hdr.func_lang = (uint32_t)func_lang;
+	if (!(path = xdl_index_path(xpp->index_dir, &hdr)))
+		return -1;
+	len = strlen(path);
+	if (!(tmp = xdl_malloc(len + sizeof(suffix))) ||
+	    !XDL_ALLOC_ARRAY(buf, XDL_INDEX_CHUNK))
+		goto out;
+	memcpy(tmp, path, len);
+	memcpy(tmp + len, suffix, sizeof(suffix));
+	if ((fd = mkstemp(tmp)) < 0)
+		goto out;
+
+	ret = lseek(fd, sizeof(hdr), SEEK_SET) < 0 ? -1 : 0;
+	for (what = XDL_INDEX_SEC_END; what <= XDL_INDEX_SEC_ATTR && !ret; what++)
+		ret = xdl_index_section(fd, xdf, func_lang, what, buf, &hdr.check);
+	if (!ret)
+		ret = lseek(fd, 0, SEEK_SET) < 0 ? -1 :
+			xdl_index_write(fd, &hdr, sizeof(hdr));
+	if (close(fd) < 0 || ret < 0 || rename(tmp, path) < 0) {
+		unlink(tmp);
+		ret = -1;
+	}
+
+out:
+	xdl_free(buf);
+	xdl_free(tmp);
+	xdl_free(path);
+	return ret;
+}
+
+int xdl_index_file(mmfile_t *mf, xpparam_t const *xpp, int func_lang)
+{
+	xdalloc_t *prev;
+	xpparam_t pp = *xpp;
+	mmfile_t none = { NULL, 0 };
+	uint8_t digest[XDL_INDEX_DIGEST_SIZE];
+	xdfenv_t xe;
+	int ret = -1;
+
+	if (!xpp->index_dir)
+		return -1;
+	prev = xdl_alloc_set(xpp->alloc ? xpp->alloc : xdl_alloc_get());
+	/* prepared here, stored below with the function header bits */
+	pp.index_dir = NULL;
+	if (xdl_prepare_env(mf, &none, &pp, &xe) >= 0) {
+		xdl_index_digest(mf->ptr, mf->size, digest);
+		ret = xdl_index_store(xpp, digest, &xe.xdf1, mf->size, func_lang);
+		xdl_free_env(&xe);
+	}
+	xdl_alloc_set(prev);
+
+	return ret;
+}
@@ -0,0 +1,170 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * Old-to-new line translation (xdl_diff_linemap()).
+ *
+ * The edit script is turned into the list of runs of lines it leaves
+ * unchanged. Within a run, translation is a constant offset, so a line
+ * is translated by finding the last run starting at or before it; a
+ * line between two runs lies in a change and goes to the start of its
+ * replacement. Runs are stored as parallel arrays so that the search
+ * only touches the old-side starts.
+ */
+
+static int xdl_linemap_build(xdchange_t *xscr, long nrec1, long nrec2,
+			     xdlinemap_t *map)
+{
+	xdchange_t *xch;
+	long n = 1, p1 = 0, p2 = 0;
+
+	for (xch = xscr; xch; xch = xch->next)
+		n++;
+	/* Handed to the caller, hence not from the current allocator. */
+	map->start1 = xdl_sys_malloc(3 * n * sizeof(long));
+	if (!map->start1)
+		return -1;
+	map->start2 = map->start1 + n;
+	map->count = map->start2 + n;
+	map->nr = 0;
+	map->nrec1 = nrec1;
+	map->nrec2 = nrec2;
+
+	for (xch = xscr; ; xch = xch->next) {
+		long end1 = xch ? xch->i1 : nrec1;
+
+		if (end1 > p1) {
+			map->start1[map->nr] = p1;
+			map->start2[map->nr] = p2;
+			map->count[map->nr++] = end1 - p1;
+		}
+		if (!xch)
+			break;
+		p1 = xch->i1 + xch->chg1;
+		p2 = xch->i2 + xch->chg2;
+	}
+
+	return 0;
+}
+
+int xdl_diff_linemap(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		     xdlinemap_t *map)
+{
+	xdalloc_t *prev;
+	xdchange_t *xscr;
+	xdfenv_t xe;
+	xpparam_t pp = *xpp;
+	int ret = -1;
+
+	/* the map is kept in lines, not pieces of them */
+	pp.flags &= ~XDF_SEGMENT_LINES;
+	memset(map, 0, sizeof(*map));
+	prev = xdl_alloc_set(xpp->alloc ? xpp->alloc : xdl_alloc_get());
+	if (xdl_diff_script(mf1, mf2, &pp, &xe, &xscr) >= 0) {
+		ret = xdl_linemap_build(xscr, (long)xe.xdf1.nrec,
+					(long)xe.xdf2.nrec, map);
+		xdl_free_script(xscr);
+		xdl_free_env(&xe);
+	}
+	xdl_alloc_set(prev);
+
+	return ret;
+}
+
+void xdl_linemap_free(xdlinemap_t *map)
+{
+	xdl_sys_free(map->start1);
+	memset(map, 0, sizeof(*map));
+}
+
+/* Index of the last run starting at or before line in [lo, nr), or lo - 1. */
+static long xdl_linemap_find(xdlinemap_t const *map, long lo, long line)
+{
+	long hi = map->nr, step = 1;
+
+	/* Gallop first: sorted queries tend to land close to the last one. */
+	while (lo + step < hi && map->start1[lo + step] <= line) {
+		lo += step;
+		step <<= 1;
+	}
+	if (lo + step < hi)
+		hi = lo + step;
+	if (lo >= hi || map->start1[lo] > line)
+		return lo - 1;
+	while (hi - lo > 1) {
+		long mid = lo + (hi - lo) / 2;
+
+		if (map->start1[mid] <= line)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int xdl_linemap_at(xdlinemap_t const *map, long k, long line, long *out)
+{
+	if (k < 0) {
+		*out = 0;
+		return 0;
+	}
+	if (line < map->start1[k] + map->count[k]) {
+		*out = map->start2[k] + line - map->start1[k];
+		return 1;
+	}
+	*out = map->start2[k] + map->count[k];
+	return 0;
+}
+
+int xdl_linemap_line(xdlinemap_t const *map, long line, long *out)
+{
+	if (line < 0 || line >= map->nrec1) {
+		*out = -1;
+		return -1;
+	}
+	return xdl_linemap_at(map, xdl_linemap_find(map, 0, line), line, out);
+}
+
+long xdl_linemap_translate(xdlinemap_t const *map, long const *lines, long n,
+			   long *out, unsigned char *exact)
+{
+	long i, k = -1, prev = -1, nexact = 0;
+	int res;
+
+	for (i = 0; i < n; i++) {
+		long line = lines[i];
+
+		if (line < 0 || line >= map->nrec1) {
+			out[i] = -1;
+			res = 0;
+		} else {
+			/* Sorted input continues from the last run found. */
+			if (line < prev || k < 0)
+				k = xdl_linemap_find(map, 0, line);
+			else if (k + 1 < map->nr && map->start1[k + 1] <= line)
+				k = xdl_linemap_find(map, k + 1, line);
+			res = xdl_linemap_at(map, k, line, &out[i]);
+			prev = line;
+		}
+		if (exact)
+			exact[i] = (unsigned char)res;
+		nexact += res;
+	}
+
+	return nexact;
+}
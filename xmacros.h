@@ -49,6 +49,12 @@ do { \
 		((unsigned long) __p[2]) << 16 | ((unsigned long) __p[3]) << 24; \
 } while (0)
 
+/*
+ * Long-running loops poll xpparam_t.abort_check once every
+ * (XDL_ABORT_POLL_MASK + 1) iterations.
+ */
+#define XDL_ABORT_POLL_MASK 1023
+
 /* Allocate an array of nr elements, returns NULL on failure */
 #define XDL_ALLOC_ARRAY(p, nr)				\
 	((p) = SIZE_MAX / sizeof(*(p)) >= (size_t)(nr)	\
@@ -47,6 +47,14 @@ typedef struct s_xdmerge {
 	long chg0;
 } xdmerge_t;
 
+/* Where xdl_merge_regions() wants its results. */
+typedef struct s_xdmregions {
+	int list;		/* fill in regions, for the caller */
+	xdmergeregion_t *regions;
+	long nr;
+	xdoutbuf_t *clean;
+} xdmregions_t;
+
 static int xdl_append_merge(xdmerge_t **merge, int mode,
 			    long i0, long chg0,
 			    long i1, long chg1,
@@ -88,7 +96,7 @@ static int xdl_cleanup_merge(xdmerge_t *c)
 		if (c->mode == 0)
 			count++;
 		next_c = c->next;
-		free(c);
+		xdl_free(c);
 	}
 	return count;
 }
@@ -280,6 +288,44 @@ static int fill_conflict_hunk(xdfenv_t *xe1, const char *name1,
 	return size;
 }
 
+/*
+ * Render the part of the result that ends with region m, starting at
+ * line i of side #1's postimage. Returns the number of bytes written
+ * to dest (or needed, if dest is NULL), or -1 if m contributes nothing.
+ */
+static int xdl_fill_merge_region(xdfenv_t *xe1, const char *name1,
+				 xdfenv_t *xe2, const char *name2,
+				 const char *ancestor_name,
+				 int i, xdmerge_t *m, char *dest, int style,
+				 int marker_size)
+{
+	int size = 0;
+
+	if (m->mode == 0)
+		return fill_conflict_hunk(xe1, name1, xe2, name2,
+					  ancestor_name,
+					  0, i, style, m, dest,
+					  marker_size);
+	if (!(m->mode & 3))
+		return -1;
+
+	/* Before conflicting part */
+	size += xdl_recs_copy(xe1, i, m->i1 - i, 0, 0,
+			      dest ? dest + size : NULL);
+	/* Postimage from side #1 */
+	if (m->mode & 1) {
+		int needs_cr = is_cr_needed(xe1, xe2, m);
+
+		size += xdl_recs_copy(xe1, m->i1, m->chg1, needs_cr, (m->mode & 2),
+				      dest ? dest + size : NULL);
+	}
+	/* Postimage from side #2 */
+	if (m->mode & 2)
+		size += xdl_recs_copy(xe2, m->i2, m->chg2, 0, 0,
+				      dest ? dest + size : NULL);
+	return size;
+}
+
 static int xdl_fill_merge_buffer(xdfenv_t *xe1, const char *name1,
 				 xdfenv_t *xe2, const char *name2,
 				 const char *ancestor_name,
@@ -287,34 +333,19 @@ static int xdl_fill_merge_buffer(xdfenv_t *xe1, const char *name1,
 				 xdmerge_t *m, char *dest, int style,
 				 int marker_size)
 {
-	int size, i;
+	int size, i, n;
 
 	for (size = i = 0; m; m = m->next) {
 		if (favor && !m->mode)
 			m->mode = favor;
 
-		if (m->mode == 0)
-			size = fill_conflict_hunk(xe1, name1, xe2, name2,
-						  ancestor_name,
-						  size, i, style, m, dest,
-						  marker_size);
-		else if (m->mode & 3) {
-			/* Before conflicting part */
-			size += xdl_recs_copy(xe1, i, m->i1 - i, 0, 0,
-					      dest ? dest + size : NULL);
-			/* Postimage from side #1 */
-			if (m->mode & 1) {
-				int needs_cr = is_cr_needed(xe1, xe2, m);
-
-				size += xdl_recs_copy(xe1, m->i1, m->chg1, needs_cr, (m->mode & 2),
-						      dest ? dest + size : NULL);
-			}
-			/* Postimage from side #2 */
-			if (m->mode & 2)
-				size += xdl_recs_copy(xe2, m->i2, m->chg2, 0, 0,
-						      dest ? dest + size : NULL);
-		} else
+		n = xdl_fill_merge_region(xe1, name1, xe2, name2,
+					  ancestor_name, i, m,
+					  dest ? dest + size : NULL,
+					  style, marker_size);
+		if (n < 0)
 			continue;
+		size += n;
 		i = m->i1 + m->chg1;
 	}
 	size += xdl_recs_copy(xe1, i, (int)xe1->xdf2.nrec - i, 0, 0,
@@ -322,6 +353,110 @@ static int xdl_fill_merge_buffer(xdfenv_t *xe1, const char *name1,
 	return size;
 }
 
+/*
+ * Same output as xdl_fill_merge_buffer(), but appended region by region
+ * to a growable buffer. Each region is sized right before it is copied,
+ * while its records are still hot, instead of walking the whole result
+ * twice.
+ */
+static int xdl_fill_merge_outbuf(xdfenv_t *xe1, const char *name1,
+				 xdfenv_t *xe2, const char *name2,
+				 const char *ancestor_name,
+				 int favor,
+				 xdmerge_t *m, xdoutbuf_t *ob, int style,
+				 int marker_size)
+{
+	int i, n;
+	char *dest;
+
+	for (i = 0; m; m = m->next) {
+		if (favor && !m->mode)
+			m->mode = favor;
+
+		n = xdl_fill_merge_region(xe1, name1, xe2, name2,
+					  ancestor_name, i, m, NULL,
+					  style, marker_size);
+		if (n < 0)
+			continue;
+		if (!(dest = xdl_outbuf_grow(ob, n)))
+			return -1;
+		xdl_fill_merge_region(xe1, name1, xe2, name2,
+				      ancestor_name, i, m, dest,
+				      style, marker_size);
+		i = m->i1 + m->chg1;
+	}
+	n = xdl_recs_copy(xe1, i, (int)xe1->xdf2.nrec - i, 0, 0, NULL);
+	if (!(dest = xdl_outbuf_grow(ob, n)))
+		return -1;
+	xdl_recs_copy(xe1, i, (int)xe1->xdf2.nrec - i, 0, 0, dest);
+	return 0;
+}
+
+/*
+ * Lists the regions of a merge for xdl_merge_regions() and, if asked
+ * to, appends the result with all conflicts left out to rl->clean.
+ */
+static int xdl_fill_merge_regions(xdfenv_t *xe1, xdfenv_t *xe2, int favor,
+				  xdmerge_t *m, xdmregions_t *rl)
+{
+	xdmergeregion_t *r;
+	xdmerge_t *c;
+	long i, out, n = 0;
+	char *dest;
+	int size;
+
+	if (rl->list) {
+		for (c = m; c; c = c->next)
+			n++;
+		/* Handed to the caller, hence not from the current allocator. */
+		if (n && !(rl->regions = xdl_sys_malloc(n * sizeof(*r))))
+			return -1;
+	}
+
+	for (i = out = 0; m; m = m->next) {
+		if (favor && !m->mode)
+			m->mode = favor;
+
+		if (rl->list) {
+			r = &rl->regions[rl->nr++];
+			r->mode = m->mode;
+			r->i0 = m->i0;
+			r->chg0 = m->chg0;
+			r->i1 = m->i1;
+			r->chg1 = m->chg1;
+			r->i2 = m->i2;
+			r->chg2 = m->chg2;
+			r->out = out + m->i1 - i;
+		}
+		if (m->mode && !(m->mode & 3))
+			continue;
+		if (rl->clean) {
+			if (m->mode)
+				size = xdl_fill_merge_region(xe1, NULL, xe2, NULL,
+							     NULL, i, m, NULL, 0, 0);
+			else
+				size = xdl_recs_copy(xe1, i, m->i1 - i, 0, 0, NULL);
+			if (!(dest = xdl_outbuf_grow(rl->clean, size)))
+				return -1;
+			if (m->mode)
+				xdl_fill_merge_region(xe1, NULL, xe2, NULL,
+						      NULL, i, m, dest, 0, 0);
+			else
+				xdl_recs_copy(xe1, i, m->i1 - i, 0, 0, dest);
+		}
+		out += m->i1 - i + (m->mode & 1 ? m->chg1 : 0) +
+			(m->mode & 2 ? m->chg2 : 0);
+		i = m->i1 + m->chg1;
+	}
+	if (rl->clean) {
+		size = xdl_recs_copy(xe1, i, (int)xe1->xdf2.nrec - i, 0, 0, NULL);
+		if (!(dest = xdl_outbuf_grow(rl->clean, size)))
+			return -1;
+		xdl_recs_copy(xe1, i, (int)xe1->xdf2.nrec - i, 0, 0, dest);
+	}
+	return 0;
+}
+
 static int recmatch(xrecord_t *rec1, xrecord_t *rec2, unsigned long flags)
 {
 	return xdl_recmatch((const char *)rec1->ptr, (long)rec1->size,
@@ -363,6 +498,11 @@ static void xdl_refine_zdiff3_conflicts(xdfenv_t *xe1, xdfenv_t *xe2, xdmerge_t
 static int xdl_refine_conflicts(xdfenv_t *xe1, xdfenv_t *xe2, xdmerge_t *m,
 		xpparam_t const *xpp)
 {
+	xpparam_t sub = *xpp;
+
+	/* conflicts are cut out of the inputs; not worth an index */
+	sub.index_dir = NULL;
+	xpp = &sub;
 	for (; m; m = m->next) {
 		mmfile_t t1, t2;
 		xdfenv_t xe;
@@ -416,6 +556,8 @@ static int xdl_refine_conflicts(xdfenv_t *xe1, xdfenv_t *xe2, xdmerge_t *m,
 			xscr = xscr->next;
 			m2->next = m->next;
 			m->next = m2;
+			m2->i0 = m->i0;
+			m2->chg0 = m->chg0;
 			m = m2;
 			m->mode = 0;
 			m->i1 = xscr->i1 + i1;
@@ -453,10 +595,11 @@ static int lines_contain_alnum(xdfenv_t *xe, int i, int chg)
 static void xdl_merge_two_conflicts(xdmerge_t *m)
 {
 	xdmerge_t *next_m = m->next;
+	m->chg0 = XDL_MAX(m->i0 + m->chg0, next_m->i0 + next_m->chg0) - m->i0;
 	m->chg1 = next_m->i1 + next_m->chg1 - m->i1;
 	m->chg2 = next_m->i2 + next_m->chg2 - m->i2;
 	m->next = next_m->next;
-	free(next_m);
+	xdl_free(next_m);
 }
 
 /*
@@ -504,7 +647,8 @@ static int xdl_simplify_non_conflicts(xdfenv_t *xe1, xdmerge_t *m,
  */
 static int xdl_do_merge(xdfenv_t *xe1, xdchange_t *xscr1,
 		xdfenv_t *xe2, xdchange_t *xscr2,
-		xmparam_t const *xmp, mmbuffer_t *result)
+		xmparam_t const *xmp, mmbuffer_t *result, xdoutbuf_t *ob,
+		xdmregions_t *rl)
 {
 	xdmerge_t *changes, *c;
 	xpparam_t const *xpp = &xmp->xpp;
@@ -668,7 +812,7 @@ static int xdl_do_merge(xdfenv_t *xe1, xdchange_t *xscr1,
 						 ancestor_name,
 						 favor, changes, NULL, style,
 						 marker_size);
-		result->ptr = xdl_malloc(size);
+		result->ptr = xdl_sys_malloc(size);
 		if (!result->ptr) {
 			xdl_cleanup_merge(changes);
 			return -1;
@@ -677,23 +821,37 @@ static int xdl_do_merge(xdfenv_t *xe1, xdchange_t *xscr1,
 		xdl_fill_merge_buffer(xe1, name1, xe2, name2,
 				      ancestor_name, favor, changes,
 				      result->ptr, style, marker_size);
+	} else if (ob &&
+		   xdl_fill_merge_outbuf(xe1, name1, xe2, name2,
+					 ancestor_name, favor, changes,
+					 ob, style, xmp->marker_size) < 0) {
+		xdl_cleanup_merge(changes);
+		return -1;
+	} else if (rl &&
+		   xdl_fill_merge_regions(xe1, xe2, favor, changes, rl) < 0) {
+		xdl_cleanup_merge(changes);
+		return -1;
 	}
 	return xdl_cleanup_merge(changes);
 }
 
-int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
-		xmparam_t const *xmp, mmbuffer_t *result)
+static int xdl_merge_0(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		       xmparam_t const *xmp, mmbuffer_t *result,
+		       xdoutbuf_t *ob, xdmregions_t *rl)
 {
 	xdchange_t *xscr1 = NULL, *xscr2 = NULL;
 	xdfenv_t xe1, xe2;
 	int status = -1;
-	xpparam_t const *xpp = &xmp->xpp;
+	xmparam_t mp = *xmp;
+	xpparam_t const *xpp = &mp.xpp;
 
-	result->ptr = NULL;
-	result->size = 0;
+	/* merged output is whole lines, ignorable ones included */
+	mp.xpp.flags &= ~(XDF_SEGMENT_LINES | XDF_FILTER_IGNORED);
+	xmp = &mp;
 
+	xdl_trace_enter(XDL_TRACE_MERGE, mf1->size, mf2->size);
 	if (xdl_do_diff(orig, mf1, xpp, &xe1) < 0)
-		return -1;
+		goto trace;
 
 	if (xdl_do_diff(orig, mf2, xpp, &xe2) < 0)
 		goto free_xe1; /* avoid double free of xe2 */
@@ -708,24 +866,31 @@ int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
 	    xdl_build_script(&xe2, &xscr2) < 0)
 		goto out;
 
-	if (!xscr1) {
-		result->ptr = xdl_malloc(mf2->size);
-		if (!result->ptr)
-			goto out;
-		status = 0;
-		memcpy(result->ptr, mf2->ptr, mf2->size);
-		result->size = mf2->size;
-	} else if (!xscr2) {
-		result->ptr = xdl_malloc(mf1->size);
-		if (!result->ptr)
-			goto out;
+	if (rl) {
+		/*
+		 * Regions are wanted even when only one side changed, so
+		 * there is no shortcut; nothing is rendered anyway.
+		 */
+		status = xdl_do_merge(&xe1, xscr1, &xe2, xscr2,
+				      xmp, NULL, NULL, rl);
+	} else if (!xscr1 || !xscr2) {
+		mmfile_t *taken = !xscr1 ? mf2 : mf1;
+
+		if (ob) {
+			if (xdl_outbuf_add(ob, taken->ptr, taken->size) < 0)
+				goto out;
+		} else {
+			result->ptr = xdl_sys_malloc(taken->size);
+			if (!result->ptr)
+				goto out;
+			memcpy(result->ptr, taken->ptr, taken->size);
+			result->size = taken->size;
+		}
 		status = 0;
-		memcpy(result->ptr, mf1->ptr, mf1->size);
-		result->size = mf1->size;
 	} else {
 		status = xdl_do_merge(&xe1, xscr1,
 				      &xe2, xscr2,
-				      xmp, result);
+				      xmp, result, ob, NULL);
 	}
  out:
 	xdl_free_script(xscr1);
@@ -734,6 +899,67 @@ int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
 	xdl_free_env(&xe2);
  free_xe1:
 	xdl_free_env(&xe1);
+ trace:
+	xdl_trace_leave(XDL_TRACE_MERGE, mf1->size, mf2->size,
+			status < 0 ? 0 : status, status);
+
+	return status;
+}
+
+int xdl_merge(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		xmparam_t const *xmp, mmbuffer_t *result)
+{
+	xdalloc_t *prev;
+	int status;
+
+	result->ptr = NULL;
+	result->size = 0;
+
+	prev = xdl_alloc_set(xmp->xpp.alloc ? xmp->xpp.alloc : xdl_alloc_get());
+	status = xdl_merge_0(orig, mf1, mf2, xmp, result, NULL, NULL);
+	xdl_alloc_set(prev);
+
+	return status;
+}
+
+int xdl_merge_outbuf(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		     xmparam_t const *xmp, xdoutbuf_t *ob)
+{
+	xdalloc_t *prev;
+	int status;
 
+	prev = xdl_alloc_set(xmp->xpp.alloc ? xmp->xpp.alloc : xdl_alloc_get());
+	status = xdl_merge_0(orig, mf1, mf2, xmp, NULL, ob, NULL);
+	xdl_alloc_set(prev);
+
+	return status;
+}
+
+int xdl_merge_regions(mmfile_t *orig, mmfile_t *mf1, mmfile_t *mf2,
+		      xmparam_t const *xmp, xdmergeregion_t **regions,
+		      long *nr, xdoutbuf_t *clean)
+{
+	xdmregions_t rl;
+	xdalloc_t *prev;
+	int status;
+
+	rl.list = regions != NULL;
+	rl.regions = NULL;
+	rl.nr = 0;
+	rl.clean = clean;
+
+	prev = xdl_alloc_set(xmp->xpp.alloc ? xmp->xpp.alloc : xdl_alloc_get());
+	status = xdl_merge_0(orig, mf1, mf2, xmp, NULL, NULL, &rl);
+	xdl_alloc_set(prev);
+
+	if (status < 0) {
+		xdl_sys_free(rl.regions);
+		rl.regions = NULL;
+		rl.nr = 0;
+	}
+	if (regions)
+		*regions = rl.regions;
+	if (nr)
+		*nr = rl.nr;
 	return status;
 }
@@ -0,0 +1,184 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * Growable output buffers for merge and emit results whose final size
+ * is not known up front.
+ *
+ * Where anonymous mappings are available, the whole max_size is
+ * reserved as inaccessible address space and pages are committed with
+ * mprotect() as the output grows. The buffer therefore never moves,
+ * so pointers handed out earlier stay valid and the region can be
+ * exposed to an embedder as a resizable buffer without copying.
+ * Elsewhere we fall back to plain realloc() growth.
+ */
+
+#if !defined(NO_MMAP) && defined(MAP_ANONYMOUS)
+#define XDL_OUTBUF_RESERVE 1
+#endif
+
+#define XDL_OUTBUF_MIN_COMMIT (64 * 1024)
+
+static size_t xdl_outbuf_pagesize(void)
+{
+#ifdef XDL_OUTBUF_RESERVE
+	long sz = sysconf(_SC_PAGESIZE);
+
+	if (sz > 0)
+		return (size_t)sz;
+#endif
+	return 4096;
+}
+
+static size_t xdl_outbuf_round(size_t n, size_t page)
+{
+	if (n > SIZE_MAX - (page - 1))
+		return SIZE_MAX - (SIZE_MAX % page);
+	return (n + page - 1) & ~(page - 1);
+}
+
+int xdl_outbuf_init(xdoutbuf_t *ob, size_t initial, size_t max_size)
+{
+	memset(ob, 0, sizeof(*ob));
+	if (!max_size || initial > max_size)
+		return -1;
+	ob->limit = max_size;
+
+#ifdef XDL_OUTBUF_RESERVE
+	ob->reserved = xdl_outbuf_round(max_size, xdl_outbuf_pagesize());
+	ob->ptr = mmap(NULL, ob->reserved, PROT_NONE,
+		       MAP_PRIVATE | MAP_ANONYMOUS
+#ifdef MAP_NORESERVE
+		       | MAP_NORESERVE
+#endif
+		       , -1, 0);
+	if (ob->ptr != MAP_FAILED) {
+		ob->mapped = 1;
+		if (initial && xdl_outbuf_commit(ob, initial) < 0) {
+			xdl_outbuf_release(ob);
+			return -1;
+		}
+		return 0;
+	}
+	ob->ptr = NULL;
+	ob->reserved = 0;
+#endif
+	/* No address space reservation, grow on the heap instead. */
+	if (initial && xdl_outbuf_commit(ob, initial) < 0)
+		return -1;
+	return 0;
+}
+
+int xdl_outbuf_commit(xdoutbuf_t *ob, size_t n)
+{
+	size_t want;
+
+	if (n <= ob->committed)
+		return 0;
+	if (n > ob->limit)
+		return -1;
+
+	/*
+	 * Grow geometrically so that appending is amortized O(1) no
+	 * matter how small the individual writes are.
+	 */
+	want = ob->committed < ob->limit / 2 ? 2 * ob->committed : ob->limit;
+	if (want < XDL_OUTBUF_MIN_COMMIT)
+		want = XDL_OUTBUF_MIN_COMMIT;
+	if (want < n)
+		want = n;
+	if (want > ob->limit)
+		want = ob->limit;
+
+#ifdef XDL_OUTBUF_RESERVE
+	if (ob->mapped) {
+		size_t page = xdl_outbuf_pagesize();
+		size_t from = xdl_outbuf_round(ob->committed, page);
+		size_t to = xdl_outbuf_round(want, page);
+
+		if (to > ob->reserved)
+			to = ob->reserved;
+		if (to > from &&
+		    mprotect(ob->ptr + from, to - from, PROT_READ | PROT_WRITE))
+			return -1;
+		ob->committed = want;
+		return 0;
+	}
+#endif
+	{
+		char *tmp = xdl_sys_realloc(ob->ptr, want);
+
+		if (!tmp)
+			return -1;
+		ob->ptr = tmp;
+		ob->committed = want;
+	}
+	return 0;
+}
+
+char *xdl_outbuf_grow(xdoutbuf_t *ob, size_t n)
+{
+	char *dest;
+
+	if (n > ob->limit - ob->size ||
+	    xdl_outbuf_commit(ob, ob->size + n) < 0)
+		return NULL;
+	dest = ob->ptr + ob->size;
+	ob->size += n;
+
+	return dest;
+}
+
+int xdl_outbuf_add(xdoutbuf_t *ob, char const *data, size_t n)
+{
+	char *dest;
+
+	if (!n)
+		return 0;
+	if (!(dest = xdl_outbuf_grow(ob, n)))
+		return -1;
+	memcpy(dest, data, n);
+
+	return 0;
+}
+
+void xdl_outbuf_release(xdoutbuf_t *ob)
+{
+#ifdef XDL_OUTBUF_RESERVE
+	if (ob->mapped) {
+		if (ob->ptr)
+			munmap(ob->ptr, ob->reserved);
+		memset(ob, 0, sizeof(*ob));
+		return;
+	}
+#endif
+	xdl_sys_free(ob->ptr);
+	memset(ob, 0, sizeof(*ob));
+}
+
+int xdl_outbuf_out_line(void *priv, mmbuffer_t *mb, int nbuf)
+{
+	xdoutbuf_t *ob = priv;
+	int i;
+
+	for (i = 0; i < nbuf; i++)
+		if (xdl_outbuf_add(ob, mb[i].ptr, mb[i].size) < 0)
+			return -1;
+
+	return 0;
+}
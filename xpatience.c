@@ -41,6 +41,9 @@
 
 #define NON_UNIQUE ULONG_MAX
 
+/* gaps with at least this many lines are diffed on xpp->pool, if set */
+#define PAR_MIN_GAP 2048
+
 /*
  * This is a hash mapping from line hash to line numbers in the first and
  * second file.
@@ -257,11 +260,55 @@ static int match(struct hashmap *map, int line1, int line2)
 static int patience_diff(xpparam_t const *xpp, xdfenv_t *env,
 		int line1, int count1, int line2, int count2);
 
+/*
+ * A gap between common lines handed to the pool. Every gap only writes
+ * its own ranges of changed[] and builds its own hashmaps, so gaps can
+ * be diffed in any order.
+ */
+struct gap {
+	xpparam_t const *xpp;
+	xdfenv_t *env;
+	int line1, count1, line2, count2;
+	int result;
+};
+
+static void gap_run(void *priv)
+{
+	struct gap *gap = priv;
+
+	gap->result = patience_diff(gap->xpp, gap->env,
+			gap->line1, gap->count1, gap->line2, gap->count2);
+}
+
+static int run_gaps(xpparam_t const *xpp, struct gap *gaps, long nr)
+{
+	xdtask_group_t grp;
+	long i;
+	int result = 0;
+
+	xdl_group_init(&grp, xpp->pool);
+	for (i = 0; i < nr; i++) {
+		xdtask_t t = { gap_run, NULL, &gaps[i],
+			       XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY };
+
+		if (xdl_pool_submit(&grp, &t) < 0)
+			gap_run(&gaps[i]);
+	}
+	if (xdl_group_wait(&grp) < 0)
+		return -1;
+	for (i = 0; i < nr; i++)
+		if (gaps[i].result)
+			result = -1;
+	return result;
+}
+
 static int walk_common_sequence(struct hashmap *map, struct entry *first,
 		int line1, int count1, int line2, int count2)
 {
 	int end1 = line1 + count1, end2 = line2 + count2;
-	int next1, next2;
+	int next1, next2, result = -1;
+	struct gap *gaps = NULL;
+	long nr_gaps = 0, alloc_gaps = 0;
 
 	for (;;) {
 		/* Try to grow the line ranges of common lines */
@@ -283,16 +330,29 @@ static int walk_common_sequence(struct hashmap *map, struct entry *first,
 			line2++;
 		}
 
-		/* Recurse */
-		if (next1 > line1 || next2 > line2) {
+		/* Recurse, or leave large gaps to the pool */
+		if (map->xpp->pool &&
+		    (next1 - line1) + (next2 - line2) >= PAR_MIN_GAP) {
+			struct gap *gap;
+
+			if (XDL_ALLOC_GROW(gaps, nr_gaps + 1, alloc_gaps))
+				goto out;
+			gap = &gaps[nr_gaps++];
+			gap->xpp = map->xpp;
+			gap->env = map->env;
+			gap->line1 = line1;
+			gap->count1 = next1 - line1;
+			gap->line2 = line2;
+			gap->count2 = next2 - line2;
+		} else if (next1 > line1 || next2 > line2) {
 			if (patience_diff(map->xpp, map->env,
 					line1, next1 - line1,
 					line2, next2 - line2))
-				return -1;
+				goto out;
 		}
 
 		if (!first)
-			return 0;
+			break;
 
 		while (first->next &&
 				first->next->line1 == first->line1 + 1 &&
@@ -304,6 +364,11 @@ static int walk_common_sequence(struct hashmap *map, struct entry *first,
 
 		first = first->next;
 	}
+
+	result = nr_gaps ? run_gaps(map->xpp, gaps, nr_gaps) : 0;
+out:
+	xdl_free(gaps);
+	return result;
 }
 
 static int fall_back_to_classic_diff(struct hashmap *map,
@@ -311,8 +376,7 @@ static int fall_back_to_classic_diff(struct hashmap *map,
 {
 	xpparam_t xpp;
 
-	memset(&xpp, 0, sizeof(xpp));
-	xpp.flags = map->xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
+	xdl_fallback_xpparam(&xpp, map->xpp);
 
 	return xdl_fall_back_diff(map->env, &xpp,
 				  line1, count1, line2, count2);
@@ -342,6 +406,9 @@ static int patience_diff(xpparam_t const *xpp, xdfenv_t *env,
 		return 0;
 	}
 
+	if (xdl_should_abort(xpp))
+		return -1;
+
 	memset(&map, 0, sizeof(map));
 	if (fill_hashmap(xpp, env, &map,
 			line1, count1, line2, count2))
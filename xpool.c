@@ -0,0 +1,558 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * A small work-stealing thread pool for CPU-heavy diff work.
+ *
+ * Every worker owns one deque per priority. Workers pop their own
+ * deque from the back (most recently pushed, so nested work stays hot
+ * in cache) and steal from the front of other workers' deques when
+ * they run dry. Interactive work is always preferred over batch work,
+ * both locally and when stealing.
+ *
+ * Waiting on a task group never just blocks: the waiter keeps running
+ * queued tasks until the group is done, which is what makes it safe
+ * for a task to fan out into a nested group and wait for it, even on
+ * a single-threaded pool.
+ *
+ * Built with NO_PTHREADS, or given a NULL pool, every task simply runs
+ * to completion inside xdl_pool_submit().
+ */
+
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+
+#define XDL_POOL_MAX_THREADS 256
+#define XDL_POOL_NPRIO 2
+
+typedef struct s_xdpool_job {
+	struct s_xdpool_job *next;	/* cancellation list */
+	xdtask_t task;
+	xdtask_group_t *grp;
+	xdtask_times_t times;
+	xdalloc_t *alloc;		/* the submitter's, see xalloc.c */
+} xdpool_job_t;
+
+static void xdl_pool_run_inline(xdtask_t const *task)
+{
+	xdtask_times_t times;
+
+	times.queued = times.started = xdl_now_ns();
+	task->run(task->priv);
+	times.finished = xdl_now_ns();
+	if (task->done)
+		task->done(task->priv, 0, &times);
+}
+
+#ifndef NO_PTHREADS
+
+typedef struct s_xdpool_deque {
+	pthread_mutex_t lock;
+	xdpool_job_t **jobs;
+	long head, nr, alloc;
+} xdpool_deque_t;
+
+typedef struct s_xdpool_worker {
+	xdpool_t *pool;
+	int index;
+	pthread_t thread;
+	xdpool_deque_t q[XDL_POOL_NPRIO];
+} xdpool_worker_t;
+
+struct s_xdpool {
+	int nthreads;
+	int shutdown;			/* set under lock, read anywhere */
+	long refs;			/* guarded by xdl_pool_lock */
+	long queued;			/* jobs sitting in deques */
+	unsigned long next;		/* round-robin placement */
+	pthread_mutex_t lock;
+	pthread_cond_t work;		/* a job was queued */
+	pthread_cond_t idle;		/* a group finished */
+	int sleeping, waiting;
+	xdpool_worker_t *workers;
+};
+
+static void xdl_pool_finish(xdpool_t *pool, xdpool_job_t *job, int status);
+
+static pthread_mutex_t xdl_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static xdpool_t *xdl_default_pool;
+static int xdl_default_threads;
+static pthread_once_t xdl_pool_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t xdl_pool_key;
+
+static void xdl_pool_make_key(void)
+{
+	pthread_key_create(&xdl_pool_key, NULL);
+}
+
+static xdpool_worker_t *xdl_pool_self(xdpool_t *pool)
+{
+	xdpool_worker_t *w;
+
+	pthread_once(&xdl_pool_key_once, xdl_pool_make_key);
+	w = pthread_getspecific(xdl_pool_key);
+	return w && w->pool == pool ? w : NULL;
+}
+
+static int xdl_deque_push(xdpool_deque_t *q, xdpool_job_t *job)
+{
+	pthread_mutex_lock(&q->lock);
+	if (q->nr == q->alloc) {
+		xdpool_job_t **jobs;
+		long i, alloc = q->alloc ? 2 * q->alloc : 16;
+
+		if (!(jobs = xdl_sys_malloc(alloc * sizeof(*jobs)))) {
+			pthread_mutex_unlock(&q->lock);
+			return -1;
+		}
+		for (i = 0; i < q->nr; i++)
+			jobs[i] = q->jobs[(q->head + i) % q->alloc];
+		xdl_sys_free(q->jobs);
+		q->jobs = jobs;
+		q->alloc = alloc;
+		q->head = 0;
+	}
+	q->jobs[(q->head + q->nr) % q->alloc] = job;
+	q->nr++;
+	pthread_mutex_unlock(&q->lock);
+
+	return 0;
+}
+
+static xdpool_job_t *xdl_deque_take(xdpool_deque_t *q, int back)
+{
+	xdpool_job_t *job = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->nr) {
+		if (back) {
+			job = q->jobs[(q->head + q->nr - 1) % q->alloc];
+		} else {
+			job = q->jobs[q->head];
+			q->head = (q->head + 1) % q->alloc;
+		}
+		q->nr--;
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return job;
+}
+
+static xdpool_job_t *xdl_pool_find(xdpool_t *pool, xdpool_worker_t *self)
+{
+	xdpool_job_t *job;
+	int prio, i, start = self ? self->index : 0;
+
+	if (xdl_atomic_load(&pool->queued, XDL_ATOMIC_ACQUIRE) <= 0)
+		return NULL;
+	for (prio = 0; prio < XDL_POOL_NPRIO; prio++) {
+		if (self && (job = xdl_deque_take(&self->q[prio], 1)))
+			goto found;
+		for (i = 0; i < pool->nthreads; i++) {
+			xdpool_worker_t *victim = &pool->workers[(start + i) % pool->nthreads];
+
+			if (victim != self && (job = xdl_deque_take(&victim->q[prio], 0)))
+				goto found;
+		}
+	}
+	return NULL;
+
+found:
+	xdl_atomic_sub(&pool->queued, 1, XDL_ATOMIC_ACQ_REL);
+	return job;
+}
+
+static void xdl_pool_run(xdpool_t *pool, xdpool_job_t *job)
+{
+	xdalloc_t *prev = xdl_alloc_set(job->alloc);
+
+	job->times.started = xdl_now_ns();
+	job->task.run(job->task.priv);
+	job->times.finished = xdl_now_ns();
+	xdl_pool_finish(pool, job, 0);
+	xdl_alloc_set(prev);
+}
+
+static void *xdl_pool_worker_main(void *arg)
+{
+	xdpool_worker_t *self = arg;
+	xdpool_t *pool = self->pool;
+	xdpool_job_t *job;
+
+	pthread_once(&xdl_pool_key_once, xdl_pool_make_key);
+	pthread_setspecific(xdl_pool_key, self);
+
+	for (;;) {
+		if ((job = xdl_pool_find(pool, self))) {
+			xdl_pool_run(pool, job);
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		pool->sleeping++;
+		while (!xdl_atomic_load(&pool->shutdown, XDL_ATOMIC_ACQUIRE) &&
+		       xdl_atomic_load(&pool->queued, XDL_ATOMIC_ACQUIRE) <= 0)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		pool->sleeping--;
+		if (xdl_atomic_load(&pool->shutdown, XDL_ATOMIC_ACQUIRE) &&
+		    xdl_atomic_load(&pool->queued, XDL_ATOMIC_ACQUIRE) <= 0) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+static void xdl_pool_destroy(xdpool_t *pool)
+{
+	int i, prio;
+
+	if (pool->workers) {
+		for (i = 0; i < pool->nthreads; i++) {
+			for (prio = 0; prio < XDL_POOL_NPRIO; prio++) {
+				pthread_mutex_destroy(&pool->workers[i].q[prio].lock);
+				xdl_sys_free(pool->workers[i].q[prio].jobs);
+			}
+		}
+		xdl_sys_free(pool->workers);
+	}
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	xdl_sys_free(pool);
+}
+
+static void xdl_pool_stop(xdpool_t *pool, int started)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	xdl_atomic_store(&pool->shutdown, 1, XDL_ATOMIC_RELEASE);
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < started; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+}
+
+static int xdl_pool_default_size(void)
+{
+	long n = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (n < 1)
+		n = 1;
+	return n > XDL_POOL_MAX_THREADS ? XDL_POOL_MAX_THREADS : (int)n;
+}
+
+xdpool_t *xdl_pool_new(int nthreads)
+{
+	xdpool_t *pool;
+	int i, prio;
+
+	if (nthreads <= 0)
+		nthreads = xdl_pool_default_size();
+	if (nthreads > XDL_POOL_MAX_THREADS)
+		nthreads = XDL_POOL_MAX_THREADS;
+
+	if (!(pool = xdl_sys_calloc(1, sizeof(*pool))))
+		return NULL;
+	pool->refs = 1;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	if (!(pool->workers = xdl_sys_calloc(nthreads, sizeof(*pool->workers)))) {
+		xdl_pool_destroy(pool);
+		return NULL;
+	}
+	pool->nthreads = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+		for (prio = 0; prio < XDL_POOL_NPRIO; prio++)
+			pthread_mutex_init(&pool->workers[i].q[prio].lock, NULL);
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&pool->workers[i].thread, NULL,
+				   xdl_pool_worker_main, &pool->workers[i])) {
+			xdl_pool_stop(pool, i);
+			xdl_pool_destroy(pool);
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+
+void xdl_pool_set_default_threads(int nthreads)
+{
+	pthread_mutex_lock(&xdl_pool_lock);
+	xdl_default_threads = nthreads;
+	pthread_mutex_unlock(&xdl_pool_lock);
+}
+
+xdpool_t *xdl_pool_get_default(void)
+{
+	xdpool_t *pool;
+
+	pthread_mutex_lock(&xdl_pool_lock);
+	if (!xdl_default_pool)
+		xdl_default_pool = xdl_pool_new(xdl_default_threads);
+	else
+		xdl_default_pool->refs++;
+	pool = xdl_default_pool;
+	pthread_mutex_unlock(&xdl_pool_lock);
+
+	return pool;
+}
+
+void xdl_pool_put(xdpool_t *pool)
+{
+	int last;
+
+	if (!pool)
+		return;
+	pthread_mutex_lock(&xdl_pool_lock);
+	last = !--pool->refs;
+	if (last && pool == xdl_default_pool)
+		xdl_default_pool = NULL;
+	pthread_mutex_unlock(&xdl_pool_lock);
+	if (!last)
+		return;
+
+	/*
+	 * Nobody can submit any more, but tasks that are still running
+	 * may fan out further; let the workers finish all of that.
+	 */
+	xdl_pool_stop(pool, pool->nthreads);
+	xdl_pool_destroy(pool);
+}
+
+int xdl_pool_threads(xdpool_t const *pool)
+{
+	return pool ? pool->nthreads : 0;
+}
+
+int xdl_pool_worker(xdpool_t *pool)
+{
+	xdpool_worker_t *self;
+
+	if (!pool)
+		return -1;
+	self = xdl_pool_self(pool);
+	return self ? self->index : -1;
+}
+
+void xdl_group_init(xdtask_group_t *grp, xdpool_t *pool)
+{
+	grp->pool = pool;
+	grp->pending = 0;
+	grp->cancelled = 0;
+}
+
+int xdl_pool_submit(xdtask_group_t *grp, xdtask_t const *task)
+{
+	xdpool_t *pool = grp->pool;
+	xdpool_worker_t *self, *target;
+	xdpool_job_t *job;
+	int prio = task->prio == XDL_PRIO_BATCH;
+
+	if (!pool || xdl_atomic_load(&pool->shutdown, XDL_ATOMIC_ACQUIRE)) {
+		xdl_pool_run_inline(task);
+		return 0;
+	}
+	if (!(job = xdl_sys_malloc(sizeof(*job))))
+		return -1;
+	job->next = NULL;
+	job->task = *task;
+	job->grp = grp;
+	job->alloc = xdl_alloc_get();
+	job->times.queued = xdl_now_ns();
+	job->times.started = job->times.finished = 0;
+
+	self = xdl_pool_self(pool);
+	if (task->affinity >= 0)
+		target = &pool->workers[task->affinity % pool->nthreads];
+	else if (self)
+		target = self;
+	else
+		target = &pool->workers[(unsigned long)xdl_atomic_fetch_add(&pool->next, 1,
+									    XDL_ATOMIC_RELAXED) %
+					pool->nthreads];
+
+	xdl_atomic_add(&grp->pending, 1, XDL_ATOMIC_ACQ_REL);
+	xdl_atomic_add(&pool->queued, 1, XDL_ATOMIC_ACQ_REL);
+	if (xdl_deque_push(&target->q[prio], job) < 0) {
+		xdl_atomic_sub(&pool->queued, 1, XDL_ATOMIC_ACQ_REL);
+		xdl_atomic_sub(&grp->pending, 1, XDL_ATOMIC_ACQ_REL);
+		xdl_sys_free(job);
+		return -1;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->sleeping)
+		pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+int xdl_group_wait(xdtask_group_t *grp)
+{
+	xdpool_t *pool = grp->pool;
+	xdpool_worker_t *self;
+	xdpool_job_t *job;
+
+	if (!pool)
+		return grp->cancelled ? -1 : 0;
+
+	self = xdl_pool_self(pool);
+	while (xdl_atomic_load(&grp->pending, XDL_ATOMIC_ACQUIRE) > 0) {
+		/* Help out instead of sleeping while there is work around. */
+		if ((job = xdl_pool_find(pool, self))) {
+			xdl_pool_run(pool, job);
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		if (xdl_atomic_load(&grp->pending, XDL_ATOMIC_ACQUIRE) > 0 &&
+		    xdl_atomic_load(&pool->queued, XDL_ATOMIC_ACQUIRE) <= 0) {
+			pool->waiting++;
+			pthread_cond_wait(&pool->idle, &pool->lock);
+			pool->waiting--;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return xdl_atomic_load(&grp->cancelled, XDL_ATOMIC_ACQUIRE) ? -1 : 0;
+}
+
+int xdl_pool_cancel(xdpool_t *pool, xdtask_group_t *grp)
+{
+	xdpool_job_t *job, *list = NULL;
+	int i, prio, n = 0;
+
+	if (!pool)
+		return 0;
+	for (i = 0; i < pool->nthreads; i++) {
+		for (prio = 0; prio < XDL_POOL_NPRIO; prio++) {
+			xdpool_deque_t *q = &pool->workers[i].q[prio];
+			long j, kept = 0;
+
+			pthread_mutex_lock(&q->lock);
+			for (j = 0; j < q->nr; j++) {
+				job = q->jobs[(q->head + j) % q->alloc];
+				if (grp && job->grp != grp) {
+					q->jobs[(q->head + kept++) % q->alloc] = job;
+					continue;
+				}
+				job->next = list;
+				list = job;
+				n++;
+			}
+			if (kept != q->nr) {
+				xdl_atomic_sub(&pool->queued, q->nr - kept, XDL_ATOMIC_ACQ_REL);
+				q->nr = kept;
+			}
+			pthread_mutex_unlock(&q->lock);
+		}
+	}
+
+	/* Completion callbacks run outside of the deque locks. */
+	while ((job = list)) {
+		list = job->next;
+		xdl_atomic_add(&job->grp->cancelled, 1, XDL_ATOMIC_ACQ_REL);
+		xdl_pool_finish(pool, job, -1);
+	}
+
+	return n;
+}
+
+static void xdl_pool_finish(xdpool_t *pool, xdpool_job_t *job, int status)
+{
+	xdtask_group_t *grp = job->grp;
+
+	if (job->task.done)
+		job->task.done(job->task.priv, status, &job->times);
+	xdl_sys_free(job);
+
+	if (!xdl_atomic_sub(&grp->pending, 1, XDL_ATOMIC_ACQ_REL)) {
+		/* grp may be gone as soon as pending hits zero */
+		pthread_mutex_lock(&pool->lock);
+		if (pool->waiting)
+			pthread_cond_broadcast(&pool->idle);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+#else /* NO_PTHREADS */
+
+xdpool_t *xdl_pool_new(int nthreads UNUSED)
+{
+	return NULL;
+}
+
+void xdl_pool_set_default_threads(int nthreads UNUSED)
+{
+}
+
+xdpool_t *xdl_pool_get_default(void)
+{
+	return NULL;
+}
+
+void xdl_pool_put(xdpool_t *pool UNUSED)
+{
+}
+
+int xdl_pool_threads(xdpool_t const *pool UNUSED)
+{
+	return 0;
+}
+
+int xdl_pool_worker(xdpool_t *pool UNUSED)
+{
+	return -1;
+}
+
+void xdl_group_init(xdtask_group_t *grp, xdpool_t *pool)
+{
+	grp->pool = pool;
+	grp->pending = 0;
+	grp->cancelled = 0;
+}
+
+int xdl_pool_submit(xdtask_group_t *grp UNUSED, xdtask_t const *task)
+{
+	xdl_pool_run_inline(task);
+	return 0;
+}
+
+int xdl_group_wait(xdtask_group_t *grp UNUSED)
+{
+	return 0;
+}
+
+int xdl_pool_cancel(xdpool_t *pool UNUSED, xdtask_group_t *grp UNUSED)
+{
+	return 0;
+}
+
+#endif /* NO_PTHREADS */
@@ -26,8 +26,23 @@
 #define XDL_KPDIS_RUN 4
 #define XDL_MAX_EQLIMIT 1024
 #define XDL_SIMSCAN_WINDOW 100
+#define XDL_CLEANUP_PAR_RECS 65536	/* both files together, see xdl_cleanup_records() */
 #define XDL_GUESS_NLINES1 256
 #define XDL_GUESS_NLINES2 20
+/* what a record costs in memory, see xdl_prepare_ctx() */
+#define XDL_REC_BYTES (sizeof(xrecord_t) + sizeof(bool) + 2 * sizeof(size_t))
+
+/*
+ * XDF_AUTO_DIFF thresholds, tuned on a corpus of small edits, heavy
+ * churn, moved blocks, brace-heavy code and low-entropy files.
+ */
+#define XDL_AUTO_MIN_RECS 2048	/* below this every engine is fast enough */
+#define XDL_AUTO_MIN_UNIQUE 50	/* per mille of matched records */
+#define XDL_AUTO_MAX_BREAKS 16	/* out-of-order unique records Myers tolerates */
+
+/* XDF_SEGMENT_LINES: default piece length limit, gear hash for cuts */
+#define XDL_SEGMENT_SIZE 1024
+#define XDL_SEGMENT_GEAR(c) (((uint64_t)(c) + 1) * 0x9e3779b97f4a7c15ULL)
 
 #define DISCARD 0
 #define KEEP 1
@@ -128,32 +143,175 @@ static int xdl_classify_record(unsigned int pass, xdlclassifier_t *cf, xrecord_t
 
 static void xdl_free_ctx(xdfile_t *xdf)
 {
+	xdl_index_close(xdf->index);
+	xdl_free(xdf->ignored);
+	if (xdf->spill) {
+		xdl_spill_close(xdf->spill);
+		return;
+	}
 	xdl_free(xdf->reference_index);
-	xdl_free(xdf->changed - 1);
+	if (xdf->changed)
+		xdl_free(xdf->changed - 1);
 	xdl_free(xdf->recs);
 }
 
 
+static int xdl_grow_recs(xdfile_t *xdf, long *narec) {
+	long alloc = 2 * *narec + 16;
+
+	if (!xdf->spill)
+		return XDL_ALLOC_GROW(xdf->recs, (long)xdf->nrec + 1, *narec);
+	if ((long)xdf->nrec + 1 <= *narec)
+		return 0;
+	if (!(xdf->recs = xdl_spill_grow(xdf->spill, alloc * sizeof(xrecord_t))))
+		return -1;
+	*narec = alloc;
+	return 0;
+}
+
+
+/*
+ * Lays the other arrays out after the records in the spill file:
+ * changed[] (with its two guard entries), reference_index[] and then
+ * room for reference_class[], filled in by xdl_prepare_env_0().
+ */
+static int xdl_spill_layout(xdfile_t *xdf, bool need_index) {
+	size_t off_chg, off_ref, size;
+	uint8_t *base;
+
+	off_chg = xdf->nrec * sizeof(xrecord_t);
+	off_ref = (off_chg + xdf->nrec + 2 + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	size = off_ref + 2 * (xdf->nrec + 1) * sizeof(size_t);
+	if (!(base = xdl_spill_grow(xdf->spill, size)))
+		return -1;
+
+	xdf->recs = (xrecord_t *)base;
+	xdf->changed = (bool *)(base + off_chg);
+	memset(xdf->changed, 0, xdf->nrec + 2);
+	xdf->changed += 1;
+	if (need_index)
+		xdf->reference_index = (size_t *)(base + off_ref);
+	return 0;
+}
+
+
+static bool xdl_segment_delim(uint8_t c)
+{
+	switch (c) {
+	case ',': case ';': case ' ': case '\t': case '|':
+	case '{': case '}': case '(': case ')': case '[': case ']':
+	case '<': case '>':
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Where the record starting at 'cur' ends if its line has to be cut,
+ * or NULL if the rest of the line is one record. Cuts fall after a
+ * delimiter whose rolling hash has its top 'bits' clear, so that they
+ * depend on the bytes around them and an edit moves only nearby cuts;
+ * pieces are at least max / 8 bytes long. A piece that reaches max
+ * bytes without such a delimiter is cut after its last delimiter, or
+ * at max on a UTF-8 character boundary.
+ *
+ * Only the bytes up to the cut are looked at, so preparing a range
+ * of records on its own (xdl_fall_back_diff()) cuts it the same way:
+ * a line running into 'top' without a newline is cut like a longer one.
+ */
+static uint8_t const *xdl_segment_end(uint8_t const *cur, uint8_t const *top,
+				      long max, int bits)
+{
+	uint8_t const *lim, *cut = NULL, *p;
+	long min = XDL_MAX(max / 8, 1);
+	uint64_t h = 0;
+
+	if (memchr(cur, '\n', XDL_MIN(top - cur, max + 1)))
+		return NULL;
+	lim = top - cur > max ? cur + max : top;
+	for (p = cur; p < lim; p++) {
+		h = (h << 1) + XDL_SEGMENT_GEAR(*p);
+		if (p - cur + 1 < min || !xdl_segment_delim(*p))
+			continue;
+		cut = p + 1;
+		if (!(h >> (64 - bits)))
+			return cut < top ? cut : NULL;
+	}
+	if (cut)
+		return cut < top ? cut : NULL;
+	if (lim == top)
+		return NULL;
+	for (p = lim; p > cur + min && (*p & 0xc0) == 0x80; p--)
+		;
+	return p;
+}
+
+static long xdl_segment_size(xpparam_t const *xpp)
+{
+	if (!(xpp->flags & XDF_SEGMENT_LINES))
+		return 0;
+	return xpp->segment_size > 0 ? xpp->segment_size : XDL_SEGMENT_SIZE;
+}
+
 static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_t const *xpp,
-			   xdlclassifier_t *cf, xdfile_t *xdf) {
+			   xdlclassifier_t *cf, xdfile_t *xdf, bool spill) {
 	long bsize;
 	uint64_t hav;
-	uint8_t const *blk, *cur, *top, *prev;
+	uint8_t digest[XDL_INDEX_DIGEST_SIZE];
+	int indexed;
+	uint8_t const *blk, *cur, *top, *prev, *end;
 	xrecord_t *crec;
+	long seg = xdl_segment_size(xpp);
+	int segbits = 1;
+	bool need_index = (XDF_DIFF_ALG(xpp->flags) != XDF_PATIENCE_DIFF) &&
+		(XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF);
 
 	xdf->reference_index = NULL;
+	xdf->reference_class = NULL;
 	xdf->changed = NULL;
 	xdf->recs = NULL;
-
-	if (!XDL_ALLOC_ARRAY(xdf->recs, narec))
+	xdf->spill = NULL;
+	xdf->nsplit = 0;
+	xdf->index = NULL;
+	xdf->ignored = NULL;
+	xdf->nignored = 0;
+
+	/* about one delimiter in 16 cuts at 1K, more for larger pieces */
+	while (seg && segbits < 32 && (64L << segbits) < seg)
+		segbits++;
+
+	if (spill) {
+		if (!(xdf->spill = xdl_spill_open(xpp->spill_dir)) ||
+		    !(xdf->recs = xdl_spill_grow(xdf->spill, narec * sizeof(xrecord_t))))
+			goto abort;
+		/* Records are written front to back, once. */
+		xdl_spill_advise(xdf->spill, 0, narec * sizeof(xrecord_t),
+				 XDL_SPILL_SEQUENTIAL);
+	} else if (!XDL_ALLOC_ARRAY(xdf->recs, narec))
 		goto abort;
 
 	xdf->nrec = 0;
 	if ((cur = blk = xdl_mmfile_first(mf, &bsize))) {
+		indexed = xpp->index_dir && bsize >= XDL_INDEX_MIN_SIZE;
+		if (indexed) {
+			xdl_index_digest(blk, bsize, digest);
+			xdf->index = xdl_index_open(xpp, digest, bsize);
+		}
 		for (top = blk + bsize; cur < top; ) {
+			if (!(xdf->nrec & XDL_ABORT_POLL_MASK) &&
+			    xdl_should_abort(xpp))
+				goto abort;
 			prev = cur;
-			hav = xdl_hash_record(&cur, top, xpp->flags);
-			if (XDL_ALLOC_GROW(xdf->recs, (long)xdf->nrec + 1, narec))
+			if (xdf->index) {
+				hav = xdl_index_record(xdf->index, xdf->nrec, blk, &cur);
+				if (cur < top && cur[-1] != '\n')
+					xdf->nsplit++;
+			} else if (seg && (end = xdl_segment_end(cur, top, seg, segbits))) {
+				hav = xdl_hash_record(&cur, end, xpp->flags);
+				xdf->nsplit++;
+			} else
+				hav = xdl_hash_record(&cur, top, xpp->flags);
+			if (xdl_grow_recs(xdf, &narec))
 				goto abort;
 			crec = &xdf->recs[xdf->nrec++];
 			crec->ptr = prev;
@@ -162,18 +320,24 @@ static int xdl_prepare_ctx(unsigned int pass, mmfile_t *mf, long narec, xpparam_
 			if (xdl_classify_record(pass, cf, crec) < 0)
 				goto abort;
 		}
+		/* best effort: a diff does not fail for want of an index */
+		if (indexed && !xdf->index)
+			xdl_index_store(xpp, digest, xdf, bsize, XDL_FUNC_LANG_NONE);
 	}
 
-	if (!XDL_CALLOC_ARRAY(xdf->changed, xdf->nrec + 2))
-		goto abort;
+	if (xdf->spill) {
+		if (xdl_spill_layout(xdf, need_index) < 0)
+			goto abort;
+	} else {
+		if (!XDL_CALLOC_ARRAY(xdf->changed, xdf->nrec + 2))
+			goto abort;
+		xdf->changed += 1;
 
-	if ((XDF_DIFF_ALG(xpp->flags) != XDF_PATIENCE_DIFF) &&
-	    (XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF)) {
-		if (!XDL_ALLOC_ARRAY(xdf->reference_index, xdf->nrec + 1))
+		if (need_index &&
+		    !XDL_ALLOC_ARRAY(xdf->reference_index, xdf->nrec + 1))
 			goto abort;
 	}
 
-	xdf->changed += 1;
 	xdf->nreff = 0;
 	xdf->dstart = 0;
 	xdf->dend = xdf->nrec - 1;
@@ -193,38 +357,27 @@ void xdl_free_env(xdfenv_t *xe) {
 }
 
 
-static bool xdl_clean_mmatch(uint8_t const *action, long i, long s, long e) {
-	long r, rdis0, rpdis0, rdis1, rpdis1;
+typedef struct s_xdcleanup {
+	xdlclassifier_t *cf;
+	xdfile_t *xdf;
+	int pass;	/* 1 for the first file, 2 for the second */
+	long nrec;	/* records the multimatch limit scales with */
+	int ret;
+} xdcleanup_t;
 
-	/*
-	 * Limits the window that is examined during the similar-lines
-	 * scan. The loops below stops when action[i - r] == KEEP
-	 * (line that has no match), but there are corner cases where
-	 * the loop proceed all the way to the extremities by causing
-	 * huge performance penalties in case of big files.
-	 */
-	if (i - s > XDL_SIMSCAN_WINDOW)
-		s = i - XDL_SIMSCAN_WINDOW;
-	if (e - i > XDL_SIMSCAN_WINDOW)
-		e = i + XDL_SIMSCAN_WINDOW;
 
-	/*
-	 * Scans the lines before 'i' to find a run of lines that either
-	 * have no match (action[j] == DISCARD) or have multiple matches
-	 * (action[j] == INVESTIGATE). Note that we always call this
-	 * function with action[i] == INVESTIGATE, so the current line
-	 * (i) is already a multimatch line.
-	 */
-	for (r = 1, rdis0 = 0, rpdis0 = 1; (i - r) >= s; r++) {
-		if (action[i - r] == DISCARD)
-			rdis0++;
-		else if (action[i - r] == INVESTIGATE)
-			rpdis0++;
-		else if (action[i - r] == KEEP)
-			break;
-		else
-			BUG("Illegal value for action[i - r]");
-	}
+/*
+ * Decides whether the multimatch line 'i' sits in a run of lines that
+ * have no match (DISCARD), or multiple matches (INVESTIGATE), that is
+ * mostly made of the former. The run is [lo, hi], i.e. it is bounded
+ * by the closest KEEP lines on either side, by the ends of the range
+ * being diffed and by XDL_SIMSCAN_WINDOW. 'ndis' counts DISCARD lines
+ * as a prefix sum, so that runs need not be rescanned for each line;
+ * all indices are relative to its start.
+ */
+static bool xdl_clean_mmatch(long const *ndis, long i, long lo, long hi) {
+	long rdis0, rpdis0, rdis1, rpdis1;
+
 	/*
 	 * If the run before the line 'i' found only multimatch lines,
 	 * we return false and hence we don't make the current line (i)
@@ -232,25 +385,15 @@ static bool xdl_clean_mmatch(uint8_t const *action, long i, long s, long e) {
 	 * they appear in the middle of runs with nomatch lines
 	 * (action[j] == DISCARD).
 	 */
-	if (rdis0 == 0)
-		return 0;
-	for (r = 1, rdis1 = 0, rpdis1 = 1; (i + r) <= e; r++) {
-		if (action[i + r] == DISCARD)
-			rdis1++;
-		else if (action[i + r] == INVESTIGATE)
-			rpdis1++;
-		else if (action[i + r] == KEEP)
-			break;
-		else
-			BUG("Illegal value for action[i + r]");
-	}
-	/*
-	 * If the run after the line 'i' found only multimatch lines,
-	 * we return false and hence we don't make the current line (i)
-	 * discarded.
-	 */
-	if (rdis1 == 0)
+	if ((rdis0 = ndis[i] - ndis[lo]) == 0)
+		return false;
+	rpdis0 = (i - lo) - rdis0 + 1;
+
+	/* Likewise for the run after the line 'i'. */
+	if ((rdis1 = ndis[hi + 1] - ndis[i + 1]) == 0)
 		return false;
+	rpdis1 = (hi - i) - rdis1 + 1;
+
 	rdis1 += rdis0;
 	rpdis1 += rpdis0;
 
@@ -263,78 +406,100 @@ static bool xdl_clean_mmatch(uint8_t const *action, long i, long s, long e) {
  * matches on the other file. Also, lines that have multiple matches
  * might be potentially discarded if they appear in a run of discardable.
  */
-static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2) {
-	long i, nm, mlim;
+static void xdl_cleanup_file(void *priv) {
+	xdcleanup_t *cu = priv;
+	xdlclassifier_t *cf = cu->cf;
+	xdfile_t *xdf = cu->xdf;
+	long i, nm, mlim, keep, next, s = xdf->dstart, e = xdf->dend;
+	long *ndis = NULL;
 	xrecord_t *recs;
 	xdlclass_t *rcrec;
-	uint8_t *action1 = NULL, *action2 = NULL;
+	uint8_t *action = NULL;
 	bool need_min = !!(cf->flags & XDF_NEED_MINIMAL);
-	int ret = 0;
+
+	cu->ret = -1;
 
 	/*
 	 * Create temporary arrays that will help us decide if
-	 * changed[i] should remain false, or become true.
+	 * changed[i] should remain false, or become true. ndis[j]
+	 * is the number of DISCARD lines in [dstart, dstart + j).
 	 */
-	if (!XDL_CALLOC_ARRAY(action1, xdf1->nrec + 1)) {
-		ret = -1;
+	if (!XDL_CALLOC_ARRAY(action, xdf->nrec + 1) ||
+	    !XDL_ALLOC_ARRAY(ndis, e - s + 2))
 		goto cleanup;
-	}
-	if (!XDL_CALLOC_ARRAY(action2, xdf2->nrec + 1)) {
-		ret = -1;
-		goto cleanup;
-	}
 
 	/*
 	 * Initialize temporary arrays with DISCARD, KEEP, or INVESTIGATE.
 	 */
-	if ((mlim = xdl_bogosqrt((long)xdf1->nrec)) > XDL_MAX_EQLIMIT)
+	if ((mlim = xdl_bogosqrt(cu->nrec)) > XDL_MAX_EQLIMIT)
 		mlim = XDL_MAX_EQLIMIT;
-	for (i = xdf1->dstart, recs = &xdf1->recs[xdf1->dstart]; i <= xdf1->dend; i++, recs++) {
+	ndis[0] = 0;
+	for (i = s, recs = &xdf->recs[s]; i <= e; i++, recs++) {
 		rcrec = cf->rcrecs[recs->minimal_perfect_hash];
-		nm = rcrec ? rcrec->len2 : 0;
-		action1[i] = (nm == 0) ? DISCARD: (nm >= mlim && !need_min) ? INVESTIGATE: KEEP;
-	}
-
-	if ((mlim = xdl_bogosqrt((long)xdf2->nrec)) > XDL_MAX_EQLIMIT)
-		mlim = XDL_MAX_EQLIMIT;
-	for (i = xdf2->dstart, recs = &xdf2->recs[xdf2->dstart]; i <= xdf2->dend; i++, recs++) {
-		rcrec = cf->rcrecs[recs->minimal_perfect_hash];
-		nm = rcrec ? rcrec->len1 : 0;
-		action2[i] = (nm == 0) ? DISCARD: (nm >= mlim && !need_min) ? INVESTIGATE: KEEP;
+		nm = rcrec ? (cu->pass == 1 ? rcrec->len2 : rcrec->len1) : 0;
+		action[i] = (nm == 0) ? DISCARD: (nm >= mlim && !need_min) ? INVESTIGATE: KEEP;
+		ndis[i - s + 1] = ndis[i - s] + (action[i] == DISCARD);
 	}
 
 	/*
 	 * Use temporary arrays to decide if changed[i] should remain
-	 * false, or become true.
+	 * false, or become true. 'keep' is the last KEEP line before 'i'
+	 * and 'next' the first one after it, once needed.
 	 */
-	xdf1->nreff = 0;
-	for (i = xdf1->dstart, recs = &xdf1->recs[xdf1->dstart];
-	     i <= xdf1->dend; i++, recs++) {
-		if (action1[i] == KEEP ||
-		    (action1[i] == INVESTIGATE && !xdl_clean_mmatch(action1, i, xdf1->dstart, xdf1->dend))) {
-			xdf1->reference_index[xdf1->nreff++] = i;
-			/* changed[i] remains false, i.e. keep */
-		} else
-			xdf1->changed[i] = true;
-			/* i.e. discard */
-	}
-
-	xdf2->nreff = 0;
-	for (i = xdf2->dstart, recs = &xdf2->recs[xdf2->dstart];
-	     i <= xdf2->dend; i++, recs++) {
-		if (action2[i] == KEEP ||
-		    (action2[i] == INVESTIGATE && !xdl_clean_mmatch(action2, i, xdf2->dstart, xdf2->dend))) {
-			xdf2->reference_index[xdf2->nreff++] = i;
+	xdf->nreff = 0;
+	for (i = s, keep = s - 1, next = s; i <= e; i++) {
+		if (action[i] == KEEP)
+			keep = i;
+		else if (action[i] == INVESTIGATE && next <= i)
+			for (next = i + 1; next <= e && action[next] != KEEP; next++)
+				;
+		if (action[i] == KEEP ||
+		    (action[i] == INVESTIGATE &&
+		     !xdl_clean_mmatch(ndis, i - s,
+				       XDL_MAX(keep + 1, i - XDL_SIMSCAN_WINDOW) - s,
+				       XDL_MIN(next - 1, i + XDL_SIMSCAN_WINDOW) - s))) {
+			xdf->reference_index[xdf->nreff++] = i;
 			/* changed[i] remains false, i.e. keep */
 		} else
-			xdf2->changed[i] = true;
+			xdf->changed[i] = true;
 			/* i.e. discard */
 	}
+	cu->ret = 0;
 
 cleanup:
-	xdl_free(action1);
-	xdl_free(action2);
+	xdl_free(ndis);
+	xdl_free(action);
+}
+
 
+static int xdl_cleanup_records(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2,
+			       xpparam_t const *xpp, xdscale_t const *scale) {
+	xdcleanup_t cu[2] = {
+		{ cf, xdf1, 1, scale ? scale->nrec1 : (long)xdf1->nrec, 0 },
+		{ cf, xdf2, 2, scale ? scale->nrec2 : (long)xdf2->nrec, 0 },
+	};
+	xdtask_group_t grp;
+	int i, ret = 0;
+
+	xdl_trace_enter(XDL_TRACE_CLEANUP, xdf1->dend - xdf1->dstart + 1,
+			xdf2->dend - xdf2->dstart + 1);
+
+	/* The two files are independent; large ones are done side by side. */
+	xdl_group_init(&grp, xdf1->nrec + xdf2->nrec >= XDL_CLEANUP_PAR_RECS ?
+		       xpp->pool : NULL);
+	for (i = 0; i < 2; i++) {
+		xdtask_t t = { xdl_cleanup_file, NULL, &cu[i],
+			       XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY };
+
+		if (xdl_pool_submit(&grp, &t) < 0)
+			xdl_cleanup_file(&cu[i]);
+	}
+	if (xdl_group_wait(&grp) < 0 || cu[0].ret < 0 || cu[1].ret < 0)
+		ret = -1;
+
+	xdl_trace_leave(XDL_TRACE_CLEANUP, xdf1->nreff, xdf2->nreff,
+			ret < 0 ? 0 : xdf1->dend - xdf1->dstart + 1 - xdf1->nreff +
+			xdf2->dend - xdf2->dstart + 1 - xdf2->nreff, ret);
 	return ret;
 }
 
@@ -368,10 +533,11 @@ static int xdl_trim_ends(xdfile_t *xdf1, xdfile_t *xdf2) {
 }
 
 
-static int xdl_optimize_ctxs(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2) {
+static int xdl_optimize_ctxs(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2,
+			     xpparam_t const *xpp, xdscale_t const *scale) {
 
 	if (xdl_trim_ends(xdf1, xdf2) < 0 ||
-	    xdl_cleanup_records(cf, xdf1, xdf2) < 0) {
+	    xdl_cleanup_records(cf, xdf1, xdf2, xpp, scale) < 0) {
 
 		return -1;
 	}
@@ -379,10 +545,215 @@ static int xdl_optimize_ctxs(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2
 	return 0;
 }
 
-int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-		    xdfenv_t *xe) {
-	long enl1, enl2, sample;
+/*
+ * Gather the statistics XDF_AUTO_DIFF decides on. Everything except
+ * the out-of-order count falls out of the classifier; that one needs a
+ * pass over both files, mapping records unique on both sides to their
+ * position in the second file.
+ */
+static int xdl_auto_stats(xdlclassifier_t *cf, xdfile_t *xdf1, xdfile_t *xdf2,
+			  xdautoinfo_t *ai) {
+	long i, last, *pos2;
+	xdlclass_t *rcrec;
+
+	memset(ai, 0, sizeof(*ai));
+	ai->nrec1 = (long)xdf1->nrec;
+	ai->nrec2 = (long)xdf2->nrec;
+	ai->nclass = cf->count;
+	for (i = 0; i < cf->count; i++) {
+		rcrec = cf->rcrecs[i];
+		if (!rcrec->len1 || !rcrec->len2) {
+			ai->nunmatched += rcrec->len1 + rcrec->len2;
+			continue;
+		}
+		if (rcrec->len1 == 1 && rcrec->len2 == 1)
+			ai->nunique++;
+		if (ai->maxdup < XDL_MAX(rcrec->len1, rcrec->len2))
+			ai->maxdup = XDL_MAX(rcrec->len1, rcrec->len2);
+	}
+
+	if (!XDL_ALLOC_ARRAY(pos2, cf->count))
+		return -1;
+	for (i = 0; i < (long)xdf2->nrec; i++)
+		pos2[xdf2->recs[i].minimal_perfect_hash] = i;
+	for (i = 0, last = -1; i < (long)xdf1->nrec; i++) {
+		rcrec = cf->rcrecs[xdf1->recs[i].minimal_perfect_hash];
+		if (rcrec->len1 != 1 || rcrec->len2 != 1)
+			continue;
+		if (pos2[rcrec->idx] < last)
+			ai->breaks++;
+		last = pos2[rcrec->idx];
+	}
+	xdl_free(pos2);
+
+	return 0;
+}
+
+
+static unsigned long xdl_auto_pick(xdautoinfo_t const *ai) {
+	long matched = ai->nrec1 + ai->nrec2 - ai->nunmatched;
+
+	/*
+	 * Small inputs, and inputs where almost nothing anchors a
+	 * patience or histogram split (both would just fall back to
+	 * Myers, after doing extra work first).
+	 */
+	if (ai->nrec1 + ai->nrec2 < XDL_AUTO_MIN_RECS ||
+	    2 * ai->nunique * 1000 < matched * XDL_AUTO_MIN_UNIQUE)
+		return 0;
+
+	/*
+	 * Blocks that moved around: Myers has to explore every diagonal
+	 * between the old and new positions, while histogram splits
+	 * right at the unique lines of the moved blocks.
+	 */
+	if (ai->breaks > XDL_AUTO_MAX_BREAKS)
+		return XDF_HISTOGRAM_DIFF;
+
+	/*
+	 * Mostly repeated lines (braces, blank lines) with enough unique
+	 * ones in between: Myers matches the repeats across the whole
+	 * file, patience only ever looks between consecutive anchors.
+	 */
+	if (matched > 4 * ai->nunique)
+		return XDF_PATIENCE_DIFF;
+
+	return 0;
+}
+
+
+/*
+ * Out-of-core runs give Myers the classes of the records it looks at
+ * as one sequential array, so that it never has to fault in the
+ * records themselves, which can then be dropped until the script is
+ * emitted.
+ */
+static void xdl_spill_classes(xdfile_t *xdf) {
+	size_t i;
+
+	xdf->reference_class = xdf->reference_index + xdf->nrec + 1;
+	for (i = 0; i < xdf->nreff; i++)
+		xdf->reference_class[i] =
+			xdf->recs[xdf->reference_index[i]].minimal_perfect_hash;
+	xdl_spill_advise(xdf->spill, 0, xdf->nrec * sizeof(xrecord_t),
+			 XDL_SPILL_DONTNEED);
+}
+
+
+/*
+ * XDF_FILTER_IGNORED: move the records a change could be ignored for
+ * out of recs[] into ignored[], so that the engine diffs only the rest.
+ * xdl_unfilter_env() puts them back in place afterwards.
+ */
+static int xdl_filter_ctx(xdfile_t *xdf, xpparam_t const *xpp) {
+	size_t i, n = 0;
+	long alloc = 0;
+
+	for (i = 0; i < xdf->nrec; i++) {
+		if (!(i & XDL_ABORT_POLL_MASK) && xdl_should_abort(xpp))
+			return -1;
+		if (!xdl_record_ignorable(xdf, (long)i, xpp)) {
+			xdf->recs[n++] = xdf->recs[i];
+			continue;
+		}
+		if (XDL_ALLOC_GROW(xdf->ignored, (long)xdf->nignored + 1, alloc))
+			return -1;
+		xdf->ignored[xdf->nignored].pos = i;
+		xdf->ignored[xdf->nignored++].rec = xdf->recs[i];
+	}
+	xdf->nrec = n;
+	xdf->dend = (long)n - 1;
+
+	return 0;
+}
+
+
+/*
+ * The slice of ignored[] between 'from' and the next record of xdf the
+ * engine left unchanged, which is returned (nrec at the end).
+ */
+static size_t xdl_unfilter_gap(xdfile_t *xdf, size_t from, size_t *k) {
+	for (; from < xdf->nrec; from++) {
+		if (*k < xdf->nignored && xdf->ignored[*k].pos == from)
+			(*k)++;
+		else if (!xdf->changed[from])
+			break;
+	}
+	return from;
+}
+
+
+static void xdl_unfilter_ctx(xdfile_t *xdf, size_t nkept) {
+	size_t p, k = xdf->nignored;
+
+	xdf->nrec = nkept + xdf->nignored;
+	for (p = xdf->nrec; p-- > 0; ) {
+		if (k && xdf->ignored[k - 1].pos == p) {
+			xdf->recs[p] = xdf->ignored[--k].rec;
+			xdf->changed[p] = false;
+		} else {
+			xdf->recs[p] = xdf->recs[--nkept];
+			xdf->changed[p] = xdf->changed[nkept];
+		}
+	}
+	xdf->dstart = 0;
+	xdf->dend = (long)xdf->nrec - 1;
+}
+
+
+/*
+ * Puts the records xdl_filter_ctx() took out back in place, marking
+ * changed those that do not line up with an equal one on the other
+ * side: between two records the engine matched, the ignorable records
+ * of both files are paired off from either end as far as they agree.
+ */
+void xdl_unfilter_env(xdfenv_t *xe) {
+	xdfile_t *xdf1 = &xe->xdf1, *xdf2 = &xe->xdf2;
+	size_t i1 = 0, i2 = 0, k1 = 0, k2 = 0, s1, s2, e1, e2, a, b, c, d;
+
+	if (!xdf1->nignored && !xdf2->nignored)
+		return;
+	xdl_unfilter_ctx(xdf1, xdf1->nrec);
+	xdl_unfilter_ctx(xdf2, xdf2->nrec);
+
+	while (i1 < xdf1->nrec || i2 < xdf2->nrec) {
+		s1 = k1;
+		s2 = k2;
+		e1 = xdl_unfilter_gap(xdf1, i1, &k1);
+		e2 = xdl_unfilter_gap(xdf2, i2, &k2);
+
+		for (a = s1, b = s2; a < k1 && b < k2; a++, b++)
+			if (xdf1->ignored[a].rec.minimal_perfect_hash !=
+			    xdf2->ignored[b].rec.minimal_perfect_hash)
+				break;
+		for (c = k1, d = k2; c > a && d > b; c--, d--)
+			if (xdf1->ignored[c - 1].rec.minimal_perfect_hash !=
+			    xdf2->ignored[d - 1].rec.minimal_perfect_hash)
+				break;
+		for (; a < c; a++)
+			xdf1->changed[xdf1->ignored[a].pos] = true;
+		for (; b < d; b++)
+			xdf2->changed[xdf2->ignored[b].pos] = true;
+
+		/* step over the matched pair */
+		i1 = e1 + 1;
+		i2 = e2 + 1;
+	}
+
+	xdl_free(xdf1->ignored);
+	xdl_free(xdf2->ignored);
+	xdf1->ignored = xdf2->ignored = NULL;
+	xdf1->nignored = xdf2->nignored = 0;
+}
+
+
+static int xdl_prepare_env_0(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			     xdfenv_t *xe, xdautoinfo_t *ai,
+			     xdscale_t const *scale) {
+	long enl1, enl2, sample, seg = xdl_segment_size(xpp);
+	unsigned long alg = XDF_DIFF_ALG(xpp->flags);
 	xdlclassifier_t cf;
+	bool spill;
 
 	memset(&cf, 0, sizeof(cf));
 
@@ -398,25 +769,35 @@ int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 
 	enl1 = xdl_guess_lines(mf1, sample) + 1;
 	enl2 = xdl_guess_lines(mf2, sample) + 1;
+	if (seg) {
+		/* the classifier is sized by this; long lines make many records */
+		enl1 = XDL_MAX(enl1, mf1->size / XDL_MAX(seg / 4, 1) + 1);
+		enl2 = XDL_MAX(enl2, mf2->size / XDL_MAX(seg / 4, 1) + 1);
+	}
+	spill = xpp->spill_threshold &&
+		(size_t)(enl1 + enl2) > xpp->spill_threshold / XDL_REC_BYTES;
 
 	if (xdl_init_classifier(&cf, enl1 + enl2 + 1, xpp->flags) < 0)
 		return -1;
 
-	if (xdl_prepare_ctx(1, mf1, enl1, xpp, &cf, &xe->xdf1) < 0) {
+	if (xdl_prepare_ctx(1, mf1, enl1, xpp, &cf, &xe->xdf1, spill) < 0) {
 
 		xdl_free_classifier(&cf);
 		return -1;
 	}
-	if (xdl_prepare_ctx(2, mf2, enl2, xpp, &cf, &xe->xdf2) < 0) {
+	if (xdl_prepare_ctx(2, mf2, enl2, xpp, &cf, &xe->xdf2, spill) < 0) {
 
 		xdl_free_ctx(&xe->xdf1);
 		xdl_free_classifier(&cf);
 		return -1;
 	}
 
-	if ((XDF_DIFF_ALG(xpp->flags) != XDF_PATIENCE_DIFF) &&
-	    (XDF_DIFF_ALG(xpp->flags) != XDF_HISTOGRAM_DIFF) &&
-	    xdl_optimize_ctxs(&cf, &xe->xdf1, &xe->xdf2) < 0) {
+	/* Filtering goes by whole lines; inputs cut in pieces are left alone. */
+	if ((xpp->flags & XDF_FILTER_IGNORED) &&
+	    ((xpp->flags & XDF_IGNORE_BLANK_LINES) || xpp->ignore_regex) &&
+	    !xe->xdf1.nsplit && !xe->xdf2.nsplit &&
+	    (xdl_filter_ctx(&xe->xdf1, xpp) < 0 ||
+	     xdl_filter_ctx(&xe->xdf2, xpp) < 0)) {
 
 		xdl_free_ctx(&xe->xdf2);
 		xdl_free_ctx(&xe->xdf1);
@@ -424,7 +805,69 @@ int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		return -1;
 	}
 
+	if (ai) {
+		if (xdl_auto_stats(&cf, &xe->xdf1, &xe->xdf2, ai) < 0) {
+
+			xdl_free_ctx(&xe->xdf2);
+			xdl_free_ctx(&xe->xdf1);
+			xdl_free_classifier(&cf);
+			return -1;
+		}
+		alg = ai->alg = xdl_auto_pick(ai);
+		if (alg == XDF_PATIENCE_DIFF || alg == XDF_HISTOGRAM_DIFF) {
+			if (!spill) {
+				xdl_free(xe->xdf1.reference_index);
+				xdl_free(xe->xdf2.reference_index);
+			}
+			xe->xdf1.reference_index = xe->xdf2.reference_index = NULL;
+		}
+	}
+
+	if ((alg != XDF_PATIENCE_DIFF) &&
+	    (alg != XDF_HISTOGRAM_DIFF) &&
+	    xdl_optimize_ctxs(&cf, &xe->xdf1, &xe->xdf2, xpp, scale) < 0) {
+
+		xdl_free_ctx(&xe->xdf2);
+		xdl_free_ctx(&xe->xdf1);
+		xdl_free_classifier(&cf);
+		return -1;
+	}
+
+	if (spill && xe->xdf1.reference_index) {
+		xdl_spill_classes(&xe->xdf1);
+		xdl_spill_classes(&xe->xdf2);
+	}
+
 	xdl_free_classifier(&cf);
 
 	return 0;
 }
+
+/*
+ * Like xdl_prepare_env(). With ai, for XDF_AUTO_DIFF, also picks the
+ * algorithm, stores it in ai->alg and prepares the environment for it.
+ * With scale, discarding goes by its record counts rather than by
+ * those of mf1 and mf2.
+ */
+int xdl_prepare_env_scaled(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			   xdfenv_t *xe, xdautoinfo_t *ai,
+			   xdscale_t const *scale) {
+	int ret;
+
+	xdl_trace_enter(XDL_TRACE_PREPARE, mf1->size, mf2->size);
+	ret = xdl_prepare_env_0(mf1, mf2, xpp, xe, ai, scale);
+	if (ret < 0)
+		xdl_trace_leave(XDL_TRACE_PREPARE, 0, 0, 0, ret);
+	else
+		xdl_trace_leave(XDL_TRACE_PREPARE, xe->xdf1.nrec, xe->xdf2.nrec,
+				xdl_trace_changed(&xe->xdf1) +
+				xdl_trace_changed(&xe->xdf2), ret);
+
+	return ret;
+}
+
+int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		    xdfenv_t *xe) {
+
+	return xdl_prepare_env_scaled(mf1, mf2, xpp, xe, NULL, NULL);
+}
@@ -25,8 +25,22 @@
 
 
 
+/*
+ * Record counts the heuristics of a diff scale with: the Myers cost
+ * limit, and how often a record may occur before it is a candidate
+ * for discarding. Those of the files themselves, unless the files are
+ * regions of larger ones whose diff should come out the same.
+ */
+typedef struct s_xdscale {
+	long nrec1, nrec2;
+} xdscale_t;
+
 int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		    xdfenv_t *xe);
+int xdl_prepare_env_scaled(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			   xdfenv_t *xe, xdautoinfo_t *ai,
+			   xdscale_t const *scale);
+void xdl_unfilter_env(xdfenv_t *xe);
 void xdl_free_env(xdfenv_t *xe);
 
 
@@ -0,0 +1,156 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * Disk-backed storage for the per-line arrays of large inputs (see
+ * xpparam_t.spill_threshold). Only those arrays move off the heap; the
+ * classifier and the engines' working memory do not.
+ *
+ * Every file being diffed gets one unlinked temporary file, mapped
+ * shared, that holds its records followed by its changed[],
+ * reference_index[] and reference_class[] arrays. Pages that are not
+ * being worked on can then be written back and dropped by the kernel
+ * like any other file cache, instead of weighing on swap.
+ */
+
+struct s_xdspill {
+	int fd;
+	void *base;
+	size_t size;
+};
+
+#if !defined(NO_MMAP) && defined(MAP_SHARED)
+
+#define XDL_SPILL_GRAIN (1 << 16)
+
+xdspill_t *xdl_spill_open(char const *dir)
+{
+	static char const name[] = "/xdiff-spill-XXXXXX";
+	xdspill_t *sp;
+	char *path;
+	size_t len;
+	int fd;
+
+	if (!dir && !(dir = getenv("TMPDIR")))
+		dir = "/tmp";
+	len = strlen(dir);
+	if (!(path = xdl_malloc(len + sizeof(name))))
+		return NULL;
+	memcpy(path, dir, len);
+	memcpy(path + len, name, sizeof(name));
+	fd = mkstemp(path);
+	if (fd >= 0)
+		unlink(path);
+	xdl_free(path);
+	if (fd < 0)
+		return NULL;
+
+	if (!(sp = xdl_malloc(sizeof(*sp)))) {
+		close(fd);
+		return NULL;
+	}
+	sp->fd = fd;
+	sp->base = NULL;
+	sp->size = 0;
+
+	return sp;
+}
+
+void *xdl_spill_grow(xdspill_t *sp, size_t size)
+{
+	void *base;
+
+	if (size <= sp->size)
+		return sp->base;
+	if (size < sp->size + sp->size / 2)
+		size = sp->size + sp->size / 2;
+	size = (size + XDL_SPILL_GRAIN - 1) & ~(size_t)(XDL_SPILL_GRAIN - 1);
+
+	/* The contents live in the file; remapping it keeps them. */
+	if (ftruncate(sp->fd, (off_t)size) < 0)
+		return NULL;
+	if (sp->base)
+		munmap(sp->base, sp->size);
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, sp->fd, 0);
+	if (base == MAP_FAILED) {
+		sp->base = NULL;
+		sp->size = 0;
+		return NULL;
+	}
+	sp->base = base;
+	sp->size = size;
+
+	return base;
+}
+
+void xdl_spill_advise(xdspill_t *sp, size_t off, size_t len, int advice)
+{
+	size_t page = XDL_SPILL_GRAIN, start, end;
+
+	/* Only whole pages inside the range are affected. */
+	start = (off + page - 1) & ~(page - 1);
+	end = XDL_MIN(off + len, sp->size) & ~(page - 1);
+	if (!sp->base || start >= end)
+		return;
+	switch (advice) {
+#ifdef MADV_SEQUENTIAL
+	case XDL_SPILL_SEQUENTIAL:
+		madvise((char *)sp->base + start, end - start, MADV_SEQUENTIAL);
+		break;
+#endif
+#ifdef MADV_DONTNEED
+	case XDL_SPILL_DONTNEED:
+		madvise((char *)sp->base + start, end - start, MADV_DONTNEED);
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+void xdl_spill_close(xdspill_t *sp)
+{
+	if (!sp)
+		return;
+	if (sp->base)
+		munmap(sp->base, sp->size);
+	close(sp->fd);
+	xdl_free(sp);
+}
+
+#else
+
+xdspill_t *xdl_spill_open(char const *dir)
+{
+	return NULL;
+}
+
+void *xdl_spill_grow(xdspill_t *sp, size_t size)
+{
+	return NULL;
+}
+
+void xdl_spill_advise(xdspill_t *sp, size_t off, size_t len, int advice)
+{
+}
+
+void xdl_spill_close(xdspill_t *sp)
+{
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * Phase tracepoints (see xdtrace_t).
+ *
+ * Every probe site tests xdl_tracing() first, which is one load and
+ * branch while nothing listens; sizes and costs that take work to
+ * compute are only evaluated behind it. Builds with XDL_USDT also
+ * carry the USDT probes xdiff:phase__entry(phase, size1, size2) and
+ * xdiff:phase__return(phase, size1, size2, cost, status), guarded by
+ * their semaphores so that they too cost nothing until a tracer
+ * attaches.
+ */
+
+#ifdef XDL_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+unsigned short xdiff_phase__entry_semaphore __attribute__((section(".probes")));
+unsigned short xdiff_phase__return_semaphore __attribute__((section(".probes")));
+#endif
+
+xdtrace_t const *xdl_trace_hooks;
+
+void xdl_trace_set(xdtrace_t const *hooks)
+{
+	xdl_atomic_store_ptr(&xdl_trace_hooks, hooks, XDL_ATOMIC_RELEASE);
+}
+
+void xdl_trace_enter_0(int phase, long size1, long size2)
+{
+	xdtrace_t const *hooks = xdl_atomic_load_ptr(&xdl_trace_hooks, XDL_ATOMIC_ACQUIRE);
+
+#ifdef XDL_USDT
+	STAP_PROBE3(xdiff, phase__entry, phase, size1, size2);
+#endif
+	if (hooks && hooks->enter)
+		hooks->enter(hooks->priv, phase, size1, size2);
+}
+
+void xdl_trace_leave_0(int phase, long size1, long size2, long cost, int status)
+{
+	xdtrace_t const *hooks = xdl_atomic_load_ptr(&xdl_trace_hooks, XDL_ATOMIC_ACQUIRE);
+
+#ifdef XDL_USDT
+	STAP_PROBE5(xdiff, phase__return, phase, size1, size2, cost, status);
+#endif
+	if (hooks && hooks->leave)
+		hooks->leave(hooks->priv, phase, size1, size2, cost, status);
+}
+
+long xdl_trace_changed(xdfile_t const *xdf)
+{
+	long i, n = 0;
+
+	for (i = 0; i < (long)xdf->nrec; i++)
+		n += xdf->changed[i];
+	return n;
+}
+
+long xdl_trace_hunks(xdchange_t const *xscr)
+{
+	long n = 0;
+
+	for (; xscr; xscr = xscr->next)
+		n++;
+	return n;
+}
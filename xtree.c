@@ -0,0 +1,725 @@
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, see
+ *  <http://www.gnu.org/licenses/>.
+ */
+
+#include "xinclude.h"
+
+/*
+ * Diffing two directory trees (xdl_diff_trees()).
+ *
+ * Both trees are walked into path-sorted file lists. Then the contents
+ * of every file are hashed on the pool, straight from a read-only
+ * mapping and with the block hash of the chunking pre-pass, so that
+ * this phase runs at the speed of the disk. The hash can be made to
+ * collide, so it only ever rules contents out: files present on both
+ * sides with the same size and hash are compared byte for byte on the
+ * pool, and left out of the report when they are equal. Of the rest,
+ * files only on one side are paired into renames: first by equal
+ * contents, confirmed the same way, then by the share of lines they
+ * have in common. The remaining pairs are diffed on the pool, a
+ * window ahead of the caller, and reported in path order as they
+ * complete.
+ */
+
+#define XDL_TREE_HASH_BYTES (16 * 1024 * 1024)	/* contents hashed per task */
+#define XDL_TREE_HASH_FILES 256			/* files hashed per task */
+#define XDL_TREE_RENAME_PAIRS (1000 * 1000)	/* inexact rename candidates */
+#define XDL_TREE_BINARY_SCAN 8000		/* as git's buffer_is_binary() */
+#define XDL_TREE_WINDOW_MIN 16
+#define XDL_TREE_MAX_OUT ((size_t)1 << (sizeof(size_t) > 4 ? 34 : 30))
+
+typedef struct s_xdtreefile {
+	char *path;		/* relative to the root, '/'-separated */
+	size_t size;
+	uint64_t hash;
+	uint64_t *lines;	/* sorted line hashes, for rename scoring */
+	long nlines;
+	int paired;
+} xdtreefile_t;
+
+typedef struct s_xdtreeside {
+	char const *root;
+	xdtreefile_t *files;
+	long nr, alloc;
+} xdtreeside_t;
+
+typedef struct s_xdtreemap {
+	mmfile_t mf;
+	int mapped;
+} xdtreemap_t;
+
+typedef struct s_xdtreescan {
+	xdtreeside_t *side;
+	xdtreefile_t **files;	/* when not a run of side->files */
+	long from, to;
+	int lines;		/* build rename signatures instead of hashing */
+	int res;
+} xdtreescan_t;
+
+typedef struct s_xdtreepair {
+	xdtreefile_t *f1, *f2;
+	int status;
+	int similarity;
+	int binary;
+	int maybe_same;		/* same size and hash: compare before diffing */
+	int same;
+	xdoutbuf_t out;
+	int res;
+	xdtask_group_t grp;
+	xdtreeside_t const *s1, *s2;
+	xpparam_t const *xpp;
+	xdemitconf_t const *xecfg;
+} xdtreepair_t;
+
+typedef struct s_xdtreescore {
+	long i1, i2;
+	int score;
+} xdtreescore_t;
+
+
+static char *xdl_tree_join(char const *a, char const *b)
+{
+	size_t la = strlen(a), lb = strlen(b);
+	char *p;
+
+	if (!(p = xdl_malloc(la + lb + 2)))
+		return NULL;
+	memcpy(p, a, la);
+	p[la] = '/';
+	memcpy(p + la + 1, b, lb + 1);
+	return la ? p : memmove(p, p + 1, lb + 1);
+}
+
+static int xdl_tree_walk(xdtreeside_t *side, char const *rel)
+{
+	char *dir, *path = NULL, *full = NULL;
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+	int ret = -1;
+
+	if (!(dir = *rel ? xdl_tree_join(side->root, rel) : NULL) && *rel)
+		return -1;
+	if (!(d = opendir(dir ? dir : side->root))) {
+		/* An unreadable subdirectory is walked as if it were empty. */
+		xdl_free(dir);
+		return *rel ? 0 : -1;
+	}
+	while ((de = readdir(d))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") ||
+		    !strcmp(de->d_name, ".git"))
+			continue;
+		if (!(path = xdl_tree_join(rel, de->d_name)) ||
+		    !(full = xdl_tree_join(side->root, path)) ||
+		    lstat(full, &st) < 0)
+			goto out;
+		xdl_free(full);
+		full = NULL;
+
+		if (S_ISDIR(st.st_mode)) {
+			if (xdl_tree_walk(side, path) < 0)
+				goto out;
+		} else if (S_ISREG(st.st_mode)) {
+			xdtreefile_t *f;
+
+			if (XDL_ALLOC_GROW(side->files, side->nr + 1, side->alloc))
+				goto out;
+			f = &side->files[side->nr++];
+			memset(f, 0, sizeof(*f));
+			f->path = path;
+			f->size = (size_t)st.st_size;
+			path = NULL;
+		}
+		/* Symbolic links and special files are not compared. */
+		xdl_free(path);
+		path = NULL;
+	}
+	ret = 0;
+out:
+	xdl_free(full);
+	xdl_free(path);
+	closedir(d);
+	xdl_free(dir);
+	return ret;
+}
+
+static int xdl_tree_path_cmp(const void *p1, const void *p2)
+{
+	xdtreefile_t const *f1 = p1, *f2 = p2;
+
+	return strcmp(f1->path, f2->path);
+}
+
+static int xdl_tree_path_ptr_cmp(const void *p1, const void *p2)
+{
+	xdtreefile_t const *f1 = *(xdtreefile_t * const *)p1;
+	xdtreefile_t const *f2 = *(xdtreefile_t * const *)p2;
+
+	return strcmp(f1->path, f2->path);
+}
+
+/*
+ * Maps the file as it is now, which need not be the size the walk saw:
+ * mapping past the end of a file that has shrunk since would fault.
+ */
+static int xdl_tree_map(xdtreeside_t const *side, xdtreefile_t const *f,
+			xdtreemap_t *m)
+{
+	struct stat st;
+	size_t size;
+	char *full;
+	int fd;
+
+	m->mf.ptr = NULL;
+	m->mf.size = 0;
+	m->mapped = 0;
+	if (!f)
+		return 0;
+	if (!(full = xdl_tree_join(side->root, f->path)))
+		return -1;
+	fd = open(full, O_RDONLY);
+	xdl_free(full);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (!(size = (size_t)st.st_size)) {
+		close(fd);
+		return 0;
+	}
+
+#ifndef NO_MMAP
+	m->mf.ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m->mf.ptr != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+		madvise(m->mf.ptr, size, MADV_SEQUENTIAL);
+#endif
+		m->mf.size = (long)size;
+		m->mapped = 1;
+		close(fd);
+		return 0;
+	}
+#endif
+	/* No mapping: read it in. */
+	if ((m->mf.ptr = xdl_malloc(size))) {
+		size_t got = 0;
+		ssize_t n;
+
+		while (got < size &&
+		       (n = read(fd, m->mf.ptr + got, size - got)) > 0)
+			got += n;
+		if (got == size) {
+			m->mf.size = (long)size;
+			close(fd);
+			return 0;
+		}
+		xdl_free(m->mf.ptr);
+		m->mf.ptr = NULL;
+	}
+	close(fd);
+	return -1;
+}
+
+static void xdl_tree_unmap(xdtreemap_t *m)
+{
+#ifndef NO_MMAP
+	if (m->mapped) {
+		munmap(m->mf.ptr, m->mf.size);
+		return;
+	}
+#endif
+	xdl_free(m->mf.ptr);
+}
+
+static int xdl_tree_same(xdtreemap_t const *m1, xdtreemap_t const *m2)
+{
+	return m1->mf.size == m2->mf.size &&
+		!memcmp(m1->mf.ptr, m2->mf.ptr, m1->mf.size);
+}
+
+/* 1 if the two files have the same contents, 0 if not, -1 on errors. */
+static int xdl_tree_identical(xdtreeside_t const *s1, xdtreefile_t const *f1,
+			      xdtreeside_t const *s2, xdtreefile_t const *f2)
+{
+	xdtreemap_t m1, m2;
+	int same;
+
+	if (xdl_tree_map(s1, f1, &m1) < 0)
+		return -1;
+	if (xdl_tree_map(s2, f2, &m2) < 0) {
+		xdl_tree_unmap(&m1);
+		return -1;
+	}
+	same = xdl_tree_same(&m1, &m2);
+	xdl_tree_unmap(&m2);
+	xdl_tree_unmap(&m1);
+	return same;
+}
+
+static int xdl_tree_u64_cmp(const void *p1, const void *p2)
+{
+	uint64_t a = *(uint64_t const *)p1, b = *(uint64_t const *)p2;
+
+	return a < b ? -1 : a > b;
+}
+
+static int xdl_tree_signature(xdtreefile_t *f, mmfile_t const *mf)
+{
+	char const *cur = mf->ptr, *top = mf->ptr + mf->size, *nl;
+	long n = 0;
+
+	for (nl = cur; nl < top; n++)
+		nl = (nl = memchr(nl, '\n', top - nl)) ? nl + 1 : top;
+	if (!XDL_ALLOC_ARRAY(f->lines, n + 1))
+		return -1;
+	for (f->nlines = 0; cur < top; cur = nl) {
+		nl = memchr(cur, '\n', top - cur);
+		nl = nl ? nl + 1 : top;
+		f->lines[f->nlines++] = xdl_hash_bytes(cur, nl - cur);
+	}
+	QSORT(f->lines, f->nlines, xdl_tree_u64_cmp);
+	return 0;
+}
+
+static void xdl_tree_scan_run(void *priv)
+{
+	xdtreescan_t *scan = priv;
+	xdtreemap_t m;
+	long i;
+
+	scan->res = 0;
+	for (i = scan->from; i < scan->to; i++) {
+		xdtreefile_t *f = scan->files ? scan->files[i] : &scan->side->files[i];
+
+		if (xdl_tree_map(scan->side, f, &m) < 0) {
+			scan->res = -1;
+			return;
+		}
+		if (!scan->lines) {
+			f->size = (size_t)m.mf.size;
+			f->hash = xdl_hash_bytes(m.mf.ptr, m.mf.size);
+		} else if (xdl_tree_signature(f, &m.mf) < 0)
+			scan->res = -1;
+		xdl_tree_unmap(&m);
+		if (scan->res < 0)
+			return;
+	}
+}
+
+/*
+ * Runs xdl_tree_scan_run() over the files of a side (or the given
+ * files of it), in tasks of a bounded number of bytes.
+ */
+static int xdl_tree_scan(xdtreeside_t *side, xdtreefile_t **files, long nr,
+			 int lines, xpparam_t const *xpp)
+{
+	xdtreescan_t *scans;
+	xdtask_group_t grp;
+	long i, n = 0, from;
+	size_t bytes;
+	int res = 0;
+
+	if (!nr)
+		return 0;
+	if (!XDL_ALLOC_ARRAY(scans, nr))
+		return -1;
+	for (i = 0; i < nr; n++) {
+		from = i;
+		for (bytes = 0; i < nr && i - from < XDL_TREE_HASH_FILES &&
+			     (i == from || bytes < XDL_TREE_HASH_BYTES); i++)
+			bytes += files ? files[i]->size : side->files[i].size;
+		scans[n].side = side;
+		scans[n].files = files;
+		scans[n].from = from;
+		scans[n].to = i;
+		scans[n].lines = lines;
+		scans[n].res = 0;
+	}
+
+	xdl_group_init(&grp, xpp->pool);
+	for (i = 0; i < n; i++) {
+		xdtask_t t = { xdl_tree_scan_run, NULL, &scans[i],
+			       XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY };
+
+		if (xdl_pool_submit(&grp, &t) < 0)
+			xdl_tree_scan_run(&scans[i]);
+	}
+	if (xdl_group_wait(&grp) < 0)
+		res = -1;
+	for (i = 0; i < n; i++)
+		if (scans[i].res < 0)
+			res = -1;
+	xdl_free(scans);
+	return res;
+}
+
+static int xdl_tree_content_cmp(const void *p1, const void *p2)
+{
+	xdtreefile_t const *f1 = *(xdtreefile_t * const *)p1;
+	xdtreefile_t const *f2 = *(xdtreefile_t * const *)p2;
+
+	if (f1->hash != f2->hash)
+		return f1->hash < f2->hash ? -1 : 1;
+	if (f1->size != f2->size)
+		return f1->size < f2->size ? -1 : 1;
+	return strcmp(f1->path, f2->path);
+}
+
+static int xdl_tree_score_cmp(const void *p1, const void *p2)
+{
+	xdtreescore_t const *s1 = p1, *s2 = p2;
+
+	if (s1->score != s2->score)
+		return s2->score - s1->score;
+	if (s1->i2 != s2->i2)
+		return s1->i2 < s2->i2 ? -1 : 1;
+	return s1->i1 < s2->i1 ? -1 : s1->i1 > s2->i1;
+}
+
+/* Percentage of lines of the larger file that also occur in the other. */
+static int xdl_tree_similarity(xdtreefile_t const *f1, xdtreefile_t const *f2)
+{
+	long i = 0, j = 0, common = 0;
+
+	while (i < f1->nlines && j < f2->nlines) {
+		if (f1->lines[i] < f2->lines[j])
+			i++;
+		else if (f1->lines[i] > f2->lines[j])
+			j++;
+		else {
+			common++;
+			i++;
+			j++;
+		}
+	}
+	return (int)(common * 100 / XDL_MAX(XDL_MAX(f1->nlines, f2->nlines), 1));
+}
+
+static int xdl_tree_add_pair(xdtreepair_t **pairs, long *nr, long *alloc,
+			     xdtreefile_t *f1, xdtreefile_t *f2, int status,
+			     int similarity)
+{
+	xdtreepair_t *p;
+
+	if (XDL_ALLOC_GROW(*pairs, *nr + 1, *alloc))
+		return -1;
+	p = &(*pairs)[(*nr)++];
+	memset(p, 0, sizeof(*p));
+	p->f1 = f1;
+	p->f2 = f2;
+	p->status = status;
+	p->similarity = similarity;
+	if (f1)
+		f1->paired = 1;
+	if (f2)
+		f2->paired = 1;
+	return 0;
+}
+
+/*
+ * Pairs files that only exist in the first tree with files that only
+ * exist in the second one: identical contents first, then, when both
+ * lists are small enough, by similarity above rename_score. Equal
+ * hashes are only taken for identical contents once the bytes match;
+ * a deleted file whose candidate turns out to differ is left for the
+ * similarity pass. del[] and
+ * add[] are reordered but keep all their entries; the caller reports
+ * those left unpaired.
+ */
+static int xdl_tree_renames(xdtreeside_t *s1, xdtreeside_t *s2,
+			    xdtreefile_t **del, long ndel,
+			    xdtreefile_t **add, long nadd, int rename_score,
+			    xpparam_t const *xpp, xdtreepair_t **pairs,
+			    long *npairs, long *apairs)
+{
+	xdtreescore_t *scores = NULL;
+	xdtreefile_t **left1 = NULL, **left2 = NULL;
+	long i, j, n = 0, nd = 0, na = 0;
+	int score, same, ret = -1;
+
+	QSORT(del, ndel, xdl_tree_content_cmp);
+	QSORT(add, nadd, xdl_tree_content_cmp);
+	for (i = j = 0; i < ndel && j < nadd; ) {
+		if (!del[i]->size) {
+			i++;
+			continue;
+		}
+		score = xdl_tree_content_cmp(&del[i], &add[j]);
+		if (del[i]->hash == add[j]->hash && del[i]->size == add[j]->size) {
+			if ((same = xdl_tree_identical(s1, del[i], s2, add[j])) < 0)
+				return -1;
+			if (!same)
+				i++;
+			else if (xdl_tree_add_pair(pairs, npairs, apairs, del[i++],
+						   add[j++], XDL_TREE_RENAMED, 100) < 0)
+				return -1;
+		} else if (score < 0)
+			i++;
+		else
+			j++;
+	}
+	if (rename_score >= 100)
+		return 0;
+
+	/* What is left, minus empty files. */
+	for (i = 0; i < ndel; i++)
+		nd += !del[i]->paired && del[i]->size;
+	for (i = 0; i < nadd; i++)
+		na += !add[i]->paired && add[i]->size;
+	if (!nd || !na || nd > XDL_TREE_RENAME_PAIRS / na)
+		return 0;
+	if (!XDL_ALLOC_ARRAY(left1, nd) || !XDL_ALLOC_ARRAY(left2, na))
+		goto out;
+	for (i = 0, nd = 0; i < ndel; i++)
+		if (!del[i]->paired && del[i]->size)
+			left1[nd++] = del[i];
+	for (i = 0, na = 0; i < nadd; i++)
+		if (!add[i]->paired && add[i]->size)
+			left2[na++] = add[i];
+	QSORT(left1, nd, xdl_tree_path_ptr_cmp);
+	QSORT(left2, na, xdl_tree_path_ptr_cmp);
+
+	if (xdl_tree_scan(s1, left1, nd, 1, xpp) < 0 ||
+	    xdl_tree_scan(s2, left2, na, 1, xpp) < 0 ||
+	    !XDL_ALLOC_ARRAY(scores, nd * na))
+		goto out;
+	for (i = 0; i < nd; i++)
+		for (j = 0; j < na; j++)
+			if ((score = xdl_tree_similarity(left1[i], left2[j])) >= rename_score) {
+				scores[n].i1 = i;
+				scores[n].i2 = j;
+				scores[n++].score = score;
+			}
+	QSORT(scores, n, xdl_tree_score_cmp);
+	for (i = 0; i < n; i++) {
+		xdtreefile_t *f1 = left1[scores[i].i1], *f2 = left2[scores[i].i2];
+
+		if (!f1->paired && !f2->paired &&
+		    xdl_tree_add_pair(pairs, npairs, apairs, f1, f2,
+				      XDL_TREE_RENAMED, scores[i].score) < 0)
+			goto out;
+	}
+	ret = 0;
+out:
+	xdl_free(scores);
+	xdl_free(left2);
+	xdl_free(left1);
+	return ret;
+}
+
+static int xdl_tree_is_binary(mmfile_t const *mf)
+{
+	return mf->size &&
+		memchr(mf->ptr, 0, XDL_MIN(mf->size, XDL_TREE_BINARY_SCAN)) != NULL;
+}
+
+static void xdl_tree_diff_run(void *priv)
+{
+	xdtreepair_t *p = priv;
+	xdtreemap_t m1, m2;
+	xdemitcb_t ecb;
+
+	p->res = -1;
+	if (xdl_tree_map(p->s1, p->f1, &m1) < 0)
+		return;
+	if (xdl_tree_map(p->s2, p->f2, &m2) < 0) {
+		xdl_tree_unmap(&m1);
+		return;
+	}
+	p->same = p->maybe_same && xdl_tree_same(&m1, &m2);
+	p->binary = !p->same &&
+		(xdl_tree_is_binary(&m1.mf) || xdl_tree_is_binary(&m2.mf));
+	if (p->same || p->binary)
+		p->res = 0;
+	else if (!xdl_outbuf_init(&p->out, 0, XDL_TREE_MAX_OUT)) {
+		memset(&ecb, 0, sizeof(ecb));
+		ecb.priv = &p->out;
+		ecb.out_line = xdl_outbuf_out_line;
+		p->res = xdl_diff(&m1.mf, &m2.mf, p->xpp, p->xecfg, &ecb);
+	}
+	xdl_tree_unmap(&m2);
+	xdl_tree_unmap(&m1);
+}
+
+static void xdl_tree_submit(xdtreepair_t *p)
+{
+	xdtask_t t = { xdl_tree_diff_run, NULL, p,
+		       XDL_PRIO_INTERACTIVE, XDL_AFFINITY_ANY };
+
+	xdl_group_init(&p->grp, p->xpp->pool);
+	if (xdl_pool_submit(&p->grp, &t) < 0)
+		xdl_tree_diff_run(p);
+}
+
+static char const *xdl_tree_pair_path(xdtreepair_t const *p)
+{
+	return p->f2 ? p->f2->path : p->f1->path;
+}
+
+static int xdl_tree_pair_cmp(const void *p1, const void *p2)
+{
+	xdtreepair_t const *a = p1, *b = p2;
+	int cmp = strcmp(xdl_tree_pair_path(a), xdl_tree_pair_path(b));
+
+	/* A deletion sorts before an addition of the same path. */
+	return cmp ? cmp : !!a->f2 - !!b->f2;
+}
+
+/*
+ * Diffs the pairs on the pool, at most a window of them ahead of the
+ * one being reported, and hands them to the callback in order.
+ */
+static int xdl_tree_report(xdtreepair_t *pairs, long nr,
+			   xdtreeconf_t const *tcf, xpparam_t const *xpp)
+{
+	long i, next = 0, window;
+	xdtreeentry_t ent;
+	int ret = 0;
+
+	window = XDL_MAX(4L * xdl_pool_threads(xpp->pool), XDL_TREE_WINDOW_MIN);
+	for (i = 0; i < nr; i++) {
+		xdtreepair_t *p = &pairs[i];
+
+		for (; next < nr && next < i + window; next++)
+			if (!ret)
+				xdl_tree_submit(&pairs[next]);
+			else
+				pairs[next].res = -1;
+
+		if (ret) {
+			xdl_pool_cancel(xpp->pool, &p->grp);
+			xdl_group_wait(&p->grp);
+		} else if (xdl_group_wait(&p->grp) < 0 || p->res < 0) {
+			ret = -1;
+		} else if (!p->same) {
+			ent.status = p->status;
+			ent.path1 = p->f1 ? p->f1->path : NULL;
+			ent.path2 = p->f2 ? p->f2->path : NULL;
+			ent.similarity = p->similarity;
+			ent.binary = p->binary;
+			ent.diff = p->out.ptr;
+			ent.size = p->out.size;
+			if (tcf->entry && tcf->entry(tcf->priv, &ent))
+				ret = -1;
+		}
+		xdl_outbuf_release(&p->out);
+	}
+	return ret;
+}
+
+static void xdl_tree_free(xdtreeside_t *side)
+{
+	long i;
+
+	for (i = 0; i < side->nr; i++) {
+		xdl_free(side->files[i].path);
+		xdl_free(side->files[i].lines);
+	}
+	xdl_free(side->files);
+}
+
+static int xdl_diff_trees_0(char const *root1, char const *root2,
+			    xpparam_t const *xpp, xdemitconf_t const *xecfg,
+			    xdtreeconf_t const *tcf)
+{
+	xdtreeside_t s1, s2;
+	xdtreefile_t **del = NULL, **add = NULL;
+	xdtreepair_t *pairs = NULL;
+	long i, j, ndel = 0, nadd = 0, npairs = 0, apairs = 0;
+	int cmp, ret = -1;
+
+	memset(&s1, 0, sizeof(s1));
+	memset(&s2, 0, sizeof(s2));
+	s1.root = root1;
+	s2.root = root2;
+	if (xdl_tree_walk(&s1, "") < 0 || xdl_tree_walk(&s2, "") < 0)
+		goto out;
+	QSORT(s1.files, s1.nr, xdl_tree_path_cmp);
+	QSORT(s2.files, s2.nr, xdl_tree_path_cmp);
+	if (xdl_tree_scan(&s1, NULL, s1.nr, 0, xpp) < 0 ||
+	    xdl_tree_scan(&s2, NULL, s2.nr, 0, xpp) < 0)
+		goto out;
+
+	if (!XDL_ALLOC_ARRAY(del, s1.nr + 1) || !XDL_ALLOC_ARRAY(add, s2.nr + 1))
+		goto out;
+	for (i = j = 0; i < s1.nr || j < s2.nr; ) {
+		if (i == s1.nr)
+			cmp = 1;
+		else if (j == s2.nr)
+			cmp = -1;
+		else
+			cmp = strcmp(s1.files[i].path, s2.files[j].path);
+		if (cmp < 0) {
+			del[ndel++] = &s1.files[i++];
+		} else if (cmp > 0) {
+			add[nadd++] = &s2.files[j++];
+		} else {
+			xdtreefile_t *f1 = &s1.files[i++], *f2 = &s2.files[j++];
+
+			if (xdl_tree_add_pair(&pairs, &npairs, &apairs, f1, f2,
+					      XDL_TREE_MODIFIED, 0) < 0)
+				goto out;
+			/* Same size and contents hash: most likely nothing to diff. */
+			pairs[npairs - 1].maybe_same =
+				f1->size == f2->size && f1->hash == f2->hash;
+		}
+	}
+
+	if (tcf->rename_score > 0 &&
+	    xdl_tree_renames(&s1, &s2, del, ndel, add, nadd, tcf->rename_score,
+			     xpp, &pairs, &npairs, &apairs) < 0)
+		goto out;
+	for (i = 0; i < ndel; i++)
+		if (!del[i]->paired &&
+		    xdl_tree_add_pair(&pairs, &npairs, &apairs, del[i], NULL,
+				      XDL_TREE_DELETED, 0) < 0)
+			goto out;
+	for (i = 0; i < nadd; i++)
+		if (!add[i]->paired &&
+		    xdl_tree_add_pair(&pairs, &npairs, &apairs, NULL, add[i],
+				      XDL_TREE_ADDED, 0) < 0)
+			goto out;
+
+	QSORT(pairs, npairs, xdl_tree_pair_cmp);
+	for (i = 0; i < npairs; i++) {
+		pairs[i].s1 = &s1;
+		pairs[i].s2 = &s2;
+		pairs[i].xpp = xpp;
+		pairs[i].xecfg = xecfg;
+	}
+	ret = xdl_tree_report(pairs, npairs, tcf, xpp);
+out:
+	xdl_free(pairs);
+	xdl_free(add);
+	xdl_free(del);
+	xdl_tree_free(&s2);
+	xdl_tree_free(&s1);
+	return ret;
+}
+
+int xdl_diff_trees(char const *root1, char const *root2, xpparam_t const *xpp,
+		   xdemitconf_t const *xecfg, xdtreeconf_t const *tcf)
+{
+	xdalloc_t *prev;
+	int ret;
+
+	prev = xdl_alloc_set(xpp->alloc ? xpp->alloc : xdl_alloc_get());
+	ret = xdl_diff_trees_0(root1, root2, xpp, xecfg, tcf);
+	xdl_alloc_set(prev);
+
+	return ret;
+}
@@ -45,6 +45,15 @@ typedef struct s_xrecord {
 	size_t minimal_perfect_hash;
 } xrecord_t;
 
+typedef struct s_xdspill xdspill_t;
+typedef struct s_xdindex xdindex_t;
+
+/* a record XDF_FILTER_IGNORED took out of recs[], and where it sat */
+typedef struct s_xdignored {
+	size_t pos;
+	xrecord_t rec;
+} xdignored_t;
+
 typedef struct s_xdfile {
 	xrecord_t *recs;
 	size_t nrec;
@@ -52,8 +61,24 @@ typedef struct s_xdfile {
 	bool *changed;
 	size_t *reference_index;
 	size_t nreff;
+	/* minimal_perfect_hash in reference_index order, or NULL */
+	size_t *reference_class;
+	/* disk-backed storage of the arrays above, or NULL (see xspill.c) */
+	xdspill_t *spill;
+	/* records that a line was cut after (XDF_SEGMENT_LINES) */
+	size_t nsplit;
+	/* prepared-file index the records were read from, or NULL (see xindex.c) */
+	xdindex_t *index;
+	/* records left out of recs[] until xdl_unfilter_env(), by position */
+	xdignored_t *ignored;
+	size_t nignored;
 } xdfile_t;
 
+/* where a record of a file cut by XDF_SEGMENT_LINES sits, see xdl_seg_lines() */
+typedef struct s_xdlinepos {
+	long rec, line, off;
+} xdlinepos_t;
+
 typedef struct s_xdfenv {
 	xdfile_t xdf1, xdf2;
 } xdfenv_t;
@@ -358,6 +358,31 @@ uint64_t xdl_hash_record_verbatim(uint8_t const **data, uint8_t const *top) {
 	return ha;
 }
 
+/*
+ * Hashes a whole block of bytes, line ends included, eight bytes at a
+ * time. Unlike the record hashes above this is not meant to classify
+ * lines; it only has to tell large blocks apart quickly.
+ */
+uint64_t xdl_hash_bytes(void const *data, size_t size) {
+	uint8_t const *ptr = data, *top = ptr + size;
+	uint64_t ha = 0x9e3779b97f4a7c15ULL ^ size, w;
+
+	for (; top - ptr >= 8; ptr += 8) {
+		memcpy(&w, ptr, 8);
+		ha = (ha ^ (w * 0xff51afd7ed558ccdULL)) * 0xc4ceb9fe1a85ec53ULL;
+		ha ^= ha >> 29;
+	}
+	if (ptr < top) {
+		w = 0;
+		memcpy(&w, ptr, top - ptr);
+		ha = (ha ^ (w * 0xff51afd7ed558ccdULL)) * 0xc4ceb9fe1a85ec53ULL;
+	}
+	ha ^= ha >> 33;
+	ha *= 0xff51afd7ed558ccdULL;
+	ha ^= ha >> 33;
+	return ha;
+}
+
 unsigned int xdl_hashbits(unsigned int size) {
 	unsigned int val = 1, bits = 0;
 
@@ -388,18 +413,24 @@ int xdl_num_out(char *out, long val) {
 	return str - out;
 }
 
-static int xdl_format_hunk_hdr(long s1, long c1, long s2, long c2,
+static int xdl_format_hunk_hdr(long s1, long o1, long c1,
+			       long s2, long o2, long c2,
 			       const char *func, long funclen,
 			       xdemitcb_t *ecb) {
 	int nb = 0;
 	mmbuffer_t mb;
-	char buf[128];
+	char buf[160];
 
 	memcpy(buf, "@@ -", 4);
 	nb += 4;
 
 	nb += xdl_num_out(buf + nb, c1 ? s1: s1 - 1);
 
+	if (o1) {
+		buf[nb++] = ':';
+		nb += xdl_num_out(buf + nb, o1);
+	}
+
 	if (c1 != 1) {
 		memcpy(buf + nb, ",", 1);
 		nb += 1;
@@ -412,6 +443,11 @@ static int xdl_format_hunk_hdr(long s1, long c1, long s2, long c2,
 
 	nb += xdl_num_out(buf + nb, c2 ? s2: s2 - 1);
 
+	if (o2) {
+		buf[nb++] = ':';
+		nb += xdl_num_out(buf + nb, o2);
+	}
+
 	if (c2 != 1) {
 		memcpy(buf + nb, ",", 1);
 		nb += 1;
@@ -437,11 +473,13 @@ static int xdl_format_hunk_hdr(long s1, long c1, long s2, long c2,
 	return 0;
 }
 
-int xdl_emit_hunk_hdr(long s1, long c1, long s2, long c2,
-		      const char *func, long funclen,
-		      xdemitcb_t *ecb) {
+int xdl_emit_seg_hunk_hdr(long s1, long o1, long c1,
+			  long s2, long o2, long c2,
+			  const char *func, long funclen,
+			  xdemitcb_t *ecb) {
 	if (!ecb->out_hunk)
-		return xdl_format_hunk_hdr(s1, c1, s2, c2, func, funclen, ecb);
+		return xdl_format_hunk_hdr(s1, o1, c1, s2, o2, c2,
+					   func, funclen, ecb);
 	if (ecb->out_hunk(ecb->priv,
 			  c1 ? s1 : s1 - 1, c1,
 			  c2 ? s2 : s2 - 1, c2,
@@ -450,6 +488,75 @@ int xdl_emit_hunk_hdr(long s1, long c1, long s2, long c2,
 	return 0;
 }
 
+int xdl_emit_hunk_hdr(long s1, long c1, long s2, long c2,
+		      const char *func, long funclen,
+		      xdemitcb_t *ecb) {
+	return xdl_emit_seg_hunk_hdr(s1, 0, c1, s2, 0, c2, func, funclen, ecb);
+}
+
+static void xdl_seg_advance(xdfile_t const *xdf, xdlinepos_t *pos, long ri)
+{
+	for (; pos->rec < ri; pos->rec++) {
+		xrecord_t const *rec = &xdf->recs[pos->rec];
+
+		if (rec->size && rec->ptr[rec->size - 1] == '\n') {
+			pos->line++;
+			pos->off = 0;
+		} else
+			pos->off += (long)rec->size;
+	}
+}
+
+/*
+ * The lines touched by records [s, e) of a file cut by
+ * XDF_SEGMENT_LINES: the first line (0-based) and the byte offset of
+ * record s into it go to *line and *off, the number of lines is
+ * returned. A range that starts or ends inside a line touches all of
+ * it, even when empty. 'pos' remembers where the last call stopped,
+ * so that walking the hunks of a diff in order is linear.
+ */
+long xdl_seg_lines(xdfile_t const *xdf, xdlinepos_t *pos, long s, long e,
+		   long *line, long *off) {
+	long first;
+
+	if (s < pos->rec)
+		memset(pos, 0, sizeof(*pos));
+	xdl_seg_advance(xdf, pos, s);
+	*line = first = pos->line;
+	*off = pos->off;
+	if (e <= s)
+		return pos->off ? 1 : 0;
+	xdl_seg_advance(xdf, pos, e - 1);
+	return pos->line - first + 1;
+}
+
+int xdl_record_matches_regex(xrecord_t const *rec, xpparam_t const *xpp)
+{
+	regmatch_t regmatch;
+	size_t i;
+
+	for (i = 0; i < xpp->ignore_regex_nr; i++)
+		if (!regexec_buf(xpp->ignore_regex[i], (const char *)rec->ptr, rec->size, 1,
+				 &regmatch, 0))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Whether record ri of xdf is one XDF_IGNORE_BLANK_LINES or the -I
+ * regexes of xpp let a change consist of.
+ */
+int xdl_record_ignorable(xdfile_t const *xdf, long ri, xpparam_t const *xpp)
+{
+	xrecord_t const *rec = &xdf->recs[ri];
+
+	if ((xpp->flags & XDF_IGNORE_BLANK_LINES) &&
+	    xdl_blankline((const char *)rec->ptr, (long)rec->size, xpp->flags))
+		return 1;
+	return xpp->ignore_regex && xdl_record_matches_regex(rec, xpp);
+}
+
 int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp,
 		int line1, int count1, int line2, int count2)
 {
@@ -470,7 +577,8 @@ int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp,
 	subfile2.ptr = (char *)diff_env->xdf2.recs[line2 - 1].ptr;
 	subfile2.size = (char *)diff_env->xdf2.recs[line2 + count2 - 2].ptr +
 		diff_env->xdf2.recs[line2 + count2 - 2].size - subfile2.ptr;
-	if (xdl_do_diff(&subfile1, &subfile2, xpp, &env) < 0)
+	/* counts are of the records left after XDF_FILTER_IGNORED */
+	if (xdl_do_diff_filtered(&subfile1, &subfile2, xpp, &env) < 0)
 		return -1;
 
 	memcpy(diff_env->xdf1.changed + line1 - 1, env.xdf1.changed, count1);
@@ -481,6 +589,57 @@ int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp,
 	return 0;
 }
 
+uint64_t xdl_now_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+		return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+	return (uint64_t)time(NULL) * 1000000000;
+}
+
+void xdl_cancel_init(xdcancel_t *c, uint64_t timeout_ns)
+{
+	c->cancelled = 0;
+	c->deadline_ns = timeout_ns ? xdl_now_ns() + timeout_ns : 0;
+}
+
+void xdl_cancel_request(xdcancel_t *c)
+{
+	xdl_atomic_store(&c->cancelled, 1, XDL_ATOMIC_RELEASE);
+}
+
+int xdl_cancel_check(void *priv)
+{
+	xdcancel_t *c = priv;
+
+	if (xdl_atomic_load(&c->cancelled, XDL_ATOMIC_ACQUIRE))
+		return 1;
+	return c->deadline_ns && xdl_now_ns() >= c->deadline_ns;
+}
+
+/*
+ * Set up the parameters of a nested classic diff run on behalf of
+ * another algorithm: same flags minus the algorithm selection, and the
+ * same runtime hooks so that the nested run can still be aborted.
+ */
+void xdl_fallback_xpparam(xpparam_t *dst, xpparam_t const *src)
+{
+	memset(dst, 0, sizeof(*dst));
+	dst->flags = src->flags & ~XDF_DIFF_ALGORITHM_MASK;
+	dst->abort_check = src->abort_check;
+	dst->abort_priv = src->abort_priv;
+	dst->pool = src->pool;
+	dst->spill_threshold = src->spill_threshold;
+	dst->spill_dir = src->spill_dir;
+	dst->alloc = src->alloc;
+	dst->segment_size = src->segment_size;
+	dst->ignore_regex = src->ignore_regex;
+	dst->ignore_regex_nr = src->ignore_regex_nr;
+}
+
 void* xdl_alloc_grow_helper(void *p, long nr, long *alloc, size_t size)
 {
 	void *tmp = NULL;
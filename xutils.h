@@ -24,6 +24,94 @@
 #define XUTILS_H
 
 
+/*
+ * Atomic accesses to the counters, flags and pointers threads share.
+ * GCC and Clang get their builtins; MSVC gets the Interlocked
+ * intrinsics, which order everything fully; any other compiler gets
+ * plain accesses, which is only right when built with NO_PTHREADS.
+ * xdl_atomic_add() and xdl_atomic_sub() return the new value,
+ * xdl_atomic_fetch_add() the old one, and xdl_atomic_cas() stores the
+ * value it found in *expect when it fails.
+ */
+#if defined(__GNUC__)
+#define XDL_ATOMIC_RELAXED __ATOMIC_RELAXED
+#define XDL_ATOMIC_ACQUIRE __ATOMIC_ACQUIRE
+#define XDL_ATOMIC_RELEASE __ATOMIC_RELEASE
+#define XDL_ATOMIC_ACQ_REL __ATOMIC_ACQ_REL
+#define xdl_atomic_load(p, mo) __atomic_load_n(p, mo)
+#define xdl_atomic_store(p, v, mo) __atomic_store_n(p, v, mo)
+#define xdl_atomic_add(p, v, mo) __atomic_add_fetch(p, v, mo)
+#define xdl_atomic_sub(p, v, mo) __atomic_sub_fetch(p, v, mo)
+#define xdl_atomic_fetch_add(p, v, mo) __atomic_fetch_add(p, v, mo)
+#define xdl_atomic_cas(p, expect, v, mo) \
+	__atomic_compare_exchange_n(p, expect, v, 1, mo, __ATOMIC_RELAXED)
+#define xdl_atomic_load_ptr(p, mo) __atomic_load_n(p, mo)
+#define xdl_atomic_store_ptr(p, v, mo) __atomic_store_n(p, v, mo)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define XDL_ATOMIC_RELAXED 0
+#define XDL_ATOMIC_ACQUIRE 0
+#define XDL_ATOMIC_RELEASE 0
+#define XDL_ATOMIC_ACQ_REL 0
+
+static inline __int64 xdl_atomic_add_msvc(void volatile *p, __int64 v, size_t size)
+{
+	if (size == 8)
+		return _InterlockedExchangeAdd64((__int64 volatile *)p, v) + v;
+	return (long)((unsigned long)_InterlockedExchangeAdd((long volatile *)p, (long)v) +
+		      (unsigned long)v);
+}
+
+static inline int xdl_atomic_cas_msvc(void volatile *p, void *expect, __int64 v,
+				      size_t size)
+{
+	if (size == 8) {
+		__int64 e = *(__int64 *)expect;
+		__int64 found = _InterlockedCompareExchange64((__int64 volatile *)p, v, e);
+
+		if (found == e)
+			return 1;
+		*(__int64 *)expect = found;
+	} else {
+		long e = *(long *)expect;
+		long found = _InterlockedCompareExchange((long volatile *)p, (long)v, e);
+
+		if (found == e)
+			return 1;
+		*(long *)expect = found;
+	}
+	return 0;
+}
+
+#define xdl_atomic_load(p, mo) xdl_atomic_add_msvc((p), 0, sizeof(*(p)))
+#define xdl_atomic_store(p, v, mo) \
+	((void)(sizeof(*(p)) == 8 ? \
+		_InterlockedExchange64((__int64 volatile *)(p), (__int64)(v)) : \
+		_InterlockedExchange((long volatile *)(p), (long)(v))))
+#define xdl_atomic_add(p, v, mo) xdl_atomic_add_msvc((p), (__int64)(v), sizeof(*(p)))
+#define xdl_atomic_sub(p, v, mo) xdl_atomic_add_msvc((p), -(__int64)(v), sizeof(*(p)))
+#define xdl_atomic_fetch_add(p, v, mo) (xdl_atomic_add(p, v, mo) - (__int64)(v))
+#define xdl_atomic_cas(p, expect, v, mo) \
+	xdl_atomic_cas_msvc((p), (expect), (__int64)(v), sizeof(*(p)))
+#define xdl_atomic_load_ptr(p, mo) \
+	_InterlockedCompareExchangePointer((void *volatile *)(p), NULL, NULL)
+#define xdl_atomic_store_ptr(p, v, mo) \
+	((void)_InterlockedExchangePointer((void *volatile *)(p), (void *)(v)))
+#else
+#define XDL_ATOMIC_RELAXED 0
+#define XDL_ATOMIC_ACQUIRE 0
+#define XDL_ATOMIC_RELEASE 0
+#define XDL_ATOMIC_ACQ_REL 0
+#define xdl_atomic_load(p, mo) (*(p))
+#define xdl_atomic_store(p, v, mo) ((void)(*(p) = (v)))
+#define xdl_atomic_add(p, v, mo) (*(p) += (v))
+#define xdl_atomic_sub(p, v, mo) (*(p) -= (v))
+#define xdl_atomic_fetch_add(p, v, mo) ((*(p) += (v)) - (v))
+#define xdl_atomic_cas(p, expect, v, mo) \
+	(*(p) == *(expect) ? (*(p) = (v), 1) : (*(expect) = *(p), 0))
+#define xdl_atomic_load_ptr(p, mo) (*(p))
+#define xdl_atomic_store_ptr(p, v, mo) ((void)(*(p) = (v)))
+#endif
 
 long xdl_bogosqrt(long n);
 int xdl_emit_diffrec(char const *rec, long size, char const *pre, long psize,
@@ -43,13 +131,80 @@ static inline uint64_t xdl_hash_record(uint8_t const **data, uint8_t const *top,
 	else
 		return xdl_hash_record_verbatim(data, top);
 }
+uint64_t xdl_hash_bytes(void const *data, size_t size);
 unsigned int xdl_hashbits(unsigned int size);
 int xdl_num_out(char *out, long val);
 int xdl_emit_hunk_hdr(long s1, long c1, long s2, long c2,
 		      const char *func, long funclen, xdemitcb_t *ecb);
+int xdl_emit_seg_hunk_hdr(long s1, long o1, long c1,
+			  long s2, long o2, long c2,
+			  const char *func, long funclen, xdemitcb_t *ecb);
+
+long xdl_seg_lines(xdfile_t const *xdf, xdlinepos_t *pos, long s, long e,
+		   long *line, long *off);
+int xdl_record_matches_regex(xrecord_t const *rec, xpparam_t const *xpp);
+int xdl_record_ignorable(xdfile_t const *xdf, long ri, xpparam_t const *xpp);
 int xdl_fall_back_diff(xdfenv_t *diff_env, xpparam_t const *xpp,
 		       int line1, int count1, int line2, int count2);
 
+uint64_t xdl_now_ns(void);
+void xdl_fallback_xpparam(xpparam_t *dst, xpparam_t const *src);
+
+static inline int xdl_should_abort(xpparam_t const *xpp)
+{
+	return xpp->abort_check && xpp->abort_check(xpp->abort_priv);
+}
+
+#define XDL_SPILL_SEQUENTIAL 1
+#define XDL_SPILL_DONTNEED 2
+
+xdspill_t *xdl_spill_open(char const *dir);
+void *xdl_spill_grow(xdspill_t *sp, size_t size);
+void xdl_spill_advise(xdspill_t *sp, size_t off, size_t len, int advice);
+void xdl_spill_close(xdspill_t *sp);
+#define XDL_INDEX_DIGEST_SIZE 32
+/* smaller inputs are prepared faster than an index is opened */
+#define XDL_INDEX_MIN_SIZE (1 << 16)
+
+void xdl_index_digest(void const *data, size_t size,
+		      uint8_t digest[XDL_INDEX_DIGEST_SIZE]);
+xdindex_t *xdl_index_open(xpparam_t const *xpp,
+			  uint8_t const digest[XDL_INDEX_DIGEST_SIZE], long size);
+void xdl_index_close(xdindex_t *xi);
+uint64_t xdl_index_record(xdindex_t const *xi, size_t ri,
+			  uint8_t const *base, uint8_t const **cur);
+int xdl_index_indent(xdindex_t const *xi, long ri);
+int xdl_index_maybe_func(xdindex_t const *xi, int func_lang, long ri);
+int xdl_index_store(xpparam_t const *xpp,
+		    uint8_t const digest[XDL_INDEX_DIGEST_SIZE],
+		    xdfile_t const *xdf, long size, int func_lang);
+
+extern xdtrace_t const *xdl_trace_hooks;
+#ifdef XDL_USDT
+extern unsigned short xdiff_phase__entry_semaphore, xdiff_phase__return_semaphore;
+#define XDL_USDT_ACTIVE() (xdiff_phase__entry_semaphore || xdiff_phase__return_semaphore)
+#else
+#define XDL_USDT_ACTIVE() 0
+#endif
+#define xdl_tracing() \
+	(XDL_USDT_ACTIVE() || xdl_atomic_load_ptr(&xdl_trace_hooks, XDL_ATOMIC_RELAXED))
+
+/* The arguments are only evaluated while somebody is tracing. */
+#define xdl_trace_enter(phase, size1, size2) \
+	do { \
+		if (xdl_tracing()) \
+			xdl_trace_enter_0(phase, size1, size2); \
+	} while (0)
+#define xdl_trace_leave(phase, size1, size2, cost, status) \
+	do { \
+		if (xdl_tracing()) \
+			xdl_trace_leave_0(phase, size1, size2, cost, status); \
+	} while (0)
+
+void xdl_trace_enter_0(int phase, long size1, long size2);
+void xdl_trace_leave_0(int phase, long size1, long size2, long cost, int status);
+long xdl_trace_changed(xdfile_t const *xdf);
+
 /* Do not call this function, use XDL_ALLOC_GROW instead */
 void* xdl_alloc_grow_helper(void* p, long nr, long* alloc, size_t size);
 